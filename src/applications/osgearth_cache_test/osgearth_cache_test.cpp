@@ -22,7 +22,21 @@
 #include <osgEarth/Registry>
 #include <osgEarth/StringUtils>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/TileCodec>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarthDrivers/cache_filesystem/FileSystemCache>
 #include <osg/ArgumentParser>
+#include <osg/Shape>
+#include <osgDB/Registry>
+#include <osgDB/FileNameUtils>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <cstdlib>
 
 #define LC "[cache_test] "
 
@@ -36,15 +50,458 @@ quit(const std::string& msg)
     return -1;
 }
 
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_cache_test\n"
+        << "    [--stress]              : run a multi-threaded read/write stress test\n"
+        << "    [--threads <num>]       : number of threads for --stress (default 4)\n"
+        << "    [--count <num>]         : tiles per thread for --stress (default 250)\n"
+        << "    [--evict <mb>]          : with --stress, compare filesystem caches with and without an <mb> size limit\n"
+        << "    [--codec]               : benchmark the raw tile codec against osgb+zlib\n"
+        << "    [--count <num>]         : iterations per format for --codec (default 200)\n"
+        << std::endl;
+    return -1;
+}
+
+/**
+ * Fills a 256x256 RGBA tile with noise (so the compressor does real work)
+ * that depends on "version", so a reader can tell which write it got.
+ */
+osg::Image*
+makeStressTile(unsigned version)
+{
+    osg::Image* image = new osg::Image();
+    image->allocateImage(256, 256, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    unsigned char* ptr = image->data();
+    for(unsigned i=0; i<image->getTotalSizeInBytes(); ++i)
+        ptr[i] = (unsigned char)(((i + version*7919u) * 2654435761u) >> 24);
+    return image;
+}
+
+typedef std::vector< osg::ref_ptr<osg::Image> > StressTiles;
+
+/**
+ * Thread that writes its own range of tiles, or reads tiles back and
+ * checks that each one is exactly one of the versions written.
+ *
+ * With a bin lock, each write holds it exclusively and each read shares
+ * it. That is how the filesystem cache locked its bins before writes were
+ * striped, so running with and without one compares the two.
+ */
+struct StressThread : public OpenThreads::Thread
+{
+    enum Mode
+    {
+        WRITE,          // write version 0 of this thread's tiles
+        REWRITE,        // overwrite this thread's tiles with version 1
+        READ,           // read back this thread's tiles
+        READ_ANY        // read random tiles of all the writers
+    };
+
+    StressThread(CacheBin* bin, const StressTiles& tiles, int id, int numWriters, int count, Mode mode,
+                 Threading::ReadWriteMutex* binLock, bool allowMissing, OpenThreads::Atomic& failures)
+        : _bin(bin), _tiles(tiles), _id(id), _numWriters(numWriters), _count(count), _mode(mode),
+          _binLock(binLock), _allowMissing(allowMissing), _failures(failures),
+          _missing(0), _reads(0), _maxLatency(0.0), _totalLatency(0.0) { }
+
+    void run()
+    {
+        unsigned seed = 12345u + (unsigned)_id;
+
+        for(int i=0; i<_count; ++i)
+        {
+            if ( _mode == WRITE || _mode == REWRITE )
+            {
+                std::string key = Stringify() << "stress/" << _id << "/" << i;
+                osg::Image* image = _tiles[_mode == WRITE ? 0 : 1].get();
+                if ( !write(key, image) )
+                    ++_failures;
+            }
+            else
+            {
+                int writer = _id, index = i;
+                if ( _mode == READ_ANY )
+                {
+                    seed = seed * 1664525u + 1013904223u;
+                    writer = (int)((seed >> 8) % (unsigned)_numWriters);
+                    seed = seed * 1664525u + 1013904223u;
+                    index  = (int)((seed >> 8) % (unsigned)_count);
+                }
+                std::string key = Stringify() << "stress/" << writer << "/" << index;
+
+                osg::Timer_t t0 = osg::Timer::instance()->tick();
+                ReadResult r = read(key);
+                double latency = osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+                _maxLatency = osg::maximum(_maxLatency, latency);
+                _totalLatency += latency;
+                ++_reads;
+
+                // records may have been evicted if the cache has a size limit.
+                if ( r.code() == ReadResult::RESULT_NOT_FOUND )
+                {
+                    ++_missing;
+                    if ( !_allowMissing )
+                        ++_failures;
+                    continue;
+                }
+
+                // a torn or half-swapped record won't match either version.
+                bool ok = false;
+                for(unsigned v=0; v<_tiles.size() && !ok; ++v)
+                    ok = r.succeeded() && ImageUtils::areEquivalent(r.getImage(), _tiles[v].get());
+                if ( !ok )
+                    ++_failures;
+            }
+        }
+    }
+
+    bool write(const std::string& key, osg::Image* image)
+    {
+        if ( !_binLock )
+            return _bin->write(key, image);
+        Threading::ScopedWriteLock exclusive( *_binLock );
+        return _bin->write(key, image);
+    }
+
+    ReadResult read(const std::string& key)
+    {
+        if ( !_binLock )
+            return _bin->readImage(key);
+        Threading::ScopedReadLock shared( *_binLock );
+        return _bin->readImage(key);
+    }
+
+    osg::ref_ptr<CacheBin>     _bin;
+    const StressTiles&         _tiles;
+    int                        _id, _numWriters, _count;
+    Mode                       _mode;
+    Threading::ReadWriteMutex* _binLock;
+    bool                       _allowMissing;
+    OpenThreads::Atomic&       _failures;
+    unsigned                   _missing, _reads;
+    double                     _maxLatency, _totalLatency;
+};
+
+struct StressResult
+{
+    double   _rate;         // operations/sec over all the threads
+    unsigned _failures;
+    unsigned _missing;      // reads that found no record
+    double   _maxLatency;   // seconds, reads only
+    double   _meanLatency;
+};
+
+/**
+ * Runs one stress phase: "numWriters" threads in "writeMode" (if any) at
+ * the same time as "numReaders" threads in "readMode" (if any).
+ */
+StressResult
+runStressPhase(CacheBin* bin, const StressTiles& tiles, int numWriters, int numReaders, int count,
+               StressThread::Mode writeMode, StressThread::Mode readMode,
+               Threading::ReadWriteMutex* binLock, bool allowMissing)
+{
+    OpenThreads::Atomic numFailures;
+    std::vector<StressThread*> threads;
+    for(int t=0; t<numWriters; ++t)
+        threads.push_back( new StressThread(bin, tiles, t, numWriters, count, writeMode, binLock, allowMissing, numFailures) );
+    for(int t=0; t<numReaders; ++t)
+        threads.push_back( new StressThread(bin, tiles, t, osg::maximum(numWriters, numReaders), count, readMode, binLock, allowMissing, numFailures) );
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    for(unsigned t=0; t<threads.size(); ++t)
+        threads[t]->start();
+
+    StressResult result;
+    result._missing = 0;
+    result._maxLatency = 0.0;
+    double totalLatency = 0.0;
+    unsigned reads = 0;
+    for(unsigned t=0; t<threads.size(); ++t)
+    {
+        threads[t]->join();
+        result._missing += threads[t]->_missing;
+        result._maxLatency = osg::maximum(result._maxLatency, threads[t]->_maxLatency);
+        totalLatency += threads[t]->_totalLatency;
+        reads += threads[t]->_reads;
+        delete threads[t];
+    }
+
+    double seconds = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+    result._rate = seconds > 0.0 ? (double)(threads.size()*count)/seconds : 0.0;
+    result._failures = numFailures;
+    result._meanLatency = reads > 0 ? totalLatency / (double)reads : 0.0;
+    return result;
+}
+
+/**
+ * Runs the concurrent write, read and mixed workloads against one bin,
+ * first under a bin-wide lock (the old locking) and then under the
+ * cache's own locking. In the mixed phase, readers check every record
+ * they get while the writers overwrite them.
+ */
+int
+stress(Cache* cache, int numThreads, int count)
+{
+    CacheBin* bin = cache->addBin("stress_bin");
+    if (!bin)
+        return quit( "Failed to open the cache bin!" );
+
+    StressTiles tiles;
+    tiles.push_back( makeStressTile(0) );
+    tiles.push_back( makeStressTile(1) );
+
+    // with OSGEARTH_CACHE_MAX_SIZE_MB set, records may be evicted mid-test.
+    bool allowMissing = ::getenv(OSGEARTH_ENV_CACHE_MAX_SIZE_MB) != 0L;
+
+    Threading::ReadWriteMutex binLock;
+    const char*                names[2] = { "bin-wide lock", "striped" };
+    Threading::ReadWriteMutex* locks[2] = { &binLock, 0L };
+    double                     mixed[2] = { 0.0, 0.0 };
+
+    OE_NOTICE << LC << numThreads << " threads, " << count << " tiles per thread" << std::endl;
+    OE_NOTICE << LC << std::setw(16) << "locking" << std::setw(12) << "writes/s"
+        << std::setw(12) << "reads/s" << std::setw(12) << "mixed/s" << std::setw(10) << "failures" << std::endl;
+
+    bool ok = true;
+
+    for(unsigned m=0; m<2; ++m)
+    {
+        bin->clear();
+
+        StressResult w = runStressPhase(bin, tiles, numThreads, 0, count, StressThread::WRITE, StressThread::READ, locks[m], allowMissing);
+        StressResult r = runStressPhase(bin, tiles, 0, numThreads, count, StressThread::WRITE, StressThread::READ, locks[m], allowMissing);
+        StressResult x = runStressPhase(bin, tiles, numThreads, numThreads, count, StressThread::REWRITE, StressThread::READ_ANY, locks[m], allowMissing);
+
+        unsigned failures = w._failures + r._failures + x._failures;
+        mixed[m] = x._rate;
+
+        OE_NOTICE << LC << std::setw(16) << names[m] << std::fixed << std::setprecision(0)
+            << std::setw(12) << w._rate << std::setw(12) << r._rate << std::setw(12) << x._rate
+            << std::setw(10) << failures << std::endl;
+
+        if ( failures > 0 )
+            ok = false;
+    }
+
+    bin->clear();
+
+    if ( mixed[0] > 0.0 )
+    {
+        OE_NOTICE << LC << "Mixed read/write speedup over a bin-wide lock: "
+            << std::fixed << std::setprecision(2) << mixed[1]/mixed[0] << "x" << std::endl;
+    }
+
+    if ( !ok )
+        return quit( "Stress test: FAIL" );
+
+    OE_NOTICE << "Stress test: PASS" << std::endl;
+    return 0;
+}
+
+/**
+ * Runs the same write-then-read workload on two filesystem caches under
+ * OSGEARTH_CACHE_PATH, one without a size limit and one limited to
+ * "maxSizeMB", and compares the throughput and read latency. Reads of
+ * records the evictor has already removed are counted, not failed.
+ */
+int
+evictionBenchmark(int numThreads, int count, unsigned maxSizeMB)
+{
+    const char* cachePath = ::getenv(OSGEARTH_ENV_CACHE_PATH);
+    if ( !cachePath )
+        return quit( "Please set OSGEARTH_CACHE_PATH for the eviction benchmark." );
+
+    // the driver applies this to every cache it opens, including the unlimited one.
+    if ( ::getenv(OSGEARTH_ENV_CACHE_MAX_SIZE_MB) )
+        return quit( "Please unset " OSGEARTH_ENV_CACHE_MAX_SIZE_MB " for the eviction benchmark." );
+
+    StressTiles tiles;
+    tiles.push_back( makeStressTile(0) );
+
+    OE_NOTICE << LC << numThreads << " threads, " << count << " tiles per thread, limit " << maxSizeMB << " MB" << std::endl;
+    OE_NOTICE << LC << std::setw(12) << "eviction" << std::setw(12) << "writes/s"
+        << std::setw(12) << "reads/s" << std::setw(14) << "mean read ms" << std::setw(13) << "max read ms"
+        << std::setw(10) << "evicted" << std::setw(10) << "failures" << std::endl;
+
+    bool ok = true;
+
+    for(unsigned e=0; e<2; ++e)
+    {
+        bool evict = ( e == 1 );
+
+        Drivers::FileSystemCacheOptions options;
+        options.rootPath() = osgDB::concatPaths( cachePath, evict ? "stress_evict_on" : "stress_evict_off" );
+        if ( evict )
+        {
+            options.maxSizeMB() = maxSizeMB;
+            options.evictionPeriod() = 0.5;
+        }
+
+        osg::ref_ptr<Cache> cache = CacheFactory::create( options );
+        CacheBin* bin = cache.valid() ? cache->addBin("stress_bin") : 0L;
+        if ( !bin )
+            return quit( "Failed to open the cache bin!" );
+
+        bin->clear();
+
+        StressResult w = runStressPhase(bin, tiles, numThreads, 0, count, StressThread::WRITE, StressThread::READ, 0L, evict);
+        StressResult r = runStressPhase(bin, tiles, 0, numThreads, count, StressThread::WRITE, StressThread::READ, 0L, evict);
+
+        unsigned failures = w._failures + r._failures;
+        if ( failures > 0 )
+            ok = false;
+
+        OE_NOTICE << LC << std::setw(12) << (evict ? "on" : "off") << std::fixed
+            << std::setprecision(0) << std::setw(12) << w._rate << std::setw(12) << r._rate
+            << std::setprecision(3) << std::setw(14) << r._meanLatency*1000.0 << std::setw(13) << r._maxLatency*1000.0
+            << std::setw(10) << r._missing << std::setw(10) << failures << std::endl;
+
+        bin->clear();
+    }
+
+    if ( !ok )
+        return quit( "Eviction benchmark: FAIL" );
+
+    OE_NOTICE << "Eviction benchmark: PASS" << std::endl;
+    return 0;
+}
+
+/**
+ * Encodes and decodes one object "count" times in one format, and reports
+ * the throughput (in MB/s of uncompressed data) and the encoded size.
+ */
+bool
+benchmarkFormat(const std::string& name, const osg::Object* object, unsigned rawBytes, int count,
+                osgDB::ReaderWriter* rw, osgDB::Options* rwOptions, TileCodec::Compression compression)
+{
+    bool isImage = dynamic_cast<const osg::Image*>(object) != 0L;
+    std::string encoded;
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for(int i=0; i<count; ++i)
+    {
+        std::stringstream buf;
+        bool ok =
+            rw == 0L      ? TileCodec::encode(object, buf, compression) :
+            isImage       ? rw->writeImage(*static_cast<const osg::Image*>(object), buf, rwOptions).success() :
+                            rw->writeObject(*object, buf, rwOptions).success();
+        if ( !ok )
+            return false;
+        encoded = buf.str();
+    }
+    double encodeTime = osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+
+    t0 = osg::Timer::instance()->tick();
+    for(int i=0; i<count; ++i)
+    {
+        std::istringstream buf(encoded);
+        osg::ref_ptr<osg::Object> result =
+            rw == 0L      ? TileCodec::decode(buf) :
+            isImage       ? rw->readImage(buf, rwOptions).takeImage() :
+                            rw->readObject(buf, rwOptions).takeObject();
+        if ( !result.valid() )
+            return false;
+    }
+    double decodeTime = osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+
+    double mb = (double)rawBytes * (double)count / 1048576.0;
+    OE_NOTICE << LC << "  " << std::setw(10) << std::left << name
+        << " encode " << std::setw(8) << (encodeTime > 0.0 ? mb/encodeTime : 0.0) << " MB/s,"
+        << " decode " << std::setw(8) << (decodeTime > 0.0 ? mb/decodeTime : 0.0) << " MB/s,"
+        << " size "   << encoded.length() << " bytes" << std::endl;
+    return true;
+}
+
+int
+codecBenchmark(int count)
+{
+    osg::ref_ptr<osgDB::ReaderWriter> rw = osgDB::Registry::instance()->getReaderWriterForExtension("osgb");
+    if ( !rw.valid() )
+        return quit( "Failed to load the osgb plugin!" );
+
+    osg::ref_ptr<osgDB::Options> rwOptions = Registry::instance()->cloneOrCreateOptions();
+    rwOptions->setOptionString( "Compressor=zlib" );
+
+    // imagery-like content: smooth gradients plus a little noise.
+    osg::ref_ptr<osg::Image> image = new osg::Image();
+    image->allocateImage(256, 256, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    image->setInternalTextureFormat(GL_RGBA8);
+    unsigned char* ptr = image->data();
+    for(int t=0; t<256; ++t)
+    {
+        for(int s=0; s<256; ++s, ptr += 4)
+        {
+            unsigned noise = ((unsigned)(s*256+t) * 2654435761u) >> 29;
+            ptr[0] = (unsigned char)(s + noise);
+            ptr[1] = (unsigned char)(t + noise);
+            ptr[2] = (unsigned char)((s+t)/2);
+            ptr[3] = 255;
+        }
+    }
+
+    // terrain-like content:
+    osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
+    hf->allocate(257, 257);
+    for(unsigned r=0; r<257; ++r)
+        for(unsigned c=0; c<257; ++c)
+            hf->setHeight(c, r, 1000.0f * sinf(0.05f*(float)c) * cosf(0.03f*(float)r) + 0.37f*(float)((c*r) % 7));
+
+    struct Tile { std::string name; const osg::Object* object; unsigned bytes; };
+    Tile tiles[2] = {
+        { "256x256 RGBA image",      image.get(), image->getTotalSizeInBytes() },
+        { "257x257 float heightfield", hf.get(),  257*257*sizeof(float) } };
+
+    for(int i=0; i<2; ++i)
+    {
+        OE_NOTICE << LC << tiles[i].name << " (" << count << " iterations):" << std::endl;
+        if ( !benchmarkFormat("osgb+zlib", tiles[i].object, tiles[i].bytes, count, rw.get(), rwOptions.get(), TileCodec::COMPRESSION_NONE) ||
+             !benchmarkFormat("raw",       tiles[i].object, tiles[i].bytes, count, 0L, 0L, TileCodec::COMPRESSION_NONE) ||
+             !benchmarkFormat("raw+zlib",  tiles[i].object, tiles[i].bytes, count, 0L, 0L, TileCodec::COMPRESSION_ZLIB) )
+        {
+            return quit( "Codec benchmark: FAIL" );
+        }
+    }
+
+    OE_NOTICE << "Codec benchmark: PASS" << std::endl;
+    return 0;
+}
+
 int
 main(int argc, char** argv)
 {
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    if ( arguments.read("--codec") )
+    {
+        int count = 200;
+        arguments.read("--count", count);
+        return codecBenchmark(osg::maximum(count, 1));
+    }
+
     osg::ref_ptr<Cache> cache = Registry::instance()->getCache();
     if ( !cache.valid() )
     {
         return quit( "Please configure a cache path in your environment (OSGEARTH_CACHE_PATH)." );
     }
 
+    if ( arguments.read("--stress") )
+    {
+        int numThreads = 4, count = 250, evictMB = 0;
+        arguments.read("--threads", numThreads);
+        arguments.read("--count", count);
+        bool evict = arguments.read("--evict", evictMB);
+        int result = stress(cache.get(), osg::maximum(numThreads, 1), osg::maximum(count, 1));
+        if ( result == 0 && evict )
+            result = evictionBenchmark(osg::maximum(numThreads, 1), osg::maximum(count, 1), (unsigned)osg::maximum(evictMB, 1));
+        Registry::instance()->setCache( 0L );
+        return result;
+    }
+
     // open a bin:
     CacheBin* bin = cache->addBin("test_bin");
     if (!bin)
@@ -85,6 +542,26 @@ main(int argc, char** argv)
         OE_NOTICE << "Image test: PASS" << std::endl;
     }
 
+    // RAW IMAGE:
+    {
+        osg::ref_ptr<osg::Image> image = ImageUtils::createOnePixelImage(osg::Vec4(0,1,0,1));
+
+        bin->setTileCodec( TileCodec::COMPRESSION_ZLIB );
+        bool ok = bin->write("raw_image_key", image.get());
+        bin->resetTileCodec();
+        if ( !ok )
+            return quit("Raw image write failed.");
+
+        ReadResult r = bin->readImage("raw_image_key");
+        if ( r.failed() )
+            return quit( Stringify() << "Raw image read failed - " << r.getResultCodeString() );
+
+        if ( !ImageUtils::areEquivalent(r.getImage(), image.get()) )
+            return quit( "Raw image read error - images do not match" );
+
+        OE_NOTICE << "Raw image test: PASS" << std::endl;
+    }
+
     // Need to properly shut down the cache here
     Registry::instance()->setCache( 0L );
 
@@ -0,0 +1,198 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/Map>
+#include <osgEarth/Registry>
+#include <osgEarthFeatures/Feature>
+#include <osgEarthFeatures/GeometryCompiler>
+#include <osgEarthFeatures/Session>
+#include <osgEarthSymbology/Style>
+#include <osgEarthSymbology/Geometry>
+#include <osg/ArgumentParser>
+#include <osg/NodeVisitor>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Timer>
+#include <vector>
+#include <cmath>
+#include <iomanip>
+
+#define LC "[compile_test] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_compile_test\n"
+        << "    [--buildings <num>]     : number of building footprints in the tile (default 20000)\n"
+        << "    [--threads <num>]       : compile threads for the parallel run (default 4)\n"
+        << "    [--runs <num>]          : compile the tile this many times per mode (default 3)\n"
+        << "    [--flat]                : build flat polygons instead of extruding them\n"
+        << std::endl;
+    return -1;
+}
+
+/**
+ * Makes a grid of rectangular building footprints around downtown Boston,
+ * with the story height attribute of boston_buildings_utm19.shp.
+ */
+void
+makeBuildings(unsigned count, const GeoExtent& extent, FeatureList& out)
+{
+    unsigned cols = (unsigned)ceil(sqrt((double)count));
+    double dx = extent.width() / (double)cols;
+    double dy = extent.height() / (double)cols;
+
+    out.clear();
+    for(unsigned i=0; i<count; ++i)
+    {
+        double x = extent.xMin() + dx*(double)(i % cols);
+        double y = extent.yMin() + dy*(double)(i / cols);
+
+        // an L-shaped footprint, so roofs need real tessellation.
+        Polygon* poly = new Polygon();
+        poly->push_back( osg::Vec3d(x + 0.1*dx, y + 0.1*dy, 0.0) );
+        poly->push_back( osg::Vec3d(x + 0.9*dx, y + 0.1*dy, 0.0) );
+        poly->push_back( osg::Vec3d(x + 0.9*dx, y + 0.5*dy, 0.0) );
+        poly->push_back( osg::Vec3d(x + 0.5*dx, y + 0.5*dy, 0.0) );
+        poly->push_back( osg::Vec3d(x + 0.5*dx, y + 0.9*dy, 0.0) );
+        poly->push_back( osg::Vec3d(x + 0.1*dx, y + 0.9*dy, 0.0) );
+
+        Feature* feature = new Feature( poly, extent.getSRS(), Style(), i );
+        feature->set( "story_ht_", (double)(1 + i % 12) );
+        out.push_back( feature );
+    }
+}
+
+/** Counts the drawables and vertices in a graph. */
+struct CountGeometry : public osg::NodeVisitor
+{
+    CountGeometry() : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), _geodes(0), _drawables(0), _vertices(0) { }
+
+    void apply(osg::Geode& geode)
+    {
+        ++_geodes;
+        for(unsigned i=0; i<geode.getNumDrawables(); ++i)
+        {
+            osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+            if ( geom && geom->getVertexArray() )
+            {
+                ++_drawables;
+                _vertices += geom->getVertexArray()->getNumElements();
+            }
+        }
+    }
+
+    unsigned _geodes, _drawables, _vertices;
+};
+
+/** Compiles the buildings in one tile, and returns the mean time in ms. */
+double
+compileTile(Session* session, const FeatureProfile* profile, const Style& style, unsigned numBuildings,
+            unsigned threads, unsigned runs, CountGeometry& out_count)
+{
+    GeometryCompilerOptions options;
+    options.compileThreads() = threads;
+    options.shaderPolicy()   = SHADERPOLICY_DISABLE;
+    GeometryCompiler compiler( options );
+
+    double ms = 0.0;
+    for(unsigned r=0; r<runs; ++r)
+    {
+        // the filters modify the features, so start from fresh ones each time.
+        FeatureList features;
+        makeBuildings( numBuildings, profile->getExtent(), features );
+        FilterContext context( session, profile, profile->getExtent() );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        osg::ref_ptr<osg::Node> node = compiler.compile( features, style, context );
+        ms += osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        if ( r == 0 && node.valid() )
+            node->accept( out_count );
+    }
+
+    return ms / (double)runs;
+}
+
+/**
+ * Measures the time to compile a tile of many buildings, with the style of
+ * tests/boston_buildings.earth, on the calling thread and in parallel chunks.
+ */
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    int numBuildings = 20000, threads = 4, runs = 3;
+    arguments.read("--buildings", numBuildings);
+    arguments.read("--threads", threads);
+    arguments.read("--runs", runs);
+    bool flat = arguments.read("--flat");
+
+    if ( numBuildings < 1 || threads < 1 || runs < 1 )
+        return usage( argv[0] );
+
+    // a geocentric map, and a tile about 3km on a side over Boston.
+    osg::ref_ptr<Map> map = new Map();
+    osg::ref_ptr<Session> session = new Session( map.get() );
+    GeoExtent extent( SpatialReference::get("wgs84"), -71.08, 42.34, -71.04, 42.37 );
+    osg::ref_ptr<FeatureProfile> profile = new FeatureProfile( extent );
+
+    Style style;
+    if ( flat )
+    {
+        style.getOrCreate<PolygonSymbol>()->fill()->color() = Color::White;
+    }
+    else
+    {
+        ExtrusionSymbol* extrusion = style.getOrCreate<ExtrusionSymbol>();
+        extrusion->heightExpression() = NumericExpression( "3.5 * max([story_ht_], 1)" );
+        extrusion->flatten() = true;
+    }
+    // a vertical offset makes the altitude filter run, without needing terrain.
+    style.getOrCreate<AltitudeSymbol>()->clamping() = AltitudeSymbol::CLAMP_NONE;
+    style.getOrCreate<AltitudeSymbol>()->verticalOffset() = NumericExpression( 1.0 );
+
+    OE_NOTICE << LC << "compiling " << numBuildings << (flat ? " flat" : " extruded") << " buildings" << std::endl;
+
+    CountGeometry seqCount, parCount;
+    double seqTime = compileTile( session.get(), profile.get(), style, (unsigned)numBuildings, 1u, (unsigned)runs, seqCount );
+    double parTime = compileTile( session.get(), profile.get(), style, (unsigned)numBuildings, (unsigned)threads, (unsigned)runs, parCount );
+
+    OE_NOTICE << LC << std::setw(12) << "" << std::setw(12) << "ms/tile" << std::setw(10) << "geodes"
+        << std::setw(12) << "drawables" << std::setw(12) << "vertices" << std::endl;
+    OE_NOTICE << LC << std::setw(12) << "sequential"
+        << std::setw(12) << std::fixed << std::setprecision(1) << seqTime
+        << std::setw(10) << seqCount._geodes << std::setw(12) << seqCount._drawables << std::setw(12) << seqCount._vertices << std::endl;
+    OE_NOTICE << LC << std::setw(9) << threads << " th"
+        << std::setw(12) << parTime
+        << std::setw(10) << parCount._geodes << std::setw(12) << parCount._drawables << std::setw(12) << parCount._vertices
+        << "  (" << std::setprecision(2) << (parTime > 0.0 ? seqTime/parTime : 0.0) << "x)" << std::endl;
+
+    return 0;
+}
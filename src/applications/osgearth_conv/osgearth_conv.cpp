@@ -41,6 +41,10 @@ int usage(char** argv)
         << "\n    --profile [profile def]             : set an output profile (optional; default = same as input)"
         << "\n    --min-level [int]                   : minimum level of detail"
         << "\n    --max-level [int]                   : maximum level of detail"
+        << "\n    --threads [int]                     : number of threads"
+        << "\n    --pipeline                          : read and write tiles in separate stages"
+        << "\n    --journal [file]                    : record the converted tiles in a file, and skip"
+        << "\n                                          the tiles already in it (implies --pipeline)"
         << std::endl;
         
     return 0;
@@ -79,6 +83,25 @@ struct TileSourceToTileSource : public TileHandler
         return _source->hasData(key);
     }
 
+    // stages, for the PipelinedTileVisitor:
+    bool supportsStages() const { return true; }
+
+    osg::Referenced* fetchTile(const TileKey& key)
+    {
+        if (_heightFields)
+            return _source->createHeightField(key);
+        else
+            return _source->createImage(key);
+    }
+
+    bool storeTile(const TileKey& key, osg::Referenced* data)
+    {
+        if (_heightFields)
+            return _dest->storeHeightField(key, static_cast<osg::HeightField*>(data), 0L);
+        else
+            return _dest->storeImage(key, static_cast<osg::Image*>(data), 0L);
+    }
+
     TileSource* _source;
     TileSource* _dest;
     bool        _heightFields;
@@ -110,6 +133,20 @@ struct ImageLayerToTileSource : public TileHandler
         return _source->getTileSource()->hasData(key);
     }
 
+    // stages, for the PipelinedTileVisitor:
+    bool supportsStages() const { return true; }
+
+    osg::Referenced* fetchTile(const TileKey& key)
+    {
+        GeoImage image = _source->createImage(key);
+        return image.valid() ? image.takeImage() : 0L;
+    }
+
+    bool storeTile(const TileKey& key, osg::Referenced* data)
+    {
+        return _dest->storeImage(key, static_cast<osg::Image*>(data), 0L);
+    }
+
     osg::ref_ptr<ImageLayer> _source;
     TileSource*              _dest;
 };
@@ -140,6 +177,20 @@ struct ElevationLayerToTileSource : public TileHandler
         return _source->getTileSource()->hasData(key);
     }
 
+    // stages, for the PipelinedTileVisitor:
+    bool supportsStages() const { return true; }
+
+    osg::Referenced* fetchTile(const TileKey& key)
+    {
+        GeoHeightField hf = _source->createHeightField(key, 0L);
+        return hf.valid() ? hf.takeHeightField() : 0L;
+    }
+
+    bool storeTile(const TileKey& key, osg::Referenced* data)
+    {
+        return _dest->storeHeightField(key, static_cast<osg::HeightField*>(data), 0L);
+    }
+
     osg::ref_ptr<ElevationLayer> _source;
     TileSource*                  _dest;
 };
@@ -201,6 +252,10 @@ struct ProgressReporter : public osgEarth::ProgressCallback
  *      --min-level [int]     : min level of detail to copy
  *      --max-level [int]     : max level of detail to copy
  *      --threads [n]         : threads to use (may crash. Careful.)
+ *      --pipeline            : read and write tiles in separate stages; with --threads,
+ *                              the number of threads reading tiles
+ *      --journal [file]      : record converted tiles in a file, so an interrupted
+ *                              conversion can resume where it left off
  *
  *      --extents [minLat] [minLong] [maxLat] [maxLong] : Lat/Long extends to copy (*)
  *
@@ -299,7 +354,24 @@ main(int argc, char** argv)
     osg::ref_ptr<TileVisitor> visitor;
 
     unsigned numThreads = 1;
-    if (args.read("--threads", numThreads))
+    bool threadsSet = args.read("--threads", numThreads);
+
+    std::string journal;
+    bool pipelined = args.read("--journal", journal);
+    pipelined = args.read("--pipeline") || pipelined;
+
+    if (pipelined)
+    {
+        PipelinedTileVisitor* ptv = new PipelinedTileVisitor();
+        if (threadsSet)
+        {
+            ptv->setNumFetchThreads( numThreads );
+            ptv->setNumProcessThreads( numThreads );
+        }
+        ptv->setJournal( journal );
+        visitor = ptv;
+    }
+    else if (threadsSet)
     {
         MultithreadedTileVisitor* mtv = new MultithreadedTileVisitor();
         mtv->setNumThreads( numThreads < 1 ? 1 : numThreads );
@@ -310,6 +382,9 @@ main(int argc, char** argv)
         visitor = new TileVisitor();
     }
 
+    // Skip the parts of the output profile where the input has no data.
+    visitor->setCoverageIndex( new TileCoverageIndex(input.get(), outputProfile.get()) );
+
     // If the profiles are identical, just use a tile copier.
     if ( isSameProfile )
     {
@@ -401,5 +476,20 @@ main(int argc, char** argv)
         << osg::Timer::instance()->delta_s(t0, t1)
         << " seconds." << std::endl;
 
+    PipelinedTileVisitor* ptv = dynamic_cast<PipelinedTileVisitor*>(visitor.get());
+    if ( ptv )
+    {
+        const std::vector<PipelinedTileVisitor::StageStats>& stats = ptv->getStageStats();
+        for(unsigned i=0; i<stats.size(); ++i)
+        {
+            std::cout
+                << "  " << std::setw(8) << std::left << stats[i]._name << std::right
+                << std::setw(4) << stats[i]._threads << " threads"
+                << std::setw(10) << stats[i]._tiles << " tiles"
+                << std::setw(10) << std::setprecision(1) << stats[i].tilesPerSecond() << " tiles/sec"
+                << std::endl;
+        }
+    }
+
     return 0;
 }
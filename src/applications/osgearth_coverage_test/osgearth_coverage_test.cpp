@@ -0,0 +1,246 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/Registry>
+#include <osgEarth/TileSource>
+#include <osgEarth/TileVisitor>
+#include <osgEarth/TileCoverageIndex>
+#include <osgEarth/FileUtils>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <OpenThreads/Atomic>
+#include <cstdio>
+#include <iomanip>
+
+#define LC "[coverage_test] "
+
+using namespace osgEarth;
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_coverage_test\n"
+        << "    [--islands <num>]       : number of small data extents scattered over the globe (default 400)\n"
+        << "    [--size <degrees>]      : width and height of each extent (default 0.5)\n"
+        << "    [--max-level <num>]     : level to seed down to (default 12)\n"
+        << std::endl;
+    return -1;
+}
+
+/**
+ * A tile source with many small data extents, like a collection of
+ * high-resolution insets; it never returns any data.
+ */
+class SparseTileSource : public TileSource
+{
+public:
+    SparseTileSource(unsigned islands, double size, unsigned maxLevel) : TileSource(TileSourceOptions())
+    {
+        setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+
+        const SpatialReference* srs = getProfile()->getSRS();
+        unsigned seed = 12345u;
+        for(unsigned i=0; i<islands; ++i)
+        {
+            seed = seed * 1103515245u + 12345u;
+            double x = -180.0 + (double)((seed >> 8) % 36000u) * (360.0 - size) / 36000.0;
+            seed = seed * 1103515245u + 12345u;
+            double y = -90.0 + (double)((seed >> 8) % 18000u) * (180.0 - size) / 18000.0;
+
+            getDataExtents().push_back( DataExtent(GeoExtent(srs, x, y, x+size, y+size), 0u, maxLevel) );
+        }
+    }
+
+    osg::Image* createImage(const TileKey& key, ProgressCallback* progress)
+    {
+        return 0L;
+    }
+};
+
+/**
+ * Counts the keys it tests for data and the tiles it handles. Asks either the
+ * tile source (walking all of its extents) or a coverage index whether
+ * there is data, the way the cache seeder does.
+ */
+class CountingTileHandler : public TileHandler
+{
+public:
+    CountingTileHandler(TileSource* source, TileCoverageIndex* coverage, unsigned cancelAfter =0u)
+        : _source(source), _coverage(coverage), _cancelAfter(cancelAfter) { }
+
+    bool handleTile(const TileKey& key, const TileVisitor& tv)
+    {
+        if ( _coverage.valid() && !_coverage->hasData(key) )
+            return true;
+
+        unsigned handled = ++_handled;
+        if ( _cancelAfter > 0 && handled >= _cancelAfter && _progress.valid() )
+            _progress->cancel();
+
+        return true;
+    }
+
+    bool hasData(const TileKey& key) const
+    {
+        ++_visited;
+        return _coverage.valid() ? _coverage->mayHaveData(key) : _source->hasData(key);
+    }
+
+    osg::ref_ptr<TileSource>         _source;
+    osg::ref_ptr<TileCoverageIndex>  _coverage;
+    osg::ref_ptr<ProgressCallback>   _progress;
+    unsigned                         _cancelAfter;
+    mutable OpenThreads::Atomic      _visited;
+    OpenThreads::Atomic              _handled;
+};
+
+struct Result
+{
+    unsigned _visited, _handled;
+    double   _seconds;
+};
+
+Result
+seed(TileVisitor* visitor, CountingTileHandler* handler, unsigned maxLevel)
+{
+    visitor->setTileHandler( handler );
+    visitor->setMinLevel( 0 );
+    visitor->setMaxLevel( maxLevel );
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    visitor->run( Registry::instance()->getGlobalGeodeticProfile() );
+
+    Result r;
+    r._seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+    r._visited = handler->_visited;
+    r._handled = handler->_handled;
+    return r;
+}
+
+void
+print(const std::string& name, const Result& r)
+{
+    OE_NOTICE << LC << std::setw(22) << std::left << name << std::right
+        << std::setw(12) << r._visited
+        << std::setw(12) << r._handled
+        << std::setw(12) << std::fixed << std::setprecision(3) << r._seconds
+        << std::endl;
+}
+
+/**
+ * Compares the keys visited and the time it takes to traverse a sparse
+ * dataset for seeding, asking the tile source about each key and asking a
+ * coverage index built from its extents; then resumes an interrupted
+ * pipelined seed from its journal.
+ */
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    int islands = 400, maxLevel = 12;
+    double size = 0.5;
+    arguments.read("--islands", islands);
+    arguments.read("--size", size);
+    arguments.read("--max-level", maxLevel);
+
+    if ( islands < 1 || size <= 0.0 || size >= 90.0 || maxLevel < 0 )
+        return usage( argv[0] );
+
+    osg::ref_ptr<TileSource> source = new SparseTileSource( (unsigned)islands, size, (unsigned)maxLevel );
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+
+    OE_NOTICE << LC << islands << " extents of " << size << " degrees, levels 0 to " << maxLevel << std::endl;
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    osg::ref_ptr<TileCoverageIndex> coverage = new TileCoverageIndex( source.get(), profile );
+    double buildSeconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+    OE_NOTICE << LC << "index: " << coverage->getNumNodes() << " nodes, built in "
+        << std::fixed << std::setprecision(3) << buildSeconds << " s" << std::endl;
+
+    OE_NOTICE << LC << std::setw(22) << std::left << "" << std::right
+        << std::setw(12) << "tested" << std::setw(12) << "handled" << std::setw(12) << "seconds" << std::endl;
+
+    // before: every key asks the tile source, which walks all of its extents.
+    Result before;
+    {
+        osg::ref_ptr<TileVisitor> visitor = new TileVisitor();
+        before = seed( visitor.get(), new CountingTileHandler(source.get(), 0L), (unsigned)maxLevel );
+        print( "tile source", before );
+    }
+
+    // after: the visitor asks the index, and skips empty subtrees before the handler tests them.
+    Result after;
+    {
+        osg::ref_ptr<TileVisitor> visitor = new TileVisitor();
+        visitor->setCoverageIndex( coverage.get() );
+        after = seed( visitor.get(), new CountingTileHandler(source.get(), coverage.get()), (unsigned)maxLevel );
+        print( "coverage index", after );
+    }
+
+    // interrupt a pipelined seed halfway, then resume it from the journal.
+    std::string journal = getTempName( getTempPath(), "coverage_test.journal" );
+    ::remove( journal.c_str() );
+
+    Result interrupted, resumed;
+    {
+        osg::ref_ptr<TileCoverageIndex> index = new TileCoverageIndex( source.get(), profile );
+        osg::ref_ptr<CountingTileHandler> handler = new CountingTileHandler( source.get(), index.get(), after._handled/2 );
+        handler->_progress = new ProgressCallback();
+
+        osg::ref_ptr<PipelinedTileVisitor> visitor = new PipelinedTileVisitor();
+        visitor->setNumFetchThreads( 1 );
+        visitor->setJournal( journal );
+        visitor->setCoverageIndex( index.get() );
+        visitor->setProgressCallback( handler->_progress.get() );
+        interrupted = seed( visitor.get(), handler.get(), (unsigned)maxLevel );
+        print( "interrupted", interrupted );
+    }
+    {
+        osg::ref_ptr<TileCoverageIndex> index = new TileCoverageIndex( source.get(), profile );
+        osg::ref_ptr<PipelinedTileVisitor> visitor = new PipelinedTileVisitor();
+        visitor->setNumFetchThreads( 1 );
+        visitor->setJournal( journal );
+        visitor->setCoverageIndex( index.get() );
+        resumed = seed( visitor.get(), new CountingTileHandler(source.get(), index.get()), (unsigned)maxLevel );
+        print( "resumed from journal", resumed );
+    }
+
+    ::remove( journal.c_str() );
+
+    OE_NOTICE << LC << "speedup: " << std::setprecision(2) << (after._seconds > 0.0 ? before._seconds/after._seconds : 0.0) << "x" << std::endl;
+
+    // the index must find exactly the tiles the tile source does, and the resumed
+    // seed must only do what the interrupted one didn't.
+    if ( after._handled != before._handled || after._visited > before._visited ||
+         interrupted._handled + resumed._handled < after._handled )
+    {
+        OE_NOTICE << "Coverage test: FAIL" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << "Coverage test: PASS" << std::endl;
+    return 0;
+}
@@ -0,0 +1,299 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/Decluttering>
+#include <osgUtil/RenderBin>
+#include <osgUtil/RenderStage>
+#include <osgUtil/StateGraph>
+#include <osg/ArgumentParser>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Camera>
+#include <osg/Timer>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <iomanip>
+
+#define LC "[declutter_test] "
+
+using namespace osgEarth;
+
+#define WIDTH  1920
+#define HEIGHT 1080
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_declutter_test\n"
+        << "    [--labels <num>]        : labels to declutter (default: 1000, then 10000, then 50000)\n"
+        << "    [--frames <num>]        : decluttering passes to time (default 10)\n"
+        << std::endl;
+    return -1;
+}
+
+/** A label: a rectangle of window-space pixels at a window position. */
+struct Label
+{
+    osg::ref_ptr<osg::Geode>     _geode;
+    osg::ref_ptr<osg::Geometry>  _geom;
+    osg::ref_ptr<osg::RefMatrix> _modelview;
+    float                        _depth;
+    osg::BoundingBox             _box;
+};
+
+/** Labels of 40-160 by 12-20 pixels scattered over (and a bit past) the window, at distinct depths. */
+void
+makeLabels(unsigned count, std::vector<Label>& labels)
+{
+    labels.resize( count );
+
+    unsigned seed = 12345u;
+    for(unsigned i=0; i<count; ++i)
+    {
+        Label& label = labels[i];
+
+        seed = seed * 1664525u + 1013904223u;
+        float x = -100.0f + (float)((seed >> 8) % (WIDTH+200));
+        seed = seed * 1664525u + 1013904223u;
+        float y = -50.0f + (float)((seed >> 8) % (HEIGHT+100));
+        seed = seed * 1664525u + 1013904223u;
+        float w = 40.0f + (float)((seed >> 8) % 121);
+        float h = 12.0f + (float)((seed >> 16) % 9);
+
+        osg::Vec3Array* verts = new osg::Vec3Array();
+        verts->push_back( osg::Vec3(0, 0, 0) );
+        verts->push_back( osg::Vec3(w, 0, 0) );
+        verts->push_back( osg::Vec3(w, h, 0) );
+        verts->push_back( osg::Vec3(0, h, 0) );
+
+        label._geom = new osg::Geometry();
+        label._geom->setVertexArray( verts );
+        label._geom->addPrimitiveSet( new osg::DrawArrays(GL_QUADS, 0, 4) );
+        label._geom->getBound();
+
+        label._geode = new osg::Geode();
+        label._geode->addDrawable( label._geom.get() );
+
+        label._modelview = new osg::RefMatrix( osg::Matrix::translate(x, y, 0) );
+        label._box.set( x, y, 0, x+w, y+h, 0 );
+        label._depth = (float)i;
+    }
+
+    // shuffle the depths so the sort has some work to do.
+    seed = 54321u;
+    for(unsigned i=count-1; i>0; --i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        std::swap( labels[i]._depth, labels[(seed >> 8) % (i+1)]._depth );
+    }
+}
+
+struct FrontToBack
+{
+    bool operator()(const Label* lhs, const Label* rhs) const { return lhs->_depth < rhs->_depth; }
+};
+
+/**
+ * Declutters the labels the way the bin did before it used a grid: front to
+ * back, testing each label against all the labels that passed before it.
+ */
+double
+declutterBruteForce(const std::vector<Label>& labels, std::set<const osg::Drawable*>& passed)
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    std::vector<const Label*> sorted( labels.size() );
+    for(unsigned i=0; i<labels.size(); ++i)
+        sorted[i] = &labels[i];
+
+    std::sort( sorted.begin(), sorted.end(), FrontToBack() );
+
+    std::vector<const Label*> used;
+    for(unsigned i=0; i<sorted.size(); ++i)
+    {
+        const osg::BoundingBox& box = sorted[i]->_box;
+        bool visible = true;
+        for(unsigned j=0; j<used.size() && visible; ++j)
+        {
+            const osg::BoundingBox& u = used[j]->_box;
+            visible =
+                box.xMin() > u.xMax() || box.xMax() < u.xMin() ||
+                box.yMin() > u.yMax() || box.yMax() < u.yMin();
+        }
+        if ( visible )
+        {
+            used.push_back( sorted[i] );
+            passed.insert( sorted[i]->_geom.get() );
+        }
+    }
+
+    return osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+}
+
+/** Fills the bin with a fresh render leaf for each label, as the cull traversal would. */
+void
+fill(osgUtil::RenderBin* bin, const std::vector<Label>& labels, osg::RefMatrix* projection)
+{
+    bin->reset();
+    for(unsigned i=0; i<labels.size(); ++i)
+    {
+        osgUtil::StateGraph* sg = new osgUtil::StateGraph();
+        sg->addLeaf( new osgUtil::RenderLeaf(labels[i]._geom.get(), projection, labels[i]._modelview.get(), labels[i]._depth, i) );
+        bin->addStateGraph( sg );
+    }
+}
+
+struct Result
+{
+    double   _seconds, _bruteForceSeconds;
+    unsigned _passed;
+    bool     _ok;
+};
+
+/**
+ * Declutters the labels in a decluttering bin over several passes, and
+ * checks that the labels it shows at full opacity are exactly the ones the
+ * brute force test lets through.
+ */
+Result
+run(unsigned count, unsigned frames, std::vector< osg::ref_ptr<osg::Referenced> >& keepAlive)
+{
+    Result r;
+    r._ok = true;
+
+    std::vector<Label> labels;
+    makeLabels( count, labels );
+
+    std::set<const osg::Drawable*> expected;
+    r._bruteForceSeconds = declutterBruteForce( labels, expected );
+
+    // each run gets its own camera; the bin remembers the labels per camera.
+    osg::Camera* camera = new osg::Camera();
+    camera->setViewport( 0, 0, WIDTH, HEIGHT );
+    osgUtil::RenderStage* stage = new osgUtil::RenderStage();
+    stage->setCamera( camera );
+    osgUtil::RenderBin* bin = osgUtil::RenderBin::createRenderBin( OSGEARTH_DECLUTTER_BIN );
+    bin->setStage( stage );
+    keepAlive.push_back( camera );
+    keepAlive.push_back( stage );
+    keepAlive.push_back( bin );
+    for(unsigned i=0; i<labels.size(); ++i)
+        keepAlive.push_back( labels[i]._geode.get() );
+
+    osg::ref_ptr<osg::RefMatrix> projection = new osg::RefMatrix( osg::Matrix::ortho2D(0, WIDTH, 0, HEIGHT) );
+
+    r._seconds = 0.0;
+    for(unsigned f=0; f<frames; ++f)
+    {
+        fill( bin, labels, projection.get() );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        bin->sort();
+        r._seconds += osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+    }
+
+    // after the first pass the labels that failed have started to fade out,
+    // so the ones still at full opacity are the ones that passed.
+    std::set<const osg::Drawable*> passed;
+    const osgUtil::RenderBin::RenderLeafList& leaves = bin->getRenderLeafList();
+    for(osgUtil::RenderBin::RenderLeafList::const_iterator i = leaves.begin(); i != leaves.end(); ++i)
+    {
+        if ( (*i)->_depth == 1.0f )
+            passed.insert( (*i)->getDrawable() );
+    }
+
+    r._passed = passed.size();
+    r._ok = (passed == expected);
+    r._seconds /= (double)frames;
+    return r;
+}
+
+/**
+ * Measures the time the decluttering bin takes to sort out overlapping
+ * labels at growing label counts, next to the brute force test of each
+ * label against all the labels in front of it, and checks both agree.
+ */
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    int numLabels = 0, frames = 10;
+    arguments.read("--labels", numLabels);
+    arguments.read("--frames", frames);
+
+    if ( numLabels < 0 || frames < 2 )
+        return usage( argv[0] );
+
+    Decluttering::setEnabled( true );
+    if ( !osgUtil::RenderBin::getRenderBinPrototype(OSGEARTH_DECLUTTER_BIN) )
+    {
+        OE_NOTICE << LC << "Decluttering bin is not registered" << std::endl;
+        return -1;
+    }
+
+    std::vector<unsigned> counts;
+    if ( numLabels > 0 )
+    {
+        counts.push_back( (unsigned)numLabels );
+    }
+    else
+    {
+        counts.push_back( 1000u );
+        counts.push_back( 10000u );
+        counts.push_back( 50000u );
+    }
+
+    OE_NOTICE << LC << std::setw(10) << "labels" << std::setw(10) << "passed"
+        << std::setw(14) << "bin ms" << std::setw(16) << "brute force ms" << std::endl;
+
+    std::vector< osg::ref_ptr<osg::Referenced> > keepAlive;
+    bool ok = true;
+
+    for(unsigned i=0; i<counts.size(); ++i)
+    {
+        Result r = run( counts[i], (unsigned)frames, keepAlive );
+
+        OE_NOTICE << LC << std::setw(10) << counts[i] << std::setw(10) << r._passed
+            << std::setw(14) << std::fixed << std::setprecision(3) << 1000.0*r._seconds
+            << std::setw(16) << 1000.0*r._bruteForceSeconds
+            << std::endl;
+
+        if ( !r._ok )
+        {
+            OE_NOTICE << LC << "Decluttering of " << counts[i] << " labels does not match the brute force test" << std::endl;
+            ok = false;
+        }
+    }
+
+    if ( !ok )
+    {
+        OE_NOTICE << "Declutter test: FAIL" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << "Declutter test: PASS" << std::endl;
+    return 0;
+}
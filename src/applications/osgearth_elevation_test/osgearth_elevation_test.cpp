@@ -0,0 +1,383 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/Map>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/ElevationQuery>
+#include <osgEarth/TileSource>
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osg/ArgumentParser>
+#include <osg/Shape>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <cmath>
+#include <iomanip>
+
+#define LC "[elevation_test] "
+
+using namespace osgEarth;
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_elevation_test\n"
+        << "    [--populate]            : benchmark populateHeightField only\n"
+        << "    [--iterations <num>]    : tiles to build per measurement (default 200)\n"
+        << "    [--query]               : benchmark ElevationQuery only\n"
+        << "    [--points <num>]        : points per query benchmark (default 100000)\n"
+        << "    [--service]             : test ElevationQueryService only\n"
+        << "    [--threads <num>]       : batch threads for the query benchmark,\n"
+        << "                              and client threads for the service test (default 4)\n"
+        << std::endl;
+    return -1;
+}
+
+/**
+ * Procedural elevation source. Each layer has a NO_DATA "hole" in a different
+ * spot, so the lower-priority layers have to fill in for the higher ones.
+ */
+class ProceduralElevationSource : public TileSource
+{
+public:
+    ProceduralElevationSource(int index, int tileSize) : TileSource(makeOptions(tileSize)), _index(index) { }
+
+    static TileSourceOptions makeOptions(int tileSize)
+    {
+        TileSourceOptions options;
+        options.tileSize() = tileSize;
+        return options;
+    }
+
+    Status initialize(const osgDB::Options* dbOptions)
+    {
+        setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+        return STATUS_OK;
+    }
+
+    osg::HeightField* createHeightField(const TileKey& key, ProgressCallback* progress)
+    {
+        unsigned size = getPixelsPerTile();
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate(size, size);
+
+        const GeoExtent& ex = key.getExtent();
+        double dx = ex.width() / (double)(size-1);
+        double dy = ex.height() / (double)(size-1);
+        for(unsigned r=0; r<size; ++r)
+        {
+            double y = ex.yMin() + dy*(double)r;
+            for(unsigned c=0; c<size; ++c)
+            {
+                double x = ex.xMin() + dx*(double)c;
+
+                // the bottom layer covers everything; the others leave a hole.
+                bool hole = _index > 0 && (((c + r*3 + _index*7) / (size/4 + 1)) % 5) == 0;
+                hf->setHeight(c, r, hole ? NO_DATA_VALUE :
+                    (float)(1000.0*sin(0.3*x + _index) * cos(0.2*y) + 100.0*_index));
+            }
+        }
+        return hf;
+    }
+
+    int _index;
+};
+
+/**
+ * Builds "iterations" tiles with "numLayers" stacked elevation layers, and
+ * returns the average time per tile in milliseconds.
+ */
+Map*
+createMap(unsigned numLayers, unsigned tileSize)
+{
+    MapOptions mapOptions;
+    mapOptions.cachePolicy() = CachePolicy::NO_CACHE;
+    Map* map = new Map( mapOptions );
+
+    for(unsigned i=0; i<numLayers; ++i)
+    {
+        ElevationLayerOptions options( Stringify() << "layer" << i );
+        options.cachePolicy() = CachePolicy::NO_CACHE;
+        map->addElevationLayer( new ElevationLayer(options, new ProceduralElevationSource(i, tileSize)) );
+    }
+    return map;
+}
+
+double
+benchmark(unsigned numLayers, unsigned tileSize, int iterations, unsigned& out_unresolved)
+{
+    osg::ref_ptr<Map> map = createMap( numLayers, tileSize );
+
+    ElevationLayerVector layers;
+    map->getElevationLayers( layers );
+
+    out_unresolved = 0;
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    for(int i=0; i<iterations; ++i)
+    {
+        TileKey key( 8, 200 + (i % 16), 100 + (i / 16) % 16, map->getProfile() );
+
+        osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
+        hf->allocate( tileSize, tileSize );
+        for(unsigned k=0; k<hf->getFloatArray()->size(); ++k)
+            (*hf->getFloatArray())[k] = NO_DATA_VALUE;
+
+        layers.populateHeightField( hf.get(), key, 0L, INTERP_BILINEAR, 0L );
+
+        for(unsigned k=0; k<hf->getFloatArray()->size(); ++k)
+            if ( (*hf->getFloatArray())[k] == NO_DATA_VALUE )
+                ++out_unresolved;
+    }
+
+    double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+    return 1000.0 * seconds / (double)iterations;
+}
+
+int
+populateBenchmark(int iterations)
+{
+    unsigned tileSizes[3] = { 17, 33, 257 };
+
+    OE_NOTICE << LC << "populateHeightField, " << iterations << " tiles per measurement (ms/tile):" << std::endl;
+    for(unsigned s=0; s<3; ++s)
+    {
+        for(unsigned numLayers=1; numLayers<=5; ++numLayers)
+        {
+            unsigned unresolved = 0;
+            double ms = benchmark( numLayers, tileSizes[s], iterations, unresolved );
+
+            OE_NOTICE << LC << "  size " << std::setw(3) << tileSizes[s]
+                << ", " << numLayers << " layer(s): " << std::setw(10) << ms << " ms" << std::endl;
+
+            // the bottom layer has full coverage, so every post must resolve.
+            if ( unresolved > 0 )
+            {
+                OE_NOTICE << "populateHeightField test: FAIL (" << unresolved << " unresolved posts)" << std::endl;
+                return -1;
+            }
+        }
+    }
+
+    OE_NOTICE << "populateHeightField test: PASS" << std::endl;
+    return 0;
+}
+
+/** Points scattered over a 2x2 degree area. */
+void
+makePoints(unsigned numPoints, std::vector<osg::Vec3d>& points)
+{
+    points.resize( numPoints );
+    unsigned seed = 12345u;
+    for(unsigned i=0; i<numPoints; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        double x = 10.0 + 2.0 * (double)(seed >> 8) / (double)(1u << 24);
+        seed = seed * 1664525u + 1013904223u;
+        double y = 45.0 + 2.0 * (double)(seed >> 8) / (double)(1u << 24);
+        points[i].set( x, y, 0.0 );
+    }
+}
+
+/**
+ * Compares point-by-point ElevationQuery::getElevation against the batched
+ * getElevations, serially and with a thread pool, and reports points/sec.
+ */
+int
+queryBenchmark(unsigned numPoints, unsigned numThreads)
+{
+    osg::ref_ptr<Map> map = createMap( 2, 33 );
+    const SpatialReference* srs = map->getProfile()->getSRS()->getGeographicSRS();
+
+    std::vector<osg::Vec3d> points;
+    makePoints( numPoints, points );
+
+    OE_NOTICE << LC << "ElevationQuery, " << numPoints << " points (points/sec):" << std::endl;
+
+    // one point at a time:
+    std::vector<double> reference( numPoints, 0.0 );
+    {
+        ElevationQuery eq( map.get() );
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for(unsigned i=0; i<numPoints; ++i)
+            eq.getElevation( GeoPoint(srs, points[i].x(), points[i].y(), 0.0, ALTMODE_ABSOLUTE), reference[i] );
+        double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+        OE_NOTICE << LC << "  per point:           " << std::setw(12) << (seconds > 0.0 ? numPoints/seconds : 0.0) << std::endl;
+    }
+
+    // batched, serially and then in parallel:
+    unsigned threadCounts[2] = { 0u, numThreads };
+    for(unsigned t=0; t<2; ++t)
+    {
+        ElevationQuery eq( map.get() );
+        eq.setNumBatchThreads( threadCounts[t] );
+
+        std::vector<double> elevations;
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        eq.getElevations( points, srs, elevations );
+        double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        OE_NOTICE << LC << "  batch, " << std::setw(2) << threadCounts[t] << " thread(s): "
+            << std::setw(12) << (seconds > 0.0 ? numPoints/seconds : 0.0) << std::endl;
+
+        unsigned mismatches = 0;
+        for(unsigned i=0; i<numPoints; ++i)
+            if ( fabs(elevations[i] - reference[i]) > 1e-3 )
+                ++mismatches;
+
+        if ( mismatches > 0 )
+        {
+            OE_NOTICE << "ElevationQuery test: FAIL (" << mismatches << " mismatches)" << std::endl;
+            return -1;
+        }
+    }
+
+    OE_NOTICE << "ElevationQuery test: PASS" << std::endl;
+    return 0;
+}
+
+/** Queries a shared ElevationQueryService, a point or a batch at a time. */
+struct ServiceThread : public OpenThreads::Thread
+{
+    ServiceThread(ElevationQueryService* service, const std::vector<osg::Vec3d>& points,
+                  const SpatialReference* srs, bool batch)
+        : _service(service), _points(points), _srs(srs), _batch(batch) { }
+
+    void run()
+    {
+        if ( _batch )
+        {
+            _service->getElevations( _points, _srs, _elevations );
+        }
+        else
+        {
+            _elevations.assign( _points.size(), 0.0 );
+            for(unsigned i=0; i<_points.size(); ++i)
+                _service->getElevation( GeoPoint(_srs, _points[i].x(), _points[i].y(), 0.0, ALTMODE_ABSOLUTE), _elevations[i] );
+        }
+    }
+
+    ElevationQueryService*         _service;
+    const std::vector<osg::Vec3d>& _points;
+    const SpatialReference*        _srs;
+    bool                           _batch;
+    std::vector<double>            _elevations;
+};
+
+/**
+ * Runs several threads against one shared ElevationQueryService, all of them
+ * querying the same points, and checks their results against ElevationQuery.
+ */
+int
+serviceBenchmark(unsigned numPoints, unsigned numThreads)
+{
+    osg::ref_ptr<Map> map = createMap( 2, 33 );
+    const SpatialReference* srs = map->getProfile()->getSRS()->getGeographicSRS();
+
+    std::vector<osg::Vec3d> points;
+    makePoints( numPoints, points );
+
+    std::vector<double> reference;
+    {
+        ElevationQuery eq( map.get() );
+        eq.getElevations( points, srs, reference );
+    }
+
+    OE_NOTICE << LC << "ElevationQueryService, " << numThreads << " threads x " << numPoints << " points:" << std::endl;
+
+    for(unsigned pass=0; pass<2; ++pass)
+    {
+        bool batch = (pass == 1);
+        osg::ref_ptr<ElevationQueryService> service = new ElevationQueryService( map.get() );
+
+        std::vector<ServiceThread*> threads;
+        for(unsigned t=0; t<numThreads; ++t)
+            threads.push_back( new ServiceThread(service.get(), points, srs, batch) );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for(unsigned t=0; t<threads.size(); ++t)
+            threads[t]->start();
+        for(unsigned t=0; t<threads.size(); ++t)
+            threads[t]->join();
+        double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        unsigned mismatches = 0;
+        for(unsigned t=0; t<threads.size(); ++t)
+        {
+            for(unsigned i=0; i<numPoints; ++i)
+                if ( fabs(threads[t]->_elevations[i] - reference[i]) > 1e-3 )
+                    ++mismatches;
+            delete threads[t];
+        }
+
+        ElevationQueryService::Stats stats = service->getStats();
+        OE_NOTICE << LC << "  " << (batch ? "batch:    " : "per point:")
+            << " points/sec=" << (seconds > 0.0 ? (numThreads*numPoints)/seconds : 0.0)
+            << ", hits=" << stats.hits
+            << ", misses=" << stats.misses
+            << ", shared misses=" << stats.sharedMisses
+            << ", hit ratio=" << stats.getHitRatio()
+            << ", avg query=" << stats.getAverageQueryTime()*1e6 << "us"
+            << ", max query=" << stats.maxTime*1e6 << "us"
+            << std::endl;
+
+        if ( mismatches > 0 )
+        {
+            OE_NOTICE << "ElevationQueryService test: FAIL (" << mismatches << " mismatches)" << std::endl;
+            return -1;
+        }
+    }
+
+    OE_NOTICE << "ElevationQueryService test: PASS" << std::endl;
+    return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    bool populate = arguments.read("--populate");
+    bool query    = arguments.read("--query");
+    bool service  = arguments.read("--service");
+    if ( !populate && !query && !service )
+        populate = query = service = true;
+
+    int iterations = 200, numPoints = 100000, numThreads = 4;
+    arguments.read("--iterations", iterations);
+    arguments.read("--points", numPoints);
+    arguments.read("--threads", numThreads);
+
+    if ( populate && populateBenchmark(osg::maximum(iterations, 1)) != 0 )
+        return -1;
+
+    if ( query && queryBenchmark(osg::maximum(numPoints, 1), osg::maximum(numThreads, 1)) != 0 )
+        return -1;
+
+    if ( service && serviceBenchmark(osg::maximum(numPoints, 1), osg::maximum(numThreads, 1)) != 0 )
+        return -1;
+
+    OE_NOTICE << "All tests passed." << std::endl;
+    return 0;
+}
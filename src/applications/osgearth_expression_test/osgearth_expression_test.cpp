@@ -0,0 +1,253 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osgEarthFeatures/Feature>
+#include <osgEarthFeatures/CompiledExpression>
+#include <osgEarthSymbology/Geometry>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <vector>
+#include <iomanip>
+
+#define LC "[expression_test] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_expression_test\n"
+        << "    [--features <num>]      : number of features to evaluate (default 1000000)\n"
+        << "    [--batch <num>]         : features in memory at once (default 100000)\n"
+        << "    [--threads <num>]       : threads sharing one compiled expression (default 4)\n"
+        << "    [--numeric <expr>]      : numeric expression (default \"[HEIGHT] * 1.5 + max([FLOORS] * 3, 10)\")\n"
+        << "    [--string <expr>]       : string expression (default \"\\\"style_\\\" + [TYPE]\")\n"
+        << std::endl;
+    return -1;
+}
+
+/**
+ * Makes a batch of point features with the attributes of a typical
+ * buildings shapefile, in the same order as the schema.
+ */
+void
+makeFeatures(unsigned first, unsigned count, FeatureList& out)
+{
+    static const char* types[] = { "residential", "commercial", "industrial", "school", "church", "hospital", "office", "garage" };
+    const SpatialReference* srs = Registry::instance()->getGlobalGeodeticProfile()->getSRS();
+
+    out.clear();
+    for(unsigned i=first; i<first+count; ++i)
+    {
+        PointSet* point = new PointSet();
+        point->push_back( osg::Vec3d(-180.0 + (i % 3600)*0.1, -90.0 + (i/3600 % 1800)*0.1, 0.0) );
+
+        Feature* feature = new Feature( point, srs, Style(), i );
+        feature->set( "NAME",   Stringify() << "building " << i );
+        feature->set( "TYPE",   std::string(types[i % 8]) );
+        feature->set( "HEIGHT", 3.0 + (double)(i % 97) );
+        feature->set( "FLOORS", (int)(1 + i % 30) );
+        feature->set( "AREA",   50.0 + (double)(i % 1000) );
+        out.push_back( feature );
+    }
+}
+
+struct Checksum
+{
+    Checksum() : _sum(0.0), _hash(0u) { }
+
+    void add(double value) { _sum += value; }
+
+    void add(const std::string& value)
+    {
+        unsigned h = 2166136261u; // FNV-1a
+        for(unsigned i=0; i<value.length(); ++i)
+            h = (h ^ (unsigned char)value[i]) * 16777619u;
+        _hash += h;
+    }
+
+    void add(const Checksum& rhs) { _sum += rhs._sum; _hash += rhs._hash; }
+
+    double   _sum;
+    unsigned _hash;
+};
+
+/** Evaluates a range of features with the shared compiled expressions. */
+struct EvalThread : public OpenThreads::Thread
+{
+    EvalThread(const CompiledNumericExpression& numeric, const CompiledStringExpression& str,
+               std::vector<const Feature*>& features, unsigned first, unsigned last)
+        : _numeric(numeric), _string(str), _features(features), _first(first), _last(last) { }
+
+    void run()
+    {
+        std::string value;
+        for(unsigned i=_first; i<_last; ++i)
+        {
+            _checksum.add( _numeric.eval(_features[i]) );
+            _string.eval( _features[i], 0L, value );
+            _checksum.add( value );
+        }
+    }
+
+    const CompiledNumericExpression& _numeric;
+    const CompiledStringExpression&  _string;
+    std::vector<const Feature*>&     _features;
+    unsigned                         _first, _last;
+    Checksum                         _checksum;
+};
+
+/**
+ * Compares evaluating feature expressions with Feature::eval, which looks
+ * every variable up by name and sets it on the expression, against
+ * expressions compiled once for the feature schema, on one and on several
+ * threads.
+ */
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    int numFeatures = 1000000, batchSize = 100000, numThreads = 4;
+    std::string numericExpr = "[HEIGHT] * 1.5 + max([FLOORS] * 3, 10)";
+    std::string stringExpr  = "\"style_\" + [TYPE]";
+    arguments.read("--features", numFeatures);
+    arguments.read("--batch", batchSize);
+    arguments.read("--threads", numThreads);
+    arguments.read("--numeric", numericExpr);
+    arguments.read("--string", stringExpr);
+
+    if ( numFeatures < 1 || batchSize < 1 || numThreads < 1 )
+        return usage( argv[0] );
+
+    FeatureSchema schema;
+    schema["NAME"]   = ATTRTYPE_STRING;
+    schema["TYPE"]   = ATTRTYPE_STRING;
+    schema["HEIGHT"] = ATTRTYPE_DOUBLE;
+    schema["FLOORS"] = ATTRTYPE_INT;
+    schema["AREA"]   = ATTRTYPE_DOUBLE;
+
+    NumericExpression numeric( numericExpr );
+    StringExpression  str( stringExpr );
+
+    CompiledNumericExpression compiledNumeric( numeric, schema );
+    CompiledStringExpression  compiledString( str, schema );
+
+    OE_NOTICE << LC << numFeatures << " features, numeric expression: " << numericExpr
+        << ", string expression: " << stringExpr << std::endl;
+
+    // seconds[0]: Feature::eval; [1]: compiled; [2]: compiled, multiple threads
+    double seconds[3] = { 0.0, 0.0, 0.0 };
+    Checksum checksums[3];
+
+    FeatureList batch;
+    std::vector<const Feature*> features;
+
+    for(unsigned first=0; first<(unsigned)numFeatures; first += (unsigned)batchSize)
+    {
+        unsigned count = osg::minimum( (unsigned)batchSize, (unsigned)numFeatures - first );
+        makeFeatures( first, count, batch );
+
+        features.clear();
+        for(FeatureList::const_iterator i = batch.begin(); i != batch.end(); ++i)
+            features.push_back( i->get() );
+
+        // by name, the way FeatureModelGraph used to (one expression copy per pass):
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        {
+            NumericExpression numericCopy( numeric );
+            StringExpression  strCopy( str );
+            for(unsigned i=0; i<features.size(); ++i)
+            {
+                checksums[0].add( features[i]->eval(numericCopy) );
+                checksums[0].add( features[i]->eval(strCopy) );
+            }
+        }
+        seconds[0] += osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        // compiled:
+        start = osg::Timer::instance()->tick();
+        {
+            std::string value;
+            for(unsigned i=0; i<features.size(); ++i)
+            {
+                checksums[1].add( compiledNumeric.eval(features[i]) );
+                compiledString.eval( features[i], 0L, value );
+                checksums[1].add( value );
+            }
+        }
+        seconds[1] += osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        // compiled, sharing the expressions across threads:
+        std::vector<EvalThread*> threads;
+        unsigned perThread = (count + numThreads - 1) / numThreads;
+        for(unsigned t=0; t<(unsigned)numThreads; ++t)
+        {
+            unsigned a = osg::minimum(t*perThread, count), b = osg::minimum(a+perThread, count);
+            threads.push_back( new EvalThread(compiledNumeric, compiledString, features, a, b) );
+        }
+
+        start = osg::Timer::instance()->tick();
+        for(unsigned t=0; t<threads.size(); ++t)
+            threads[t]->start();
+        for(unsigned t=0; t<threads.size(); ++t)
+            threads[t]->join();
+        seconds[2] += osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        for(unsigned t=0; t<threads.size(); ++t)
+        {
+            checksums[2].add( threads[t]->_checksum );
+            delete threads[t];
+        }
+    }
+
+    const char* names[3] = { "Feature::eval", "compiled", "compiled, MT" };
+    OE_NOTICE << LC << std::setw(16) << "" << std::setw(16) << "features/sec" << std::setw(10) << "speedup" << std::endl;
+    for(unsigned m=0; m<3; ++m)
+    {
+        double rate = seconds[m] > 0.0 ? (double)numFeatures/seconds[m] : 0.0;
+        OE_NOTICE << LC << std::setw(16) << names[m]
+            << std::setw(16) << std::fixed << std::setprecision(0) << rate
+            << std::setw(10) << std::setprecision(2) << (seconds[m] > 0.0 ? seconds[0]/seconds[m] : 0.0)
+            << std::endl;
+    }
+
+    // the sums can differ in the last bits when the threads add them up in another order.
+    bool numericOK = checksums[1]._sum == checksums[0]._sum &&
+        osg::absolute(checksums[2]._sum - checksums[0]._sum) <= 1e-9 * osg::absolute(checksums[0]._sum);
+
+    if ( !numericOK || checksums[1]._hash != checksums[0]._hash || checksums[2]._hash != checksums[0]._hash )
+    {
+        OE_NOTICE << "Expression test: FAIL (results differ)" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << "Expression test: PASS" << std::endl;
+    return 0;
+}
@@ -0,0 +1,346 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/Map>
+#include <osgEarth/Registry>
+#include <osgEarth/TileKey>
+#include <osgEarthFeatures/CropFilter>
+#include <osgEarthFeatures/Feature>
+#include <osgEarthFeatures/FeatureCursor>
+#include <osgEarthFeatures/FeatureListSource>
+#include <osgEarthFeatures/GeometryCompiler>
+#include <osgEarthFeatures/Session>
+#include <osgEarthSymbology/Geometry>
+#include <osgEarthSymbology/Query>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <vector>
+#include <iomanip>
+
+#define LC "[featurelist_test] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_featurelist_test\n"
+        << "    [--features <num>]      : features in the source (default: 100000, then 1000000)\n"
+        << "    [--level <num>]         : level of the tiles to query (default 7)\n"
+        << "    [--tiles <num>]         : tiles to query through the index (default 200)\n"
+        << "    [--baseline-tiles <num>]: tiles to query copying every feature (default 5)\n"
+        << std::endl;
+    return -1;
+}
+
+/** Short road-like line strings scattered over the globe, with two attributes. */
+FeatureListSource*
+makeSource(unsigned count)
+{
+    const SpatialReference* srs = SpatialReference::create("wgs84");
+    FeatureListSource* source = new FeatureListSource( GeoExtent(srs, -180.0, -90.0, 180.0, 90.0) );
+
+    unsigned seed = 12345u;
+    for(unsigned i=0; i<count; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        double x = -179.0 + 358.0 * (double)(seed >> 8) / (double)(1u << 24);
+        seed = seed * 1664525u + 1013904223u;
+        double y = -89.0 + 178.0 * (double)(seed >> 8) / (double)(1u << 24);
+
+        LineString* line = new LineString();
+        line->push_back( osg::Vec3d(x,      y,      0.0) );
+        line->push_back( osg::Vec3d(x+0.05, y+0.02, 0.0) );
+        line->push_back( osg::Vec3d(x+0.09, y-0.03, 0.0) );
+
+        Feature* feature = new Feature( line, srs, Style(), i );
+        feature->set( "name", std::string("road") );
+        feature->set( "height", (double)(i % 50) );
+        source->insertFeature( feature );
+    }
+    return source;
+}
+
+struct Result
+{
+    double   _seconds;
+    unsigned _tiles, _features, _geometryCopies, _pointCopies;
+};
+
+/**
+ * Runs the features of a cursor through a filter chain like a feature model
+ * tile would: changes the attributes and geometry of one feature in ten,
+ * crops the features to the tile and compiles them into line geometry.
+ * Counts the features and geometries that had to be copied from the source
+ * along the way.
+ */
+void
+process(FeatureCursor* cursor, Session* session, const GeoExtent& extent,
+        const std::vector<const Geometry*>& sourceGeoms, Result& out)
+{
+    FeatureList features;
+    cursor->fill( features );
+
+    unsigned i = 0;
+    for(FeatureList::iterator f = features.begin(); f != features.end(); ++f)
+    {
+        Feature* feature = f->get();
+        if ( (i++ % 10) == 0 )
+        {
+            double height = feature->getDouble("height");
+            feature->set( "height", height * 3.0 );
+            GeometryIterator gi( feature->getGeometry() );
+            while( gi.hasMore() )
+            {
+                Geometry* part = gi.next();
+                for(Geometry::iterator p = part->begin(); p != part->end(); ++p)
+                    p->z() = height * 3.0;
+            }
+        }
+    }
+
+    osg::ref_ptr<FeatureProfile> profile = new FeatureProfile( extent );
+    FilterContext context( session, profile.get(), extent );
+
+    CropFilter crop( CropFilter::METHOD_CENTROID );
+    context = crop.push( features, context );
+
+    Style style;
+    style.getOrCreate<LineSymbol>()->stroke()->color() = Color::Yellow;
+    GeometryCompilerOptions options;
+    options.shaderPolicy() = SHADERPOLICY_DISABLE;
+    GeometryCompiler compiler( options );
+    osg::ref_ptr<osg::Node> node = compiler.compile( features, style, context );
+
+    // a clone shares the source geometry until it changes it.
+    for(FeatureList::const_iterator f = features.begin(); f != features.end(); ++f)
+    {
+        const Feature* feature = f->get();
+        const Geometry* geom = feature->readGeometry();
+        out._features++;
+        if ( geom && (feature->getFID() >= sourceGeoms.size() || geom != sourceGeoms[feature->getFID()]) )
+        {
+            out._geometryCopies++;
+            out._pointCopies += geom->size();
+        }
+    }
+}
+
+/** Queries tiles at one level, scattered over the globe. */
+void
+queryTiles(FeatureListSource* source, Session* session, bool baseline, unsigned level, unsigned numTiles,
+           const std::vector<const Geometry*>& sourceGeoms, Result& out)
+{
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    unsigned wide, high;
+    profile->getNumTiles( level, wide, high );
+
+    out._seconds = 0.0;
+    out._tiles = out._features = out._geometryCopies = out._pointCopies = 0;
+
+    unsigned seed = 54321u;
+    for(unsigned t=0; t<numTiles; ++t)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        unsigned x = (seed >> 8) % wide;
+        seed = seed * 1664525u + 1013904223u;
+        unsigned y = (seed >> 8) % high;
+
+        TileKey key( level, x, y, profile );
+        Query query;
+        query.bounds() = key.getExtent().bounds();
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        // the baseline copies every feature, like the source did without an index.
+        osg::ref_ptr<FeatureCursor> cursor = baseline ?
+            new FeatureListCursor( source->getFeatures(), true ) :
+            source->createFeatureCursor( query );
+        process( cursor.get(), session, key.getExtent(), sourceGeoms, out );
+
+        out._seconds += osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+        out._tiles++;
+    }
+}
+
+/** Counts the features whose extent intersects a tile, by testing all of them. */
+unsigned
+countIntersecting(FeatureListSource* source, const TileKey& key)
+{
+    Bounds tile = key.getExtent().bounds();
+    unsigned count = 0;
+    const FeatureList& features = source->getFeatures();
+    for(FeatureList::const_iterator i = features.begin(); i != features.end(); ++i)
+    {
+        Bounds b = i->get()->readGeometry()->getBounds();
+        if ( b.xMin() <= tile.xMax() && b.xMax() >= tile.xMin() && b.yMin() <= tile.yMax() && b.yMax() >= tile.yMin() )
+            ++count;
+    }
+    return count;
+}
+
+void
+print(const std::string& name, const Result& r)
+{
+    double tiles = (double)osg::maximum(r._tiles, 1u);
+    OE_NOTICE << LC << std::setw(10) << std::left << name << std::right
+        << std::setw(12) << std::fixed << std::setprecision(3) << 1000.0*r._seconds/tiles
+        << std::setw(12) << std::setprecision(0) << (double)r._features/tiles
+        << std::setw(14) << (double)r._geometryCopies/tiles
+        << std::setw(14) << (double)r._pointCopies*sizeof(osg::Vec3d)/1024.0/tiles
+        << std::endl;
+}
+
+/**
+ * Runs the benchmark for one number of features, and checks that the index
+ * finds exactly the intersecting features and that changes to the clones
+ * never reach the source.
+ */
+bool
+run(unsigned numFeatures, unsigned level, unsigned numTiles, unsigned baselineTiles)
+{
+    osg::ref_ptr<FeatureListSource> source = makeSource( numFeatures );
+
+    // remember the source geometries, by FID, to detect copies.
+    std::vector<const Geometry*> sourceGeoms( numFeatures, (const Geometry*)0L );
+    const FeatureList& features = source->getFeatures();
+    for(FeatureList::const_iterator i = features.begin(); i != features.end(); ++i)
+    {
+        const Feature* f = i->get();
+        if ( f->getFID() < numFeatures )
+            sourceGeoms[f->getFID()] = f->readGeometry();
+    }
+
+    // the first query builds the index.
+    Query everything;
+    everything.bounds() = Bounds(-180.0, -90.0, 180.0, 90.0);
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    osg::ref_ptr<FeatureCursor> first = source->createFeatureCursor( everything );
+    double buildSeconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+    first = 0L;
+
+    OE_NOTICE << LC << numFeatures << " features, tiles at level " << level
+        << ", index built in " << std::fixed << std::setprecision(3) << buildSeconds << " s" << std::endl;
+
+    OE_NOTICE << LC << std::setw(10) << std::left << "" << std::right
+        << std::setw(12) << "ms/tile" << std::setw(12) << "features"
+        << std::setw(14) << "geom copies" << std::setw(14) << "KB copied" << std::endl;
+
+    // a geocentric map to compile the tiles against.
+    osg::ref_ptr<Map> map = new Map();
+    osg::ref_ptr<Session> session = new Session( map.get() );
+
+    Result baseline, indexed;
+    queryTiles( source.get(), session.get(), true,  level, baselineTiles, sourceGeoms, baseline );
+    print( "copy all", baseline );
+    queryTiles( source.get(), session.get(), false, level, numTiles, sourceGeoms, indexed );
+    print( "indexed", indexed );
+
+    double baselineMs = 1000.0*baseline._seconds/(double)osg::maximum(baseline._tiles, 1u);
+    double indexedMs  = 1000.0*indexed._seconds/(double)osg::maximum(indexed._tiles, 1u);
+    OE_NOTICE << LC << "speedup: " << std::setprecision(1) << (indexedMs > 0.0 ? baselineMs/indexedMs : 0.0) << "x" << std::endl;
+
+    bool ok = true;
+
+    // the index must return exactly the features whose extent intersects the tile.
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    unsigned wide, high;
+    profile->getNumTiles( level, wide, high );
+    for(unsigned x=0; x<4 && ok; ++x)
+    {
+        TileKey key( level, (x*13u) % wide, (x*7u) % high, profile );
+        Query query;
+        query.bounds() = key.getExtent().bounds();
+
+        FeatureList found;
+        osg::ref_ptr<FeatureCursor> cursor = source->createFeatureCursor( query );
+        cursor->fill( found );
+        if ( found.size() != countIntersecting(source.get(), key) )
+        {
+            OE_NOTICE << LC << "Wrong number of features in tile " << key.str() << std::endl;
+            ok = false;
+        }
+    }
+
+    // changing the clones must not change the source.
+    for(FeatureList::const_iterator i = features.begin(); i != features.end() && ok; ++i)
+    {
+        const Feature* f = i->get();
+        if ( f->readGeometry() != sourceGeoms[f->getFID()] ||
+             (*f->readGeometry())[0].z() != 0.0 ||
+             f->getDouble("height") != (double)(f->getFID() % 50) )
+        {
+            OE_NOTICE << LC << "Source feature " << f->getFID() << " was modified" << std::endl;
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Compares the latency of tile queries on an in-memory feature source, run
+ * through a crop and compile filter chain, and the features and geometry
+ * they copy, when every query copies every feature versus when the source
+ * looks them up in its spatial index and returns copy-on-write clones.
+ */
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    int numFeatures = 0, level = 7, numTiles = 200, baselineTiles = 5;
+    arguments.read("--features", numFeatures);
+    arguments.read("--level", level);
+    arguments.read("--tiles", numTiles);
+    arguments.read("--baseline-tiles", baselineTiles);
+
+    if ( numFeatures < 0 || level < 0 || numTiles < 1 || baselineTiles < 1 )
+        return usage( argv[0] );
+
+    std::vector<unsigned> sizes;
+    if ( numFeatures > 0 )
+    {
+        sizes.push_back( (unsigned)numFeatures );
+    }
+    else
+    {
+        sizes.push_back( 100000u );
+        sizes.push_back( 1000000u );
+    }
+
+    for(unsigned i=0; i<sizes.size(); ++i)
+    {
+        if ( !run(sizes[i], (unsigned)level, (unsigned)numTiles, (unsigned)baselineTiles) )
+        {
+            OE_NOTICE << "Feature list test: FAIL" << std::endl;
+            return -1;
+        }
+    }
+
+    OE_NOTICE << "Feature list test: PASS" << std::endl;
+    return 0;
+}
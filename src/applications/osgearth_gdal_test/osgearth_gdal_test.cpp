@@ -0,0 +1,285 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/TileSource>
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osgEarthDrivers/gdal/GDALOptions>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+#include <vector>
+#include <cstring>
+#include <iomanip>
+
+#define LC "[gdal_test] "
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_gdal_test <file>\n"
+        << "    [--elevation]           : read heightfields instead of images\n"
+        << "    [--threads <num>]       : highest thread count to measure (default 8)\n"
+        << "    [--handles <num>]       : dataset handles for the pooled run (default: --threads)\n"
+        << "    [--level <num>]         : level of the tiles to read (default: the data's max level)\n"
+        << "    [--tiles <num>]         : maximum number of tiles to read per run (default 256)\n"
+        << "    [--interp]              : instead, compare windowed and per-pixel bilinear\n"
+        << "                              sampling of imagery (interp_imagery)\n"
+        << std::endl;
+    return -1;
+}
+
+/**
+ * Reads tiles from a shared list until it runs out.
+ */
+struct ReadThread : public OpenThreads::Thread
+{
+    ReadThread(TileSource* source, const std::vector<TileKey>& keys, bool elevation,
+               OpenThreads::Atomic& next, OpenThreads::Atomic& failures)
+        : _source(source), _keys(keys), _elevation(elevation), _next(next), _failures(failures) { }
+
+    void run()
+    {
+        for( ; ; )
+        {
+            unsigned i = (++_next) - 1;
+            if ( i >= _keys.size() )
+                break;
+
+            bool ok;
+            if ( _elevation )
+            {
+                osg::ref_ptr<osg::HeightField> hf = _source->createHeightField( _keys[i] );
+                ok = hf.valid();
+            }
+            else
+            {
+                osg::ref_ptr<osg::Image> image = _source->createImage( _keys[i] );
+                ok = image.valid();
+            }
+
+            if ( !ok )
+                ++_failures;
+        }
+    }
+
+    TileSource*                 _source;
+    const std::vector<TileKey>& _keys;
+    bool                        _elevation;
+    OpenThreads::Atomic&        _next;
+    OpenThreads::Atomic&        _failures;
+};
+
+/** Reads all the keys with the given number of threads, and returns tiles/sec. */
+double
+readTiles(TileSource* source, const std::vector<TileKey>& keys, bool elevation, unsigned numThreads, unsigned& out_failures)
+{
+    OpenThreads::Atomic next( 0 ), failures( 0 );
+
+    std::vector<ReadThread*> threads;
+    for(unsigned t=0; t<numThreads; ++t)
+        threads.push_back( new ReadThread(source, keys, elevation, next, failures) );
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for(unsigned t=0; t<threads.size(); ++t)
+        threads[t]->start();
+    for(unsigned t=0; t<threads.size(); ++t)
+        threads[t]->join();
+    double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+    for(unsigned t=0; t<threads.size(); ++t)
+        delete threads[t];
+
+    out_failures = failures;
+    return seconds > 0.0 ? (double)keys.size()/seconds : 0.0;
+}
+
+/** Collects up to maxTiles keys covering the source's data at the given level (<0 for its max level). */
+bool
+collectKeys(TileSource* source, int& level, int maxTiles, std::vector<TileKey>& keys)
+{
+    const DataExtentList& extents = source->getDataExtents();
+    if ( extents.empty() )
+    {
+        OE_NOTICE << "Source reports no data extents" << std::endl;
+        return false;
+    }
+
+    if ( level < 0 )
+        level = (int)extents.front().maxLevel().value();
+
+    source->getProfile()->getIntersectingTiles( extents.front(), (unsigned)level, keys );
+    if ( (int)keys.size() > maxTiles )
+        keys.resize( maxTiles );
+
+    OE_NOTICE << LC << keys.size() << " tiles at level " << level << std::endl;
+    return true;
+}
+
+/**
+ * Reads the same tiles with interpolated imagery sampling, once sampling each
+ * pixel with its own reads and once from a window read per tile, and checks
+ * that both give the same images.
+ */
+int
+interpBenchmark(const std::string& file, int level, int maxTiles)
+{
+    OE_NOTICE << LC << file << ", bilinear imagery sampling (tiles/sec):" << std::endl;
+
+    std::vector<TileKey> keys;
+    std::vector< osg::ref_ptr<osg::Image> > images[2];
+
+    for(unsigned mode=0; mode<2; ++mode)
+    {
+        GDALOptions options;
+        options.url() = file;
+        options.L2CacheSize() = 0;
+        options.interpolateImagery() = true;
+        options.interpolation() = INTERP_BILINEAR;
+        options.windowedSampling() = (mode == 1);
+
+        osg::ref_ptr<TileSource> source = TileSourceFactory::create( options );
+        if ( !source.valid() || source->open().isError() )
+        {
+            OE_NOTICE << "Failed to open " << file << std::endl;
+            return -1;
+        }
+
+        if ( keys.empty() && !collectKeys(source.get(), level, maxTiles, keys) )
+            return -1;
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for(unsigned i=0; i<keys.size(); ++i)
+            images[mode].push_back( source->createImage(keys[i]) );
+        double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        OE_NOTICE << LC << "  " << (mode == 1 ? "windowed: " : "per pixel:") << std::setw(12)
+            << (seconds > 0.0 ? keys.size()/seconds : 0.0) << std::endl;
+    }
+
+    unsigned mismatches = 0;
+    for(unsigned i=0; i<keys.size(); ++i)
+    {
+        osg::Image* a = images[0][i].get();
+        osg::Image* b = images[1][i].get();
+        if ( (a == 0L) != (b == 0L) )
+            ++mismatches;
+        else if ( a && (a->getImageSizeInBytes() != b->getImageSizeInBytes() ||
+                        memcmp(a->data(), b->data(), a->getImageSizeInBytes()) != 0) )
+            ++mismatches;
+    }
+
+    if ( mismatches > 0 )
+    {
+        OE_NOTICE << "Interpolation test: FAIL (" << mismatches << " tiles differ)" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << "Interpolation test: PASS" << std::endl;
+    return 0;
+}
+
+/**
+ * Measures how tile reads from a GDAL source scale with the number of
+ * threads, with the shared dataset handle (global GDAL lock) and with a pool
+ * of per-thread handles.
+ */
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") || argc < 2 )
+        return usage( argv[0] );
+
+    bool elevation = arguments.read("--elevation");
+    bool interp    = arguments.read("--interp");
+
+    int maxThreads = 8, maxTiles = 256, level = -1;
+    arguments.read("--threads", maxThreads);
+    arguments.read("--tiles", maxTiles);
+    arguments.read("--level", level);
+    maxThreads = osg::maximum(maxThreads, 1);
+
+    int numHandles = maxThreads;
+    arguments.read("--handles", numHandles);
+
+    if ( arguments.argc() < 2 )
+        return usage( argv[0] );
+
+    std::string file = arguments[1];
+
+    if ( interp )
+        return interpBenchmark( file, level, maxTiles );
+
+    OE_NOTICE << LC << file << ", reading " << (elevation ? "heightfields" : "images") << " (tiles/sec):" << std::endl;
+    OE_NOTICE << LC << std::setw(8) << "threads" << std::setw(16) << "shared handle"
+        << std::setw(16) << (Stringify() << numHandles << " handles") << std::endl;
+
+    // results[mode][threads]
+    std::vector<double> results[2];
+    std::vector<TileKey> keys;
+
+    for(unsigned mode=0; mode<2; ++mode)
+    {
+        GDALOptions options;
+        options.url() = file;
+        options.L2CacheSize() = 0; // measure reads, not the memory cache
+        if ( mode == 1 )
+            options.maxDatasetHandles() = (unsigned)osg::maximum(numHandles, 1);
+
+        osg::ref_ptr<TileSource> source = TileSourceFactory::create( options );
+        if ( !source.valid() || source->open().isError() )
+        {
+            OE_NOTICE << "Failed to open " << file << std::endl;
+            return -1;
+        }
+
+        if ( keys.empty() && !collectKeys(source.get(), level, maxTiles, keys) )
+            return -1;
+
+        // warm up the OS and GDAL caches, so each run measures the same thing.
+        unsigned failures;
+        readTiles( source.get(), keys, elevation, 1u, failures );
+
+        for(int t=1; t<=maxThreads; t *= 2)
+        {
+            results[mode].push_back( readTiles(source.get(), keys, elevation, (unsigned)t, failures) );
+            if ( failures > 0 )
+                OE_NOTICE << LC << failures << " tiles failed to read" << std::endl;
+        }
+    }
+
+    unsigned i = 0;
+    for(int t=1; t<=maxThreads; t *= 2, ++i)
+    {
+        OE_NOTICE << LC << std::setw(8) << t
+            << std::setw(16) << std::fixed << std::setprecision(1) << results[0][i]
+            << std::setw(16) << results[1][i]
+            << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,274 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/ImageLayer>
+#include <osgEarth/CompositeTileSource>
+#include <osgEarth/TileSource>
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <vector>
+#include <cstring>
+#include <iomanip>
+
+#define LC "[mosaic_test] "
+
+using namespace osgEarth;
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_mosaic_test\n"
+        << "    [--latency <ms>]        : simulated round-trip time per source tile (default 50)\n"
+        << "    [--fail-every <num>]    : every Nth source tile has no data, so the layer\n"
+        << "                              falls back on its parent (default 0, never)\n"
+        << "    [--threads <num>]       : threads for the parallel run (default 4)\n"
+        << "    [--level <num>]         : level of the tiles to request (default 3)\n"
+        << "    [--tiles <num>]         : maximum number of tiles to request (default 16)\n"
+        << "    [--composite <num>]     : instead, request tiles from a composite of this many\n"
+        << "                              layers, one layer at a time and concurrently\n"
+        << std::endl;
+    return -1;
+}
+
+/**
+ * Stands in for a remote (HTTP) tile service: a global-geodetic source whose
+ * every tile costs a fixed delay, and optionally some tiles have no data.
+ */
+class LatencyTileSource : public TileSource
+{
+public:
+    LatencyTileSource(const TileSourceOptions& options) : TileSource(options)
+    {
+        _latency   = options.getConfig().value<unsigned>("latency", 50u);
+        _failEvery = options.getConfig().value<unsigned>("fail_every", 0u);
+    }
+
+    Status initialize(const osgDB::Options* options)
+    {
+        setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+        return STATUS_OK;
+    }
+
+    osg::Image* createImage(const TileKey& key, ProgressCallback* progress)
+    {
+        OpenThreads::Thread::microSleep( _latency * 1000u );
+
+        unsigned x, y;
+        key.getTileXY( x, y );
+        unsigned hash = x*7u + y*13u + key.getLevelOfDetail()*31u;
+
+        if ( _failEvery > 0 && key.getLevelOfDetail() > 0 && (hash % _failEvery) == 0 )
+            return 0L;
+
+        osg::Image* image = new osg::Image();
+        image->allocateImage( 256, 256, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+        unsigned char* p = image->data();
+        for(unsigned i=0; i<256*256; ++i, p += 4)
+        {
+            p[0] = (unsigned char)(hash * 17u);
+            p[1] = (unsigned char)(i >> 8);
+            p[2] = (unsigned char)(i & 0xff);
+            p[3] = 255;
+        }
+        return image;
+    }
+
+    CachePolicy getCachePolicyHint(const Profile*) const
+    {
+        return CachePolicy::NO_CACHE;
+    }
+
+private:
+    unsigned _latency, _failEvery;
+};
+
+class LatencyTileSourceDriver : public TileSourceDriver
+{
+public:
+    LatencyTileSourceDriver()
+    {
+        supportsExtension( "osgearth_latency", "Simulated remote tile service" );
+    }
+
+    virtual const char* className()
+    {
+        return "Latency Test Driver";
+    }
+
+    virtual ReadResult readObject(const std::string& file_name, const Options* options) const
+    {
+        if ( !acceptsExtension(osgDB::getLowerCaseFileExtension( file_name )))
+            return ReadResult::FILE_NOT_HANDLED;
+
+        return new LatencyTileSource( getTileSourceOptions(options) );
+    }
+};
+
+REGISTER_OSGPLUGIN(osgearth_latency, LatencyTileSourceDriver)
+
+
+/** Requests each key from a fresh layer, and returns the mean time-to-tile in ms. */
+double
+requestTiles(const TileSourceOptions& driver, unsigned assemblyThreads, const std::vector<TileKey>& keys,
+             std::vector< osg::ref_ptr<osg::Image> >& out_images)
+{
+    ImageLayerOptions options( "latency", driver );
+    options.assemblyThreads() = assemblyThreads;
+    osg::ref_ptr<ImageLayer> layer = new ImageLayer( options );
+
+    out_images.clear();
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for(unsigned i=0; i<keys.size(); ++i)
+    {
+        GeoImage image = layer->createImage( keys[i] );
+        out_images.push_back( image.getImage() );
+    }
+    double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+    return keys.size() > 0 ? ms/(double)keys.size() : 0.0;
+}
+
+/** Requests each key from a composite of numLayers layers, and returns the mean time-to-tile in ms. */
+double
+requestCompositeTiles(const TileSourceOptions& driver, unsigned numLayers, unsigned layerThreads,
+                      const std::vector<TileKey>& keys, std::vector< osg::ref_ptr<osg::Image> >& out_images)
+{
+    CompositeTileSourceOptions options;
+    options.L2CacheSize() = 0;
+    options.layerThreads() = layerThreads;
+    for(unsigned i=0; i<numLayers; ++i)
+    {
+        ImageLayerOptions layer( Stringify() << "latency" << i, driver );
+        layer.opacity() = 0.5f;
+        options.add( layer );
+    }
+
+    osg::ref_ptr<TileSource> source = TileSourceFactory::create( options );
+    if ( !source.valid() || source->open().isError() )
+    {
+        OE_NOTICE << "Failed to open the composite" << std::endl;
+        return 0.0;
+    }
+
+    out_images.clear();
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for(unsigned i=0; i<keys.size(); ++i)
+    {
+        out_images.push_back( source->createImage(keys[i]) );
+    }
+    double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+    return keys.size() > 0 ? ms/(double)keys.size() : 0.0;
+}
+
+/**
+ * Measures the time to assemble mercator tiles from a high-latency geodetic
+ * source, fetching the source tiles one at a time and in parallel; or the
+ * time to composite several such layers, one layer at a time and concurrently.
+ */
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    int latency = 50, failEvery = 0, threads = 4, level = 3, maxTiles = 16, composite = 0;
+    arguments.read("--latency", latency);
+    arguments.read("--fail-every", failEvery);
+    arguments.read("--threads", threads);
+    arguments.read("--level", level);
+    arguments.read("--tiles", maxTiles);
+    arguments.read("--composite", composite);
+
+    if ( latency < 0 || failEvery < 0 || threads < 1 || level < 0 || maxTiles < 1 || composite < 0 )
+        return usage( argv[0] );
+
+    Config conf;
+    conf.set( "driver", "latency" );
+    conf.set( "latency", latency );
+    conf.set( "fail_every", failEvery );
+    TileSourceOptions driver( conf );
+
+    // a composite is in the profile of its layers; a plain layer is assembled into mercator tiles.
+    const Profile* profile = composite > 0 ?
+        Registry::instance()->getGlobalGeodeticProfile() :
+        Registry::instance()->getSphericalMercatorProfile();
+
+    std::vector<TileKey> keys;
+    profile->getAllKeysAtLOD( (unsigned)level, keys );
+    if ( (int)keys.size() > maxTiles )
+        keys.resize( maxTiles );
+
+    std::vector< osg::ref_ptr<osg::Image> > sequential, parallel;
+    double seqTime, parTime;
+
+    if ( composite > 0 )
+    {
+        OE_NOTICE << LC << keys.size() << " geodetic tiles at level " << level << " from a composite of "
+            << composite << " layers with " << latency << " ms latency" << std::endl;
+
+        seqTime = requestCompositeTiles( driver, (unsigned)composite, 1u, keys, sequential );
+        parTime = requestCompositeTiles( driver, (unsigned)composite, (unsigned)threads, keys, parallel );
+    }
+    else
+    {
+        OE_NOTICE << LC << keys.size() << " mercator tiles at level " << level
+            << " from a geodetic source with " << latency << " ms latency" << std::endl;
+
+        seqTime = requestTiles( driver, 1u, keys, sequential );
+        parTime = requestTiles( driver, (unsigned)threads, keys, parallel );
+    }
+
+    OE_NOTICE << LC << "mean time to tile (ms):" << std::endl
+        << LC << "  sequential:      " << std::fixed << std::setprecision(1) << std::setw(10) << seqTime << std::endl
+        << LC << "  " << std::setw(2) << threads << " threads:      " << std::setw(10) << parTime
+        << " (" << std::setprecision(2) << (parTime > 0.0 ? seqTime/parTime : 0.0) << "x)" << std::endl;
+
+    unsigned mismatches = 0;
+    for(unsigned i=0; i<keys.size(); ++i)
+    {
+        osg::Image* a = sequential[i].get();
+        osg::Image* b = parallel[i].get();
+        if ( (a == 0L) != (b == 0L) )
+            ++mismatches;
+        else if ( a && (a->getImageSizeInBytes() != b->getImageSizeInBytes() ||
+                        memcmp(a->data(), b->data(), a->getImageSizeInBytes()) != 0) )
+            ++mismatches;
+    }
+
+    if ( mismatches > 0 )
+    {
+        OE_NOTICE << "Mosaic test: FAIL (" << mismatches << " tiles differ)" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << "Mosaic test: PASS" << std::endl;
+    return 0;
+}
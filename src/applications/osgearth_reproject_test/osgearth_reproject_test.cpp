@@ -0,0 +1,211 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/GeoData>
+#include <osgEarth/Profile>
+#include <osgEarth/Registry>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+
+#define LC "[reproject_test] "
+
+using namespace osgEarth;
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_reproject_test\n"
+        << "    [--level <num>]         : mercator level of the tiles to make (default 2)\n"
+        << "    [--size <num>]          : tile size in pixels (default 256)\n"
+        << "    [--source-size <num>]   : width of the global geodetic source image (default 4096)\n"
+        << "    [--error <num>]         : max error in source pixels to measure, repeatable\n"
+        << "                              (default 0.5, 0.125 and 0.05)\n"
+        << "    [--rgb]                 : use an RGB source image instead of RGBA\n"
+        << std::endl;
+    return -1;
+}
+
+/**
+ * A global geodetic image with smooth gradients and a fine checker pattern,
+ * so that coordinate errors show up as color differences.
+ */
+osg::Image*
+makeSourceImage(unsigned width, GLenum pixelFormat)
+{
+    unsigned height = width/2;
+    unsigned channels = pixelFormat == GL_RGBA ? 4 : 3;
+
+    osg::Image* image = new osg::Image();
+    image->allocateImage(width, height, 1, pixelFormat, GL_UNSIGNED_BYTE);
+
+    for(unsigned t=0; t<height; ++t)
+    {
+        for(unsigned s=0; s<width; ++s)
+        {
+            unsigned char* p = image->data(s, t);
+            p[0] = (unsigned char)((255 * s) / width);
+            p[1] = (unsigned char)((255 * t) / height);
+            p[2] = ((s/4 + t/4) & 1) ? 255 : 0;
+            if ( channels == 4 )
+                p[3] = (unsigned char)(128 + (rand() & 127));
+        }
+    }
+    return image;
+}
+
+struct Accuracy
+{
+    Accuracy() : _maxDiff(0), _sumDiff(0.0), _numValues(0), _numPixels(0), _numDiffPixels(0) { }
+
+    void compare(const osg::Image* exact, const osg::Image* approx)
+    {
+        unsigned bytesPerPixel = osg::Image::computePixelSizeInBits(exact->getPixelFormat(), exact->getDataType()) / 8;
+        for(int t=0; t<exact->t(); ++t)
+        {
+            for(int s=0; s<exact->s(); ++s)
+            {
+                const unsigned char* a = exact->data(s, t);
+                const unsigned char* b = approx->data(s, t);
+                bool differs = false;
+                for(unsigned i=0; i<bytesPerPixel; ++i)
+                {
+                    int diff = abs((int)a[i] - (int)b[i]);
+                    _maxDiff = osg::maximum(_maxDiff, diff);
+                    _sumDiff += (double)diff;
+                    differs = differs || diff > 0;
+                    ++_numValues;
+                }
+                ++_numPixels;
+                if ( differs )
+                    ++_numDiffPixels;
+            }
+        }
+    }
+
+    int      _maxDiff;
+    double   _sumDiff;
+    unsigned _numValues, _numPixels, _numDiffPixels;
+};
+
+/** Reprojects the source image into each tile, and returns the tiles/sec. */
+double
+reprojectTiles(const GeoImage& source, const std::vector<TileKey>& keys, unsigned size, double maxError,
+               std::vector< osg::ref_ptr<osg::Image> >& out_images)
+{
+    out_images.clear();
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for(unsigned i=0; i<keys.size(); ++i)
+    {
+        const GeoExtent& extent = keys[i].getExtent();
+        GeoImage result = source.reproject(extent.getSRS(), &extent, size, size, true, maxError);
+        out_images.push_back( result.getImage() );
+    }
+    double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+    return seconds > 0.0 ? (double)keys.size()/seconds : 0.0;
+}
+
+/**
+ * Compares the speed and accuracy of GeoImage::reproject with approximate
+ * (control grid) coordinate transformation against transforming every pixel.
+ */
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    int level = 2, size = 256, sourceSize = 4096;
+    arguments.read("--level", level);
+    arguments.read("--size", size);
+    arguments.read("--source-size", sourceSize);
+    bool rgb = arguments.read("--rgb");
+
+    std::vector<double> errors;
+    double error;
+    while( arguments.read("--error", error) )
+        errors.push_back( error );
+    if ( errors.empty() )
+    {
+        errors.push_back( 0.5 );
+        errors.push_back( 0.125 );
+        errors.push_back( 0.05 );
+    }
+
+    if ( level < 0 || size < 2 || sourceSize < 2 )
+        return usage( argv[0] );
+
+    const Profile* geodetic = Registry::instance()->getGlobalGeodeticProfile();
+    const Profile* mercator = Registry::instance()->getSphericalMercatorProfile();
+
+    GeoImage source(
+        makeSourceImage((unsigned)sourceSize, rgb ? GL_RGB : GL_RGBA),
+        GeoExtent(geodetic->getSRS(), -180.0, -90.0, 180.0, 90.0) );
+
+    std::vector<TileKey> keys;
+    mercator->getAllKeysAtLOD( (unsigned)level, keys );
+
+    OE_NOTICE << LC << keys.size() << " mercator tiles of " << size << "x" << size
+        << " from a " << source.getImage()->s() << "x" << source.getImage()->t()
+        << (rgb ? " RGB" : " RGBA") << " geodetic image" << std::endl;
+
+    std::vector< osg::ref_ptr<osg::Image> > exact;
+    double exactRate = reprojectTiles( source, keys, (unsigned)size, 0.0, exact );
+
+    OE_NOTICE << LC
+        << std::setw(10) << "max error" << std::setw(12) << "tiles/sec" << std::setw(10) << "speedup"
+        << std::setw(12) << "max diff" << std::setw(12) << "mean diff" << std::setw(14) << "pixels diff"
+        << std::endl;
+
+    OE_NOTICE << LC
+        << std::setw(10) << "exact" << std::setw(12) << std::fixed << std::setprecision(1) << exactRate
+        << std::endl;
+
+    for(unsigned e=0; e<errors.size(); ++e)
+    {
+        std::vector< osg::ref_ptr<osg::Image> > approx;
+        double rate = reprojectTiles( source, keys, (unsigned)size, errors[e], approx );
+
+        Accuracy acc;
+        for(unsigned i=0; i<keys.size(); ++i)
+        {
+            if ( exact[i].valid() && approx[i].valid() )
+                acc.compare( exact[i].get(), approx[i].get() );
+        }
+
+        OE_NOTICE << LC
+            << std::setw(10) << std::setprecision(3) << errors[e]
+            << std::setw(12) << std::setprecision(1) << rate
+            << std::setw(10) << std::setprecision(2) << (exactRate > 0.0 ? rate/exactRate : 0.0)
+            << std::setw(12) << acc._maxDiff
+            << std::setw(12) << std::setprecision(4) << (acc._numValues > 0 ? acc._sumDiff/(double)acc._numValues : 0.0)
+            << std::setw(13) << std::setprecision(2) << (acc._numPixels > 0 ? 100.0*(double)acc._numDiffPixels/(double)acc._numPixels : 0.0) << "%"
+            << std::endl;
+    }
+
+    return 0;
+}
@@ -30,6 +30,7 @@
 #include <osgEarth/Registry>
 #include <osgEarthDrivers/feature_ogr/OGRFeatureOptions>
 #include <osgEarth/FileUtils>
+#include <osgEarth/StringUtils>
 
 #include <osgEarth/TileVisitor>
 
@@ -86,7 +87,9 @@ int
         << "        [--index shapefile]             ; Use the feature extents in a shapefile to set the bounding boxes for seeding" << std::endl
         << "        [--mp]                          ; Use multiprocessing to process the tiles.  Useful for GDAL sources as this avoids the global GDAL lock" << std::endl
         << "        [--mt]                          ; Use multithreading to process the tiles." << std::endl
-        << "        [--concurrency]                 ; The number of threads or proceses to use if --mp or --mt are provided." << std::endl
+        << "        [--pipeline]                    ; Use a pipeline of threads in this process, keeping the layers open." << std::endl
+        << "        [--journal file]                ; Record the seeded tiles in a file, and skip the tiles already in it, so an interrupted seed can resume (implies --pipeline)" << std::endl
+        << "        [--concurrency]                 ; The number of threads or proceses to use if --mp, --mt or --pipeline are provided." << std::endl
         << "        [--verbose]                     ; Displays progress of the seed operation" << std::endl
         << std::endl
         << "    --purge file.earth                  ; Purges a layer cache in a .earth file (interactive)" << std::endl
@@ -104,6 +107,38 @@ int message( const std::string& msg )
     return 0;
 }
 
+/**
+ * Points a pipelined visitor at the journal for one layer. When seeding
+ * the whole map, each layer needs a journal of its own.
+ */
+void
+    setJournal( TileVisitor* visitor, const std::string& journal, const std::string& suffix )
+{
+    PipelinedTileVisitor* v = dynamic_cast<PipelinedTileVisitor*>( visitor );
+    if ( v && !journal.empty() )
+    {
+        v->setJournal( suffix.empty() ? journal : journal + "." + suffix );
+    }
+}
+
+/**
+ * Prints the throughput of each stage of a pipelined visitor.
+ */
+void
+    reportStages( TileVisitor* visitor )
+{
+    PipelinedTileVisitor* v = dynamic_cast<PipelinedTileVisitor*>( visitor );
+    if ( v )
+    {
+        const std::vector<PipelinedTileVisitor::StageStats>& stats = v->getStageStats();
+        for (unsigned int i = 0; i < stats.size(); ++i)
+        {
+            OE_NOTICE << "  Stage " << stats[i]._name << " (" << stats[i]._threads << " threads): "
+                << stats[i]._tiles << " tiles, " << stats[i].tilesPerSecond() << " tiles/sec" << std::endl;
+        }
+    }
+}
+
 int
     seed( osg::ArgumentParser& args )
 {    
@@ -137,6 +172,9 @@ int
 
     bool verbose = args.read("--verbose");
 
+    std::string journal;
+    while (args.read( "--journal", journal ) );
+
     unsigned int batchSize = 0;
     args.read("--batchsize", batchSize);
 
@@ -232,7 +270,18 @@ int
     // If we dont' have a visitor create one.
     if (!visitor.valid())
     {
-        if (args.read("--mt"))
+        if (args.read("--pipeline") || !journal.empty())
+        {
+            // Create a pipelined visitor. The cache layers read, process and
+            // write each tile in one call, so all of the threads handle tiles.
+            PipelinedTileVisitor* v = new PipelinedTileVisitor();
+            if (concurrency > 0)
+            {
+                v->setNumFetchThreads(concurrency);
+            }
+            visitor = v;
+        }
+        else if (args.read("--mt"))
         {
             // Create a multithreaded visitor
             MultithreadedTileVisitor* v = new MultithreadedTileVisitor();
@@ -310,12 +359,14 @@ int
         if (layer)
         {
             OE_NOTICE << "Seeding single layer " << layer->getName() << std::endl;
+            setJournal( visitor.get(), journal, "" );
             osg::Timer_t start = osg::Timer::instance()->tick();        
             seeder.run(layer, map);
             osg::Timer_t end = osg::Timer::instance()->tick();
             if (verbose)
             {
                 OE_NOTICE << "Completed seeding layer " << layer->getName() << " in " << prettyPrintTime( osg::Timer::instance()->delta_s( start, end ) ) << std::endl;
+                reportStages( visitor.get() );
             }    
         }
         else
@@ -332,12 +383,14 @@ int
         if (layer)
         {
             OE_NOTICE << "Seeding single layer " << layer->getName() << std::endl;
+            setJournal( visitor.get(), journal, "" );
             osg::Timer_t start = osg::Timer::instance()->tick();        
             seeder.run(layer, map);
             osg::Timer_t end = osg::Timer::instance()->tick();
             if (verbose)
             {
                 OE_NOTICE << "Completed seeding layer " << layer->getName() << " in " << prettyPrintTime( osg::Timer::instance()->delta_s( start, end ) ) << std::endl;
+                reportStages( visitor.get() );
             }    
         }
         else
@@ -354,12 +407,14 @@ int
         {            
             osg::ref_ptr< ImageLayer > layer = map->getImageLayerAt(i);
             OE_NOTICE << "Seeding layer" << layer->getName() << std::endl;            
+            setJournal( visitor.get(), journal, Stringify() << "image" << i );
             osg::Timer_t start = osg::Timer::instance()->tick();
             seeder.run(layer.get(), map);            
             osg::Timer_t end = osg::Timer::instance()->tick();
             if (verbose)
             {
                 OE_NOTICE << "Completed seeding layer " << layer->getName() << " in " << prettyPrintTime( osg::Timer::instance()->delta_s( start, end ) ) << std::endl;
+                reportStages( visitor.get() );
             }                
         }
 
@@ -367,12 +422,14 @@ int
         {
             osg::ref_ptr< ElevationLayer > layer = map->getElevationLayerAt(i);
             OE_NOTICE << "Seeding layer" << layer->getName() << std::endl;
+            setJournal( visitor.get(), journal, Stringify() << "elevation" << i );
             osg::Timer_t start = osg::Timer::instance()->tick();
             seeder.run(layer.get(), map);            
             osg::Timer_t end = osg::Timer::instance()->tick();
             if (verbose)
             {
                 OE_NOTICE << "Completed seeding layer " << layer->getName() << " in " << prettyPrintTime( osg::Timer::instance()->delta_s( start, end ) ) << std::endl;
+                reportStages( visitor.get() );
             }                
         }        
     }    
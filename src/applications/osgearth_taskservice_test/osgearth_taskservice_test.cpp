@@ -0,0 +1,282 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Thread>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <float.h>
+
+#define LC "[taskservice_test] "
+
+using namespace osgEarth;
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_taskservice_test\n"
+        << "    [--tasks <num>]         : requests to run (default 200000)\n"
+        << "    [--threads <num>]       : worker threads (default: number of cores)\n"
+        << "    [--producers <num>]     : threads adding requests (default 4)\n"
+        << "    [--work <us>]           : time each request spins (default 5)\n"
+        << "    [--max-size <num>]      : bound on queued requests for the bounded run (default 64)\n"
+        << std::endl;
+    return -1;
+}
+
+/** Counts the requests as they start, to record the order they ran in. */
+static OpenThreads::Atomic s_started;
+
+/** Spins for a while and records when it started relative to the others. */
+struct SpinTask : public TaskRequest
+{
+    SpinTask(float priority, double work_us, Threading::MultiEvent* done) :
+        TaskRequest(priority), _work_us(work_us), _done(done), _rank(0u) { }
+
+    void operator()(ProgressCallback* progress)
+    {
+        _rank = ++s_started;
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        while( osg::Timer::instance()->delta_u(start, osg::Timer::instance()->tick()) < _work_us );
+
+        _done->notify();
+    }
+
+    double                 _work_us;
+    Threading::MultiEvent* _done;
+    unsigned               _rank;
+};
+
+/** Holds up a worker thread until the gate opens. */
+struct GateTask : public TaskRequest
+{
+    GateTask(Threading::MultiEvent* entered, Threading::Event* gate) :
+        TaskRequest(-FLT_MAX), _entered(entered), _gate(gate) { }
+
+    void operator()(ProgressCallback* progress)
+    {
+        _entered->notify();
+        _gate->wait();
+    }
+
+    Threading::MultiEvent* _entered;
+    Threading::Event*      _gate;
+};
+
+/** Adds a share of the requests to a service from its own thread. */
+struct Producer : public OpenThreads::Thread
+{
+    void run()
+    {
+        for(unsigned i=_first; i<_end; ++i)
+        {
+            _service->add( (*_tasks)[i].get() );
+
+            unsigned queued = _service->getNumRequests();
+            if ( _maxSize > 0 && queued > _maxSize )
+                _overshoot = osg::maximum( _overshoot, queued - _maxSize );
+        }
+    }
+
+    TaskService*                             _service;
+    std::vector< osg::ref_ptr<SpinTask> >*   _tasks;
+    unsigned                                 _first, _end, _maxSize, _overshoot;
+};
+
+struct ByPriority
+{
+    bool operator()(const SpinTask* lhs, const SpinTask* rhs) const { return lhs->getPriority() < rhs->getPriority(); }
+};
+
+struct Result
+{
+    double   _seconds;
+    double   _displacement;
+    unsigned _overshoot;
+};
+
+/**
+ * Runs the requests with random priorities through a service, with the
+ * producers adding them concurrently. Reports the throughput, and how far
+ * (on average, in requests) each request started from its place in the
+ * priority order when all of them were queued before any ran.
+ */
+Result
+run(TaskService::Scheduler scheduler, unsigned numTasks, int numThreads, unsigned numProducers, double work_us, unsigned maxSize)
+{
+    Result r;
+    r._overshoot = 0u;
+
+    std::vector< osg::ref_ptr<SpinTask> > tasks( numTasks );
+
+    // throughput: producers and workers run at the same time.
+    {
+        osg::ref_ptr<TaskService> service = new TaskService( "bench", numThreads, maxSize, scheduler );
+        Threading::MultiEvent done( numTasks );
+
+        unsigned seed = 12345u;
+        for(unsigned i=0; i<numTasks; ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            tasks[i] = new SpinTask( (float)(seed >> 8), work_us, &done );
+        }
+
+        std::vector<Producer*> producers( numProducers );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for(unsigned p=0; p<numProducers; ++p)
+        {
+            producers[p] = new Producer();
+            producers[p]->_service   = service.get();
+            producers[p]->_tasks     = &tasks;
+            producers[p]->_first     = numTasks * p / numProducers;
+            producers[p]->_end       = numTasks * (p+1) / numProducers;
+            producers[p]->_maxSize   = maxSize;
+            producers[p]->_overshoot = 0u;
+            producers[p]->start();
+        }
+        for(unsigned p=0; p<numProducers; ++p)
+        {
+            producers[p]->join();
+            r._overshoot = osg::maximum( r._overshoot, producers[p]->_overshoot );
+            delete producers[p];
+        }
+        done.wait();
+        r._seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+    }
+
+    // ordering: hold every worker at a gate until all the requests are queued.
+    if ( maxSize == 0 )
+    {
+        osg::ref_ptr<TaskService> service = new TaskService( "bench", numThreads, 0, scheduler );
+        Threading::MultiEvent done( numTasks );
+        Threading::MultiEvent entered( numThreads );
+        Threading::Event gate;
+
+        for(int t=0; t<numThreads; ++t)
+            service->add( new GateTask(&entered, &gate) );
+        entered.wait();
+
+        std::vector<SpinTask*> sorted( numTasks );
+        for(unsigned i=0; i<numTasks; ++i)
+        {
+            tasks[i] = new SpinTask( tasks[i]->getPriority(), work_us, &done );
+            sorted[i] = tasks[i].get();
+            service->add( tasks[i].get() );
+        }
+
+        s_started.exchange( 0u );
+        gate.set();
+        done.wait();
+
+        std::stable_sort( sorted.begin(), sorted.end(), ByPriority() );
+        double sum = 0.0;
+        for(unsigned i=0; i<numTasks; ++i)
+            sum += ::fabs( (double)sorted[i]->_rank - (double)(i+1) );
+        r._displacement = sum / (double)numTasks;
+    }
+    else
+    {
+        r._displacement = 0.0;
+    }
+
+    return r;
+}
+
+/**
+ * Compares the work-stealing task scheduler with the single shared priority
+ * queue: throughput of many short requests from several producers, with an
+ * unbounded and a bounded queue, and how closely each keeps to priority
+ * order. Fails if a bounded queue ever holds more than its bound.
+ */
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    int numTasks = 200000, numThreads = OpenThreads::GetNumberOfProcessors(), numProducers = 4, maxSize = 64;
+    double work_us = 5.0;
+    arguments.read("--tasks", numTasks);
+    arguments.read("--threads", numThreads);
+    arguments.read("--producers", numProducers);
+    arguments.read("--work", work_us);
+    arguments.read("--max-size", maxSize);
+
+    if ( numTasks < 1 || numThreads < 1 || numProducers < 1 || maxSize < 1 || work_us < 0.0 )
+        return usage( argv[0] );
+
+    OE_NOTICE << LC << numTasks << " requests of " << work_us << " us, "
+        << numThreads << " threads, " << numProducers << " producers" << std::endl;
+
+    OE_NOTICE << LC << std::setw(16) << "scheduler" << std::setw(10) << "bound"
+        << std::setw(12) << "seconds" << std::setw(14) << "requests/s"
+        << std::setw(16) << "displacement" << std::endl;
+
+    const char* names[2] = { "priority", "workstealing" };
+    TaskService::Scheduler schedulers[2] = { TaskService::SCHEDULER_PRIORITY_QUEUE, TaskService::SCHEDULER_WORK_STEALING };
+    unsigned bounds[2] = { 0u, (unsigned)maxSize };
+
+    bool ok = true;
+
+    for(unsigned b=0; b<2; ++b)
+    {
+        for(unsigned s=0; s<2; ++s)
+        {
+            Result r = run( schedulers[s], (unsigned)numTasks, numThreads, (unsigned)numProducers, work_us, bounds[b] );
+
+            std::stringstream bound, displacement;
+            if ( bounds[b] > 0 ) bound << bounds[b]; else bound << "none";
+            if ( bounds[b] > 0 ) displacement << "-"; else displacement << std::fixed << std::setprecision(1) << r._displacement;
+
+            OE_NOTICE << LC << std::setw(16) << names[s] << std::setw(10) << bound.str()
+                << std::fixed << std::setprecision(3)
+                << std::setw(12) << r._seconds
+                << std::setw(14) << std::setprecision(0) << (double)numTasks / r._seconds
+                << std::setw(16) << displacement.str() << std::endl;
+
+            if ( r._overshoot > 0 )
+            {
+                OE_NOTICE << LC << names[s] << " queue held " << r._overshoot << " request(s) over its bound" << std::endl;
+                ok = false;
+            }
+        }
+    }
+
+    if ( !ok )
+    {
+        OE_NOTICE << "TaskService test: FAIL" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << "TaskService test: PASS" << std::endl;
+    return 0;
+}
@@ -0,0 +1,750 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/Notify>
+#include <osgEarth/Map>
+#include <osgEarth/MapNode>
+#include <osgEarth/ImageLayer>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/TileSource>
+#include <osgEarth/Registry>
+#include <osgEarth/Progress>
+#include <osgEarth/StringUtils>
+#include <osgEarth/Profiler>
+#include <osg/ArgumentParser>
+#include <osg/Geometry>
+#include <osg/PagedLOD>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <osgDB/ReadFile>
+#include <osgDB/FileNameUtils>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <set>
+#include <iomanip>
+
+#define LC "[tilecompile_test] "
+
+using namespace osgEarth;
+
+
+int
+usage(const std::string& msg)
+{
+    OE_NOTICE << msg << "\n"
+        << "USAGE: osgearth_tilecompile_test\n"
+        << "    [--tiles <num>]         : tiles to load per measurement (default 32)\n"
+        << "    [--level <num>]         : level of the tiles to load (default 6)\n"
+        << "    [--paging]              : benchmark allocations under sustained paging only\n"
+        << "    [--paging-tiles <num>]  : tiles to page in (default 1024)\n"
+        << "    [--size <num>]          : tile size for the paging and topology benchmarks (default 33)\n"
+        << "    [--topology]            : benchmark shared tile topology only\n"
+        << "    [--working-set <num>]   : tiles in the topology benchmark's working set (default 5000)\n"
+        << "    [--flyin]               : benchmark flying into a region only\n"
+        << "    [--flyin-level <num>]   : level of full resolution when flying in (default 12)\n"
+        << "    [--latency <ms>]        : simulated latency of each elevation tile when flying in (default 20)\n"
+        << "    [--profile <file>]      : profile the pipeline stages, print a summary and write a Chrome trace\n"
+        << std::endl;
+    return -1;
+}
+
+/**
+ * Smooth procedural terrain, so every tile has real elevation data. With
+ * "seaLevel" set, everything below zero is flat ocean. "latency" simulates
+ * the time to fetch a tile from a server.
+ */
+class ProceduralElevationSource : public TileSource
+{
+public:
+    ProceduralElevationSource(bool seaLevel =false, unsigned latency =0u)
+        : TileSource(makeOptions()), _seaLevel(seaLevel), _latency(latency) { }
+
+    static TileSourceOptions makeOptions()
+    {
+        TileSourceOptions options;
+        options.tileSize() = 65;
+        return options;
+    }
+
+    Status initialize(const osgDB::Options* dbOptions)
+    {
+        setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+        return STATUS_OK;
+    }
+
+    osg::HeightField* createHeightField(const TileKey& key, ProgressCallback* progress)
+    {
+        if ( _latency > 0u )
+            OpenThreads::Thread::microSleep( _latency * 1000u );
+
+        unsigned size = getPixelsPerTile();
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate(size, size);
+
+        const GeoExtent& ex = key.getExtent();
+        double dx = ex.width() / (double)(size-1);
+        double dy = ex.height() / (double)(size-1);
+        for(unsigned r=0; r<size; ++r)
+        {
+            double y = ex.yMin() + dy*(double)r;
+            for(unsigned c=0; c<size; ++c)
+            {
+                double x = ex.xMin() + dx*(double)c;
+                double h = 2000.0*sin(0.7*x) * cos(0.9*y) + 300.0*sin(7.0*x + 3.0*y);
+                hf->setHeight(c, r, (float)(_seaLevel ? osg::maximum(h, 0.0) : h));
+            }
+        }
+        return hf;
+    }
+
+    bool     _seaLevel;
+    unsigned _latency;
+};
+
+/** Plain gradient imagery, so every tile has a color layer to texture. */
+class GradientImageSource : public TileSource
+{
+public:
+    GradientImageSource() : TileSource(TileSourceOptions()) { }
+
+    Status initialize(const osgDB::Options* dbOptions)
+    {
+        setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+        return STATUS_OK;
+    }
+
+    osg::Image* createImage(const TileKey& key, ProgressCallback* progress)
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage(64, 64, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        for(int t=0; t<64; ++t)
+        {
+            for(int s=0; s<64; ++s)
+            {
+                unsigned char* p = image->data(s, t);
+                p[0] = (unsigned char)(s*4);
+                p[1] = (unsigned char)(t*4);
+                p[2] = (unsigned char)(key.getLevelOfDetail()*16);
+                p[3] = 255;
+            }
+        }
+        return image;
+    }
+};
+
+/** Finds the UID of the terrain engine in the file names of its paged tiles. */
+struct FindEngineUID : public osg::NodeVisitor
+{
+    FindEngineUID() : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), _uid(-1) { }
+
+    void apply(osg::PagedLOD& plod)
+    {
+        for(unsigned i=0; i<plod.getNumFileNames() && _uid < 0; ++i)
+        {
+            const std::string& name = plod.getFileName(i);
+            if ( osgDB::getFileExtension(name) == "osgearth_engine_mp_tile" )
+            {
+                unsigned lod, x, y;
+                int uid;
+                if ( sscanf(osgDB::getNameLessExtension(name).c_str(), "%u/%u/%u.%d", &lod, &x, &y, &uid) == 4 )
+                    _uid = uid;
+            }
+        }
+        if ( _uid < 0 )
+            traverse(plod);
+    }
+
+    int _uid;
+};
+
+/** Collects the surface vertices of the tiles in a subgraph. */
+struct CollectSurfaces : public osg::NodeVisitor
+{
+    CollectSurfaces() : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN) { }
+
+    void apply(osg::Geode& geode)
+    {
+        for(unsigned i=0; i<geode.getNumDrawables(); ++i)
+        {
+            osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+            if ( geom && geom->getName() == "surface" )
+            {
+                const osg::Vec3Array* verts = dynamic_cast<const osg::Vec3Array*>(geom->getVertexArray());
+                if ( verts )
+                    _verts.insert( _verts.end(), verts->begin(), verts->end() );
+            }
+        }
+    }
+
+    std::vector<osg::Vec3> _verts;
+};
+
+/** Collects the triangle indices of the tile surfaces in a subgraph. */
+struct CollectTopology : public osg::NodeVisitor
+{
+    CollectTopology() : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN) { }
+
+    void apply(osg::Geode& geode)
+    {
+        for(unsigned i=0; i<geode.getNumDrawables(); ++i)
+        {
+            osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+            if ( geom && geom->getName() == "surface" && geom->getNumPrimitiveSets() > 0 )
+                _elements.push_back( dynamic_cast<osg::DrawElements*>(geom->getPrimitiveSet(0)) );
+        }
+    }
+
+    std::vector< osg::ref_ptr<osg::DrawElements> > _elements;
+};
+
+struct Result
+{
+    double                 _compileSeconds;
+    unsigned               _tiles;
+    std::vector<osg::Vec3> _verts;
+};
+
+/**
+ * Creates a map node for the map with the MP engine at one tile size and
+ * with the given MP engine options, and finds the engine's UID, which is
+ * part of the tile file names.
+ */
+MapNode*
+createMapNode(Map* map, int tileSize, const Config& engineOptions, int& out_uid)
+{
+    TerrainOptions terrain;
+    terrain.setDriver( "mp" );
+    terrain.tileSize() = tileSize;
+
+    Config conf = terrain.getConfig();
+    conf.merge( engineOptions );
+
+    osg::ref_ptr<MapNode> mapNode = new MapNode( map, MapNodeOptions(TerrainOptions(ConfigOptions(conf))) );
+
+    FindEngineUID findUID;
+    mapNode->accept( findUID );
+    if ( findUID._uid < 0 )
+    {
+        OE_WARN << LC << "Couldn't find the MP terrain engine" << std::endl;
+        return 0L;
+    }
+
+    out_uid = findUID._uid;
+    return mapNode.release();
+}
+
+/** Loads a tile through the engine the way the database pager does. */
+osg::Node*
+loadTile(int uid, unsigned level, unsigned x, unsigned y, ProgressCallback* progress)
+{
+    osg::ref_ptr<osgDB::Options> dbOptions = Registry::instance()->cloneOrCreateOptions();
+    dbOptions->setUserData( progress );
+
+    std::string uri = Stringify() << level << "/" << x << "/" << y << "." << uid << ".osgearth_engine_mp_tile";
+    return osgDB::readNodeFile( uri, dbOptions.get() );
+}
+
+/**
+ * Loads "numTiles" tiles of a geocentric map through the MP engine at one
+ * tile size, and adds up the time the engine spent compiling tile models.
+ */
+bool
+run(Map* map, int tileSize, bool fastSurface, unsigned level, unsigned numTiles, Result& out)
+{
+    Config engine;
+    engine.set( "fast_surface", fastSurface );
+
+    int uid;
+    osg::ref_ptr<MapNode> mapNode = createMapNode( map, tileSize, engine, uid );
+    if ( !mapNode.valid() )
+        return false;
+
+    unsigned wide, high;
+    map->getProfile()->getNumTiles( level, wide, high );
+
+    out._compileSeconds = 0.0;
+    out._tiles = 0;
+    out._verts.clear();
+
+    for(unsigned i=0; i<numTiles; ++i)
+    {
+        // spread the tiles over the globe, poles included.
+        unsigned x = (i * 37u) % wide;
+        unsigned y = (i * 11u) % high;
+
+        osg::ref_ptr<ProgressCallback> progress = new ProgressCallback();
+        osg::ref_ptr<osg::Node> node = loadTile( uid, level, x, y, progress.get() );
+        if ( !node.valid() )
+            continue;
+
+        out._compileSeconds += progress->stats()["compile_tilemodel_time"];
+        out._tiles++;
+
+        CollectSurfaces collect;
+        node->accept( collect );
+        out._verts.insert( out._verts.end(), collect._verts.begin(), collect._verts.end() );
+    }
+
+    return out._tiles > 0;
+}
+
+/**
+ * Compares the time the MP engine takes to compile geocentric tiles at
+ * tile sizes 17 to 65, converting every vertex through the tile locator
+ * versus building vertices from per-row and per-column tables, and checks
+ * that both build the same surface.
+ */
+int
+compileBenchmark(Map* map, unsigned numTiles, unsigned level)
+{
+    OE_NOTICE << LC << numTiles << " tiles at level " << level << " per measurement" << std::endl;
+    OE_NOTICE << LC << std::setw(6) << "size"
+        << std::setw(14) << "locator ms" << std::setw(14) << "tables ms"
+        << std::setw(10) << "speedup" << std::setw(14) << "max error m" << std::endl;
+
+    bool ok = true;
+    const int tileSizes[4] = { 17, 33, 49, 65 };
+    for(unsigned s=0; s<4; ++s)
+    {
+        Result exact, fast;
+        if ( !run(map, tileSizes[s], false, level, numTiles, exact) ||
+             !run(map, tileSizes[s], true,  level, numTiles, fast) )
+        {
+            OE_NOTICE << "Tile compile test: FAIL (no tiles)" << std::endl;
+            return -1;
+        }
+
+        // both must build the same vertices, in the same order, up to rounding.
+        double maxError = 0.0, maxRadius = 0.0;
+        if ( exact._verts.size() != fast._verts.size() )
+        {
+            maxError = DBL_MAX;
+        }
+        else
+        {
+            for(unsigned v=0; v<exact._verts.size(); ++v)
+            {
+                maxError  = osg::maximum( maxError, (double)(exact._verts[v] - fast._verts[v]).length() );
+                maxRadius = osg::maximum( maxRadius, (double)exact._verts[v].length() );
+            }
+        }
+
+        double exactMs = 1000.0 * exact._compileSeconds / (double)exact._tiles;
+        double fastMs  = 1000.0 * fast._compileSeconds / (double)fast._tiles;
+
+        OE_NOTICE << LC << std::setw(6) << tileSizes[s]
+            << std::setw(14) << std::fixed << std::setprecision(3) << exactMs
+            << std::setw(14) << fastMs
+            << std::setw(10) << std::setprecision(2) << (fastMs > 0.0 ? exactMs/fastMs : 0.0)
+            << std::setw(14) << std::setprecision(4) << maxError
+            << std::endl;
+
+        // vertices are single precision, relative to the tile center.
+        if ( maxError > 1e-5 * osg::maximum(maxRadius, 1.0) )
+            ok = false;
+    }
+
+    if ( !ok )
+    {
+        OE_NOTICE << "Tile compile test: FAIL (surfaces differ)" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << "Tile compile test: PASS" << std::endl;
+    return 0;
+}
+
+/**
+ * Pages tiles in continuously, wandering over several levels the way a
+ * moving camera would, and reports per batch of tiles how often the
+ * compiler's scratch buffers had to grow and how many arrays it built for
+ * the scene graph. Once the buffers fit the largest tile, compiling should
+ * allocate nothing but those arrays.
+ */
+int
+pagingBenchmark(Map* map, unsigned numTiles, int tileSize)
+{
+    int uid;
+    osg::ref_ptr<MapNode> mapNode = createMapNode( map, tileSize, Config(), uid );
+    if ( !mapNode.valid() )
+    {
+        OE_NOTICE << "Tile paging test: FAIL (no engine)" << std::endl;
+        return -1;
+    }
+
+    const unsigned batchSize = 128;
+
+    OE_NOTICE << LC << "Paging " << numTiles << " tiles of size " << tileSize << std::endl;
+    OE_NOTICE << LC << std::setw(14) << "tiles"
+        << std::setw(12) << "ms/tile" << std::setw(16) << "scratch allocs"
+        << std::setw(14) << "arrays/tile" << std::endl;
+
+    bool ok = true;
+    unsigned seed = 12345u;
+    for(unsigned first=0; first<numTiles; first += batchSize)
+    {
+        unsigned last = osg::minimum( first + batchSize, numTiles );
+
+        double   seconds = 0.0, scratchAllocs = 0.0, arrays = 0.0;
+        unsigned tiles = 0;
+
+        for(unsigned i=first; i<last; ++i)
+        {
+            unsigned level = 3 + (i % 6);
+            unsigned wide, high;
+            map->getProfile()->getNumTiles( level, wide, high );
+
+            seed = seed * 1664525u + 1013904223u;
+            unsigned x = (seed >> 8) % wide;
+            seed = seed * 1664525u + 1013904223u;
+            unsigned y = (seed >> 8) % high;
+
+            osg::ref_ptr<ProgressCallback> progress = new ProgressCallback();
+            osg::ref_ptr<osg::Node> node = loadTile( uid, level, x, y, progress.get() );
+            if ( !node.valid() )
+                continue;
+
+            seconds       += progress->stats()["compile_tilemodel_time"];
+            scratchAllocs += progress->stats()["compile_scratch_allocs"];
+            arrays        += progress->stats()["compile_array_allocs"];
+            tiles++;
+        }
+
+        if ( tiles == 0 )
+            continue;
+
+        // each load compiles the four children of the key.
+        OE_NOTICE << LC << std::setw(6) << first << " - " << std::setw(5) << last
+            << std::setw(12) << std::fixed << std::setprecision(3) << 1000.0*seconds/(double)tiles
+            << std::setw(16) << std::setprecision(0) << scratchAllocs
+            << std::setw(14) << std::setprecision(1) << arrays/(double)(tiles*4)
+            << std::endl;
+
+        // every tile in this benchmark has the same size and layers, so the
+        // buffers must be done growing after the first batch.
+        if ( first > 0 && scratchAllocs > 0.0 )
+            ok = false;
+    }
+
+    if ( !ok )
+    {
+        OE_NOTICE << "Tile paging test: FAIL (scratch buffers still growing)" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << "Tile paging test: PASS" << std::endl;
+    return 0;
+}
+
+struct TopologyResult
+{
+    double   _compileSeconds;
+    unsigned _tiles, _sharedTiles, _indices;
+    unsigned _bytes;
+};
+
+/**
+ * Loads a working set of tiles scattered over several levels and measures
+ * the memory held by their triangle indices and the time spent compiling.
+ */
+bool
+loadWorkingSet(Map* map, int tileSize, bool sharedTopology, unsigned numTiles, TopologyResult& out)
+{
+    Config engine;
+    engine.set( "shared_topology", sharedTopology );
+
+    int uid;
+    osg::ref_ptr<MapNode> mapNode = createMapNode( map, tileSize, engine, uid );
+    if ( !mapNode.valid() )
+        return false;
+
+    out._compileSeconds = 0.0;
+    out._tiles = out._sharedTiles = out._indices = out._bytes = 0;
+
+    CollectTopology collect;
+
+    // each load compiles the four children of the key.
+    unsigned seed = 12345u;
+    for(unsigned i=0; i<numTiles/4; ++i)
+    {
+        unsigned level = 3 + (i % 6);
+        unsigned wide, high;
+        map->getProfile()->getNumTiles( level, wide, high );
+
+        seed = seed * 1664525u + 1013904223u;
+        unsigned x = (seed >> 8) % wide;
+        seed = seed * 1664525u + 1013904223u;
+        unsigned y = (seed >> 8) % high;
+
+        osg::ref_ptr<ProgressCallback> progress = new ProgressCallback();
+        osg::ref_ptr<osg::Node> node = loadTile( uid, level, x, y, progress.get() );
+        if ( !node.valid() )
+            continue;
+
+        out._compileSeconds += progress->stats()["compile_tilemodel_time"];
+        out._sharedTiles    += (unsigned)progress->stats()["compile_shared_topology"];
+        node->accept( collect );
+    }
+
+    // count the memory of each set of indices once, however many tiles use it.
+    std::set<const osg::DrawElements*> counted;
+    for(unsigned i=0; i<collect._elements.size(); ++i)
+    {
+        const osg::DrawElements* elements = collect._elements[i].get();
+        if ( !elements )
+            continue;
+
+        out._tiles++;
+        out._indices += elements->getNumIndices();
+        if ( counted.insert(elements).second )
+            out._bytes += elements->getTotalDataSize();
+    }
+
+    return out._tiles > 0;
+}
+
+/**
+ * Compares the memory held by triangle indices, and the time spent
+ * compiling, for a working set of tiles that each generate their own
+ * indices versus tiles that share them when their grids are complete.
+ * Half of the procedural terrain is flat ocean, whose tiles can share.
+ */
+int
+topologyBenchmark(unsigned numTiles, int tileSize)
+{
+    MapOptions mapOptions;
+    mapOptions.cachePolicy() = CachePolicy::NO_CACHE;
+    osg::ref_ptr<Map> map = new Map( mapOptions );
+
+    ElevationLayerOptions elevationOptions( "elevation" );
+    elevationOptions.cachePolicy() = CachePolicy::NO_CACHE;
+    map->addElevationLayer( new ElevationLayer(elevationOptions, new ProceduralElevationSource(true)) );
+
+    TopologyResult perTile, shared;
+    if ( !loadWorkingSet(map.get(), tileSize, false, numTiles, perTile) ||
+         !loadWorkingSet(map.get(), tileSize, true,  numTiles, shared) )
+    {
+        OE_NOTICE << "Tile topology test: FAIL (no tiles)" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << LC << "Working set of " << perTile._tiles << " tiles of size " << tileSize << std::endl;
+    OE_NOTICE << LC << std::setw(12) << ""
+        << std::setw(10) << "shared" << std::setw(14) << "index KB"
+        << std::setw(14) << "compile ms" << std::endl;
+
+    OE_NOTICE << LC << std::setw(12) << "per tile"
+        << std::setw(10) << perTile._sharedTiles
+        << std::setw(14) << std::fixed << std::setprecision(1) << (double)perTile._bytes/1024.0
+        << std::setw(14) << std::setprecision(1) << 1000.0*perTile._compileSeconds << std::endl;
+
+    OE_NOTICE << LC << std::setw(12) << "shared"
+        << std::setw(10) << shared._sharedTiles
+        << std::setw(14) << std::fixed << std::setprecision(1) << (double)shared._bytes/1024.0
+        << std::setw(14) << std::setprecision(1) << 1000.0*shared._compileSeconds << std::endl;
+
+    OE_NOTICE << LC << "saved " << std::setprecision(1)
+        << ((double)perTile._bytes - (double)shared._bytes)/1024.0 << " KB of indices and "
+        << 1000.0*(perTile._compileSeconds - shared._compileSeconds) << " ms of compile time" << std::endl;
+
+    // both must draw the same number of triangles, with fewer index sets when sharing.
+    if ( shared._tiles != perTile._tiles || shared._indices != perTile._indices ||
+         shared._sharedTiles == 0 || shared._bytes >= perTile._bytes )
+    {
+        OE_NOTICE << "Tile topology test: FAIL" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << "Tile topology test: PASS" << std::endl;
+    return 0;
+}
+
+/**
+ * Pages in the tiles containing one point, from the root down to full
+ * resolution, the way the pager does when the camera flies straight in:
+ * each level can only load once its parent is in. Returns the wall time
+ * of each level in "out_seconds".
+ */
+bool
+flyIn(bool parallelQuadrants, int tileSize, unsigned latency, unsigned maxLevel, std::vector<double>& out_seconds)
+{
+    // a new map every time, so no run profits from data another one fetched.
+    MapOptions mapOptions;
+    mapOptions.cachePolicy() = CachePolicy::NO_CACHE;
+    osg::ref_ptr<Map> map = new Map( mapOptions );
+
+    ElevationLayerOptions elevationOptions( "elevation" );
+    elevationOptions.cachePolicy() = CachePolicy::NO_CACHE;
+    map->addElevationLayer( new ElevationLayer(elevationOptions, new ProceduralElevationSource(false, latency)) );
+
+    ImageLayerOptions imageOptions( "imagery" );
+    imageOptions.cachePolicy() = CachePolicy::NO_CACHE;
+    map->addImageLayer( new ImageLayer(imageOptions, new GradientImageSource()) );
+
+    Config engine;
+    engine.set( "parallel_quadrants", parallelQuadrants );
+
+    int uid;
+    osg::ref_ptr<MapNode> mapNode = createMapNode( map.get(), tileSize, engine, uid );
+    if ( !mapNode.valid() )
+        return false;
+
+    out_seconds.clear();
+    for(unsigned level=0; level<maxLevel; ++level)
+    {
+        // the Matterhorn.
+        TileKey key = map->getProfile()->createTileKey( 7.6586, 45.9763, level );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        osg::ref_ptr<ProgressCallback> progress = new ProgressCallback();
+        osg::ref_ptr<osg::Node> node = loadTile( uid, level, key.getTileX(), key.getTileY(), progress.get() );
+        if ( !node.valid() )
+            return false;
+
+        out_seconds.push_back( osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) );
+    }
+    return true;
+}
+
+/**
+ * Compares the time to full resolution when flying into a region, building
+ * the four quadrants of each tile one after the other versus concurrently.
+ */
+int
+flyInBenchmark(int tileSize, unsigned latency, unsigned maxLevel)
+{
+    std::vector<double> sequential, parallel;
+    if ( !flyIn(false, tileSize, latency, maxLevel, sequential) ||
+         !flyIn(true,  tileSize, latency, maxLevel, parallel) )
+    {
+        OE_NOTICE << "Tile fly-in test: FAIL (no tiles)" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << LC << "Flying in to level " << maxLevel << ", tile size " << tileSize
+        << ", " << latency << " ms per elevation tile" << std::endl;
+    OE_NOTICE << LC << std::setw(8) << "level"
+        << std::setw(16) << "sequential ms" << std::setw(14) << "parallel ms" << std::endl;
+
+    double sequentialTotal = 0.0, parallelTotal = 0.0;
+    for(unsigned i=0; i<sequential.size(); ++i)
+    {
+        sequentialTotal += sequential[i];
+        parallelTotal   += parallel[i];
+        OE_NOTICE << LC << std::setw(8) << i+1
+            << std::setw(16) << std::fixed << std::setprecision(1) << 1000.0*sequential[i]
+            << std::setw(14) << 1000.0*parallel[i] << std::endl;
+    }
+
+    OE_NOTICE << LC << "time to full resolution: " << std::setprecision(1)
+        << 1000.0*sequentialTotal << " ms sequential, " << 1000.0*parallelTotal << " ms parallel ("
+        << std::setprecision(2) << (parallelTotal > 0.0 ? sequentialTotal/parallelTotal : 0.0) << "x)" << std::endl;
+
+    OE_NOTICE << "Tile fly-in test: PASS" << std::endl;
+    return 0;
+}
+
+/**
+ * Profiles the pipeline stages while the benchmarks run, and reports the
+ * zones when they're done.
+ */
+struct ProfileReport
+{
+    ProfileReport(const std::string& file) : _file(file)
+    {
+        if ( !_file.empty() )
+            Profiler::setEnabled( true );
+    }
+
+    ~ProfileReport()
+    {
+        if ( !_file.empty() )
+        {
+            Profiler::dump();
+            if ( Profiler::writeChromeTrace(_file) )
+                OE_NOTICE << LC << "Wrote trace to " << _file << std::endl;
+        }
+    }
+
+    std::string _file;
+};
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    if ( arguments.read("--help") )
+        return usage( argv[0] );
+
+    int numTiles = 32, level = 6, pagingTiles = 1024, tileSize = 33, workingSet = 5000;
+    int flyInLevel = 12, latency = 20;
+    arguments.read("--tiles", numTiles);
+    arguments.read("--level", level);
+    arguments.read("--paging-tiles", pagingTiles);
+    arguments.read("--size", tileSize);
+    arguments.read("--working-set", workingSet);
+    bool paging = arguments.read("--paging");
+    arguments.read("--flyin-level", flyInLevel);
+    arguments.read("--latency", latency);
+    bool topology = arguments.read("--topology");
+    bool flyin = arguments.read("--flyin");
+    std::string profileFile;
+    arguments.read("--profile", profileFile);
+
+    if ( numTiles < 1 || level < 1 || pagingTiles < 1 || tileSize < 2 || workingSet < 4 || flyInLevel < 1 || latency < 0 )
+        return usage( argv[0] );
+
+    ProfileReport profile( profileFile );
+
+    if ( topology )
+        return topologyBenchmark( (unsigned)workingSet, tileSize );
+
+    if ( flyin )
+        return flyInBenchmark( tileSize, (unsigned)latency, (unsigned)flyInLevel );
+
+    MapOptions mapOptions;
+    mapOptions.cachePolicy() = CachePolicy::NO_CACHE;
+    osg::ref_ptr<Map> map = new Map( mapOptions );
+
+    ElevationLayerOptions elevationOptions( "elevation" );
+    elevationOptions.cachePolicy() = CachePolicy::NO_CACHE;
+    map->addElevationLayer( new ElevationLayer(elevationOptions, new ProceduralElevationSource()) );
+
+    ImageLayerOptions imageOptions( "imagery" );
+    imageOptions.cachePolicy() = CachePolicy::NO_CACHE;
+    map->addImageLayer( new ImageLayer(imageOptions, new GradientImageSource()) );
+
+    if ( paging )
+        return pagingBenchmark( map.get(), (unsigned)pagingTiles, tileSize );
+
+    int result = compileBenchmark( map.get(), (unsigned)numTiles, (unsigned)level );
+    if ( result != 0 )
+        return result;
+
+    result = pagingBenchmark( map.get(), (unsigned)pagingTiles, tileSize );
+    if ( result != 0 )
+        return result;
+
+    result = topologyBenchmark( (unsigned)workingSet, tileSize );
+    if ( result != 0 )
+        return result;
+
+    return flyInBenchmark( tileSize, (unsigned)latency, (unsigned)flyInLevel );
+}
@@ -30,12 +30,37 @@ using namespace OpenThreads;
 
 CacheTileHandler::CacheTileHandler( TerrainLayer* layer, Map* map ):
 _layer( layer ),
-_map( map )
+_map( map ),
+_skipCached( false )
 {
+    if ( _layer->getTileSource() && _map.valid() )
+    {
+        _coverage = new TileCoverageIndex( _layer->getTileSource(), _map->getProfile() );
+    }
+
+    // Without an age limit on the cache, a tile that's in the cache is done and
+    // there's no need to read it back.
+    const CachePolicy& policy = _layer->getCachePolicy();
+    _skipCached = 
+        policy.isCacheWriteable() &&
+        !policy.maxAge().isSet() &&
+        !policy.minTime().isSet();
 }
 
 bool CacheTileHandler::handleTile(const TileKey& key, const TileVisitor& tv)
 {        
+    // The visitor got here because there might be data under this key, but
+    // maybe not at this level.
+    if (_coverage.valid() && !_coverage->hasData(key))
+    {
+        return true;
+    }
+
+    if (_skipCached && _layer->isCached(key))
+    {
+        return true;
+    }
+
     ImageLayer* imageLayer = dynamic_cast< ImageLayer* >( _layer.get() );
     ElevationLayer* elevationLayer = dynamic_cast< ElevationLayer* >( _layer.get() );    
 
@@ -67,8 +92,84 @@ bool CacheTileHandler::handleTile(const TileKey& key, const TileVisitor& tv)
     return false;        
 }   
 
+namespace
+{
+    // What the fetch stage leaves for the store stage: the new image or
+    // heightfield to cache, or nothing if the tile needs no writing.
+    struct SeedTile : public osg::Referenced
+    {
+        osg::ref_ptr<osg::Image>       _image;
+        osg::ref_ptr<osg::HeightField> _hf;
+    };
+}
+
+bool CacheTileHandler::supportsStages() const
+{
+    return
+        dynamic_cast<ImageLayer*>( _layer.get() ) != 0L ||
+        dynamic_cast<ElevationLayer*>( _layer.get() ) != 0L;
+}
+
+osg::Referenced* CacheTileHandler::fetchTile( const TileKey& key )
+{
+    // as in handleTile, a tile with nothing to do succeeds.
+    osg::ref_ptr<SeedTile> tile = new SeedTile();
+
+    if (_coverage.valid() && !_coverage->hasData(key))
+    {
+        return tile.release();
+    }
+
+    if (_skipCached && _layer->isCached(key))
+    {
+        return tile.release();
+    }
+
+    ImageLayer* imageLayer = dynamic_cast< ImageLayer* >( _layer.get() );
+    ElevationLayer* elevationLayer = dynamic_cast< ElevationLayer* >( _layer.get() );    
+
+    bool valid = false;
+    if (imageLayer)
+    {
+        valid = imageLayer->fetchImage( key, tile->_image ).valid();
+    }
+    else if (elevationLayer)
+    {
+        valid = elevationLayer->fetchHeightField( key, tile->_hf ).valid();
+    }
+
+    // see handleTile.
+    if (valid || !_layer->isKeyInRange(key))
+    {
+        return tile.release();
+    }
+
+    return 0L;
+}
+
+bool CacheTileHandler::storeTile( const TileKey& key, osg::Referenced* data )
+{
+    SeedTile* tile = static_cast<SeedTile*>( data );
+
+    if (tile->_image.valid())
+    {
+        return static_cast<ImageLayer*>( _layer.get() )->writeImageToCache( key, tile->_image.get() );
+    }
+    else if (tile->_hf.valid())
+    {
+        return static_cast<ElevationLayer*>( _layer.get() )->writeHeightFieldToCache( key, tile->_hf.get() );
+    }
+
+    return true;
+}
+
 bool CacheTileHandler::hasData( const TileKey& key ) const
 {
+    if (_coverage.valid())
+    {
+        return _coverage->mayHaveData(key);
+    }
+
     TileSource* ts = _layer->getTileSource();
     if (ts)
     {
@@ -130,6 +231,8 @@ void CacheSeed::setVisitor(TileVisitor* visitor)
 
 void CacheSeed::run( TerrainLayer* layer, Map* map )
 {
-    _visitor->setTileHandler( new CacheTileHandler( layer, map ) );
+    CacheTileHandler* handler = new CacheTileHandler( layer, map );
+    _visitor->setTileHandler( handler );
+    _visitor->setCoverageIndex( handler->getCoverageIndex() );
     _visitor->run( map->getProfile() );
 }
\ No newline at end of file
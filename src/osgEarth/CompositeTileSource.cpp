@@ -31,7 +31,8 @@ using namespace osgEarth;
 //------------------------------------------------------------------------
 
 CompositeTileSourceOptions::CompositeTileSourceOptions( const TileSourceOptions& options ) :
-TileSourceOptions( options )
+TileSourceOptions( options ),
+_layerThreads    ( 0u )
 {
     setDriver( "composite" );
     fromConfig( _conf );
@@ -64,6 +65,8 @@ CompositeTileSourceOptions::getConfig() const
             conf.add( "image", i->_imageLayerOptions->getConfig() );
     }
 
+    conf.updateIfSet( "layer_threads", _layerThreads );
+
     return conf;
 }
 
@@ -99,6 +102,8 @@ CompositeTileSourceOptions::fromConfig( const Config& conf )
     {
         OE_WARN << LC << "Illegal - composite driver only supports image and elevation layers" << std::endl;
     }
+
+    conf.getIfSet( "layer_threads", _layerThreads );
 }
 
 //------------------------------------------------------------------------
@@ -128,6 +133,153 @@ namespace
 
     // some helper types.    
     typedef std::vector<ImageInfo> ImageMixVector;   
+
+    // One component layer's part of a concurrent composite.
+    struct LayerResult : public osg::Referenced
+    {
+        ImageInfo        _info;
+        GeoImage         _fallback;
+        Threading::Event _done;
+    };
+
+    // The state a concurrent composite shares with its tasks. A layer with no
+    // image for the key only needs a parent-key fallback if another layer has
+    // an image, so it waits for that before asking for one; if no layer has
+    // data for the tile, no fallbacks are requested at all.
+    struct CompositeRequest : public osg::Referenced
+    {
+        CompositeRequest(const TileKey& key, ProgressCallback* progress, TaskService* service)
+            : _key(key), _progress(progress), _service(service), _haveImage(false), _primariesLeft(0u) { }
+
+        bool isCanceled() const { return _progress && _progress->isCanceled(); }
+
+        // called once per layer whose image was requested. A task released
+        // without running passes canFetch = false, so it doesn't queue more
+        // work from a queue that is being cleared.
+        void finishPrimary(unsigned i, bool canFetch);
+
+        TileKey                                 _key;
+        ProgressCallback*                       _progress;
+        TaskService*                            _service;
+        std::vector<osg::ref_ptr<ImageLayer> >  _imageLayers;
+        std::vector<osg::ref_ptr<LayerResult> > _layers;
+
+        Threading::Mutex                        _mutex;
+        bool                                    _haveImage;
+        unsigned                                _primariesLeft;
+        std::vector<unsigned>                   _waiting;   // layers with no image, waiting for another's
+    };
+
+    // Finds a layer's fallback from the nearest ancestor key with data.
+    struct CreateFallbackImageTask : public TaskRequest
+    {
+        CreateFallbackImageTask(CompositeRequest* request, unsigned i)
+            : _request(request), _i(i), _ran(false) { }
+
+        // a request canceled or cleared before it runs is released without
+        // running, so the waiter still has to hear about it.
+        virtual ~CreateFallbackImageTask()
+        {
+            if ( !_ran )
+                _request->_layers[_i]->_done.set();
+        }
+
+        void operator()( ProgressCallback* )
+        {
+            LayerResult* result = _request->_layers[_i].get();
+            ImageLayer*  layer  = _request->_imageLayers[_i].get();
+
+            for(TileKey parentKey = _request->_key.createParentKey();
+                parentKey.valid() && !result->_fallback.valid() && !_request->isCanceled();
+                parentKey = parentKey.createParentKey())
+            {
+                result->_fallback = layer->createImage( parentKey, _request->_progress );
+            }
+
+            _ran = true;
+            result->_done.set();
+        }
+
+        osg::ref_ptr<CompositeRequest> _request;
+        unsigned                       _i;
+        bool                           _ran;
+    };
+
+    // Creates one component layer's image.
+    struct CreateLayerImageTask : public TaskRequest
+    {
+        CreateLayerImageTask(CompositeRequest* request, unsigned i)
+            : _request(request), _i(i), _ran(false) { }
+
+        virtual ~CreateLayerImageTask()
+        {
+            if ( !_ran )
+                _request->finishPrimary( _i, false );
+        }
+
+        void operator()( ProgressCallback* )
+        {
+            if ( !_request->isCanceled() )
+            {
+                GeoImage image = _request->_imageLayers[_i]->createImage( _request->_key, _request->_progress );
+                if ( image.valid() )
+                    _request->_layers[_i]->_info.image = image.getImage();
+            }
+
+            _ran = true;
+            _request->finishPrimary( _i, true );
+        }
+
+        osg::ref_ptr<CompositeRequest> _request;
+        unsigned                       _i;
+        bool                           _ran;
+    };
+
+    void CompositeRequest::finishPrimary(unsigned i, bool canFetch)
+    {
+        std::vector<unsigned> fallbacks, finished;
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            --_primariesLeft;
+
+            if ( _layers[i]->_info.image.valid() )
+            {
+                finished.push_back( i );
+                if ( !_haveImage )
+                {
+                    // the first image: the layers waiting on it need fallbacks now.
+                    _haveImage = true;
+                    fallbacks.swap( _waiting );
+                }
+            }
+            else if ( _haveImage )
+            {
+                fallbacks.push_back( i );
+            }
+            else
+            {
+                _waiting.push_back( i );
+
+                // no layer had an image, so none needs a fallback.
+                if ( _primariesLeft == 0u )
+                    finished.swap( _waiting );
+            }
+        }
+
+        // queue the fallbacks before releasing the waiter, which owns the service.
+        for(unsigned k = 0; k < fallbacks.size(); ++k)
+        {
+            if ( canFetch && !isCanceled() )
+                _service->add( new CreateFallbackImageTask(this, fallbacks[k]) );
+            else
+                finished.push_back( fallbacks[k] );
+        }
+
+        for(unsigned k = 0; k < finished.size(); ++k)
+        {
+            _layers[finished[k]]->_done.set();
+        }
+    }
 }
 
 //-----------------------------------------------------------------------
@@ -145,6 +297,11 @@ osg::Image*
 CompositeTileSource::createImage(const TileKey&    key,
                                  ProgressCallback* progress )
 {    
+    if ( _options.layerThreads().get() > 1 && _imageLayers.size() > 1 )
+    {
+        return createImageConcurrently( key, progress );
+    }
+
     ImageMixVector images;
     images.reserve(_imageLayers.size());
 
@@ -273,6 +430,112 @@ CompositeTileSource::createImage(const TileKey&    key,
 
 }
 
+osg::Image*
+CompositeTileSource::createImageConcurrently(const TileKey&    key,
+                                             ProgressCallback* progress)
+{
+    TaskService* service = 0L;
+    {
+        Threading::ScopedMutexLock lock( _serviceMutex );
+        if ( !_service.valid() )
+        {
+            _service = new TaskService(
+                "CompositeTileSource", _options.layerThreads().get(), 0u, TaskService::SCHEDULER_WORK_STEALING );
+        }
+        service = _service.get();
+    }
+
+    const unsigned numLayers = _imageLayers.size();
+
+    osg::ref_ptr<CompositeRequest> request = new CompositeRequest( key, progress, service );
+    request->_imageLayers.assign( _imageLayers.begin(), _imageLayers.end() );
+    request->_layers.resize( numLayers );
+
+    std::vector<unsigned> toRequest;
+    for (unsigned int i = 0; i < numLayers; i++)
+    {
+        ImageLayer*  layer  = _imageLayers[i].get();
+        LayerResult* result = new LayerResult();
+        result->_info.dataInExtents = layer->getTileSource()->hasDataInExtent( key.getExtent() );
+        result->_info.opacity = layer->getOpacity();
+        request->_layers[i] = result;
+
+        if (result->_info.dataInExtents)
+            toRequest.push_back( i );
+        else
+            result->_done.set();
+    }
+
+    // Put every layer's request in flight.
+    request->_primariesLeft = toRequest.size();
+    for (unsigned int k = 0; k < toRequest.size(); k++)
+    {
+        service->add( new CreateLayerImageTask(request.get(), toRequest[k]) );
+    }
+
+    // Blend the results in layer order as they arrive. A layer that only has a
+    // fallback image can't be blended until the output size is known (from the
+    // first layer with an image of its own), so the blend waits there until then.
+    osg::Vec2s textureSize;
+    bool       haveSize    = false;
+    int        first       = -1;
+    unsigned   nextToBlend = 0;
+    osg::ref_ptr<osg::Image> result;
+
+    for (unsigned int i = 0; i < numLayers; i++)
+    {
+        LayerResult* layerResult = request->_layers[i].get();
+        while ( !layerResult->_done.isSet() )
+            layerResult->_done.wait();
+
+        if ( !haveSize && layerResult->_info.image.valid() )
+        {
+            textureSize.set( layerResult->_info.image->s(), layerResult->_info.image->t() );
+            haveSize = true;
+        }
+
+        for ( ; haveSize && nextToBlend <= i; ++nextToBlend )
+        {
+            ImageInfo&      info     = request->_layers[nextToBlend]->_info;
+            const GeoImage& fallback = request->_layers[nextToBlend]->_fallback;
+
+            if ( !info.image.valid() && fallback.valid() )
+            {
+                // TODO:  Bilinear options?
+                bool bilinear = _imageLayers[nextToBlend]->isCoverage() ? false : true;
+                GeoImage cropped = fallback.crop( key.getExtent(), true, textureSize.x(), textureSize.y(), bilinear);
+                info.image = cropped.getImage();
+            }
+
+            if ( !info.image.valid() )
+            {
+                continue;
+            }
+
+            if ( first < 0 )
+            {
+                first = nextToBlend;
+            }
+            else
+            {
+                if ( !result.valid() )
+                {
+                    result = new osg::Image( *request->_layers[first]->_info.image.get() );
+                }
+                ImageUtils::mix( result.get(), info.image.get(), info.opacity );
+            }
+        }
+    }
+
+    if ( (progress && progress->isCanceled()) || first < 0 )
+    {
+        return 0L;
+    }
+
+    // with a single valid image, return it without compositing.
+    return result.valid() ? result.release() : request->_layers[first]->_info.image.release();
+}
+
 osg::HeightField* CompositeTileSource::createHeightField(
             const TileKey&        key,
             ProgressCallback*     progress )
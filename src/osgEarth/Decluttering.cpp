@@ -25,7 +25,8 @@
 #include <osgUtil/StateGraph>
 #include <osgText/Text>
 #include <osg/UserDataContainer>
-#include <set>
+#include <osg/Math>
+#include <vector>
 #include <algorithm>
 
 #define LC "[Declutter] "
@@ -86,6 +87,218 @@ namespace
     
     typedef std::pair<const osg::Node*, osg::BoundingBox> RenderLeafBox;
 
+    // whether a window-space box conflicts with an occupied one. Boxes that
+    // share a parent never conflict.
+    inline bool boxesConflict( const osg::BoundingBox& box, const osg::Node* parent, const RenderLeafBox& used )
+    {
+        // only need a 2D test since we're in clip space
+        bool isClear =
+            box.xMin() > used.second.xMax() ||
+            box.xMax() < used.second.xMin() ||
+            box.yMin() > used.second.yMax() ||
+            box.yMax() < used.second.yMin();
+
+        return !isClear && parent != used.first;
+    }
+
+    // Uniform grid over the viewport that buckets the occupied window-space
+    // boxes by the cells they touch, so that testing a new box only visits
+    // the occupied boxes around it. Boxes off the viewport fall into the
+    // border cells. Keeps its storage from one pass to the next.
+    struct DeclutterGrid
+    {
+        enum { CELL_SIZE = 64, MAX_CELLS = 256 };
+
+        DeclutterGrid() : _cols(1), _rows(1), _x0(0.0f), _y0(0.0f), _cellWidth(1.0f), _cellHeight(1.0f) { }
+
+        // empties the grid and fits it to a viewport.
+        void reset( const osg::Viewport* vp )
+        {
+            for(std::vector<unsigned>::const_iterator i = _occupied.begin(); i != _occupied.end(); ++i)
+                _cells[*i].clear();
+            _occupied.clear();
+            _unbounded.clear();
+
+            _cols = osg::clampBetween( (unsigned)ceil(vp->width()/(double)CELL_SIZE),  1u, (unsigned)MAX_CELLS );
+            _rows = osg::clampBetween( (unsigned)ceil(vp->height()/(double)CELL_SIZE), 1u, (unsigned)MAX_CELLS );
+            _x0 = vp->x();
+            _y0 = vp->y();
+            _cellWidth  = osg::maximum( (float)(vp->width()/(double)_cols), 1.0f );
+            _cellHeight = osg::maximum( (float)(vp->height()/(double)_rows), 1.0f );
+            _cells.resize( _cols*_rows );
+        }
+
+        // records the occupied box at an index in the used list.
+        void insert( unsigned index, const osg::BoundingBox& box )
+        {
+            unsigned c0, r0, c1, r1;
+            if ( !getCells(box, c0, r0, c1, r1) )
+            {
+                _unbounded.push_back( index );
+                return;
+            }
+
+            for(unsigned r=r0; r<=r1; ++r)
+            {
+                for(unsigned c=c0; c<=c1; ++c)
+                {
+                    std::vector<unsigned>& cell = _cells[r*_cols + c];
+                    if ( cell.empty() )
+                        _occupied.push_back( r*_cols + c );
+                    cell.push_back( index );
+                }
+            }
+        }
+
+        // whether a box conflicts with any of the occupied boxes in the used list.
+        bool conflicts( const osg::BoundingBox& box, const osg::Node* parent, const std::vector<RenderLeafBox>& used ) const
+        {
+            for(std::vector<unsigned>::const_iterator i = _unbounded.begin(); i != _unbounded.end(); ++i)
+            {
+                if ( boxesConflict(box, parent, used[*i]) )
+                    return true;
+            }
+
+            unsigned c0, r0, c1, r1;
+            if ( !getCells(box, c0, r0, c1, r1) )
+            {
+                // a box with undefined extents overlaps everything; no need for the grid.
+                for(std::vector<RenderLeafBox>::const_iterator j = used.begin(); j != used.end(); ++j)
+                {
+                    if ( boxesConflict(box, parent, *j) )
+                        return true;
+                }
+                return false;
+            }
+
+            for(unsigned r=r0; r<=r1; ++r)
+            {
+                for(unsigned c=c0; c<=c1; ++c)
+                {
+                    const std::vector<unsigned>& cell = _cells[r*_cols + c];
+                    for(std::vector<unsigned>::const_iterator i = cell.begin(); i != cell.end(); ++i)
+                    {
+                        if ( boxesConflict(box, parent, used[*i]) )
+                            return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        // range of cells a box touches; false if the box has undefined extents.
+        bool getCells( const osg::BoundingBox& box, unsigned& c0, unsigned& r0, unsigned& c1, unsigned& r1 ) const
+        {
+            if ( osg::isNaN(box.xMin()) || osg::isNaN(box.xMax()) || osg::isNaN(box.yMin()) || osg::isNaN(box.yMax()) )
+                return false;
+
+            c0 = cell( box.xMin(), _x0, _cellWidth,  _cols );
+            c1 = cell( box.xMax(), _x0, _cellWidth,  _cols );
+            r0 = cell( box.yMin(), _y0, _cellHeight, _rows );
+            r1 = cell( box.yMax(), _y0, _cellHeight, _rows );
+            return c0 <= c1 && r0 <= r1;
+        }
+
+        static unsigned cell( float v, float origin, float size, unsigned count )
+        {
+            float f = (v - origin) / size;
+            if ( f <= 0.0f )
+                return 0u;
+            if ( f >= (float)count )
+                return count-1;
+            return osg::minimum( (unsigned)f, count-1 );
+        }
+
+        unsigned                            _cols, _rows;
+        float                               _x0, _y0, _cellWidth, _cellHeight;
+        std::vector< std::vector<unsigned> > _cells;
+        std::vector<unsigned>               _occupied;   // cells that are not empty
+        std::vector<unsigned>               _unbounded;  // boxes with undefined extents
+    };
+
+    // Set of nodes in a flat, open-addressed hash table (linear probing).
+    // Clearing it keeps the table for the next pass.
+    struct NodeSet
+    {
+        NodeSet() : _size(0), _hasNull(false) { }
+
+        void clear()
+        {
+            if ( _size > 0 )
+                std::fill( _slots.begin(), _slots.end(), (const osg::Node*)0L );
+            _size = 0;
+            _hasNull = false;
+        }
+
+        bool contains( const osg::Node* node ) const
+        {
+            if ( !node )
+                return _hasNull;
+            if ( _size == 0 )
+                return false;
+
+            unsigned mask = _slots.size()-1;
+            for(unsigned i = hash(node) & mask; _slots[i] != 0L; i = (i+1) & mask)
+            {
+                if ( _slots[i] == node )
+                    return true;
+            }
+            return false;
+        }
+
+        void insert( const osg::Node* node )
+        {
+            if ( !node )
+            {
+                _hasNull = true;
+                return;
+            }
+
+            // keep the table at most half full.
+            if ( 2*(_size+1) > _slots.size() )
+            {
+                std::vector<const osg::Node*> old( osg::maximum(2*(unsigned)_slots.size(), 64u), (const osg::Node*)0L );
+                old.swap( _slots );
+                _size = 0;
+                for(std::vector<const osg::Node*>::const_iterator i = old.begin(); i != old.end(); ++i)
+                {
+                    if ( *i )
+                        add( *i );
+                }
+            }
+
+            add( node );
+        }
+
+    private:
+        void add( const osg::Node* node )
+        {
+            unsigned mask = _slots.size()-1;
+            unsigned i = hash(node) & mask;
+            for( ; _slots[i] != 0L; i = (i+1) & mask)
+            {
+                if ( _slots[i] == node )
+                    return;
+            }
+            _slots[i] = node;
+            ++_size;
+        }
+
+        static unsigned hash( const osg::Node* node )
+        {
+            // nodes are heap-allocated, so the low bits carry little information.
+            size_t h = reinterpret_cast<size_t>(node) >> 4;
+            h ^= h >> 16;
+            h *= 0x45d9f3bu;
+            h ^= h >> 16;
+            return (unsigned)h;
+        }
+
+        std::vector<const osg::Node*> _slots;
+        unsigned                      _size;
+        bool                          _hasNull;
+    };
+
     // Data structure stored one-per-View.
     struct PerCamInfo
     {
@@ -98,6 +311,8 @@ namespace
         osgUtil::RenderBin::RenderLeafList _passed;
         osgUtil::RenderBin::RenderLeafList _failed;
         std::vector<RenderLeafBox>         _used;
+        DeclutterGrid                      _grid;
+        NodeSet                            _culledParents;
 
         // time stamp of the previous pass, for calculating animation speed
         //double _lastTimeStamp;
@@ -223,6 +438,7 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
         local._passed.clear();          // drawables that pass occlusion test
         local._failed.clear();          // drawables that fail occlusion test
         local._used.clear();            // list of occupied bounding boxes in screen space
+        local._culledParents.clear();   // parents of drawables that failed the occlusion test
 
         // compute a window matrix so we can do window-space culling. If this is an RTT camera
         // with a reference camera attachment, we actually want to declutter in the window-space
@@ -245,10 +461,13 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
 
         osg::Matrix windowMatrix = vp->computeWindowMatrix();
 
+        // bucket the occupied boxes in window space.
+        local._grid.reset( vp );
+
         // Track the parent nodes of drawables that are obscured (and culled). Drawables
         // with the same parent node (typically a Geode) are considered to be grouped and
         // will be culled as a group.
-        std::set<const osg::Node*> culledParents;
+        NodeSet& culledParents = local._culledParents;
 
         const DeclutteringOptions& options = _context->_options;
         unsigned limit = *options.maxObjects();
@@ -290,32 +509,15 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
             // if this leaf is already in a culled group, skip it.
             if ( s_enabledGlobally )
             {
-                if ( culledParents.find(drawableParent) != culledParents.end() )
+                if ( culledParents.contains(drawableParent) )
                 {
                     visible = false;
                 }
                 else
                 {
-                    // weed out any drawables that are obscured by closer drawables.
-                    // TODO: think about a more efficient algorithm - right now we are just using
-                    // brute force to compare all bbox's
-                    for( std::vector<RenderLeafBox>::const_iterator j = local._used.begin(); j != local._used.end(); ++j )
-                    {
-                        // only need a 2D test since we're in clip space
-                        bool isClear =
-                            box.xMin() > j->second.xMax() ||
-                            box.xMax() < j->second.xMin() ||
-                            box.yMin() > j->second.yMax() ||
-                            box.yMax() < j->second.yMin();
-
-                        // if there's an overlap (and the conflict isn't from the same drawable
-                        // parent, which is acceptable), then the leaf is culled.
-                        if ( !isClear && drawableParent != j->first )
-                        {
-                            visible = false;
-                            break;
-                        }
-                    }
+                    // weed out any drawables that are obscured by closer drawables,
+                    // testing only the occupied boxes in the grid cells this one touches.
+                    visible = !local._grid.conflicts( box, drawableParent, local._used );
                 }
             }
 
@@ -323,6 +525,7 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
             {
                 // passed the test, so add the leaf's bbox to the "used" list, and add the leaf
                 // to the final draw list.
+                local._grid.insert( local._used.size(), box );
                 local._used.push_back( std::make_pair(drawableParent, box) );
                 local._passed.push_back( leaf );
             }
@@ -358,7 +561,7 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
                 osgUtil::RenderLeaf* leaf     = *i;
                 const osg::Drawable* drawable = leaf->getDrawable();
 
-                if ( culledParents.find( drawable->getParent(0) ) == culledParents.end() )
+                if ( !culledParents.contains( drawable->getParent(0) ) )
                 {
                     DrawableInfo& info = local._memory[drawable];
 
@@ -21,6 +21,8 @@
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/Progress>
 #include <osgEarth/MemCache>
+#include <osgEarth/Profiler>
+#include <osgEarth/Metrics>
 #include <osg/Version>
 #include <iterator>
 
@@ -84,6 +86,10 @@ ElevationLayerOptions::mergeConfig( const Config& conf )
 
 namespace
 {
+    const Metrics::Counter s_cacheReads  = Metrics::getCounter("cache.elevation.reads");
+    const Metrics::Counter s_cacheHits   = Metrics::getCounter("cache.elevation.hits");
+    const Metrics::Counter s_cacheWrites = Metrics::getCounter("cache.elevation.writes");
+
     struct ElevationLayerPreCacheOperation : public TileSource::HeightFieldOperation
     {
         osg::ref_ptr<CompositeValidValueOperator> _ops;
@@ -367,6 +373,36 @@ ElevationLayer::assembleHeightFieldFromTileSource(const TileKey&    key,
 GeoHeightField
 ElevationLayer::createHeightField(const TileKey&    key,
                                   ProgressCallback* progress )
+{
+    return createHeightField( key, progress, 0L );
+}
+
+GeoHeightField
+ElevationLayer::fetchHeightField(const TileKey&                  key,
+                                 osg::ref_ptr<osg::HeightField>& toCache,
+                                 ProgressCallback*               progress )
+{
+    toCache = 0L;
+    return createHeightField( key, progress, &toCache );
+}
+
+bool
+ElevationLayer::writeHeightFieldToCache(const TileKey& key, const osg::HeightField* hf)
+{
+    CacheBin* cacheBin = getCacheBin( key.getProfile() );
+    if ( !hf || !cacheBin || !getCachePolicy().isCacheWriteable() )
+        return false;
+
+    OE_PROFILING_ZONE("Cache write");
+    Metrics::add( s_cacheWrites );
+
+    return cacheBin->write( key.str(), hf );
+}
+
+GeoHeightField
+ElevationLayer::createHeightField(const TileKey&                  key,
+                                  ProgressCallback*               progress,
+                                  osg::ref_ptr<osg::HeightField>* toCache )
 {
     GeoHeightField result;
     osg::ref_ptr<osg::HeightField> hf;
@@ -423,6 +459,9 @@ ElevationLayer::createHeightField(const TileKey&    key,
 
         if ( cacheBin && getCachePolicy().isCacheReadable() )
         {
+            OE_PROFILING_ZONE("Cache read");
+            Metrics::add( s_cacheReads );
+
             ReadResult r = cacheBin->readObject( key.str() );
             if ( r.succeeded() )
             {            
@@ -434,6 +473,7 @@ ElevationLayer::createHeightField(const TileKey&    key,
                     {
                         hf = cachedHF;
                         fromCache = true;
+                        Metrics::add( s_cacheHits );
                     }
                 }
             }
@@ -470,7 +510,16 @@ ElevationLayer::createHeightField(const TileKey&    key,
                  !fromCache    &&
                  getCachePolicy().isCacheWriteable() )
             {
-                cacheBin->write( key.str(), hf );
+                if ( toCache )
+                {
+                    // the caller writes it, so hand over a copy that the
+                    // post-processing below cannot touch.
+                    *toCache = new osg::HeightField( *hf.get(), osg::CopyOp::DEEP_COPY_ALL );
+                }
+                else
+                {
+                    writeHeightFieldToCache( key, hf.get() );
+                }
             }
 
             // We have an expired heightfield from the cache and no new data from the TileSource.  So just return the cached data.
@@ -579,6 +628,8 @@ ElevationLayerVector::populateHeightField(osg::HeightField*      hf,
                                           ElevationInterpolation interpolation,
                                           ProgressCallback*      progress ) const
 {
+    OE_PROFILING_ZONE("ElevationLayerVector::populateHeightField");
+
     // heightfield must already exist.
     if ( !hf )
         return false;
@@ -670,141 +721,83 @@ ElevationLayerVector::populateHeightField(osg::HeightField*      hf,
         return false;
     }
     
-    // Sample the layers into our target.
+    // Sample the layers into our target, one whole layer at a time. Each layer
+    // only fills the posts that higher-priority layers left unresolved, and we
+    // stop loading layers as soon as every post is resolved.
     unsigned numColumns = hf->getNumColumns();
-    unsigned numRows    = hf->getNumRows();    
-    double   xmin       = key.getExtent().xMin();
-    double   ymin       = key.getExtent().yMin();
-    double   dx         = key.getExtent().width() / (double)(numColumns-1);
-    double   dy         = key.getExtent().height() / (double)(numRows-1);
-    
-    // We will load the actual heightfields on demand. We might not need them all.
-    GeoHeightFieldVector heightFields(contenders.size());
-    GeoHeightFieldVector offsetFields(offsets.size());
-    std::vector<bool>    heightFallback(contenders.size(), false);
-    std::vector<bool>    heightFailed(contenders.size(), false);
-    std::vector<bool>    offsetFailed(offsets.size(), false);
-
-    // The maximum number of heightfields to keep in this local cache
-    unsigned int maxHeightFields = 50;
-    unsigned numHeightFieldsInCache = 0;
+    unsigned numRows    = hf->getNumRows();
+    unsigned numPosts   = numColumns * numRows;
+    float*   heights    = &hf->getFloatArray()->front();
 
-    const SpatialReference* keySRS = keyToUse.getProfile()->getSRS();
+    const GeoExtent&        gridExtent = keyToUse.getExtent();
+    const SpatialReference* keySRS     = keyToUse.getProfile()->getSRS();
 
     bool realData = false;
 
-    unsigned int total = numColumns * numRows;
-    unsigned int completed = 0;
+    std::vector<bool>  resolved(numPosts, false);
+    unsigned           numResolved = 0;
+    std::vector<float> samples;
 
-    for (unsigned c = 0; c < numColumns; ++c)
+    for(unsigned i=0; i<contenders.size() && numResolved < numPosts; ++i)
     {
-        double x = xmin + (dx * (double)c);
-        for (unsigned r = 0; r < numRows; ++r)
-        {
-            double y = ymin + (dy * (double)r);
-
-            // Collect elevations from each layer as necessary.
-            bool resolved = false;
+        ElevationLayer* layer = contenders[i].first.get();
+        TileKey actualKey = contenders[i].second;
 
-            for(int i=0; i<contenders.size() && !resolved; ++i)
+        // Fall back on parent keys to make sure that we have data at the
+        // location even if it's fallback data.
+        GeoHeightField layerHF;
+        while (!layerHF.valid() && actualKey.valid())
+        {
+            layerHF = layer->createHeightField(actualKey, progress);
+            if (!layerHF.valid())
             {
-                if ( heightFailed[i] )
-                    continue;
-
-                ElevationLayer* layer = contenders[i].first.get();
+                actualKey = actualKey.createParentKey();
+            }
+        }
 
-                GeoHeightField& layerHF = heightFields[i];
-                TileKey actualKey = contenders[i].second;
+        if ( !layerHF.valid() )
+            continue;
 
-                if (!layerHF.valid())
-                {
-                    // We couldn't get the heightfield from the cache, so try to create it.
-                    // We also fallback on parent layers to make sure that we have data at the location even if it's fallback.
-                    while (!layerHF.valid() && actualKey.valid())
-                    {
-                        layerHF = layer->createHeightField(actualKey, progress);
-                        if (!layerHF.valid())
-                        {
-                            actualKey = actualKey.createParentKey();
-                        }
-                    }
-
-                    // Mark this layer as fallback if necessary.
-                    if (layerHF.valid())
-                    {
-                        heightFallback[i] = actualKey != contenders[i].second;
-                        numHeightFieldsInCache++;
-                    }
-                    else
-                    {
-                        heightFailed[i] = true;
-                        continue;
-                    }
-                }
+        // We only have real data if this is not a fallback heightfield.
+        if ( actualKey == contenders[i].second )
+        {
+            realData = true;
+        }
 
-                if (layerHF.valid())
+        if ( layerHF.getElevations(gridExtent, numColumns, numRows, interpolation, keySRS, samples, &resolved) )
+        {
+            for(unsigned k=0; k<numPosts; ++k)
+            {
+                if ( !resolved[k] && samples[k] != NO_DATA_VALUE )
                 {
-                    bool isFallback = heightFallback[i];
-
-                    // We only have real data if this is not a fallback heightfield.
-                    if (!isFallback)
-                    {
-                        realData = true;
-                    }
-
-                    float elevation;
-                    if (layerHF.getElevation(keySRS, x, y, interpolation, keySRS, elevation) &&
-                        elevation != NO_DATA_VALUE)
-                    {
-                        resolved = true;                    
-                        hf->setHeight(c, r, elevation);
-                    }
+                    heights[k]  = samples[k];
+                    resolved[k] = true;
+                    ++numResolved;
                 }
+            }
+        }
+    }
 
+    for(int i=offsets.size()-1; i>=0; --i)
+    {
+        GeoHeightField layerHF = offsets[i].first->createHeightField(offsets[i].second, progress);
+        if ( !layerHF.valid() )
+            continue;
 
-                // Clear the heightfield cache if we have too many heightfields in the cache.
-                if (numHeightFieldsInCache >= maxHeightFields)
-                {
-                    //OE_NOTICE << "Clearing cache" << std::endl;
-                    for (unsigned int k = 0; k < heightFields.size(); k++)
-                    {
-                        heightFields[k] = GeoHeightField::INVALID;
-                        heightFallback[k] = false;
-                    }
-                    numHeightFieldsInCache = 0;
-                }
-            }
+        // If we actually got a layer then we have real data
+        realData = true;
 
-            for(int i=offsets.size()-1; i>=0; --i)
+        if ( layerHF.getElevations(gridExtent, numColumns, numRows, interpolation, keySRS, samples) )
+        {
+            for(unsigned k=0; k<numPosts; ++k)
             {
-                if ( offsetFailed[i] )
-                    continue;
-
-                GeoHeightField& layerHF = offsetFields[i];
-                if ( !layerHF.valid() )
+                if ( samples[k] != NO_DATA_VALUE )
                 {
-                    ElevationLayer* offset = offsets[i].first.get();
-
-                    layerHF = offset->createHeightField(offsets[i].second, progress);
-                    if ( !layerHF.valid() )
-                    {
-                        offsetFailed[i] = true;
-                        continue;
-                    }
-                }
-
-                // If we actually got a layer then we have real data
-                realData = true;
-
-                float elevation = 0.0f;
-                if (layerHF.getElevation(keySRS, x, y, interpolation, keySRS, elevation) &&
-                    elevation != NO_DATA_VALUE)
-                {                    
-                    hf->getHeight(c, r) += elevation;
+                    heights[k] += samples[k];
                 }
             }
         }
-    }   
+    }
 
     // Return whether or not we actually read any real data
     return realData;
@@ -20,6 +20,7 @@
 #include <osgEarth/Locators>
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/DPLineSegmentIntersector>
+#include <osgEarth/ThreadingUtils>
 #include <osgUtil/IntersectionVisitor>
 
 #define LC "[ElevationQuery] "
@@ -38,6 +39,540 @@ namespace
         x |= x >> 16;
         return x+1;
     }
+
+    // Builds the heightfield for one tile of an elevation query.
+    GeoHeightField createHeightField(const MapFrame& mapf, const TileKey& key, unsigned tileSize)
+    {
+        osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
+        hf->allocate( tileSize, tileSize );
+
+        // Initialize the heightfield to nodata
+        for (unsigned int i = 0; i < hf->getFloatArray()->size(); i++)
+        {
+            hf->getFloatArray()->at( i ) = NO_DATA_VALUE;
+        }
+
+        if ( mapf.populateHeightField(hf, key, false) )
+        {
+            return GeoHeightField( hf.get(), key.getExtent() );
+        }
+        return GeoHeightField::INVALID;
+    }
+
+    // Builds one tile's heightfield for a batch query, in a TaskService thread.
+    struct BuildHeightFieldTask : public TaskRequest
+    {
+        BuildHeightFieldTask(const MapFrame& mapf, const TileKey& key, unsigned tileSize,
+                             GeoHeightField& output, Threading::MultiEvent& done)
+            : _mapf(mapf), _key(key), _tileSize(tileSize), _output(output), _done(done), _notified(false) { }
+
+        // a request canceled or cleared before it runs is released without
+        // running, so the waiter still has to hear about it.
+        virtual ~BuildHeightFieldTask()
+        {
+            if ( !_notified )
+                _done.notify();
+        }
+
+        void operator()( ProgressCallback* progress )
+        {
+            _output = createHeightField( _mapf, _key, _tileSize );
+            _notified = true;
+            _done.notify();
+        }
+
+        const MapFrame&        _mapf;
+        TileKey                _key;
+        unsigned               _tileSize;
+        GeoHeightField&        _output;
+        Threading::MultiEvent& _done;
+        bool                   _notified;
+    };
+
+    // Points of a batch query that fall on the same tile.
+    struct TileBucket
+    {
+        std::vector<unsigned> _points;
+        GeoHeightField        _hf;
+    };
+    typedef std::map<TileKey, TileBucket> TileBuckets;
+
+    // Where a query gets its tile heightfields from. ElevationQuery keeps
+    // a private cache; ElevationQueryService shares one between threads.
+    struct HeightFieldProvider
+    {
+        virtual ~HeightFieldProvider() { }
+
+        virtual GeoHeightField getHeightField(const TileKey& key) =0;
+
+        // Fetches a whole set of tiles at once (for batch queries).
+        virtual void getHeightFields(const std::vector<TileKey>& keys, std::vector<GeoHeightField>& out)
+        {
+            out.resize( keys.size() );
+            for(unsigned i=0; i<keys.size(); ++i)
+                out[i] = getHeightField( keys[i] );
+        }
+    };
+
+    // Provider for a single-threaded ElevationQuery. Builds the misses of a
+    // batch on a TaskService when more than one batch thread is requested.
+    struct LocalHeightFieldProvider : public HeightFieldProvider
+    {
+        typedef LRUCache<TileKey, GeoHeightField> Cache;
+
+        LocalHeightFieldProvider(const MapFrame& mapf, unsigned tileSize, Cache& cache,
+                                 unsigned numThreads, osg::ref_ptr<TaskService>& service)
+            : _mapf(mapf), _tileSize(tileSize), _cache(cache), _numThreads(numThreads), _service(service) { }
+
+        GeoHeightField getHeightField(const TileKey& key)
+        {
+            Cache::Record record;
+            if ( _cache.get(key, record) )
+                return record.value();
+
+            GeoHeightField geoHF = createHeightField( _mapf, key, _tileSize );
+            if ( geoHF.valid() )
+                _cache.insert( key, geoHF );
+            return geoHF;
+        }
+
+        void getHeightFields(const std::vector<TileKey>& keys, std::vector<GeoHeightField>& out)
+        {
+            out.resize( keys.size() );
+
+            std::vector<unsigned> misses;
+            for(unsigned i=0; i<keys.size(); ++i)
+            {
+                Cache::Record record;
+                if ( _cache.get(keys[i], record) )
+                    out[i] = record.value();
+                else
+                    misses.push_back( i );
+            }
+
+            if ( _numThreads > 1 && misses.size() > 1 )
+            {
+                if ( !_service.valid() )
+                    _service = new TaskService( "ElevationQuery batch", _numThreads, 0u, TaskService::SCHEDULER_WORK_STEALING );
+
+                Threading::MultiEvent done( misses.size() );
+                for(unsigned m=0; m<misses.size(); ++m)
+                    _service->add( new BuildHeightFieldTask(_mapf, keys[misses[m]], _tileSize, out[misses[m]], done) );
+                done.wait();
+            }
+            else
+            {
+                for(unsigned m=0; m<misses.size(); ++m)
+                    out[misses[m]] = createHeightField( _mapf, keys[misses[m]], _tileSize );
+            }
+
+            for(unsigned m=0; m<misses.size(); ++m)
+            {
+                if ( out[misses[m]].valid() )
+                    _cache.insert( keys[misses[m]], out[misses[m]] );
+            }
+        }
+
+        const MapFrame&            _mapf;
+        unsigned                   _tileSize;
+        Cache&                     _cache;
+        unsigned                   _numThreads;
+        osg::ref_ptr<TaskService>& _service;
+    };
+
+    unsigned getTileSize(const MapFrame& mapf)
+    {
+        return std::max(mapf.getMapOptions().elevationTileSize().get(), 2u);
+    }
+
+    void gatherPatchLayers(const MapFrame& mapf, std::vector<ModelLayer*>& out)
+    {
+        // cache a vector of terrain patch models.
+        out.clear();
+        for(ModelLayerVector::const_iterator i = mapf.modelLayers().begin();
+            i != mapf.modelLayers().end();
+            ++i)
+        {
+            if ( i->get()->isTerrainPatch() )
+                out.push_back( i->get() );
+        }
+    }
+
+    // Whether any elevation layer reports data extents, in which case the
+    // best available level varies from point to point.
+    bool hasDataExtents(const MapFrame& mapf)
+    {
+        for( ElevationLayerVector::const_iterator i = mapf.elevationLayers().begin(); i != mapf.elevationLayers().end(); ++i )
+        {
+            const ElevationLayer* layer = i->get();
+            if ( layer->getEnabled() && layer->getVisible() && layer->getTileSource() && layer->getTileSource()->getDataExtents().size() > 0 )
+                return true;
+        }
+        return false;
+    }
+
+    unsigned getMaxLevel(const MapFrame& mapf, double x, double y, const SpatialReference* srs, const Profile* profile)
+    {
+        int targetTileSizePOT = nextPowerOf2((int)mapf.getMapOptions().elevationTileSize().get());
+
+        int maxLevel = 0;
+        for( ElevationLayerVector::const_iterator i = mapf.elevationLayers().begin(); i != mapf.elevationLayers().end(); ++i )
+        {
+            const ElevationLayer* layer = i->get();
+
+            // skip disabled layers
+            if ( !layer->getEnabled() || !layer->getVisible() )
+                continue;
+
+            int layerMaxLevel = 0;
+
+            osgEarth::TileSource* ts = layer->getTileSource();
+            if ( ts )
+            {
+                // TileSource is good; check for optional data extents:
+                if ( ts->getDataExtents().size() > 0 )
+                {
+                    osg::Vec3d tsCoord(x, y, 0);
+
+                    const SpatialReference* tsSRS = ts->getProfile() ? ts->getProfile()->getSRS() : 0L;
+                    if ( srs && tsSRS )
+                        srs->transform(tsCoord, tsSRS, tsCoord);
+                    else
+                        tsSRS = srs;
+
+                    for (osgEarth::DataExtentList::iterator j = ts->getDataExtents().begin(); j != ts->getDataExtents().end(); j++)
+                    {
+                        if (j->maxLevel().isSet() && j->maxLevel() > layerMaxLevel && j->contains( tsCoord.x(), tsCoord.y(), tsSRS ))
+                        {
+                            layerMaxLevel = j->maxLevel().value();
+                        }
+                    }
+                }
+                else
+                {
+                    // Just use the default max level.  Without any data extents we don't know the actual max
+                    layerMaxLevel = (int)(*layer->getTerrainLayerRuntimeOptions().maxLevel());
+                }
+
+                // cap the max to the layer's express max level (if set).
+                if ( layer->getTerrainLayerRuntimeOptions().maxLevel().isSet() )
+                {
+                    layerMaxLevel = std::min( layerMaxLevel, (int)(*layer->getTerrainLayerRuntimeOptions().maxLevel()) );
+                }
+
+                // Need to convert the layer max of this TileSource to that of the actual profile
+                layerMaxLevel = profile->getEquivalentLOD( ts->getProfile(), layerMaxLevel );
+            }
+            else
+            {
+                // no TileSource? probably in cache-only mode. Use the layer max (or its default).
+                layerMaxLevel = (int)(layer->getTerrainLayerRuntimeOptions().maxLevel().value());
+            }
+
+            // Adjust for the tile size resolution differential, if supported by the layer.
+            int layerTileSize = layer->getTileSize();
+            if (layerTileSize > targetTileSizePOT)
+            {
+                int temp = std::max(targetTileSizePOT, 2);
+                while(temp < layerTileSize) {
+                    temp *= 2;
+                    ++layerMaxLevel;
+                }
+            }
+
+            if (layerMaxLevel > maxLevel)
+            {
+                maxLevel = layerMaxLevel;
+            }
+        }
+
+        return maxLevel;
+    }
+
+    // Intersects a vertical line through the point with the terrain patch layers.
+    bool intersectPatchLayers(const MapFrame&                        mapf,
+                              const std::vector<ModelLayer*>&        patchLayers,
+                              ElevationQueryCacheReadCallback*       eqcrc,
+                              osg::ref_ptr<DPLineSegmentIntersector>& lsi,
+                              const GeoPoint&                        point,
+                              double&                                out_elevation)
+    {
+        if ( patchLayers.empty() )
+            return false;
+
+        osgUtil::IntersectionVisitor iv;
+
+        if ( eqcrc )
+            iv.setReadCallback(eqcrc);
+
+        for(std::vector<ModelLayer*>::const_iterator i = patchLayers.begin(); i != patchLayers.end(); ++i)
+        {
+            // find the scene graph for this layer:
+            osg::Node* node = (*i)->getSceneGraph( mapf.getUID() );
+            if ( node )
+            {
+                // configure for intersection:
+                osg::Vec3d surface;
+                point.toWorld( surface );
+
+                // trivial bounds check:
+                if ( node->getBound().contains(surface) )
+                {
+                    osg::Vec3d nvector;
+                    point.createWorldUpVector(nvector);
+
+                    osg::Vec3d start( surface + nvector*5e5 );
+                    osg::Vec3d end  ( surface - nvector*5e5 );
+
+                    // first time through, set up the intersector on demand
+                    if ( !lsi.valid() )
+                    {
+                        lsi = new DPLineSegmentIntersector(start, end);
+                        lsi->setIntersectionLimit( lsi->LIMIT_NEAREST );
+                    }
+                    else
+                    {
+                        lsi->reset();
+                        lsi->setStart( start );
+                        lsi->setEnd  ( end );
+                    }
+
+                    // try it.
+                    iv.setIntersector( lsi.get() );
+                    node->accept( iv );
+
+                    // check for a result!!
+                    if ( lsi->containsIntersections() )
+                    {
+                        osg::Vec3d isect = lsi->getIntersections().begin()->getWorldIntersectPoint();
+
+                        // transform back to input SRS:
+                        GeoPoint output;
+                        output.fromWorld( point.getSRS(), isect );
+                        out_elevation = output.z();
+                        return true;
+                    }
+                }
+            }
+        }
+
+        return false;
+    }
+
+    // Samples the elevation layers at one (absolute) point, falling back on
+    // parent tiles until one of them has data there.
+    bool sampleElevation(const MapFrame&      mapf,
+                         HeightFieldProvider& provider,
+                         const GeoPoint&      point,
+                         double               desiredResolution,
+                         double&              out_elevation,
+                         double*              out_actualResolution)
+    {
+        if ( mapf.elevationLayers().empty() )
+        {
+            // this means there are no heightfields.
+            out_elevation = 0.0;
+            return true;
+        }
+
+        // tile size (resolution of elevation tiles)
+        unsigned tileSize = getTileSize(mapf);
+
+        //This is the max resolution that we actually have data at this point
+        unsigned int bestAvailLevel = getMaxLevel( mapf, point.x(), point.y(), point.getSRS(), mapf.getProfile());
+
+        if (desiredResolution > 0.0)
+        {
+            unsigned int desiredLevel = mapf.getProfile()->getLevelOfDetailForHorizResolution( desiredResolution, tileSize );
+            if (desiredLevel < bestAvailLevel) bestAvailLevel = desiredLevel;
+        }
+
+        OE_DEBUG << LC << "Best available data level " << point.x() << ", " << point.y() << " = "  << bestAvailLevel << std::endl;
+
+        // transform the input coords to map coords:
+        GeoPoint mapPoint = point;
+        if ( point.isValid() && !point.getSRS()->isHorizEquivalentTo( mapf.getProfile()->getSRS() ) )
+        {
+            mapPoint = point.transform(mapf.getProfile()->getSRS());
+            if ( !mapPoint.isValid() )
+            {
+                OE_WARN << LC << "Fail: coord transform failed" << std::endl;
+                return false;
+            }
+        }
+
+        // get the tilekey corresponding to the tile we need:
+        TileKey key = mapf.getProfile()->createTileKey( mapPoint.x(), mapPoint.y(), bestAvailLevel );
+        if ( !key.valid() )
+        {
+            OE_WARN << LC << "Fail: coords fall outside map" << std::endl;
+            return false;
+        }
+
+        bool result = false;
+        while (!result)
+        {
+            GeoHeightField geoHF = provider.getHeightField( key );
+
+            if (geoHF.valid())
+            {
+                float elevation = 0.0f;
+                result = geoHF.getElevation( mapPoint.getSRS(), mapPoint.x(), mapPoint.y(), mapf.getMapInfo().getElevationInterpolation(), mapPoint.getSRS(), elevation);
+                if (result && elevation != NO_DATA_VALUE)
+                {
+                    // see what the actual resolution of the heightfield is.
+                    if ( out_actualResolution )
+                        *out_actualResolution = geoHF.getXInterval();
+                    out_elevation = (double)elevation;
+                    break;
+                }
+                else
+                {
+                    result = false;
+                }
+            }
+
+            if (!result)
+            {
+                key = key.createParentKey();
+                if (!key.valid())
+                {
+                    break;
+                }
+            }
+        }
+
+        return result;
+    }
+
+    // Samples the elevation layers at a whole set of points. Points are grouped by
+    // the tile that serves them, so each tile is fetched only once and all of its
+    // points are sampled together.
+    void sampleElevations(const MapFrame&                mapf,
+                          HeightFieldProvider&           provider,
+                          const std::vector<osg::Vec3d>& points,
+                          const SpatialReference*        pointsSRS,
+                          double                         desiredResolution,
+                          std::vector<double>&           out_elevations,
+                          std::vector<bool>&             out_valid)
+    {
+        out_elevations.assign( points.size(), 0.0 );
+        out_valid.assign( points.size(), false );
+
+        if ( points.empty() )
+            return;
+
+        if ( mapf.elevationLayers().empty() )
+        {
+            // this means there are no heightfields.
+            out_valid.assign( points.size(), true );
+            return;
+        }
+
+        const Profile*          profile  = mapf.getProfile();
+        const SpatialReference* mapSRS   = profile->getSRS();
+        unsigned                tileSize = getTileSize(mapf);
+        ElevationInterpolation  interp   = mapf.getMapInfo().getElevationInterpolation();
+
+        // transform all the input coords to map coords at once:
+        std::vector<osg::Vec3d> mapPoints( points );
+        std::vector<bool>       transformed( points.size(), true );
+        if ( pointsSRS && !pointsSRS->isHorizEquivalentTo(mapSRS) )
+        {
+            if ( !pointsSRS->transform(mapPoints, mapSRS) )
+            {
+                // at least one point failed, so find out which one(s).
+                for(unsigned i=0; i<points.size(); ++i)
+                    transformed[i] = pointsSRS->transform( points[i], mapSRS, mapPoints[i] );
+            }
+        }
+
+        // The best available level only varies from point to point if a layer
+        // reports data extents; otherwise compute it just once.
+        bool     perPointLevel = hasDataExtents( mapf );
+        unsigned commonLevel   = perPointLevel ? 0u : getMaxLevel( mapf, 0.0, 0.0, mapSRS, profile );
+        unsigned desiredLevel  = desiredResolution > 0.0 ?
+            profile->getLevelOfDetailForHorizResolution( desiredResolution, tileSize ) : ~0u;
+
+        // group the points by tile:
+        TileBuckets buckets;
+        for(unsigned i=0; i<mapPoints.size(); ++i)
+        {
+            if ( !transformed[i] )
+                continue;
+
+            unsigned level = perPointLevel ? getMaxLevel( mapf, mapPoints[i].x(), mapPoints[i].y(), mapSRS, profile ) : commonLevel;
+            if ( desiredLevel < level )
+                level = desiredLevel;
+
+            TileKey key = profile->createTileKey( mapPoints[i].x(), mapPoints[i].y(), level );
+            if ( key.valid() )
+                buckets[key]._points.push_back( i );
+        }
+
+        // Resolve the buckets. Points that don't resolve on their tile fall back on
+        // the parent tile in the next round, just like sampleElevation().
+        while( !buckets.empty() )
+        {
+            std::vector<TileKey> keys;
+            keys.reserve( buckets.size() );
+            for(TileBuckets::const_iterator b = buckets.begin(); b != buckets.end(); ++b)
+                keys.push_back( b->first );
+
+            std::vector<GeoHeightField> heightFields;
+            provider.getHeightFields( keys, heightFields );
+
+            unsigned k = 0;
+            for(TileBuckets::iterator b = buckets.begin(); b != buckets.end(); ++b, ++k)
+                b->second._hf = heightFields[k];
+
+            // sample each tile's points together:
+            TileBuckets parents;
+            for(TileBuckets::iterator b = buckets.begin(); b != buckets.end(); ++b)
+            {
+                const GeoHeightField&   geoHF  = b->second._hf;
+                const osg::HeightField* hf     = geoHF.valid() ? geoHF.getHeightField() : 0L;
+                const GeoExtent&        extent = geoHF.getExtent();
+
+                std::vector<unsigned> unresolved;
+                for(std::vector<unsigned>::const_iterator p = b->second._points.begin(); p != b->second._points.end(); ++p)
+                {
+                    const osg::Vec3d& mp = mapPoints[*p];
+                    float elevation = NO_DATA_VALUE;
+
+                    // the tile and the point share the map SRS, so sample directly:
+                    if ( hf && extent.contains(mp.x(), mp.y()) )
+                    {
+                        elevation = HeightFieldUtils::getHeightAtLocation(
+                            hf, mp.x(), mp.y(), extent.xMin(), extent.yMin(),
+                            geoHF.getXInterval(), geoHF.getYInterval(), interp );
+                    }
+
+                    if ( elevation != NO_DATA_VALUE )
+                    {
+                        out_elevations[*p] = (double)elevation;
+                        out_valid[*p]      = true;
+                    }
+                    else
+                    {
+                        unresolved.push_back( *p );
+                    }
+                }
+
+                if ( !unresolved.empty() )
+                {
+                    TileKey parentKey = b->first.createParentKey();
+                    if ( parentKey.valid() )
+                    {
+                        std::vector<unsigned>& target = parents[parentKey]._points;
+                        target.insert( target.end(), unresolved.begin(), unresolved.end() );
+                    }
+                }
+            }
+
+            buckets.swap( parents );
+        }
+    }
 }
 
 ElevationQueryCacheReadCallback::ElevationQueryCacheReadCallback()
@@ -127,13 +662,14 @@ ElevationQuery::postCTOR()
     _maxLevelOverride = -1;
     _queries          = 0.0;
     _totalTime        = 0.0;  
+    _numBatchThreads  = 0u;
     _cache.setMaxSize( 500 );
 
     // set read callback for IntersectionVisitor
     setElevationQueryCacheReadCallback(new ElevationQueryCacheReadCallback);
 
     // find terrain patch layers.
-    gatherPatchLayers();
+    gatherPatchLayers( _mapf, _patchLayers );
 }
 
 void
@@ -143,102 +679,14 @@ ElevationQuery::sync()
     {
         _mapf.sync();
         _cache.clear();
-        gatherPatchLayers();
-    }
-}
-
-void
-ElevationQuery::gatherPatchLayers()
-{
-    // cache a vector of terrain patch models.
-    _patchLayers.clear();
-    for(ModelLayerVector::const_iterator i = _mapf.modelLayers().begin();
-        i != _mapf.modelLayers().end();
-        ++i)
-    {
-        if ( i->get()->isTerrainPatch() )
-            _patchLayers.push_back( i->get() );
+        gatherPatchLayers( _mapf, _patchLayers );
     }
 }
 
 unsigned
 ElevationQuery::getMaxLevel( double x, double y, const SpatialReference* srs, const Profile* profile ) const
 {
-    int targetTileSizePOT = nextPowerOf2((int)_mapf.getMapOptions().elevationTileSize().get());
-
-    int maxLevel = 0;
-    for( ElevationLayerVector::const_iterator i = _mapf.elevationLayers().begin(); i != _mapf.elevationLayers().end(); ++i )
-    {
-        const ElevationLayer* layer = i->get();
-
-        // skip disabled layers
-        if ( !layer->getEnabled() || !layer->getVisible() )
-            continue;
-
-        int layerMaxLevel = 0;
-
-        osgEarth::TileSource* ts = layer->getTileSource();
-        if ( ts )
-        {
-            // TileSource is good; check for optional data extents:
-            if ( ts->getDataExtents().size() > 0 )
-            {
-                osg::Vec3d tsCoord(x, y, 0);
-
-                const SpatialReference* tsSRS = ts->getProfile() ? ts->getProfile()->getSRS() : 0L;
-                if ( srs && tsSRS )
-                    srs->transform(tsCoord, tsSRS, tsCoord);
-                else
-                    tsSRS = srs;
-                
-                for (osgEarth::DataExtentList::iterator j = ts->getDataExtents().begin(); j != ts->getDataExtents().end(); j++)
-                {
-                    if (j->maxLevel().isSet() && j->maxLevel() > layerMaxLevel && j->contains( tsCoord.x(), tsCoord.y(), tsSRS ))
-                    {
-                        layerMaxLevel = j->maxLevel().value();
-                    }
-                }            
-            }
-            else
-            {
-                // Just use the default max level.  Without any data extents we don't know the actual max
-                layerMaxLevel = (int)(*layer->getTerrainLayerRuntimeOptions().maxLevel());
-            }
-
-            // cap the max to the layer's express max level (if set).
-            if ( layer->getTerrainLayerRuntimeOptions().maxLevel().isSet() )
-            {
-                layerMaxLevel = std::min( layerMaxLevel, (int)(*layer->getTerrainLayerRuntimeOptions().maxLevel()) );
-            }
-
-            // Need to convert the layer max of this TileSource to that of the actual profile
-            layerMaxLevel = profile->getEquivalentLOD( ts->getProfile(), layerMaxLevel );
-        }
-        else
-        {
-            // no TileSource? probably in cache-only mode. Use the layer max (or its default).
-            layerMaxLevel = (int)(layer->getTerrainLayerRuntimeOptions().maxLevel().value());
-        }
-
-        // Adjust for the tile size resolution differential, if supported by the layer.
-        int layerTileSize = layer->getTileSize();
-        if (layerTileSize > targetTileSizePOT)
-        {
-            int oldMaxLevel = layerMaxLevel;
-            int temp = std::max(targetTileSizePOT, 2);
-            while(temp < layerTileSize) {
-                temp *= 2;
-                ++layerMaxLevel;
-            }
-        }
-
-        if (layerMaxLevel > maxLevel)
-        {
-            maxLevel = layerMaxLevel;
-        }
-    }
-
-    return maxLevel;
+    return ::getMaxLevel( _mapf, x, y, srs, profile );
 }
 
 void
@@ -265,6 +713,16 @@ ElevationQuery::getMaxLevelOverride() const
     return _maxLevelOverride;
 }
 
+void
+ElevationQuery::setNumBatchThreads(unsigned value)
+{
+    if ( value != _numBatchThreads )
+    {
+        _numBatchThreads = value;
+        _batchService = 0L;
+    }
+}
+
 bool
 ElevationQuery::getElevation(const GeoPoint&         point,
                              double&                 out_elevation,
@@ -291,6 +749,21 @@ ElevationQuery::getElevations(std::vector<osg::Vec3d>& points,
                               double                   desiredResolution )
 {
     sync();
+
+    // Terrain patches need a per-point intersection, so batching only applies without them.
+    if ( _patchLayers.empty() )
+    {
+        std::vector<double> elevations;
+        std::vector<bool>   valid;
+        getElevationsBatch( points, pointsSRS, desiredResolution, elevations, valid );
+        for(unsigned i=0; i<points.size(); ++i)
+        {
+            if ( valid[i] )
+                points[i].z() = ignoreZ ? elevations[i] : elevations[i] + points[i].z();
+        }
+        return true;
+    }
+
     for( osg::Vec3dArray::iterator i = points.begin(); i != points.end(); ++i )
     {
         double elevation;
@@ -311,6 +784,16 @@ ElevationQuery::getElevations(const std::vector<osg::Vec3d>& points,
                               double                         desiredResolution )
 {
     sync();
+
+    if ( _patchLayers.empty() )
+    {
+        std::vector<double> elevations;
+        std::vector<bool>   valid;
+        getElevationsBatch( points, pointsSRS, desiredResolution, elevations, valid );
+        out_elevations.insert( out_elevations.end(), elevations.begin(), elevations.end() );
+        return true;
+    }
+
     for( osg::Vec3dArray::const_iterator i = points.begin(); i != points.end(); ++i )
     {
         double elevation;
@@ -343,181 +826,324 @@ ElevationQuery::getElevationImpl(const GeoPoint& point, /* abs */
 
     osg::Timer_t begin = osg::Timer::instance()->tick();
 
+    bool result;
+
     // first try the terrain patches.
-    if ( _patchLayers.size() > 0 )
+    if ( intersectPatchLayers(_mapf, _patchLayers, _eqcrc.get(), _patchLayersLSI, point, out_elevation) )
     {
-        osgUtil::IntersectionVisitor iv;
+        if ( out_actualResolution )
+            *out_actualResolution = 0.0;
+        result = true;
+    }
+    else
+    {
+        LocalHeightFieldProvider provider( _mapf, getTileSize(_mapf), _cache, _numBatchThreads, _batchService );
+        result = sampleElevation( _mapf, provider, point, desiredResolution, out_elevation, out_actualResolution );
+    }
 
-        if ( _eqcrc.valid() )
-            iv.setReadCallback(_eqcrc);
+    osg::Timer_t end = osg::Timer::instance()->tick();
+    _queries++;
+    _totalTime += osg::Timer::instance()->delta_s( begin, end );
 
-        for(std::vector<ModelLayer*>::iterator i = _patchLayers.begin(); i != _patchLayers.end(); ++i)
-        {
-            // find the scene graph for this layer:
-            osg::Node* node = (*i)->getSceneGraph( _mapf.getUID() );
-            if ( node )
-            {
-                // configure for intersection:
-                osg::Vec3d surface;
-                point.toWorld( surface );
+    return result;
+}
 
-                // trivial bounds check:
-                if ( node->getBound().contains(surface) )
-                {
-                    osg::Vec3d nvector;
-                    point.createWorldUpVector(nvector);
+bool
+ElevationQuery::getElevationsBatch(const std::vector<osg::Vec3d>& points,
+                                   const SpatialReference*        pointsSRS,
+                                   double                         desiredResolution,
+                                   std::vector<double>&           out_elevations,
+                                   std::vector<bool>&             out_valid)
+{
+    osg::Timer_t begin = osg::Timer::instance()->tick();
 
-                    osg::Vec3d start( surface + nvector*5e5 );
-                    osg::Vec3d end  ( surface - nvector*5e5 );
-                
-                    // first time through, set up the intersector on demand
-                    if ( !_patchLayersLSI.valid() )
-                    {
-                        _patchLayersLSI = new DPLineSegmentIntersector(start, end);
-                        _patchLayersLSI->setIntersectionLimit( _patchLayersLSI->LIMIT_NEAREST );
-                    }
-                    else
-                    {
-                        _patchLayersLSI->reset();
-                        _patchLayersLSI->setStart( start );
-                        _patchLayersLSI->setEnd  ( end );
-                    }
+    LocalHeightFieldProvider provider( _mapf, getTileSize(_mapf), _cache, _numBatchThreads, _batchService );
+    sampleElevations( _mapf, provider, points, pointsSRS, desiredResolution, out_elevations, out_valid );
 
-                    // try it.
-                    iv.setIntersector( _patchLayersLSI.get() );
-                    node->accept( iv );
+    osg::Timer_t end = osg::Timer::instance()->tick();
+    _queries   += (double)points.size();
+    _totalTime += osg::Timer::instance()->delta_s( begin, end );
 
-                    // check for a result!!
-                    if ( _patchLayersLSI->containsIntersections() )
-                    {
-                        osg::Vec3d isect = _patchLayersLSI->getIntersections().begin()->getWorldIntersectPoint();
+    return true;
+}
 
-                        // transform back to input SRS:
-                        GeoPoint output;
-                        output.fromWorld( point.getSRS(), isect );
-                        out_elevation = output.z();
-                        if ( out_actualResolution )
-                            *out_actualResolution = 0.0;
+void ElevationQuery::setElevationQueryCacheReadCallback(ElevationQueryCacheReadCallback* eqcrc)
+{
+    _eqcrc = eqcrc;
+}
 
-                        return true;
-                    }
-                }
-                else
-                {
-                    //OE_INFO << LC << "Trivial rejection (bounds check)" << std::endl;
-                }
-            }
-        }
+//------------------------------------------------------------------------
+
+// Fetches tiles through the service's shared cache. The caller holds a
+// shared lock on the service's map frame.
+struct ElevationQueryService::Provider : public HeightFieldProvider
+{
+    Provider(ElevationQueryService& service, unsigned tileSize)
+        : _service(service), _tileSize(tileSize) { }
+
+    GeoHeightField getHeightField(const TileKey& key)
+    {
+        return _service.getHeightField( key, _tileSize );
     }
 
-    if ( _mapf.elevationLayers().empty() )
+    ElevationQueryService& _service;
+    unsigned               _tileSize;
+};
+
+ElevationQueryService::ElevationQueryService(const Map* map, unsigned maxTilesToCache, unsigned numShards) :
+_mapf           ( map, (Map::ModelParts)(Map::TERRAIN_LAYERS | Map::MODEL_LAYERS) ),
+_maxTilesToCache( maxTilesToCache ),
+_queries        ( 0u ),
+_points         ( 0u ),
+_failures       ( 0u ),
+_totalTime      ( 0.0 ),
+_maxTime        ( 0.0 )
+{
+    numShards = osg::clampBetween( numShards, 1u, std::max(maxTilesToCache, 1u) );
+    unsigned tilesPerShard = std::max( (maxTilesToCache + numShards - 1) / numShards, 1u );
+
+    _shards.reserve( numShards );
+    for(unsigned i=0; i<numShards; ++i)
     {
-        // this means there are no heightfields.
-        out_elevation = 0.0;
-        return true;        
+        Shard* shard = new Shard();
+        shard->_cache.setMaxSize( tilesPerShard );
+        _shards.push_back( shard );
     }
 
-    // tile size (resolution of elevation tiles)
-    unsigned tileSize = std::max(_mapf.getMapOptions().elevationTileSize().get(), 2u);
+    _eqcrc = new ElevationQueryCacheReadCallback();
+
+    gatherPatchLayers( _mapf, _patchLayers );
+}
 
-    //This is the max resolution that we actually have data at this point
-    unsigned int bestAvailLevel = getMaxLevel( point.x(), point.y(), point.getSRS(), _mapf.getProfile());
+ElevationQueryService::~ElevationQueryService()
+{
+    for(unsigned i=0; i<_shards.size(); ++i)
+        delete _shards[i];
+}
 
-    if (desiredResolution > 0.0)
+void
+ElevationQueryService::sync()
+{
+    bool needsSync;
     {
-        unsigned int desiredLevel = _mapf.getProfile()->getLevelOfDetailForHorizResolution( desiredResolution, tileSize );
-        if (desiredLevel < bestAvailLevel) bestAvailLevel = desiredLevel;
+        Threading::ScopedReadLock shared( _mapfMutex );
+        needsSync = _mapf.needsSync();
     }
 
-    OE_DEBUG << LC << "Best available data level " << point.x() << ", " << point.y() << " = "  << bestAvailLevel << std::endl;
+    if ( needsSync )
+    {
+        Threading::ScopedWriteLock exclusive( _mapfMutex );
+        if ( _mapf.needsSync() )
+        {
+            _mapf.sync();
+            clearCache();
+            gatherPatchLayers( _mapf, _patchLayers );
+        }
+    }
+}
+
+void
+ElevationQueryService::clearCache()
+{
+    for(unsigned i=0; i<_shards.size(); ++i)
+    {
+        Threading::ScopedMutexLock lock( _shards[i]->_mutex );
+        _shards[i]->_cache.clear();
+    }
+}
+
+ElevationQueryService::Shard&
+ElevationQueryService::getShard(const TileKey& key)
+{
+    unsigned hash = (key.getLOD() * 73856093u) ^ (key.getTileX() * 19349663u) ^ (key.getTileY() * 83492791u);
+    return *_shards[hash % _shards.size()];
+}
+
+GeoHeightField
+ElevationQueryService::getHeightField(const TileKey& key, unsigned tileSize)
+{
+    Shard& shard = getShard( key );
 
-    // transform the input coords to map coords:
-    GeoPoint mapPoint = point;
-    if ( point.isValid() && !point.getSRS()->isHorizEquivalentTo( _mapf.getProfile()->getSRS() ) )
+    osg::ref_ptr<InFlight> inFlight;
+    bool builder = false;
     {
-        mapPoint = point.transform(_mapf.getProfile()->getSRS());
-        if ( !mapPoint.isValid() )
+        Threading::ScopedMutexLock lock( shard._mutex );
+
+        LRUCache<TileKey, GeoHeightField>::Record record;
+        if ( shard._cache.get(key, record) )
         {
-            OE_WARN << LC << "Fail: coord transform failed" << std::endl;
-            return false;
+            ++_hits;
+            return record.value();
         }
-    }    
 
-    // get the tilekey corresponding to the tile we need:
-    TileKey key = _mapf.getProfile()->createTileKey( mapPoint.x(), mapPoint.y(), bestAvailLevel );
-    if ( !key.valid() )
+        // join a build that another thread already started, or start one:
+        Shard::InFlightMap::iterator i = shard._inFlight.find( key );
+        if ( i != shard._inFlight.end() )
+        {
+            inFlight = i->second.get();
+        }
+        else
+        {
+            inFlight = new InFlight();
+            shard._inFlight[key] = inFlight.get();
+            builder = true;
+        }
+    }
+
+    if ( !builder )
     {
-        OE_WARN << LC << "Fail: coords fall outside map" << std::endl;
-        return false;
+        ++_sharedMisses;
+        while( !inFlight->_done.isSet() )
+            inFlight->_done.wait();
+        return inFlight->_hf;
     }
-        
-    bool result = false;      
-    while (!result)
-    {      
-        GeoHeightField geoHF;
-        TileCache::Record record;
-        // Try to get the hf from the cache
-        if ( _cache.get( key, record ) )
-        {                        
-            geoHF = record.value();
+
+    ++_misses;
+
+    // build outside the lock so the rest of the shard stays available:
+    inFlight->_hf = createHeightField( _mapf, key, tileSize );
+    {
+        Threading::ScopedMutexLock lock( shard._mutex );
+        if ( inFlight->_hf.valid() )
+            shard._cache.insert( key, inFlight->_hf );
+        shard._inFlight.erase( key );
+    }
+    inFlight->_done.set();
+
+    return inFlight->_hf;
+}
+
+bool
+ElevationQueryService::getElevation(const GeoPoint& point,
+                                    double&         out_elevation,
+                                    double          desiredResolution,
+                                    double*         out_actualResolution)
+{
+    osg::Timer_t begin = osg::Timer::instance()->tick();
+
+    sync();
+
+    GeoPoint point_abs = point;
+    if ( point.altitudeMode() != ALTMODE_ABSOLUTE )
+        point_abs = GeoPoint( point.getSRS(), point.x(), point.y(), 0.0, ALTMODE_ABSOLUTE );
+
+    bool result;
+    {
+        Threading::ScopedReadLock shared( _mapfMutex );
+
+        // first try the terrain patches, with this thread's own intersector:
+        if ( intersectPatchLayers(_mapf, _patchLayers, _eqcrc.get(), _lsi.get(), point_abs, out_elevation) )
+        {
+            if ( out_actualResolution )
+                *out_actualResolution = 0.0;
+            result = true;
         }
         else
         {
-            // Create it            
-            osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
-            hf->allocate( tileSize, tileSize );
+            Provider provider( *this, getTileSize(_mapf) );
+            result = sampleElevation( _mapf, provider, point_abs, desiredResolution, out_elevation, out_actualResolution );
+        }
+    }
 
-            // Initialize the heightfield to nodata
-            for (unsigned int i = 0; i < hf->getFloatArray()->size(); i++)
-            {
-                hf->getFloatArray()->at( i ) = NO_DATA_VALUE;
-            }   
+    recordQuery( begin, 1u, result ? 0u : 1u );
+    return result;
+}
 
-            if (_mapf.populateHeightField(hf, key, false))
-            {                
-                geoHF = GeoHeightField( hf.get(), key.getExtent() );
-                _cache.insert( key, geoHF );
-            }
+bool
+ElevationQueryService::getElevations(const std::vector<osg::Vec3d>& points,
+                                     const SpatialReference*        pointsSRS,
+                                     std::vector<double>&           out_elevations,
+                                     double                         desiredResolution)
+{
+    osg::Timer_t begin = osg::Timer::instance()->tick();
+
+    sync();
+
+    std::vector<double> elevations;
+    std::vector<bool>   valid;
+    {
+        Threading::ScopedReadLock shared( _mapfMutex );
+
+        if ( _patchLayers.empty() )
+        {
+            Provider provider( *this, getTileSize(_mapf) );
+            sampleElevations( _mapf, provider, points, pointsSRS, desiredResolution, elevations, valid );
         }
+        else
+        {
+            // terrain patches need a per-point intersection.
+            elevations.assign( points.size(), 0.0 );
+            valid.assign( points.size(), false );
 
-        if (geoHF.valid())
-        {            
-            float elevation = 0.0f;                 
-            result = geoHF.getElevation( mapPoint.getSRS(), mapPoint.x(), mapPoint.y(), _mapf.getMapInfo().getElevationInterpolation(), mapPoint.getSRS(), elevation);                              
-            if (result && elevation != NO_DATA_VALUE)
-            {                        
-                // see what the actual resolution of the heightfield is.
-                if ( out_actualResolution )
-                    *out_actualResolution = geoHF.getXInterval(); 
-                out_elevation = (double)elevation;                
-                break;
-            }
-            else
-            {                               
-                result = false;
+            Provider provider( *this, getTileSize(_mapf) );
+            osg::ref_ptr<DPLineSegmentIntersector>& lsi = _lsi.get();
+            for(unsigned i=0; i<points.size(); ++i)
+            {
+                GeoPoint p(pointsSRS, points[i], ALTMODE_ABSOLUTE);
+                valid[i] =
+                    intersectPatchLayers(_mapf, _patchLayers, _eqcrc.get(), lsi, p, elevations[i]) ||
+                    sampleElevation(_mapf, provider, p, desiredResolution, elevations[i], 0L);
             }
         }
+    }
 
-        if (!result)
+    unsigned failures = 0u;
+    for(unsigned i=0; i<valid.size(); ++i)
+    {
+        if ( !valid[i] )
         {
-            key = key.createParentKey();                        
-            if (!key.valid())
-            {
-                break;
-            }
-        }         
+            elevations[i] = 0.0;
+            ++failures;
+        }
     }
 
-         
+    out_elevations.insert( out_elevations.end(), elevations.begin(), elevations.end() );
 
-    osg::Timer_t end = osg::Timer::instance()->tick();
-    _queries++;
-    _totalTime += osg::Timer::instance()->delta_s( begin, end );
+    recordQuery( begin, points.size(), failures );
+    return true;
+}
 
-    return result;
+void
+ElevationQueryService::recordQuery(osg::Timer_t begin, unsigned numPoints, unsigned numFailures)
+{
+    double t = osg::Timer::instance()->delta_s( begin, osg::Timer::instance()->tick() );
+
+    Threading::ScopedMutexLock lock( _statsMutex );
+    _queries   += 1u;
+    _points    += numPoints;
+    _failures  += numFailures;
+    _totalTime += t;
+    _maxTime = std::max( _maxTime, t );
 }
 
-void ElevationQuery::setElevationQueryCacheReadCallback(ElevationQueryCacheReadCallback* eqcrc)
+ElevationQueryService::Stats
+ElevationQueryService::getStats() const
 {
-    _eqcrc = eqcrc;
+    Stats stats;
+    stats.hits         = _hits;
+    stats.misses       = _misses;
+    stats.sharedMisses = _sharedMisses;
+
+    Threading::ScopedMutexLock lock( _statsMutex );
+    stats.queries   = _queries;
+    stats.points    = _points;
+    stats.failures  = _failures;
+    stats.totalTime = _totalTime;
+    stats.maxTime   = _maxTime;
+    return stats;
+}
+
+void
+ElevationQueryService::resetStats()
+{
+    _hits.exchange( 0 );
+    _misses.exchange( 0 );
+    _sharedMisses.exchange( 0 );
+
+    Threading::ScopedMutexLock lock( _statsMutex );
+    _queries   = 0u;
+    _points    = 0u;
+    _failures  = 0u;
+    _totalTime = 0.0;
+    _maxTime   = 0.0;
 }
@@ -394,6 +394,18 @@ osgEarth::getLastModifiedTime(const std::string& path)
 }
 
 
+bool
+osgEarth::replaceFile(const std::string& fromPath, const std::string& toPath)
+{
+#ifdef WIN32
+    // plain rename() refuses to overwrite an existing file on Windows.
+    return MoveFileExA( fromPath.c_str(), toPath.c_str(), MOVEFILE_REPLACE_EXISTING ) != 0;
+#else
+    return ::rename( fromPath.c_str(), toPath.c_str() ) == 0;
+#endif
+}
+
+
 /**************************************************/
 DirectoryVisitor::DirectoryVisitor()
 {
@@ -25,6 +25,7 @@
 #include <osgEarth/Cube>
 #include <osgEarth/VerticalDatum>
 #include <osgEarth/Terrain>
+#include <osgEarth/TaskService>
 
 #include <osg/Notify>
 #include <osg/Timer>
@@ -1761,12 +1762,441 @@ namespace
 
         return result;
     }
+
+
+    // Maps the pixel centers of a destination image to source coordinates by
+    // transforming a coarse grid of control points and interpolating between
+    // them, in the manner of GDAL's approximate transformer. Only the control
+    // points go through OGR, which serializes on the global GDAL lock. The grid
+    // is refined until the interpolation error, measured at the cell centers,
+    // is within the bound; at a spacing of one pixel every pixel is exact.
+    class ApproxTransform
+    {
+    public:
+        ApproxTransform(const GeoExtent& src_extent, const GeoExtent& dest_extent,
+                        unsigned width, unsigned height, double xfac, double yfac)
+            : _src(src_extent), _dest(dest_extent), _width(width), _height(height),
+              _xfac(xfac), _yfac(yfac), _step(1u)
+        {
+            _dx = dest_extent.width() / (double)width;
+            _dy = dest_extent.height() / (double)height;
+        }
+
+        /** Builds a grid that meets the error bound (in source pixels). False if a transform fails. */
+        bool init(double maxError)
+        {
+            for(unsigned step = INITIAL_STEP; ; step /= 2)
+            {
+                if ( !build(step) )
+                    return false;
+
+                if ( step == 1 )
+                    return true;
+
+                double error;
+                if ( !measureError(error) )
+                    return false;
+
+                if ( error <= maxError )
+                    return true;
+            }
+        }
+
+        /** Source coordinates of the pixel centers in destination row r. */
+        void getRow(unsigned r, double* out_x, double* out_y) const
+        {
+            const unsigned nCols = _cols.size();
+
+            unsigned j, j1;
+            double   v;
+            getCell( r, _rows, j, j1, v );
+
+            // interpolate down the control columns first, then across the row.
+            std::vector<double> cx(nCols), cy(nCols);
+            for(unsigned i=0; i<nCols; ++i)
+            {
+                const osg::Vec3d& p0 = _points[j*nCols + i];
+                const osg::Vec3d& p1 = _points[j1*nCols + i];
+                cx[i] = p0.x() + (p1.x() - p0.x()) * v;
+                cy[i] = p0.y() + (p1.y() - p0.y()) * v;
+            }
+
+            for(unsigned c=0; c<_width; ++c)
+            {
+                unsigned i, i1;
+                double   u;
+                getCell( c, _cols, i, i1, u );
+                out_x[c] = cx[i] + (cx[i1] - cx[i]) * u;
+                out_y[c] = cy[i] + (cy[i1] - cy[i]) * u;
+            }
+        }
+
+    private:
+        enum { INITIAL_STEP = 32 };
+
+        // Control point indices along an axis of n pixels: every step, plus the last one.
+        static void controlIndices(unsigned n, unsigned step, std::vector<unsigned>& out)
+        {
+            out.clear();
+            for(unsigned i=0; i+1 < n; i += step)
+                out.push_back( i );
+            out.push_back( n-1 );
+        }
+
+        // The control points bracketing pixel coordinate p, and the fraction of the way from one to the next.
+        void getCell(double p, const std::vector<unsigned>& controls, unsigned& out_c0, unsigned& out_c1, double& out_t) const
+        {
+            if ( controls.size() < 2 )
+            {
+                out_c0 = out_c1 = 0;
+                out_t = 0.0;
+                return;
+            }
+            out_c0 = osg::minimum( (unsigned)(p / (double)_step), (unsigned)controls.size()-2 );
+            out_c1 = out_c0 + 1;
+            out_t  = (p - (double)controls[out_c0]) / (double)(controls[out_c1] - controls[out_c0]);
+        }
+
+        osg::Vec3d getDestPoint(double c, double r) const
+        {
+            return osg::Vec3d( _dest.xMin() + (c + 0.5) * _dx, _dest.yMin() + (r + 0.5) * _dy, 0.0 );
+        }
+
+        bool build(unsigned step)
+        {
+            _step = step;
+            controlIndices( _width, step, _cols );
+            controlIndices( _height, step, _rows );
+
+            _points.clear();
+            _points.reserve( _cols.size() * _rows.size() );
+            for(unsigned j=0; j<_rows.size(); ++j)
+                for(unsigned i=0; i<_cols.size(); ++i)
+                    _points.push_back( getDestPoint(_cols[i], _rows[j]) );
+
+            return _dest.getSRS()->transform( _points, _src.getSRS() );
+        }
+
+        // Largest difference, in source pixels, between the interpolated and
+        // the exact source coordinates at the center of each grid cell.
+        bool measureError(double& out_error) const
+        {
+            const unsigned nCols = _cols.size();
+            const unsigned nCellCols = osg::maximum( nCols-1, 1u );
+            const unsigned nCellRows = osg::maximum( (unsigned)_rows.size()-1, 1u );
+
+            std::vector<osg::Vec3d> centers;
+            std::vector<osg::Vec2d> estimates;
+            centers.reserve( nCellCols * nCellRows );
+            estimates.reserve( nCellCols * nCellRows );
+
+            for(unsigned j=0; j<nCellRows; ++j)
+            {
+                unsigned j1 = osg::minimum( j+1, (unsigned)_rows.size()-1 );
+                for(unsigned i=0; i<nCellCols; ++i)
+                {
+                    unsigned i1 = osg::minimum( i+1, nCols-1 );
+                    centers.push_back( getDestPoint(
+                        0.5 * (double)(_cols[i] + _cols[i1]),
+                        0.5 * (double)(_rows[j] + _rows[j1]) ) );
+
+                    // the center of a cell interpolates to the mean of its corners.
+                    estimates.push_back( osg::Vec2d(
+                        0.25 * (_points[j*nCols+i].x() + _points[j*nCols+i1].x() + _points[j1*nCols+i].x() + _points[j1*nCols+i1].x()),
+                        0.25 * (_points[j*nCols+i].y() + _points[j*nCols+i1].y() + _points[j1*nCols+i].y() + _points[j1*nCols+i1].y()) ) );
+                }
+            }
+
+            if ( !_dest.getSRS()->transform( centers, _src.getSRS() ) )
+                return false;
+
+            out_error = 0.0;
+            for(unsigned k=0; k<centers.size(); ++k)
+            {
+                out_error = osg::maximum( out_error, fabs(centers[k].x() - estimates[k].x()) * _xfac );
+                out_error = osg::maximum( out_error, fabs(centers[k].y() - estimates[k].y()) * _yfac );
+            }
+            return true;
+        }
+
+        GeoExtent               _src, _dest;
+        unsigned                _width, _height;
+        double                  _xfac, _yfac, _dx, _dy;
+        unsigned                _step;
+        std::vector<unsigned>   _cols, _rows;
+        std::vector<osg::Vec3d> _points;  // transformed control points, row-major
+    };
+
+    // 8-bit channel values as PixelReader returns them.
+    struct ByteToFloat
+    {
+        ByteToFloat()
+        {
+            for(unsigned i=0; i<256; ++i)
+                _v[i] = float(i) * (1.0/255.0);
+        }
+        float operator[](unsigned char b) const { return _v[b]; }
+        float _v[256];
+    };
+    const ByteToFloat s_byteToFloat;
+
+    // Bilinear sample of an RGB or RGBA 8-bit image at (px, py), written
+    // straight into the destination pixel. This is the arithmetic of the
+    // generic path in manualReproject without the per-channel indirection.
+    inline void sampleBytes(const osg::Image* image, unsigned channels, float px, float py, unsigned char* out)
+    {
+        int rowMin = osg::maximum((int)floor(py), 0);
+        int rowMax = osg::maximum(osg::minimum((int)ceil(py), (int)(image->t()-1)), 0);
+        int colMin = osg::maximum((int)floor(px), 0);
+        int colMax = osg::maximum(osg::minimum((int)ceil(px), (int)(image->s()-1)), 0);
+
+        if (rowMin > rowMax) rowMin = rowMax;
+        if (colMin > colMax) colMin = colMax;
+
+        const ByteToFloat& b = s_byteToFloat;
+
+        if ((colMax == colMin) && (rowMax == rowMin))
+        {
+            int px_i = osg::clampBetween( (int)osg::round(px), 0, image->s()-1 );
+            int py_i = osg::clampBetween( (int)osg::round(py), 0, image->t()-1 );
+            const unsigned char* p = image->data(px_i, py_i);
+            for (unsigned i = 0; i < channels; ++i)
+                out[i] = (unsigned char)( b[p[i]] / (1.0/255.0) );
+        }
+        else if (colMax == colMin)
+        {
+            const unsigned char* ll = image->data(colMin, rowMin);
+            const unsigned char* ul = image->data(colMin, rowMax);
+            for (unsigned i = 0; i < channels; ++i)
+            {
+                float v = ((float)rowMax - py) * b[ll[i]] + (py - (float)rowMin) * b[ul[i]];
+                out[i] = (unsigned char)( v / (1.0/255.0) );
+            }
+        }
+        else if (rowMax == rowMin)
+        {
+            const unsigned char* ll = image->data(colMin, rowMin);
+            const unsigned char* lr = image->data(colMax, rowMin);
+            for (unsigned i = 0; i < channels; ++i)
+            {
+                float v = ((float)colMax - px) * b[ll[i]] + (px - (float)colMin) * b[lr[i]];
+                out[i] = (unsigned char)( v / (1.0/255.0) );
+            }
+        }
+        else
+        {
+            const unsigned char* ll = image->data(colMin, rowMin);
+            const unsigned char* lr = image->data(colMax, rowMin);
+            const unsigned char* ul = image->data(colMin, rowMax);
+            const unsigned char* ur = image->data(colMax, rowMax);
+            float col1 = colMax - px, col2 = px - colMin;
+            float row1 = rowMax - py, row2 = py - rowMin;
+            for (unsigned i = 0; i < channels; ++i)
+            {
+                float r1 = col1 * b[ll[i]] + col2 * b[lr[i]];
+                float r2 = col1 * b[ul[i]] + col2 * b[ur[i]];
+                float v = row1 * r1 + row2 * r2;
+                out[i] = (unsigned char)( v / (1.0/255.0) );
+            }
+        }
+    }
+
+    // Bilinear sample of an image in any format PixelReader supports.
+    inline osg::Vec4 sampleColor(const ImageUtils::PixelReader& ia, const osg::Image* image, float px, float py)
+    {
+        int rowMin = osg::maximum((int)floor(py), 0);
+        int rowMax = osg::maximum(osg::minimum((int)ceil(py), (int)(image->t()-1)), 0);
+        int colMin = osg::maximum((int)floor(px), 0);
+        int colMax = osg::maximum(osg::minimum((int)ceil(px), (int)(image->s()-1)), 0);
+
+        if (rowMin > rowMax) rowMin = rowMax;
+        if (colMin > colMax) colMin = colMax;
+
+        osg::Vec4 color(0,0,0,0);
+
+        if ((colMax == colMin) && (rowMax == rowMin))
+        {
+            int px_i = osg::clampBetween( (int)osg::round(px), 0, image->s()-1 );
+            int py_i = osg::clampBetween( (int)osg::round(py), 0, image->t()-1 );
+            color = ia(px_i, py_i);
+        }
+        else if (colMax == colMin)
+        {
+            osg::Vec4 llColor = ia(colMin, rowMin);
+            osg::Vec4 ulColor = ia(colMin, rowMax);
+            for (unsigned int i = 0; i < 4; ++i)
+                color[i] = ((float)rowMax - py) * llColor[i] + (py - (float)rowMin) * ulColor[i];
+        }
+        else if (rowMax == rowMin)
+        {
+            osg::Vec4 llColor = ia(colMin, rowMin);
+            osg::Vec4 lrColor = ia(colMax, rowMin);
+            for (unsigned int i = 0; i < 4; ++i)
+                color[i] = ((float)colMax - px) * llColor[i] + (px - (float)colMin) * lrColor[i];
+        }
+        else
+        {
+            osg::Vec4 urColor = ia(colMax, rowMax);
+            osg::Vec4 llColor = ia(colMin, rowMin);
+            osg::Vec4 ulColor = ia(colMin, rowMax);
+            osg::Vec4 lrColor = ia(colMax, rowMin);
+            float col1 = colMax - px, col2 = px - colMin;
+            float row1 = rowMax - py, row2 = py - rowMin;
+            for (unsigned int i = 0; i < 4; ++i)
+            {
+                float r1 = col1 * llColor[i] + col2 * lrColor[i];
+                float r2 = col1 * ulColor[i] + col2 * urColor[i];
+                color[i] = row1 * r1 + row2 * r2;
+            }
+        }
+        return color;
+    }
+
+    // Reprojects a band of destination rows [_firstRow, _lastRow).
+    struct ReprojectRows
+    {
+        void execute()
+        {
+            const unsigned width = _result->s();
+            const double xfac = (_image->s() - 1) / _srcExtent->width();
+            const double yfac = (_image->t() - 1) / _srcExtent->height();
+
+            // 8-bit RGB(A) gets the direct kernel; everything else goes through PixelReader.
+            const bool bytes =
+                _image->getDataType() == GL_UNSIGNED_BYTE &&
+                (_image->getPixelFormat() == GL_RGBA || _image->getPixelFormat() == GL_RGB);
+            const unsigned channels = _image->getPixelFormat() == GL_RGBA ? 4 : 3;
+
+            ImageUtils::PixelReader ia(_image);
+            ImageUtils::PixelWriter writer(_result);
+
+            std::vector<double> srcX(width), srcY(width);
+
+            for(unsigned r = _firstRow; r < _lastRow; ++r)
+            {
+                _xform->getRow( r, &srcX[0], &srcY[0] );
+
+                for(unsigned c = 0; c < width; ++c)
+                {
+                    double src_x = srcX[c];
+                    double src_y = srcY[c];
+
+                    // samples outside the source extent stay transparent.
+                    if ( src_x < _srcExtent->xMin() || src_x > _srcExtent->xMax() || src_y < _srcExtent->yMin() || src_y > _srcExtent->yMax() )
+                        continue;
+
+                    float px = (src_x - _srcExtent->xMin()) * xfac;
+                    float py = (src_y - _srcExtent->yMin()) * yfac;
+
+                    if ( bytes )
+                        sampleBytes( _image, channels, px, py, _result->data(c, r) );
+                    else
+                        writer( sampleColor(ia, _image, px, py), c, r );
+                }
+            }
+        }
+
+        const osg::Image*      _image;
+        osg::Image*            _result;
+        const GeoExtent*       _srcExtent;
+        const ApproxTransform* _xform;
+        unsigned               _firstRow, _lastRow;
+    };
+
+    // Images smaller than this are reprojected in the calling thread.
+    const unsigned MIN_PARALLEL_PIXELS = 256*256;
+    const unsigned MIN_ROWS_PER_BAND   = 16;
+
+    TaskService* getReprojectService()
+    {
+        return Registry::instance()->getTaskServiceManager()->getOrAdd( TaskServiceManager::REPROJECT_SERVICE_UID );
+    }
+
+    /**
+     * Reprojects an image like manualReproject, but transforms only a control
+     * grid that keeps the coordinate error within maxError source pixels,
+     * samples 8-bit RGB(A) imagery directly, and splits large images into
+     * bands of rows that run in parallel.
+     */
+    osg::Image*
+    approxReproject(
+        const osg::Image* image,
+        const GeoExtent&  src_extent,
+        const GeoExtent&  dest_extent,
+        unsigned int      width,
+        unsigned int      height,
+        double            maxError)
+    {
+        if (width == 0 || height == 0)
+        {
+            //If no width and height are specified, just use the minimum dimension for the image
+            width = osg::minimum(image->s(), image->t());
+            height = osg::minimum(image->s(), image->t());
+        }
+
+        ApproxTransform xform(
+            src_extent, dest_extent, width, height,
+            (image->s() - 1) / src_extent.width(),
+            (image->t() - 1) / src_extent.height() );
+
+        if ( !xform.init(maxError) )
+        {
+            OE_DEBUG << LC << "Approximate transform failed; reprojecting every pixel" << std::endl;
+            return manualReproject(image, src_extent, dest_extent, width, height);
+        }
+
+        osg::Image *result = new osg::Image();
+        result->allocateImage(width, height, 1, image->getPixelFormat(), GL_UNSIGNED_BYTE);
+        memset(result->data(), 0, result->getImageSizeInBytes());
+
+        // one band for each thread of the shared service, plus one for the caller.
+        TaskService* service = 0L;
+        unsigned numBands = 1;
+        if ( width * height >= MIN_PARALLEL_PIXELS )
+        {
+            service = getReprojectService();
+            numBands = osg::minimum(
+                (unsigned)osg::maximum(service->getNumThreads(), 0) + 1u,
+                osg::maximum(height / MIN_ROWS_PER_BAND, 1u) );
+        }
+
+        std::vector<ReprojectRows> bands( numBands );
+        for(unsigned b=0; b<numBands; ++b)
+        {
+            bands[b]._image     = image;
+            bands[b]._result    = result;
+            bands[b]._srcExtent = &src_extent;
+            bands[b]._xform     = &xform;
+            bands[b]._firstRow  = (height * b) / numBands;
+            bands[b]._lastRow   = (height * (b+1)) / numBands;
+        }
+
+        if ( numBands > 1 )
+        {
+            // the calling thread takes the first band itself.
+            Threading::MultiEvent done( numBands-1 );
+            for(unsigned b=1; b<numBands; ++b)
+            {
+                ParallelTask<ReprojectRows>* task = new ParallelTask<ReprojectRows>( &done );
+                static_cast<ReprojectRows&>(*task) = bands[b];
+                service->add( task );
+            }
+            bands[0].execute();
+            done.wait();
+        }
+        else
+        {
+            bands[0].execute();
+        }
+
+        return result;
+    }
 }
 
 
 
 GeoImage
-GeoImage::reproject(const SpatialReference* to_srs, const GeoExtent* to_extent, unsigned int width, unsigned int height, bool useBilinearInterpolation) const
+GeoImage::reproject(const SpatialReference* to_srs, const GeoExtent* to_extent, unsigned int width, unsigned int height, bool useBilinearInterpolation, double maxError) const
 {  
     GeoExtent destExtent;
     if (to_extent)
@@ -1789,7 +2219,10 @@ GeoImage::reproject(const SpatialReference* to_srs, const GeoExtent* to_extent,
     {
         // if either of the SRS is a custom projection, we have to do a manual reprojection since
         // GDAL will not recognize the SRS.
-        resultImage = manualReproject(getImage(), getExtent(), *to_extent, width, height);
+        if ( maxError > 0.0 )
+            resultImage = approxReproject(getImage(), getExtent(), destExtent, width, height, maxError);
+        else
+            resultImage = manualReproject(getImage(), getExtent(), destExtent, width, height);
     }
     else
     {
@@ -1963,6 +2396,196 @@ GeoHeightField::getElevation(const SpatialReference* inputSRS,
     }
 }
 
+namespace
+{
+    // Pixel position along one axis of a heightfield, with its bracketing posts.
+    struct PixelSpan
+    {
+        double p;
+        int    lo, hi;
+    };
+
+    inline PixelSpan makePixelSpan(double p, int size)
+    {
+        PixelSpan span;
+        span.p  = osg::clampBetween( p, 0.0, (double)(size-1) );
+        span.lo = osg::maximum( (int)floor(span.p), 0 );
+        span.hi = osg::maximum( osg::minimum((int)ceil(span.p), size-1), 0 );
+        if ( span.lo > span.hi ) span.lo = span.hi;
+        return span;
+    }
+
+    // Same result as HeightFieldUtils::getHeightAtPixel(INTERP_BILINEAR), minus
+    // the per-call bounds setup.
+    inline float sampleBilinear(const float* data, int numColumns, const PixelSpan& c, const PixelSpan& r)
+    {
+        float llHeight = data[c.lo + r.lo*numColumns];
+        float lrHeight = data[c.hi + r.lo*numColumns];
+        float ulHeight = data[c.lo + r.hi*numColumns];
+        float urHeight = data[c.hi + r.hi*numColumns];
+
+        if ( !HeightFieldUtils::validateSamples(urHeight, llHeight, ulHeight, lrHeight) )
+            return NO_DATA_VALUE;
+
+        if ( c.lo == c.hi && r.lo == r.hi )
+            return llHeight;
+
+        if ( c.lo == c.hi )
+            return ((double)r.hi - r.p) * llHeight + (r.p - (double)r.lo) * ulHeight;
+
+        if ( r.lo == r.hi )
+            return ((double)c.hi - c.p) * llHeight + (c.p - (double)c.lo) * lrHeight;
+
+        float r1 = ((double)c.hi - c.p) * llHeight + (c.p - (double)c.lo) * lrHeight;
+        float r2 = ((double)c.hi - c.p) * ulHeight + (c.p - (double)c.lo) * urHeight;
+        return ((double)r.hi - r.p) * r1 + (r.p - (double)r.lo) * r2;
+    }
+
+    void convertVerticalDatum(const SpatialReference* extentSRS, const SpatialReference* outputSRS,
+                              double x, double y, float& elevation)
+    {
+        osg::Vec3d geolocal(x, y, 0.0);
+        if ( !extentSRS->isGeographic() )
+        {
+            extentSRS->transform(geolocal, extentSRS->getGeographicSRS(), geolocal);
+        }
+
+        VerticalDatum::transform(
+            extentSRS->getVerticalDatum(),
+            outputSRS ? outputSRS->getVerticalDatum() : 0L,
+            geolocal.y(), geolocal.x(), elevation);
+    }
+}
+
+bool
+GeoHeightField::getElevations(const GeoExtent&         gridExtent,
+                              unsigned                 numColumns,
+                              unsigned                 numRows,
+                              ElevationInterpolation   interp,
+                              const SpatialReference*  outputSRS,
+                              std::vector<float>&      out_elevations,
+                              const std::vector<bool>* skip) const
+{
+    out_elevations.assign( numColumns*numRows, NO_DATA_VALUE );
+
+    if ( !valid() || !gridExtent.isValid() || numColumns < 2 || numRows < 2 )
+        return false;
+
+    const osg::HeightField* hf = _heightField.get();
+    int          hfColumns = hf->getNumColumns();
+    int          hfRows    = hf->getNumRows();
+    const float* data      = &hf->getFloatArray()->front();
+    double       xInterval = _extent.width()  / (double)(hfColumns-1);
+    double       yInterval = _extent.height() / (double)(hfRows-1);
+
+    double dx = gridExtent.width()  / (double)(numColumns-1);
+    double dy = gridExtent.height() / (double)(numRows-1);
+
+    const SpatialReference* gridSRS   = gridExtent.getSRS();
+    const SpatialReference* extentSRS = _extent.getSRS();
+    bool convertVDatum = !extentSRS->isVertEquivalentTo(outputSRS);
+    bool sampled = false;
+
+    if ( gridSRS->isHorizEquivalentTo(extentSRS) )
+    {
+        // The grid maps onto the heightfield axis by axis, so each column's
+        // and each row's pixel position is computed only once.
+        std::vector<PixelSpan> columns( numColumns );
+        std::vector<bool>      columnInside( numColumns, false );
+        double yInside  = 0.5*(_extent.yMin() + _extent.yMax());
+        double xInside  = 0.0;
+        bool   anyInside = false;
+
+        for(unsigned c=0; c<numColumns; ++c)
+        {
+            double x = gridExtent.xMin() + dx*(double)c;
+            columnInside[c] = _extent.contains(x, yInside);
+            columns[c] = makePixelSpan( (x - _extent.xMin()) / xInterval, hfColumns );
+            if ( columnInside[c] && !anyInside )
+            {
+                xInside   = x;
+                anyInside = true;
+            }
+        }
+
+        if ( !anyInside )
+            return false;
+
+        for(unsigned r=0; r<numRows; ++r)
+        {
+            double y = gridExtent.yMin() + dy*(double)r;
+            if ( !_extent.contains(xInside, y) )
+                continue;
+
+            PixelSpan row = makePixelSpan( (y - _extent.yMin()) / yInterval, hfRows );
+
+            for(unsigned c=0; c<numColumns; ++c)
+            {
+                unsigned i = r*numColumns + c;
+                if ( !columnInside[c] || (skip && (*skip)[i]) )
+                    continue;
+
+                float h = interp == INTERP_BILINEAR ?
+                    sampleBilinear( data, hfColumns, columns[c], row ) :
+                    HeightFieldUtils::getHeightAtPixel( hf, columns[c].p, row.p, interp );
+
+                if ( h != NO_DATA_VALUE && convertVDatum )
+                    convertVerticalDatum( extentSRS, outputSRS, gridExtent.xMin() + dx*(double)c, y, h );
+
+                out_elevations[i] = h;
+                sampled = true;
+            }
+        }
+    }
+
+    else
+    {
+        // Different SRS: transform all the posts in one batch.
+        std::vector<osg::Vec3d> points;
+        points.reserve( numColumns*numRows );
+        for(unsigned r=0; r<numRows; ++r)
+            for(unsigned c=0; c<numColumns; ++c)
+                points.push_back( osg::Vec3d(gridExtent.xMin() + dx*(double)c, gridExtent.yMin() + dy*(double)r, 0.0) );
+
+        std::vector<bool> transformed( points.size(), true );
+        if ( !gridSRS->transform(points, extentSRS) )
+        {
+            // at least one point failed, so find out which one(s).
+            for(unsigned r=0, i=0; r<numRows; ++r)
+                for(unsigned c=0; c<numColumns; ++c, ++i)
+                    transformed[i] = gridSRS->transform(
+                        osg::Vec3d(gridExtent.xMin() + dx*(double)c, gridExtent.yMin() + dy*(double)r, 0.0),
+                        extentSRS,
+                        points[i] );
+        }
+
+        for(unsigned i=0; i<points.size(); ++i)
+        {
+            if ( !transformed[i] || (skip && (*skip)[i]) )
+                continue;
+
+            const osg::Vec3d& local = points[i];
+            if ( !_extent.contains(local.x(), local.y()) )
+                continue;
+
+            PixelSpan column = makePixelSpan( (local.x() - _extent.xMin()) / xInterval, hfColumns );
+            PixelSpan row    = makePixelSpan( (local.y() - _extent.yMin()) / yInterval, hfRows );
+
+            float h = interp == INTERP_BILINEAR ?
+                sampleBilinear( data, hfColumns, column, row ) :
+                HeightFieldUtils::getHeightAtPixel( hf, column.p, row.p, interp );
+
+            if ( h != NO_DATA_VALUE && convertVDatum )
+                convertVerticalDatum( extentSRS, outputSRS, local.x(), local.y(), h );
+
+            out_elevations[i] = h;
+            sampled = true;
+        }
+    }
+
+    return sampled;
+}
+
 GeoHeightField
 GeoHeightField::createSubSample( const GeoExtent& destEx, ElevationInterpolation interpolation) const
 {
@@ -20,6 +20,7 @@
 #include <osgEarth/Registry>
 #include <osgEarth/Version>
 #include <osgEarth/Progress>
+#include <osgEarth/Metrics>
 #include <osgEarth/StringUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/Registry>
@@ -162,6 +163,23 @@ namespace osgEarth
     }
 }
 
+namespace
+{
+    // process-wide HTTP metrics; see Metrics.
+    struct HTTPMetrics
+    {
+        HTTPMetrics() :
+            _getTime ( Metrics::getHistogram("http.get_time", "us") ),
+            _getBytes( Metrics::getHistogram("http.get_bytes", "bytes") ),
+            _cancels ( Metrics::getCounter("http.cancel_count") ) { }
+
+        Metrics::Histogram _getTime, _getBytes;
+        Metrics::Counter   _cancels;
+    };
+
+    const HTTPMetrics s_metrics;
+}
+
 static int CurlProgressCallback(void *clientp,double dltotal,double dlnow,double ultotal,double ulnow)
 {
     ProgressCallback* callback = (ProgressCallback*)clientp;
@@ -968,6 +986,18 @@ HTTPClient::doGet(const HTTPRequest&    request,
 
     response._duration_s = OE_STOP_TIMER(get_duration);
 
+    Metrics::record( s_metrics._getTime, (unsigned long long)(response._duration_s * 1.0e6) );
+    if ( response._cancelled )
+    {
+        Metrics::add( s_metrics._cancels );
+    }
+    else if ( _simResponseCode < 0 )
+    {
+        double bytes = 0.0;
+        if ( curl_easy_getinfo(_curl_handle, CURLINFO_SIZE_DOWNLOAD, &bytes) == CURLE_OK )
+            Metrics::record( s_metrics._getBytes, (unsigned long long)bytes );
+    }
+
     if ( progress )
     {
         progress->stats()["http_get_time"] += OE_STOP_TIMER(http_get);
@@ -28,6 +28,8 @@
 #include <osgEarth/MemCache>
 #include <osgEarth/Registry>
 #include <osgEarth/Capabilities>
+#include <osgEarth/Profiler>
+#include <osgEarth/Metrics>
 #include <osg/Version>
 #include <osgDB/WriteFile>
 #include <memory.h>
@@ -66,6 +68,8 @@ ImageLayerOptions::setDefaults()
     _minRange.init( 0.0 );
     _maxRange.init( FLT_MAX );
     _featherPixels.init( false );
+    _assemblyThreads.init( 0u );
+    _reprojectionMaxError.init( 0.0 );
     _minFilter.init( osg::Texture::LINEAR_MIPMAP_LINEAR );
     _magFilter.init( osg::Texture::LINEAR );
     _texcomp.init( osg::Texture::USE_IMAGE_DATA_FORMAT ); // none
@@ -90,6 +94,8 @@ ImageLayerOptions::fromConfig( const Config& conf )
     conf.getIfSet( "shared",         _shared );
     conf.getIfSet( "coverage",       _coverage );
     conf.getIfSet( "feather_pixels", _featherPixels);
+    conf.getIfSet( "assembly_threads", _assemblyThreads );
+    conf.getIfSet( "reprojection_max_error", _reprojectionMaxError );
 
     if ( conf.hasValue( "transparent_color" ) )
         _transparentColor = stringToColor( conf.value( "transparent_color" ), osg::Vec4ub(0,0,0,0));
@@ -135,6 +141,8 @@ ImageLayerOptions::getConfig( bool isolate ) const
     conf.updateIfSet( "shared",         _shared );
     conf.updateIfSet( "coverage",       _coverage );
     conf.updateIfSet( "feather_pixels", _featherPixels );
+    conf.updateIfSet( "assembly_threads", _assemblyThreads );
+    conf.updateIfSet( "reprojection_max_error", _reprojectionMaxError );
 
     if (_transparentColor.isSet())
         conf.update("transparent_color", colorToString( _transparentColor.value()));
@@ -178,6 +186,10 @@ ImageLayerOptions::getConfig( bool isolate ) const
 
 namespace
 {
+    const Metrics::Counter s_cacheReads  = Metrics::getCounter("cache.image.reads");
+    const Metrics::Counter s_cacheHits   = Metrics::getCounter("cache.image.hits");
+    const Metrics::Counter s_cacheWrites = Metrics::getCounter("cache.image.writes");
+
     struct ImageLayerPreCacheOperation : public TileSource::ImageOperation
     {
         void operator()( osg::ref_ptr<osg::Image>& image )
@@ -197,8 +209,63 @@ namespace
             return equiv;
         }
     };
+
+    // Make sure all images in mosaic are based on "RGBA - unsigned byte" pixels.
+    // This is not the smarter choice (in some case RGB would be sufficient) but
+    // it ensure consistency between all images / layers.
+    //
+    // The main drawback is probably the CPU memory foot-print which would be reduced by allocating RGB instead of RGBA images.
+    // On GPU side, this should not change anything because of data alignements : often RGB and RGBA textures have the same memory footprint
+    //
+    void normalizeMosaicImage(GeoImage& image)
+    {
+        ImageUtils::normalizeImage(image.getImage());
+
+        if (   (image.getImage()->getDataType() != GL_UNSIGNED_BYTE)
+            || (image.getImage()->getPixelFormat() != GL_RGBA) )
+        {
+            osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(image.getImage());
+            if (convertedImg.valid())
+            {
+                image = GeoImage(convertedImg, image.getExtent());
+            }
+        }
+    }
 }
 
+// Fetches one tile of a mosaic in an assembly thread.
+struct ImageLayer::MosaicTileTask : public TaskRequest
+{
+    MosaicTileTask(ImageLayer* layer, const TileKey& key, bool fallback, ProgressCallback* progress,
+                   GeoImage& output, Threading::MultiEvent& done)
+        : _layer(layer), _key(key), _fallback(fallback), _progress(progress), _output(output), _done(done), _notified(false) { }
+
+    // a request canceled or cleared before it runs is released without
+    // running, so the waiter still has to hear about it.
+    virtual ~MosaicTileTask()
+    {
+        if ( !_notified )
+            _done.notify();
+    }
+
+    void operator()( ProgressCallback* )
+    {
+        // once the request is canceled, drain the remaining tiles without fetching.
+        if ( _progress == 0L || !_progress->isCanceled() )
+            _output = _layer->createMosaicTile( _key, _fallback, _progress );
+        _notified = true;
+        _done.notify();
+    }
+
+    ImageLayer*            _layer;
+    TileKey                _key;
+    bool                   _fallback;
+    ProgressCallback*      _progress;
+    GeoImage&              _output;
+    Threading::MultiEvent& _done;
+    bool                   _notified;
+};
+
 //------------------------------------------------------------------------
 
 ImageLayerTileProcessor::ImageLayerTileProcessor(const ImageLayerOptions& options)
@@ -509,8 +576,31 @@ ImageLayer::createImageInNativeProfile(const TileKey&    key,
 
 
 GeoImage
-ImageLayer::createImageInKeyProfile(const TileKey&    key, 
-                                    ProgressCallback* progress)
+ImageLayer::fetchImage(const TileKey&            key,
+                       osg::ref_ptr<osg::Image>& toCache,
+                       ProgressCallback*         progress)
+{
+    toCache = 0L;
+    return createImageInKeyProfile( key, progress, &toCache );
+}
+
+bool
+ImageLayer::writeImageToCache(const TileKey& key, const osg::Image* image)
+{
+    CacheBin* cacheBin = getCacheBin( key.getProfile() );
+    if ( !image || !cacheBin || !getCachePolicy().isCacheWriteable() )
+        return false;
+
+    OE_PROFILING_ZONE("Cache write");
+    Metrics::add( s_cacheWrites );
+
+    return cacheBin->write( key.str(), image );
+}
+
+GeoImage
+ImageLayer::createImageInKeyProfile(const TileKey&            key, 
+                                    ProgressCallback*         progress,
+                                    osg::ref_ptr<osg::Image>* toCache)
 {
     GeoImage result;
 
@@ -565,6 +655,9 @@ ImageLayer::createImageInKeyProfile(const TileKey&    key,
     // map profile, we can try this first.
     if ( cacheBin && getCachePolicy().isCacheReadable() )
     {
+        OE_PROFILING_ZONE("Cache read");
+        Metrics::add( s_cacheReads );
+
         ReadResult r = cacheBin->readImage( key.str() );
         if ( r.succeeded() )
         {
@@ -573,6 +666,7 @@ ImageLayer::createImageInKeyProfile(const TileKey&    key,
             bool expired = getCachePolicy().isExpired(r.lastModifiedTime());
             if (!expired)
             {
+                Metrics::add( s_cacheHits );
                 OE_DEBUG << "Got cached image for " << key.str() << std::endl;                
                 return GeoImage( cachedImage.get(), key.getExtent() );                        
             }
@@ -624,7 +718,10 @@ ImageLayer::createImageInKeyProfile(const TileKey&    key,
             OE_INFO << LC << "WARNING! mismatched extents." << std::endl;
         }
 
-        cacheBin->write( key.str(), result.getImage() );
+        if ( toCache )
+            *toCache = result.getImage();
+        else
+            writeImageToCache( key, result.getImage() );
     }
 
     if ( result.valid() )
@@ -733,45 +830,27 @@ ImageLayer::assembleImageFromTileSource(const TileKey&    key,
         // keep track of failed tiles.
         std::vector<TileKey> failedKeys;
 
-        for( std::vector<TileKey>::iterator k = intersectingKeys.begin(); k != intersectingKeys.end(); ++k )
+        std::vector<GeoImage> images;
+        createMosaicTiles( intersectingKeys, false, images, progress );
+
+        for( unsigned i = 0; i < intersectingKeys.size(); ++i )
         {
-            GeoImage image = createImageFromTileSource( *k, progress );
-            if ( image.valid() )
+            if ( images[i].valid() )
             {
-                ImageUtils::normalizeImage(image.getImage());
-
-                // Make sure all images in mosaic are based on "RGBA - unsigned byte" pixels.
-                // This is not the smarter choice (in some case RGB would be sufficient) but
-                // it ensure consistency between all images / layers.
-                //
-                // The main drawback is probably the CPU memory foot-print which would be reduced by allocating RGB instead of RGBA images.
-                // On GPU side, this should not change anything because of data alignements : often RGB and RGBA textures have the same memory footprint
-                //
-                if (   (image.getImage()->getDataType() != GL_UNSIGNED_BYTE)
-                    || (image.getImage()->getPixelFormat() != GL_RGBA) )
-                {
-                    osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(image.getImage());
-                    if (convertedImg.valid())
-                    {
-                        image = GeoImage(convertedImg, image.getExtent());
-                    }
-                }
-
-                mosaic.getImages().push_back( TileImage(image.getImage(), *k) );
+                mosaic.getImages().push_back( TileImage(images[i].getImage(), intersectingKeys[i]) );
             }
             else
             {
                 // the tile source did not return a tile, so make a note of it.
-                failedKeys.push_back( *k );
-
-                if (progress && (progress->isCanceled() || progress->needsRetry()))
-                {
-                    retry = true;
-                    break;
-                }
+                failedKeys.push_back( intersectingKeys[i] );
             }
         }
 
+        if (!failedKeys.empty() && progress && (progress->isCanceled() || progress->needsRetry()))
+        {
+            retry = true;
+        }
+
         if ( mosaic.getImages().empty() || retry )
         {
             // if we didn't get any data, fail.
@@ -782,43 +861,21 @@ ImageLayer::assembleImageFromTileSource(const TileKey&    key,
         // We got at least one good tile, so go through the bad ones and try to fall back on
         // lower resolution data to fill in the gaps. The entire mosaic must be populated or
         // this qualifies as a bad tile.
-        for(std::vector<TileKey>::iterator k = failedKeys.begin(); k != failedKeys.end(); ++k)
+        if ( !failedKeys.empty() )
         {
-            GeoImage image;
+            std::vector<GeoImage> fallbacks;
+            createMosaicTiles( failedKeys, true, fallbacks, progress );
 
-            for(TileKey parentKey = k->createParentKey();
-                parentKey.valid() && !image.valid();
-                parentKey = parentKey.createParentKey())
+            for( unsigned i = 0; i < failedKeys.size(); ++i )
             {
-                image = createImageFromTileSource( parentKey, progress );
-                if ( image.valid() )
+                if ( !fallbacks[i].valid() )
                 {
-                    ImageUtils::normalizeImage(image.getImage());
-                    if (   (image.getImage()->getDataType() != GL_UNSIGNED_BYTE)
-                        || (image.getImage()->getPixelFormat() != GL_RGBA) )
-                    {
-                        osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(image.getImage());
-                        if (convertedImg.valid())
-                        {
-                            image = GeoImage(convertedImg, image.getExtent());
-                        }
-                    }
-
-                    OE_DEBUG << LC << "Tile " << k->str() << " fell back on " << parentKey.str() << "\n";
-                    
-                    // cut out the piece we need:
-                    GeoImage croppedImage = image.crop( k->getExtent(), true, image.getImage()->s(), image.getImage()->t() );
-
-                    // and queue it.
-                    mosaic.getImages().push_back( TileImage(croppedImage.getImage(), *k) );
+                    // a tile completely failed, even with fallback. Eject.
+                    OE_DEBUG << LC << "Couldn't fallback on tiles for ImageMosaic" << std::endl;
+                    return GeoImage::INVALID;
                 }
-            }
 
-            if ( !image.valid() )
-            {
-                // a tile completely failed, even with fallback. Eject.
-                OE_DEBUG << LC << "Couldn't fallback on tiles for ImageMosaic" << std::endl;
-                return GeoImage::INVALID;
+                mosaic.getImages().push_back( TileImage(fallbacks[i].getImage(), failedKeys[i]) );
             }
         }
 
@@ -848,7 +905,8 @@ ImageLayer::assembleImageFromTileSource(const TileKey&    key,
             &key.getExtent(), 
             *_runtimeOptions.reprojectedTileSize(),
             *_runtimeOptions.reprojectedTileSize(),
-            *_runtimeOptions.driver()->bilinearReprojection());
+            *_runtimeOptions.driver()->bilinearReprojection(),
+            *_runtimeOptions.reprojectionMaxError());
     }
 
     // Process images with full alpha to properly support MP blending.
@@ -861,6 +919,94 @@ ImageLayer::assembleImageFromTileSource(const TileKey&    key,
 }
 
 
+GeoImage
+ImageLayer::createMosaicTile(const TileKey&    key,
+                             bool              fallback,
+                             ProgressCallback* progress)
+{
+    if ( !fallback )
+    {
+        GeoImage image = createImageFromTileSource( key, progress );
+        if ( image.valid() )
+        {
+            normalizeMosaicImage( image );
+        }
+        return image;
+    }
+
+    for(TileKey parentKey = key.createParentKey();
+        parentKey.valid();
+        parentKey = parentKey.createParentKey())
+    {
+        GeoImage image = createImageFromTileSource( parentKey, progress );
+        if ( image.valid() )
+        {
+            normalizeMosaicImage( image );
+
+            OE_DEBUG << LC << "Tile " << key.str() << " fell back on " << parentKey.str() << "\n";
+
+            // cut out the piece we need:
+            return image.crop( key.getExtent(), true, image.getImage()->s(), image.getImage()->t() );
+        }
+
+        if ( progress && progress->isCanceled() )
+        {
+            break;
+        }
+    }
+
+    return GeoImage::INVALID;
+}
+
+
+void
+ImageLayer::createMosaicTiles(const std::vector<TileKey>& keys,
+                              bool                        fallback,
+                              std::vector<GeoImage>&      out,
+                              ProgressCallback*           progress)
+{
+    out.assign( keys.size(), GeoImage::INVALID );
+
+    unsigned numThreads = _runtimeOptions.assemblyThreads().get();
+
+    if ( numThreads > 1 && keys.size() > 1 )
+    {
+        TaskService* service = 0L;
+        {
+            Threading::ScopedMutexLock lock(_mutex);
+            if ( !_assemblyService.valid() )
+            {
+                _assemblyService = new TaskService(
+                    Stringify() << "ImageLayer " << getName() << " assembly",
+                    numThreads, 0u, TaskService::SCHEDULER_WORK_STEALING );
+            }
+            service = _assemblyService.get();
+        }
+
+        // all the fetches (and their fallbacks) are latency-bound, so issue them
+        // together and wait for the slowest one.
+        Threading::MultiEvent done( keys.size() );
+        for(unsigned i = 0; i < keys.size(); ++i)
+        {
+            service->add( new MosaicTileTask(this, keys[i], fallback, progress, out[i], done) );
+        }
+        done.wait();
+    }
+    else
+    {
+        for(unsigned i = 0; i < keys.size(); ++i)
+        {
+            out[i] = createMosaicTile( keys[i], fallback, progress );
+
+            if ( !out[i].valid() && progress && (progress->isCanceled() || progress->needsRetry()) )
+            {
+                break;
+            }
+        }
+    }
+}
+
+
 void
 ImageLayer::applyTextureCompressionMode(osg::Texture* tex) const
 {
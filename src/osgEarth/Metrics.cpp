@@ -0,0 +1,635 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgEarth/Metrics>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/Notify>
+
+#include <map>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+#define LC "[Metrics] "
+
+#ifdef _MSC_VER
+#   define OE_METRICS_THREAD_LOCAL __declspec(thread)
+#else
+#   define OE_METRICS_THREAD_LOCAL __thread
+#endif
+
+using namespace osgEarth;
+
+namespace
+{
+    enum { MAX_COUNTERS = 256, MAX_HISTOGRAMS = 64, NUM_BUCKETS = 65 };
+
+    // A 32-bit target may store a 64-bit value in two halves, so a reader
+    // could see half of an update. There, each update is bracketed by the
+    // shard's sequence number, and readers retry until it stays the same.
+    const bool s_bracketUpdates = sizeof(void*) < 8;
+
+    struct HistogramShard
+    {
+        unsigned long long _count, _sum, _min, _max;
+        unsigned long long _buckets[NUM_BUCKETS];
+
+        void reset()
+        {
+            ::memset( this, 0, sizeof(HistogramShard) );
+            _min = ~0ull;
+        }
+
+        void merge(const HistogramShard& rhs)
+        {
+            _count += rhs._count;
+            _sum   += rhs._sum;
+            _min    = osg::minimum( _min, rhs._min );
+            _max    = osg::maximum( _max, rhs._max );
+            for(unsigned b = 0; b < NUM_BUCKETS; ++b)
+                _buckets[b] += rhs._buckets[b];
+        }
+    };
+
+    // The metrics updated by one thread. Only that thread writes to it, so
+    // it needs no locking; readers may see values a few updates behind.
+    struct ThreadShard
+    {
+        ThreadShard()
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            for(unsigned i = 0; i < MAX_COUNTERS; ++i)
+                _counters[i] = 0;
+            for(unsigned i = 0; i < MAX_HISTOGRAMS; ++i)
+                _histograms[i].reset();
+        }
+
+        // odd while the owning thread is updating (32-bit targets only).
+        OpenThreads::Atomic _sequence;
+        volatile long long  _counters[MAX_COUNTERS];
+        HistogramShard      _histograms[MAX_HISTOGRAMS];
+    };
+
+    // Brackets an update of a shard by its owning thread.
+    struct ShardUpdate
+    {
+        ShardUpdate(ThreadShard* shard) : _shard(shard) { if ( s_bracketUpdates ) ++_shard->_sequence; }
+        ~ShardUpdate() { if ( s_bracketUpdates ) ++_shard->_sequence; }
+        ThreadShard* _shard;
+    };
+
+    // Copies a value the owning thread may be updating, whole.
+    template<typename T>
+    void readShard(const ThreadShard* shard, const volatile T& value, T& out)
+    {
+        if ( !s_bracketUpdates )
+        {
+            out = const_cast<const T&>( value );
+            return;
+        }
+
+        for(;;)
+        {
+            unsigned before = shard->_sequence;
+            out = const_cast<const T&>( value );
+            unsigned after = shard->_sequence;
+            if ( before == after && (before & 1u) == 0u )
+                return;
+            OpenThreads::Thread::YieldCurrentThread();
+        }
+    }
+
+    // 0 for 0, otherwise 1 + the position of the highest bit set.
+    inline unsigned getBucket(unsigned long long value)
+    {
+        unsigned bucket = 0;
+        if ( value >= (1ull << 32) ) { bucket += 32; value >>= 32; }
+        if ( value >= (1ull << 16) ) { bucket += 16; value >>= 16; }
+        if ( value >= (1ull << 8) )  { bucket += 8;  value >>= 8; }
+        if ( value >= (1ull << 4) )  { bucket += 4;  value >>= 4; }
+        if ( value >= (1ull << 2) )  { bucket += 2;  value >>= 2; }
+        if ( value >= (1ull << 1) )  { bucket += 1;  value >>= 1; }
+        return bucket + (unsigned)value;
+    }
+
+    // Dumps the metrics to the console periodically.
+    class DumpThread : public OpenThreads::Thread
+    {
+    public:
+        DumpThread(double seconds) : _seconds(seconds), _done(false) { }
+
+        void run()
+        {
+            double waited = 0.0;
+            while( !_done )
+            {
+                OpenThreads::Thread::microSleep( 100000 );
+                waited += 0.1;
+                if ( waited >= _seconds && !_done )
+                {
+                    Metrics::dump();
+                    waited = 0.0;
+                }
+            }
+        }
+
+        void stop()
+        {
+            _done = true;
+            join();
+        }
+
+        double        _seconds;
+        volatile bool _done;
+    };
+
+    typedef std::map<std::string, osg::ref_ptr<Metrics::Gauge> > GaugeMap;
+
+    void releaseThreadShard(void* shard);
+
+    // Metric names and thread shards, shared by all threads.
+    struct MetricsData
+    {
+        MetricsData() : _dumper(0L), _envInterval(0.0), _exitHook(&releaseThreadShard)
+        {
+            // holds what exited threads recorded.
+            _retired = new ThreadShard();
+            _shards.push_back( _retired );
+
+            const char* env = ::getenv("OSGEARTH_METRICS");
+            if ( env )
+                _envInterval = osg::maximum( ::atof(env), 0.0 );
+        }
+
+        ~MetricsData()
+        {
+            if ( _dumper )
+            {
+                _dumper->stop();
+                delete _dumper;
+            }
+        }
+
+        // starts the periodic dump the environment asked for, once. It starts
+        // a thread, so it runs when metrics are first updated or read, never
+        // from a registration: registrations may run in static initializers,
+        // and starting a thread under the Windows loader lock deadlocks.
+        void checkEnvironment()
+        {
+            double interval = 0.0;
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                std::swap( interval, _envInterval );
+            }
+            if ( interval > 0.0 )
+                Metrics::setDumpInterval( interval );
+        }
+
+        Threading::Mutex                _mutex;
+        std::map<std::string, unsigned> _counterIDs;
+        std::vector<std::string>        _counterNames;
+        std::map<std::string, unsigned> _histogramIDs;
+        std::vector<std::string>        _histogramNames;
+        std::vector<std::string>        _histogramUnits;
+        GaugeMap                        _gauges;
+        std::vector<ThreadShard*>       _shards;    // never deleted, threads may still write
+        std::vector<ThreadShard*>       _free;      // shards of exited threads, for reuse
+        ThreadShard*                    _retired;
+        DumpThread*                     _dumper;
+        double                          _envInterval;
+        Threading::ThreadExitHook       _exitHook;  // last, so it goes first
+    };
+
+    // Constructed on first use, so that other modules can register their
+    // metrics from static initializers, whatever order they run in. It is
+    // also constructed at load time below, since not every compiler we
+    // support initializes a function-local static thread-safely; for the
+    // same reason, keep metric handles at namespace scope rather than in
+    // function-local statics.
+    MetricsData& getMetricsData()
+    {
+        static MetricsData s_instance;
+        return s_instance;
+    }
+
+    struct LoadMetricsData
+    {
+        LoadMetricsData() { getMetricsData(); }
+    };
+    static LoadMetricsData s_loadMetricsData;
+
+    static OE_METRICS_THREAD_LOCAL ThreadShard* s_threadShard = 0L;
+
+    ThreadShard* getThreadShard()
+    {
+        if ( !s_threadShard )
+        {
+            MetricsData& data = getMetricsData();
+            {
+                Threading::ScopedMutexLock lock( data._mutex );
+                if ( !data._free.empty() )
+                {
+                    s_threadShard = data._free.back();
+                    data._free.pop_back();
+                }
+                else
+                {
+                    s_threadShard = new ThreadShard();
+                    data._shards.push_back( s_threadShard );
+                }
+                data._exitHook.add( s_threadShard );
+            }
+            data.checkEnvironment();
+        }
+        return s_threadShard;
+    }
+
+    // Called on a thread as it exits: moves its metrics into the retired
+    // shard and keeps its shard for the next new thread, so thread churn
+    // doesn't grow the shards.
+    void releaseThreadShard(void* threadShard)
+    {
+        MetricsData& data = getMetricsData();
+        ThreadShard* shard = static_cast<ThreadShard*>( threadShard );
+
+        Threading::ScopedMutexLock lock( data._mutex );
+
+        for(unsigned i = 0; i < MAX_COUNTERS; ++i)
+            data._retired->_counters[i] = data._retired->_counters[i] + shard->_counters[i];
+        for(unsigned i = 0; i < MAX_HISTOGRAMS; ++i)
+            data._retired->_histograms[i].merge( shard->_histograms[i] );
+
+        shard->reset();
+        data._free.push_back( shard );
+
+        // in case the thread records anything else on its way out.
+        s_threadShard = 0L;
+    }
+
+    // adds up the shards of a histogram; call with the data mutex locked.
+    void readHistogram(unsigned index, Metrics::Value& out)
+    {
+        MetricsData& data = getMetricsData();
+
+        HistogramShard total;
+        total.reset();
+
+        for(std::vector<ThreadShard*>::const_iterator s = data._shards.begin(); s != data._shards.end(); ++s)
+        {
+            HistogramShard h;
+            readShard( *s, (*s)->_histograms[index], h );
+            total.merge( h );
+        }
+
+        out._type    = Metrics::Value::HISTOGRAM;
+        out._count   = (long long)total._count;
+        out._sum     = total._sum;
+        out._min     = total._count > 0 ? total._min : 0ull;
+        out._max     = total._max;
+        out._buckets.assign( total._buckets, total._buckets + NUM_BUCKETS );
+    }
+
+    long long readCounter(unsigned index)
+    {
+        MetricsData& data = getMetricsData();
+
+        long long sum = 0;
+        for(std::vector<ThreadShard*>::const_iterator s = data._shards.begin(); s != data._shards.end(); ++s)
+        {
+            long long value;
+            readShard( *s, (*s)->_counters[index], value );
+            sum += value;
+        }
+        return sum;
+    }
+
+    struct SortByName
+    {
+        bool operator()(const Metrics::Value& lhs, const Metrics::Value& rhs) const { return lhs._name < rhs._name; }
+    };
+}
+
+//------------------------------------------------------------------------
+
+double
+Metrics::Value::getMean() const
+{
+    return _count > 0 ? (double)_sum / (double)_count : 0.0;
+}
+
+unsigned long long
+Metrics::Value::getPercentile(double percent) const
+{
+    if ( _count <= 0 || _buckets.empty() )
+        return 0ull;
+
+    double target = osg::clampBetween( percent, 0.0, 100.0 ) * 0.01 * (double)_count;
+    unsigned long long seen = 0ull;
+    for(unsigned b = 0; b < _buckets.size(); ++b)
+    {
+        seen += _buckets[b];
+        if ( (double)seen >= target && seen > 0ull )
+        {
+            unsigned long long upper = b == 0 ? 0ull : b >= 64 ? ~0ull : (1ull << b) - 1ull;
+            return osg::minimum( upper, _max );
+        }
+    }
+    return _max;
+}
+
+//------------------------------------------------------------------------
+
+Metrics::Counter
+Metrics::getCounter(const std::string& name)
+{
+    MetricsData& data = getMetricsData();
+
+    Counter counter;
+    Threading::ScopedMutexLock lock( data._mutex );
+
+    std::map<std::string, unsigned>::const_iterator i = data._counterIDs.find( name );
+    if ( i != data._counterIDs.end() )
+    {
+        counter._index = i->second;
+    }
+    else if ( data._counterNames.size() < MAX_COUNTERS )
+    {
+        counter._index = data._counterNames.size();
+        data._counterNames.push_back( name );
+        data._counterIDs[name] = counter._index;
+    }
+    else
+    {
+        OE_WARN << LC << "Too many counters; ignoring \"" << name << "\"" << std::endl;
+    }
+    return counter;
+}
+
+Metrics::Histogram
+Metrics::getHistogram(const std::string& name, const std::string& units)
+{
+    MetricsData& data = getMetricsData();
+
+    Histogram histogram;
+    Threading::ScopedMutexLock lock( data._mutex );
+
+    std::map<std::string, unsigned>::const_iterator i = data._histogramIDs.find( name );
+    if ( i != data._histogramIDs.end() )
+    {
+        histogram._index = i->second;
+    }
+    else if ( data._histogramNames.size() < MAX_HISTOGRAMS )
+    {
+        histogram._index = data._histogramNames.size();
+        data._histogramNames.push_back( name );
+        data._histogramUnits.push_back( units );
+        data._histogramIDs[name] = histogram._index;
+    }
+    else
+    {
+        OE_WARN << LC << "Too many histograms; ignoring \"" << name << "\"" << std::endl;
+    }
+    return histogram;
+}
+
+void
+Metrics::setGauge(const std::string& name, Metrics::Gauge* gauge)
+{
+    MetricsData& data = getMetricsData();
+
+    Threading::ScopedMutexLock lock( data._mutex );
+    if ( gauge )
+        data._gauges[name] = gauge;
+    else
+        data._gauges.erase( name );
+}
+
+void
+Metrics::add(const Metrics::Counter& counter, long long value)
+{
+    if ( counter._index < MAX_COUNTERS )
+    {
+        ThreadShard* shard = getThreadShard();
+        ShardUpdate update( shard );
+        shard->_counters[counter._index] = shard->_counters[counter._index] + value;
+    }
+}
+
+void
+Metrics::record(const Metrics::Histogram& histogram, unsigned long long value)
+{
+    if ( histogram._index < MAX_HISTOGRAMS )
+    {
+        ThreadShard* shard = getThreadShard();
+        ShardUpdate update( shard );
+        HistogramShard& h = shard->_histograms[histogram._index];
+        h._buckets[getBucket(value)]++;
+        h._sum += value;
+        if ( value < h._min ) h._min = value;
+        if ( value > h._max ) h._max = value;
+        h._count++;
+    }
+}
+
+long long
+Metrics::get(const Metrics::Counter& counter)
+{
+    if ( counter._index >= MAX_COUNTERS )
+        return 0;
+
+    Threading::ScopedMutexLock lock( getMetricsData()._mutex );
+    return readCounter( counter._index );
+}
+
+void
+Metrics::getValues(std::vector<Metrics::Value>& out)
+{
+    MetricsData& data = getMetricsData();
+
+    data.checkEnvironment();
+
+    GaugeMap gauges;
+    {
+        Threading::ScopedMutexLock lock( data._mutex );
+
+        for(unsigned i = 0; i < data._counterNames.size(); ++i)
+        {
+            Value value;
+            value._type  = Value::COUNTER;
+            value._name  = data._counterNames[i];
+            value._count = readCounter( i );
+            out.push_back( value );
+        }
+
+        for(unsigned i = 0; i < data._histogramNames.size(); ++i)
+        {
+            Value value;
+            readHistogram( i, value );
+            value._name  = data._histogramNames[i];
+            value._units = data._histogramUnits[i];
+            out.push_back( value );
+        }
+
+        gauges = data._gauges;
+    }
+
+    // sample the gauges unlocked; they may take locks of their own.
+    for(GaugeMap::const_iterator i = gauges.begin(); i != gauges.end(); ++i)
+    {
+        Value value;
+        value._type  = Value::GAUGE;
+        value._name  = i->first;
+        value._gauge = i->second->sample();
+        out.push_back( value );
+    }
+
+    std::sort( out.begin(), out.end(), SortByName() );
+}
+
+bool
+Metrics::getValue(const std::string& name, Metrics::Value& out)
+{
+    MetricsData& data = getMetricsData();
+
+    osg::ref_ptr<Gauge> gauge;
+    {
+        Threading::ScopedMutexLock lock( data._mutex );
+
+        std::map<std::string, unsigned>::const_iterator c = data._counterIDs.find( name );
+        if ( c != data._counterIDs.end() )
+        {
+            out = Value();
+            out._type  = Value::COUNTER;
+            out._name  = name;
+            out._count = readCounter( c->second );
+            return true;
+        }
+
+        std::map<std::string, unsigned>::const_iterator h = data._histogramIDs.find( name );
+        if ( h != data._histogramIDs.end() )
+        {
+            out = Value();
+            readHistogram( h->second, out );
+            out._name  = name;
+            out._units = data._histogramUnits[h->second];
+            return true;
+        }
+
+        GaugeMap::const_iterator g = data._gauges.find( name );
+        if ( g == data._gauges.end() )
+            return false;
+        gauge = g->second.get();
+    }
+
+    out = Value();
+    out._type  = Value::GAUGE;
+    out._name  = name;
+    out._gauge = gauge->sample();
+    return true;
+}
+
+void
+Metrics::writeSummary(std::ostream& out)
+{
+    std::vector<Value> values;
+    getValues( values );
+
+    out << std::setw(36) << std::left << "metric" << std::right
+        << std::setw(14) << "count"
+        << std::setw(14) << "mean"
+        << std::setw(12) << "p50"
+        << std::setw(12) << "p95"
+        << std::setw(12) << "max"
+        << "  units" << std::endl;
+
+    for(std::vector<Value>::const_iterator v = values.begin(); v != values.end(); ++v)
+    {
+        out << std::setw(36) << std::left << v->_name << std::right;
+
+        if ( v->_type == Value::COUNTER )
+        {
+            out << std::setw(14) << v->_count << std::endl;
+        }
+        else if ( v->_type == Value::GAUGE )
+        {
+            out << std::setw(14) << std::fixed << std::setprecision(1) << v->_gauge << std::endl;
+        }
+        else
+        {
+            out << std::setw(14) << v->_count
+                << std::setw(14) << std::fixed << std::setprecision(1) << v->getMean()
+                << std::setw(12) << v->getPercentile(50.0)
+                << std::setw(12) << v->getPercentile(95.0)
+                << std::setw(12) << v->_max
+                << "  " << v->_units << std::endl;
+        }
+    }
+}
+
+void
+Metrics::dump()
+{
+    std::stringstream buf;
+    writeSummary( buf );
+    OE_NOTICE << LC << "\n" << buf.str() << std::endl;
+}
+
+void
+Metrics::setDumpInterval(double seconds)
+{
+    MetricsData& data = getMetricsData();
+
+    DumpThread* dumper = 0L;
+    {
+        Threading::ScopedMutexLock lock( data._mutex );
+        std::swap( dumper, data._dumper );
+    }
+
+    // stop the previous one unlocked, since it may be dumping.
+    if ( dumper )
+    {
+        dumper->stop();
+        delete dumper;
+        dumper = 0L;
+    }
+
+    if ( seconds > 0.0 )
+    {
+        dumper = new DumpThread( seconds );
+        dumper->start();
+
+        Threading::ScopedMutexLock lock( data._mutex );
+        std::swap( dumper, data._dumper );
+    }
+
+    // another call may have started one meanwhile.
+    if ( dumper )
+    {
+        dumper->stop();
+        delete dumper;
+    }
+}
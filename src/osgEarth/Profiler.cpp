@@ -18,58 +18,463 @@
  */
 
 #include <osgEarth/Profiler>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/Notify>
 
 #include <map>
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
 #include <osg/Timer>
+#include <OpenThreads/Atomic>
+
+#define LC "[Profiler] "
+
+#ifdef _MSC_VER
+#   define OE_PROFILER_THREAD_LOCAL __declspec(thread)
+#else
+#   define OE_PROFILER_THREAD_LOCAL __thread
+#endif
 
 using namespace osgEarth;
 
-typedef std::map< std::string, osg::Timer_t > StartTimeMap;
-static StartTimeMap S_START_TIMES;
+namespace
+{
+    enum EventType { BEGIN, END };
+
+    struct Event
+    {
+        osg::Timer_t _tick;
+        unsigned     _zone;
+        unsigned     _type;
+    };
+
+    // Ring buffer of the events of one thread. Only that thread writes to it;
+    // readers copy the events and drop the ones that may have been overwritten
+    // while they were copying them.
+    struct ThreadBuffer
+    {
+        // a power of two, so the event counters can wrap around.
+        enum { CAPACITY = 1u << 16 };
+
+        ThreadBuffer(unsigned threadId)
+            : _threadId(threadId), _next(0u), _head(0u), _tail(0u), _events(CAPACITY) { }
+
+        void push(unsigned zone, EventType type)
+        {
+            Event& e = _events[_next & (CAPACITY-1)];
+            e._tick = osg::Timer::instance()->tick();
+            e._zone = zone;
+            e._type = type;
+
+            // publish the event.
+            ++_next;
+            ++_head;
+        }
+
+        // copies the events recorded since the last clear, oldest first.
+        void read(std::vector<Event>& out) const
+        {
+            unsigned head = _head;
+            unsigned count = osg::minimum( head - _tail, (unsigned)CAPACITY-1 );
+
+            std::vector<Event> events;
+            events.reserve( count );
+            for(unsigned i = head - count; i != head; ++i)
+                events.push_back( _events[i & (CAPACITY-1)] );
+
+            // the writer may have wrapped around over the oldest ones meanwhile;
+            // it may be writing the slot after the last one it published.
+            unsigned after = _head;
+            for(unsigned i = head - count; i != head; ++i)
+            {
+                if ( after - i < (unsigned)CAPACITY )
+                    out.push_back( events[i - (head - count)] );
+            }
+        }
+
+        unsigned            _threadId;
+        unsigned            _next;      // written by the owning thread only
+        OpenThreads::Atomic _head;      // events published
+        unsigned            _tail;      // events cleared; guarded by the data mutex
+        std::vector<Event>  _events;
+    };
+
+    // The events a thread recorded before it exited.
+    struct RetiredEvents
+    {
+        unsigned           _threadId;
+        std::vector<Event> _events;
+    };
+
+    // events of exited threads to keep, oldest threads dropped first.
+    enum { MAX_RETIRED_EVENTS = 4u * ThreadBuffer::CAPACITY };
+
+    // A zone that began and ended.
+    struct Span
+    {
+        unsigned     _zone, _threadId, _depth;
+        osg::Timer_t _start, _end, _childTicks;
+    };
+
+    struct ZoneSummary
+    {
+        ZoneSummary() : _calls(0u), _total(0.0), _self(0.0), _max(0.0) { }
+        std::string _name;
+        unsigned    _calls;
+        double      _total, _self, _max;
+
+        bool operator < (const ZoneSummary& rhs) const { return _total > rhs._total; }
+    };
+
+    void releaseThreadBuffer(void* buffer);
+
+    // Zone names and thread buffers, shared by all threads.
+    struct ProfilerData
+    {
+        ProfilerData() : _enabled(false), _numRetired(0u), _exitHook(&releaseThreadBuffer)
+        {
+            _startTick      = osg::Timer::instance()->tick();
+            _secondsPerTick = osg::Timer::instance()->getSecondsPerTick();
+
+            const char* env = ::getenv("OSGEARTH_PROFILER");
+            if ( env )
+            {
+                _enabled = true;
+                if ( std::string(env) != "1" )
+                    _traceFile = env;
+            }
+        }
+
+        ~ProfilerData()
+        {
+            if ( !_traceFile.empty() )
+            {
+                std::ofstream out( _traceFile.c_str() );
+                if ( out.is_open() )
+                    writeChromeTrace( out );
+            }
+        }
+
+        // pairs the begin and end events of each thread into spans.
+        void collectSpans(std::vector<Span>& spans)
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+
+            for(std::list<RetiredEvents>::const_iterator r = _retired.begin(); r != _retired.end(); ++r)
+                pairEvents( r->_events, r->_threadId, spans );
+
+            std::vector<Event> events;
+            for(unsigned b = 0; b < _buffers.size(); ++b)
+            {
+                events.clear();
+                _buffers[b]->read( events );
+                pairEvents( events, _buffers[b]->_threadId, spans );
+            }
+        }
+
+        // pairs the begin and end events of one thread into spans.
+        static void pairEvents(const std::vector<Event>& events, unsigned threadId, std::vector<Span>& spans)
+        {
+            std::vector<Span> stack;
+            for(std::vector<Event>::const_iterator e = events.begin(); e != events.end(); ++e)
+            {
+                if ( e->_type == BEGIN )
+                {
+                    Span span;
+                    span._zone       = e->_zone;
+                    span._threadId   = threadId;
+                    span._depth      = stack.size();
+                    span._start      = e->_tick;
+                    span._end        = e->_tick;
+                    span._childTicks = 0;
+                    stack.push_back( span );
+                    continue;
+                }
+
+                // find the zone it ends; if its beginning was overwritten or
+                // cleared, there's none.
+                int k = (int)stack.size()-1;
+                while( k >= 0 && stack[k]._zone != e->_zone )
+                    --k;
+                if ( k < 0 )
+                    continue;
+
+                // any zones still open inside it never ended properly.
+                stack.resize( k+1 );
+
+                Span& span = stack.back();
+                span._end = e->_tick;
+                if ( k > 0 )
+                    stack[k-1]._childTicks += span._end - span._start;
+                spans.push_back( span );
+                stack.pop_back();
+            }
+        }
+
+        void writeChromeTrace(std::ostream& out)
+        {
+            std::vector<Span> spans;
+            collectSpans( spans );
+
+            std::vector<std::string> names;
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                names = _names;
+            }
+
+            double usPerTick = _secondsPerTick * 1.0e6;
+
+            out << "{\"traceEvents\":[";
+            for(unsigned i = 0; i < spans.size(); ++i)
+            {
+                const Span& span = spans[i];
+                out << (i > 0 ? ",\n" : "\n")
+                    << "{\"name\":\"" << escape(span._zone < names.size() ? names[span._zone] : "") << "\""
+                    << ",\"cat\":\"osgEarth\",\"ph\":\"X\",\"pid\":0"
+                    << ",\"tid\":" << span._threadId
+                    << std::fixed << std::setprecision(3)
+                    << ",\"ts\":" << (double)(span._start - _startTick) * usPerTick
+                    << ",\"dur\":" << (double)(span._end - span._start) * usPerTick
+                    << "}";
+            }
+            out << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+        }
+
+        static std::string escape(const std::string& in)
+        {
+            std::string out;
+            for(std::string::const_iterator c = in.begin(); c != in.end(); ++c)
+            {
+                if ( *c == '"' || *c == '\\' )
+                    out.push_back( '\\' );
+                if ( (unsigned char)*c >= 0x20 )
+                    out.push_back( *c );
+            }
+            return out;
+        }
+
+        volatile bool                   _enabled;
+        std::string                     _traceFile;
+        osg::Timer_t                    _startTick;
+        double                          _secondsPerTick;
+        Threading::Mutex                _mutex;
+        std::vector<std::string>        _names;
+        std::map<std::string, unsigned> _ids;
+        std::vector<ThreadBuffer*>      _buffers;   // never deleted, threads may still write
+        std::vector<ThreadBuffer*>      _free;      // buffers of exited threads, for reuse
+        std::list<RetiredEvents>        _retired;   // oldest first
+        unsigned                        _numRetired;
+        Threading::ThreadExitHook       _exitHook;  // last, so it goes first
+    };
+
+    static ProfilerData s_data;
+
+    static OE_PROFILER_THREAD_LOCAL ThreadBuffer* s_threadBuffer = 0L;
+
+    ThreadBuffer* getThreadBuffer()
+    {
+        if ( !s_threadBuffer )
+        {
+            Threading::ScopedMutexLock lock( s_data._mutex );
+            if ( !s_data._free.empty() )
+            {
+                s_threadBuffer = s_data._free.back();
+                s_data._free.pop_back();
+                s_threadBuffer->_threadId = Threading::getCurrentThreadId();
+            }
+            else
+            {
+                s_threadBuffer = new ThreadBuffer( Threading::getCurrentThreadId() );
+                s_data._buffers.push_back( s_threadBuffer );
+            }
+            s_data._exitHook.add( s_threadBuffer );
+        }
+        return s_threadBuffer;
+    }
+
+    // Called on a thread as it exits: keeps the events it recorded (up to
+    // MAX_RETIRED_EVENTS over all exited threads) and hands its buffer to the
+    // next new thread, so thread churn doesn't grow the buffers.
+    void releaseThreadBuffer(void* data)
+    {
+        ThreadBuffer* buffer = static_cast<ThreadBuffer*>( data );
+
+        Threading::ScopedMutexLock lock( s_data._mutex );
 
-typedef std::map< std::string, double > ElapsedTimeMap;
-static ElapsedTimeMap S_ELAPSED_TIMES;
+        s_data._retired.push_back( RetiredEvents() );
+        RetiredEvents& retired = s_data._retired.back();
+        retired._threadId = buffer->_threadId;
+        buffer->read( retired._events );
+        s_data._numRetired += retired._events.size();
 
-typedef std::map< std::string, unsigned int > CallMap;
-static CallMap S_CALL_COUNT;
+        while( s_data._numRetired > MAX_RETIRED_EVENTS )
+        {
+            s_data._numRetired -= s_data._retired.front()._events.size();
+            s_data._retired.pop_front();
+        }
+        if ( !s_data._retired.empty() && s_data._retired.back()._events.empty() )
+            s_data._retired.pop_back();
+
+        buffer->_tail = buffer->_head;
+        s_data._free.push_back( buffer );
+
+        // in case the thread records anything else on its way out.
+        s_threadBuffer = 0L;
+    }
+}
+
+void Profiler::setEnabled(bool value)
+{
+    s_data._enabled = value;
+}
+
+bool Profiler::isEnabled()
+{
+    return s_data._enabled;
+}
+
+unsigned Profiler::getZoneID(const std::string& name)
+{
+    Threading::ScopedMutexLock lock( s_data._mutex );
+
+    std::map<std::string, unsigned>::const_iterator i = s_data._ids.find(name);
+    if ( i != s_data._ids.end() )
+        return i->second;
+
+    unsigned zone = s_data._names.size();
+    s_data._names.push_back( name );
+    s_data._ids[name] = zone;
+    return zone;
+}
+
+unsigned Profiler::getZoneID(volatile unsigned& id, const char* name)
+{
+    // threads that race here intern the same name and store the same number.
+    unsigned zone = id;
+    if ( zone == ~0u )
+    {
+        zone = getZoneID( std::string(name) );
+        id = zone;
+    }
+    return zone;
+}
+
+std::string Profiler::getZoneName(unsigned zone)
+{
+    Threading::ScopedMutexLock lock( s_data._mutex );
+    return zone < s_data._names.size() ? s_data._names[zone] : std::string();
+}
+
+void Profiler::begin(unsigned zone)
+{
+    if ( s_data._enabled )
+        getThreadBuffer()->push( zone, BEGIN );
+}
+
+void Profiler::end(unsigned zone)
+{
+    if ( s_data._enabled )
+        getThreadBuffer()->push( zone, END );
+}
 
 void Profiler::start(const std::string& name)
 {
-    S_START_TIMES[name] = osg::Timer::instance()->tick();
+    if ( s_data._enabled )
+        begin( getZoneID(name) );
 }
 
 void Profiler::end(const std::string& name)
 {
-    osg::Timer_t end = osg::Timer::instance()->tick();
-    StartTimeMap::iterator startItr = S_START_TIMES.find(name);
-    if (startItr == S_START_TIMES.end())
+    if ( s_data._enabled )
+        end( getZoneID(name) );
+}
+
+void Profiler::writeChromeTrace(std::ostream& out)
+{
+    s_data.writeChromeTrace( out );
+}
+
+bool Profiler::writeChromeTrace(const std::string& filename)
+{
+    std::ofstream out( filename.c_str() );
+    if ( !out.is_open() )
     {
-        OE_WARN << "Can't find start time " << name << std::endl;
-        return;
+        OE_WARN << LC << "Cannot write trace to " << filename << std::endl;
+        return false;
     }
+    s_data.writeChromeTrace( out );
+    return true;
+}
 
-    double dt = osg::Timer::instance()->delta_s(startItr->second, end);
-    ElapsedTimeMap::iterator elapsedItr = S_ELAPSED_TIMES.find(name);
-    if (elapsedItr == S_ELAPSED_TIMES.end())
+void Profiler::writeSummary(std::ostream& out)
+{
+    std::vector<Span> spans;
+    s_data.collectSpans( spans );
+
+    std::vector<ZoneSummary> zones;
     {
-        S_ELAPSED_TIMES[name] = 0.0;
+        Threading::ScopedMutexLock lock( s_data._mutex );
+        zones.resize( s_data._names.size() );
+        for(unsigned i = 0; i < zones.size(); ++i)
+            zones[i]._name = s_data._names[i];
     }
-    S_ELAPSED_TIMES[name] += dt;
 
-    // Increment the number of calls for the task
-    CallMap::iterator callItr = S_CALL_COUNT.find(name);
-    if (callItr == S_CALL_COUNT.end())
+    for(std::vector<Span>::const_iterator span = spans.begin(); span != spans.end(); ++span)
     {
-        S_CALL_COUNT[name] = 0;
+        if ( span->_zone >= zones.size() )
+            continue;
+
+        ZoneSummary& zone = zones[span->_zone];
+        double seconds = (double)(span->_end - span->_start) * s_data._secondsPerTick;
+        zone._calls++;
+        zone._total += seconds;
+        zone._self  += seconds - (double)span->_childTicks * s_data._secondsPerTick;
+        zone._max    = osg::maximum( zone._max, seconds );
     }
-    S_CALL_COUNT[name] += 1;
 
+    std::sort( zones.begin(), zones.end() );
+
+    out << std::setw(32) << std::left << "zone" << std::right
+        << std::setw(10) << "calls"
+        << std::setw(12) << "total ms"
+        << std::setw(12) << "self ms"
+        << std::setw(12) << "avg ms"
+        << std::setw(12) << "max ms" << std::endl;
+
+    for(std::vector<ZoneSummary>::const_iterator zone = zones.begin(); zone != zones.end(); ++zone)
+    {
+        if ( zone->_calls == 0 )
+            continue;
+
+        out << std::setw(32) << std::left << zone->_name << std::right
+            << std::setw(10) << zone->_calls
+            << std::fixed << std::setprecision(3)
+            << std::setw(12) << 1000.0 * zone->_total
+            << std::setw(12) << 1000.0 * zone->_self
+            << std::setw(12) << 1000.0 * zone->_total / (double)zone->_calls
+            << std::setw(12) << 1000.0 * zone->_max << std::endl;
+    }
 }
 
 void Profiler::dump()
 {
-    for (ElapsedTimeMap::iterator itr = S_ELAPSED_TIMES.begin(); itr != S_ELAPSED_TIMES.end(); ++itr)
+    std::stringstream buf;
+    writeSummary( buf );
+    OE_NOTICE << LC << "\n" << buf.str() << std::endl;
+}
+
+void Profiler::clear()
+{
+    Threading::ScopedMutexLock lock( s_data._mutex );
+    for(unsigned b = 0; b < s_data._buffers.size(); ++b)
     {
-        OE_NOTICE << itr->first << ": calls=" << S_CALL_COUNT[itr->first] << "  time=" << itr->second << "s" << std::endl;
+        s_data._buffers[b]->_tail = s_data._buffers[b]->_head;
     }
-}
\ No newline at end of file
+    s_data._retired.clear();
+    s_data._numRetired = 0u;
+}
@@ -17,8 +17,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarth/TaskService>
+#include <osgEarth/StringUtils>
+#include <osgEarth/Metrics>
 #include <osg/Notify>
 #include <osg/Math>
+#include <stdlib.h>
+#include <set>
 
 using namespace osgEarth;
 using namespace OpenThreads;
@@ -143,7 +147,7 @@ TaskRequestQueue::add( TaskRequest* request )
 }
 
 TaskRequest* 
-TaskRequestQueue::get()
+TaskRequestQueue::get( unsigned slot )
 {
     
     osg::ref_ptr<TaskRequest> next;
@@ -192,9 +196,268 @@ TaskRequestQueue::setDone()
 
 //------------------------------------------------------------------------
 
-TaskThread::TaskThread( TaskRequestQueue* queue ) :
+WorkStealingTaskRequestQueue::WorkStealingTaskRequestQueue(unsigned int numSlots,
+                                                           unsigned int maxSize) :
+TaskRequestQueue( maxSize ),
+_done           ( false )
+{
+    numSlots = osg::maximum( numSlots, 1u );
+    _slots.reserve( numSlots );
+    for(unsigned i=0; i<numSlots; ++i)
+        _slots.push_back( new Slot() );
+}
+
+WorkStealingTaskRequestQueue::~WorkStealingTaskRequestQueue()
+{
+    for(unsigned i=0; i<_slots.size(); ++i)
+        delete _slots[i];
+    _slots.clear();
+}
+
+void
+WorkStealingTaskRequestQueue::removeFromCount( unsigned num )
+{
+    // OpenThreads::Atomic only steps by one.
+    for( ; num > 0u; --num )
+        --_numRequests;
+}
+
+void
+WorkStealingTaskRequestQueue::clear()
+{
+    unsigned numCleared = 0u;
+    for(unsigned i=0; i<_slots.size(); ++i)
+    {
+        Slot* slot = _slots[i];
+        ScopedLock<Mutex> lock( slot->_mutex );
+        numCleared += slot->_requests.size();
+        slot->_requests.clear();
+    }
+    removeFromCount( numCleared );
+
+    ScopedLock<Mutex> lock( _idleMutex );
+    _notFull.broadcast();
+}
+
+void
+WorkStealingTaskRequestQueue::cancel()
+{
+    unsigned numCleared = 0u;
+    for(unsigned i=0; i<_slots.size(); ++i)
+    {
+        Slot* slot = _slots[i];
+        ScopedLock<Mutex> lock( slot->_mutex );
+        for(TaskRequestPriorityMap::iterator it = slot->_requests.begin(); it != slot->_requests.end(); ++it)
+        {
+            it->second->cancel();
+        }
+        numCleared += slot->_requests.size();
+        slot->_requests.clear();
+    }
+    removeFromCount( numCleared );
+
+    ScopedLock<Mutex> lock( _idleMutex );
+    _notFull.broadcast();
+}
+
+bool
+WorkStealingTaskRequestQueue::isFull() const
+{
+    return getMaxSize() > 0 && (unsigned)_numRequests >= getMaxSize();
+}
+
+bool
+WorkStealingTaskRequestQueue::isEmpty() const
+{
+    return !_done && (unsigned)_numRequests == 0u;
+}
+
+unsigned int
+WorkStealingTaskRequestQueue::getNumRequests() const
+{
+    return _numRequests;
+}
+
+void
+WorkStealingTaskRequestQueue::add( TaskRequest* request )
+{
+    request->setState( TaskRequest::STATE_PENDING );
+
+    // install a progress callback if one isn't already installed
+    if ( !request->getProgressCallback() )
+        request->setProgressCallback( new ProgressCallback() );
+
+    // Count the request before inserting it. A bounded queue reserves its
+    // place this way, backing off and waiting when the reservation went
+    // over the limit, so concurrent adds cannot overshoot it.
+    if ( getMaxSize() > 0 )
+    {
+        ScopedLock<Mutex> lock( _idleMutex );
+        while( ++_numRequests > getMaxSize() && !_done )
+        {
+            --_numRequests;
+            _notFull.wait( &_idleMutex );
+        }
+    }
+    else
+    {
+        ++_numRequests;
+    }
+
+    // distribute new requests round-robin across the worker slots.
+    Slot* slot = _slots[ (++_nextSlot) % _slots.size() ];
+    {
+        ScopedLock<Mutex> lock( slot->_mutex );
+        slot->_requests.insert( std::pair<float,TaskRequest*>(request->getPriority(), request) );
+    }
+
+    // Only take the idle lock if someone is actually asleep. A worker registers
+    // as idle before it re-checks the request count under the same lock, so
+    // the wake-up cannot be lost.
+    if ( (unsigned)_numIdle > 0u )
+    {
+        ScopedLock<Mutex> lock( _idleMutex );
+        _notEmpty.signal();
+    }
+}
+
+TaskRequest*
+WorkStealingTaskRequestQueue::popLocked( Slot* slot )
+{
+    if ( slot->_requests.empty() )
+        return 0L;
+
+    osg::ref_ptr<TaskRequest> next = slot->_requests.begin()->second.get();
+    slot->_requests.erase( slot->_requests.begin() );
+    --_numRequests;
+    return next.release();
+}
+
+TaskRequest*
+WorkStealingTaskRequestQueue::pop( Slot* slot )
+{
+    ScopedLock<Mutex> lock( slot->_mutex );
+    return popLocked( slot );
+}
+
+TaskRequest*
+WorkStealingTaskRequestQueue::popOwn( unsigned own )
+{
+    Slot* slot = _slots[own];
+    ScopedLock<Mutex> lock( slot->_mutex );
+
+    // an empty slot leaves it to steal(), which looks at all the others.
+    if ( slot->_requests.empty() )
+        return 0L;
+
+    // Compare heads with one other slot, the next one each time, so that a
+    // request that comes first anywhere is reached within a few pops. The
+    // other slot is only try-locked, so this never waits (or deadlocks) on it.
+    unsigned numSlots = _slots.size();
+    if ( numSlots > 1 )
+    {
+        Slot* peer = _slots[ (own + 1 + slot->_nextPeer++ % (numSlots-1)) % numSlots ];
+        if ( peer->_mutex.trylock() == 0 )
+        {
+            TaskRequest* next = 0L;
+            if ( !peer->_requests.empty() && peer->_requests.begin()->first < slot->_requests.begin()->first )
+                next = popLocked( peer );
+            peer->_mutex.unlock();
+
+            if ( next )
+                return next;
+        }
+    }
+
+    return popLocked( slot );
+}
+
+TaskRequest*
+WorkStealingTaskRequestQueue::steal( unsigned thief )
+{
+    unsigned numSlots = _slots.size();
+
+    // first pass: only visit victims whose lock is free.
+    for(unsigned i=1; i<numSlots; ++i)
+    {
+        Slot* victim = _slots[ (thief+i) % numSlots ];
+        if ( victim->_mutex.trylock() == 0 )
+        {
+            TaskRequest* next = popLocked( victim );
+            victim->_mutex.unlock();
+
+            if ( next )
+                return next;
+        }
+    }
+
+    // second pass: there is work queued somewhere but every holder was
+    // busy; wait our turn.
+    for(unsigned i=1; i<numSlots && (unsigned)_numRequests > 0u; ++i)
+    {
+        TaskRequest* next = pop( _slots[ (thief+i) % numSlots ] );
+        if ( next )
+            return next;
+    }
+
+    return 0L;
+}
+
+TaskRequest*
+WorkStealingTaskRequestQueue::get( unsigned slot )
+{
+    unsigned own = slot % _slots.size();
+
+    for(;;)
+    {
+        if ( _done )
+            return 0L;
+
+        TaskRequest* next = popOwn( own );
+        if ( !next )
+            next = steal( own );
+
+        if ( next )
+        {
+            if ( getMaxSize() > 0 )
+            {
+                ScopedLock<Mutex> lock( _idleMutex );
+                _notFull.signal();
+            }
+            return next;
+        }
+
+        // nothing to do anywhere; go to sleep until add() or setDone().
+        ScopedLock<Mutex> lock( _idleMutex );
+        ++_numIdle;
+        while( isEmpty() )
+        {
+            _notEmpty.wait( &_idleMutex );
+        }
+        --_numIdle;
+    }
+}
+
+void
+WorkStealingTaskRequestQueue::setDone()
+{
+    ScopedLock<Mutex> lock( _idleMutex );
+
+    _done = true;
+
+    // alternative to buggy win32 broadcast (OSG pre-r10457 on windows)
+    for(int i=0; i<128; i++) {
+        _notFull.signal();
+        _notEmpty.signal();
+    }
+}
+
+//------------------------------------------------------------------------
+
+TaskThread::TaskThread( TaskRequestQueue* queue, unsigned slot ) :
 _queue( queue ),
-_done( false )
+_done( false ),
+_slot( slot )
 {
     //nop
 }
@@ -204,7 +467,7 @@ TaskThread::run()
 {
     while( !_done )
     {
-        _request = _queue->get();
+        _request = _queue->get( _slot );
 
         if ( _done )
             break;
@@ -277,14 +540,76 @@ TaskThread::cancel()
 
 //------------------------------------------------------------------------
 
-TaskService::TaskService( const std::string& name, int numThreads, unsigned int maxSize ):
+namespace
+{
+    // Reports the requests waiting in the queues of all the task services,
+    // e.g. the tiles waiting to load, as the "tasks.queue_depth" metric.
+    struct QueueDepthGauge : public Metrics::Gauge
+    {
+        void add(TaskService* service)
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _services.insert( service );
+        }
+
+        void remove(TaskService* service)
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _services.erase( service );
+        }
+
+        double sample()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            double depth = 0.0;
+            for(std::set<TaskService*>::const_iterator i = _services.begin(); i != _services.end(); ++i)
+                depth += (double)(*i)->getNumRequests();
+            return depth;
+        }
+
+        Threading::Mutex        _mutex;
+        std::set<TaskService*>  _services;
+    };
+
+    // never deleted, since task services may outlive static destruction.
+    QueueDepthGauge* getQueueDepthGauge()
+    {
+        static QueueDepthGauge* s_gauge = 0L;
+        static Threading::Mutex s_gaugeMutex;
+
+        Threading::ScopedMutexLock lock( s_gaugeMutex );
+        if ( !s_gauge )
+        {
+            s_gauge = new QueueDepthGauge();
+            s_gauge->ref();
+            Metrics::setGauge( "tasks.queue_depth", s_gauge );
+        }
+        return s_gauge;
+    }
+}
+
+TaskService::TaskService( const std::string& name, int numThreads, unsigned int maxSize, Scheduler scheduler ):
 osg::Referenced( true ),
 _lastRemoveFinishedThreadsStamp(0),
 _name(name),
-_numThreads( 0 )
+_numThreads( 0 ),
+_scheduler( scheduler ),
+_nextSlot( 0u )
 {
-    _queue = new TaskRequestQueue( maxSize );
+    if ( _scheduler == SCHEDULER_WORK_STEALING )
+    {
+        // one slot per thread, but at least one per core so that a service
+        // that grows its thread count later still spreads out.
+        unsigned numSlots = (unsigned)osg::maximum( numThreads, OpenThreads::GetNumberOfProcessors() );
+        _queue = new WorkStealingTaskRequestQueue( numSlots, maxSize );
+    }
+    else
+    {
+        _queue = new TaskRequestQueue( maxSize );
+    }
     setNumThreads( numThreads );
+
+    getQueueDepthGauge()->add( this );
 }
 
 unsigned int
@@ -323,6 +648,8 @@ bool TaskService::areThreadsRunning()
 
 TaskService::~TaskService()
 {
+    getQueueDepthGauge()->remove( this );
+
     _queue->setDone();
 
     for( TaskThreads::iterator i = _threads.begin(); i != _threads.end(); i++ )
@@ -389,7 +716,7 @@ TaskService::adjustThreadCount()
         //We need to add some threads
         for (int i = 0; i < diff; ++i)
         {
-            TaskThread* thread = new TaskThread( _queue.get() );
+            TaskThread* thread = new TaskThread( _queue.get(), _nextSlot++ );
             _threads.push_back( thread );
             thread->start();
         }       
@@ -454,9 +781,21 @@ TaskService::cancelAll()
 
 TaskServiceManager::TaskServiceManager( int numThreads ) :
 _numThreads( 0 ),
-_targetNumThreads( numThreads )
+_targetNumThreads( numThreads ),
+_scheduler( TaskService::SCHEDULER_PRIORITY_QUEUE )
 {
-    //nop
+    const char* scheduler = ::getenv( OSGEARTH_ENV_TASK_SCHEDULER );
+    if ( scheduler )
+    {
+        if ( ciEquals(scheduler, "workstealing") || ciEquals(scheduler, "work-stealing") )
+            _scheduler = TaskService::SCHEDULER_WORK_STEALING;
+        else if ( ciEquals(scheduler, "priority") )
+            _scheduler = TaskService::SCHEDULER_PRIORITY_QUEUE;
+        else
+            OE_WARN << LC << "Unknown task scheduler \"" << scheduler << "\" in environment" << std::endl;
+
+        OE_INFO << LC << "Task scheduler set from environment: " << scheduler << std::endl;
+    }
 }
 
 void
@@ -482,7 +821,7 @@ TaskServiceManager::add( UID uid, float weight )
     }
     else
     {
-        TaskService* newService = new TaskService( "", 1 );
+        TaskService* newService = new TaskService( "", 1, 0u, _scheduler );
         _services[uid] = WeightedTaskService( newService, weight );
         reallocate( _targetNumThreads );
         return newService;
@@ -517,6 +517,13 @@ TerrainLayer::getCacheBin(const Profile* profile, const std::string& binId)
         // and configure:
         if ( newBin.valid() )
         {
+            TileCodec::Compression compression;
+            if ( _runtimeOptions->cacheFormat().isSet() &&
+                 TileCodec::parseFormat(*_runtimeOptions->cacheFormat(), compression) )
+            {
+                newBin->setTileCodec( compression );
+            }
+
             // attempt to read the cache metadata:
             CacheBinMetadata meta( newBin->readMetadata() );
 
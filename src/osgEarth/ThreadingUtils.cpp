@@ -20,9 +20,13 @@
 
 #ifdef _WIN32
     extern "C" unsigned long __stdcall GetCurrentThreadId();
+    extern "C" unsigned long __stdcall FlsAlloc(void (__stdcall *)(void*));
+    extern "C" int __stdcall FlsSetValue(unsigned long, void*);
+    extern "C" int __stdcall FlsFree(unsigned long);
 #else
 #   include <unistd.h>
 #   include <sys/syscall.h>
+#   include <pthread.h>
 #endif
 
 using namespace osgEarth::Threading;
@@ -42,3 +46,74 @@ unsigned osgEarth::Threading::getCurrentThreadId()
   return (unsigned)::syscall(SYS_gettid);
 #endif
 }
+
+//------------------------------------------------------------------------
+
+ThreadExitHook::ThreadExitHook( Function function ) :
+_function( function ),
+_key     ( 0 ),
+_valid   ( false ),
+_active  ( true )
+{
+#ifdef _WIN32
+    _key = ::FlsAlloc( &ThreadExitHook::onExit );
+    _valid = ( _key != 0xFFFFFFFFul ); // FLS_OUT_OF_INDEXES
+#else
+    pthread_key_t key;
+    _valid = ( ::pthread_key_create( &key, &ThreadExitHook::onExit ) == 0 );
+    _key = (unsigned long)key;
+#endif
+}
+
+ThreadExitHook::~ThreadExitHook()
+{
+    // FlsFree calls back for every thread still holding a value; those
+    // threads haven't exited, so don't report them.
+    _active = false;
+
+    if ( _valid )
+    {
+#ifdef _WIN32
+        ::FlsFree( _key );
+#else
+        ::pthread_key_delete( (pthread_key_t)_key );
+#endif
+    }
+}
+
+void
+ThreadExitHook::add( void* data )
+{
+    if ( !_valid )
+        return;
+
+    Entry* entry = new Entry();
+    entry->_hook = this;
+    entry->_data = data;
+
+#ifdef _WIN32
+    ::FlsSetValue( _key, entry );
+#else
+    ::pthread_setspecific( (pthread_key_t)_key, entry );
+#endif
+}
+
+void
+ThreadExitHook::call( Entry* entry )
+{
+    if ( entry )
+    {
+        if ( entry->_hook->_active )
+            entry->_hook->_function( entry->_data );
+        delete entry;
+    }
+}
+
+#ifdef _WIN32
+void __stdcall ThreadExitHook::onExit( void* entry )
+#else
+void ThreadExitHook::onExit( void* entry )
+#endif
+{
+    call( static_cast<Entry*>(entry) );
+}
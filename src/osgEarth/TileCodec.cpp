@@ -0,0 +1,308 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TileCodec>
+#include <osgEarth/StringUtils>
+#include <osg/Image>
+#include <osg/ImageSequence>
+#include <osg/Shape>
+#include <osg/Notify>
+#include <iostream>
+#include <vector>
+#include <string.h>
+
+#ifdef OSGEARTH_HAVE_ZLIB
+#   include <zlib.h>
+#endif
+
+#define LC "[TileCodec] "
+
+using namespace osgEarth;
+
+#define TILE_CODEC_MAGIC   "OETC"
+#define TILE_CODEC_VERSION 1
+
+namespace
+{
+    enum PayloadType
+    {
+        TYPE_IMAGE       = 1,
+        TYPE_HEIGHTFIELD = 2
+    };
+
+    // All structures are written in native byte order; a cache is
+    // not meant to move between machines of different endianness.
+    struct Header
+    {
+        char     magic[4];
+        unsigned version;
+        unsigned type;
+        unsigned compression;
+        unsigned dataLength;      // uncompressed payload length
+        unsigned payloadLength;   // stored payload length
+    };
+
+    struct ImageHeader
+    {
+        int      s, t, r;
+        unsigned pixelFormat;
+        unsigned internalTextureFormat;
+        unsigned dataType;
+        unsigned packing;
+        unsigned origin;
+    };
+
+    struct HeightFieldHeader
+    {
+        double   originX, originY, originZ;
+        double   xInterval, yInterval;
+        float    skirtHeight;
+        unsigned numColumns;
+        unsigned numRows;
+        unsigned borderWidth;
+    };
+
+    bool writePayload(const char* data, unsigned length, TileCodec::Compression compression, Header& header, std::ostream& out)
+    {
+        header.dataLength = length;
+
+#ifdef OSGEARTH_HAVE_ZLIB
+        if ( compression == TileCodec::COMPRESSION_ZLIB )
+        {
+            uLongf zlength = compressBound(length);
+            std::vector<Bytef> zbuf( zlength );
+            if ( compress2(&zbuf[0], &zlength, (const Bytef*)data, length, Z_BEST_SPEED) == Z_OK )
+            {
+                header.compression   = TileCodec::COMPRESSION_ZLIB;
+                header.payloadLength = zlength;
+                out.write( (const char*)&header, sizeof(Header) );
+                return out.write( (const char*)&zbuf[0], zlength ).good();
+            }
+        }
+#endif
+
+        header.compression   = TileCodec::COMPRESSION_NONE;
+        header.payloadLength = length;
+        out.write( (const char*)&header, sizeof(Header) );
+        return out.write( data, length ).good();
+    }
+
+    bool readPayload(const Header& header, char* data, std::istream& in)
+    {
+        if ( header.compression == TileCodec::COMPRESSION_NONE )
+        {
+            return
+                header.payloadLength == header.dataLength &&
+                in.read( data, header.dataLength ).good();
+        }
+
+#ifdef OSGEARTH_HAVE_ZLIB
+        if ( header.compression == TileCodec::COMPRESSION_ZLIB )
+        {
+            std::vector<Bytef> zbuf( header.payloadLength );
+            if ( !in.read((char*)&zbuf[0], header.payloadLength).good() )
+                return false;
+
+            uLongf length = header.dataLength;
+            return
+                uncompress((Bytef*)data, &length, &zbuf[0], header.payloadLength) == Z_OK &&
+                length == header.dataLength;
+        }
+#endif
+
+        OE_WARN << LC << "Unsupported compression (" << header.compression << ")" << std::endl;
+        return false;
+    }
+}
+
+//------------------------------------------------------------------------
+
+bool
+TileCodec::parseFormat(const std::string& format, Compression& out_compression)
+{
+    std::string f = toLower(trim(format));
+    if ( f == "raw" )
+    {
+        out_compression = COMPRESSION_NONE;
+        return true;
+    }
+    else if ( f == "raw+zlib" )
+    {
+        out_compression = COMPRESSION_ZLIB;
+        return true;
+    }
+    return false;
+}
+
+bool
+TileCodec::canEncode(const osg::Object* object)
+{
+    if ( dynamic_cast<const osg::HeightField*>(object) )
+    {
+        return true;
+    }
+
+    const osg::Image* image = dynamic_cast<const osg::Image*>(object);
+    return
+        image                                                  &&
+        image->data() != 0L                                    &&
+        !image->isCompressed()                                 &&
+        image->getNumMipmapLevels() <= 1                       &&
+        dynamic_cast<const osg::ImageSequence*>(image) == 0L;
+}
+
+bool
+TileCodec::encode(const osg::Object* object, std::ostream& out, Compression compression)
+{
+    if ( !canEncode(object) )
+        return false;
+
+    Header header;
+    memcpy( header.magic, TILE_CODEC_MAGIC, 4 );
+    header.version = TILE_CODEC_VERSION;
+
+    const osg::HeightField* hf = dynamic_cast<const osg::HeightField*>(object);
+    if ( hf )
+    {
+        header.type = TYPE_HEIGHTFIELD;
+
+        HeightFieldHeader hfh;
+        hfh.originX     = hf->getOrigin().x();
+        hfh.originY     = hf->getOrigin().y();
+        hfh.originZ     = hf->getOrigin().z();
+        hfh.xInterval   = hf->getXInterval();
+        hfh.yInterval   = hf->getYInterval();
+        hfh.skirtHeight = hf->getSkirtHeight();
+        hfh.numColumns  = hf->getNumColumns();
+        hfh.numRows     = hf->getNumRows();
+        hfh.borderWidth = hf->getBorderWidth();
+
+        const osg::FloatArray* heights = hf->getFloatArray();
+        unsigned length = heights ? heights->size() * sizeof(float) : 0u;
+        if ( length != hfh.numColumns * hfh.numRows * sizeof(float) )
+            return false;
+
+        // the type-specific header rides in front of the payload, uncompressed.
+        std::string buf( sizeof(HeightFieldHeader) + length, '\0' );
+        memcpy( &buf[0], &hfh, sizeof(HeightFieldHeader) );
+        if ( length > 0 )
+            memcpy( &buf[sizeof(HeightFieldHeader)], &heights->front(), length );
+
+        return writePayload( buf.data(), buf.length(), compression, header, out );
+    }
+
+    const osg::Image* image = static_cast<const osg::Image*>(object);
+    header.type = TYPE_IMAGE;
+
+    ImageHeader ih;
+    ih.s                     = image->s();
+    ih.t                     = image->t();
+    ih.r                     = image->r();
+    ih.pixelFormat           = image->getPixelFormat();
+    ih.internalTextureFormat = image->getInternalTextureFormat();
+    ih.dataType              = image->getDataType();
+    ih.packing               = image->getPacking();
+    ih.origin                = image->getOrigin();
+
+    unsigned length = image->getTotalSizeInBytes();
+
+    std::string buf( sizeof(ImageHeader) + length, '\0' );
+    memcpy( &buf[0], &ih, sizeof(ImageHeader) );
+    memcpy( &buf[sizeof(ImageHeader)], image->data(), length );
+
+    return writePayload( buf.data(), buf.length(), compression, header, out );
+}
+
+bool
+TileCodec::isEncoded(std::istream& in)
+{
+    std::streampos pos = in.tellg();
+    if ( pos == std::streampos(-1) )
+        return false;
+
+    char magic[4];
+    in.read( magic, 4 );
+    bool match = in.gcount() == 4 && memcmp(magic, TILE_CODEC_MAGIC, 4) == 0;
+
+    in.clear();
+    in.seekg( pos );
+    return match;
+}
+
+osg::Object*
+TileCodec::decode(std::istream& in)
+{
+    Header header;
+    if ( !in.read((char*)&header, sizeof(Header)).good() ||
+         memcmp(header.magic, TILE_CODEC_MAGIC, 4) != 0 )
+    {
+        return 0L;
+    }
+
+    if ( header.version != TILE_CODEC_VERSION )
+    {
+        OE_WARN << LC << "Unsupported version (" << header.version << ")" << std::endl;
+        return 0L;
+    }
+
+    std::vector<char> buf( header.dataLength );
+    if ( buf.empty() || !readPayload(header, &buf[0], in) )
+        return 0L;
+
+    if ( header.type == TYPE_HEIGHTFIELD && buf.size() >= sizeof(HeightFieldHeader) )
+    {
+        HeightFieldHeader hfh;
+        memcpy( &hfh, &buf[0], sizeof(HeightFieldHeader) );
+
+        unsigned length = hfh.numColumns * hfh.numRows * sizeof(float);
+        if ( buf.size() != sizeof(HeightFieldHeader) + length )
+            return 0L;
+
+        osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
+        hf->allocate( hfh.numColumns, hfh.numRows );
+        hf->setOrigin( osg::Vec3d(hfh.originX, hfh.originY, hfh.originZ) );
+        hf->setXInterval( hfh.xInterval );
+        hf->setYInterval( hfh.yInterval );
+        hf->setSkirtHeight( hfh.skirtHeight );
+        hf->setBorderWidth( hfh.borderWidth );
+        if ( length > 0 )
+            memcpy( &hf->getFloatArray()->front(), &buf[sizeof(HeightFieldHeader)], length );
+
+        return hf.release();
+    }
+
+    else if ( header.type == TYPE_IMAGE && buf.size() >= sizeof(ImageHeader) )
+    {
+        ImageHeader ih;
+        memcpy( &ih, &buf[0], sizeof(ImageHeader) );
+
+        osg::ref_ptr<osg::Image> image = new osg::Image();
+        image->allocateImage( ih.s, ih.t, ih.r, ih.pixelFormat, ih.dataType, ih.packing );
+        if ( !image->data() || image->getTotalSizeInBytes() != buf.size() - sizeof(ImageHeader) )
+            return 0L;
+
+        image->setInternalTextureFormat( ih.internalTextureFormat );
+        image->setOrigin( (osg::Image::Origin)ih.origin );
+        memcpy( image->data(), &buf[sizeof(ImageHeader)], image->getTotalSizeInBytes() );
+
+        return image.release();
+    }
+
+    OE_WARN << LC << "Corrupt or unsupported record (type " << header.type << ")" << std::endl;
+    return 0L;
+}
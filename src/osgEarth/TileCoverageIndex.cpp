@@ -0,0 +1,281 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TileCoverageIndex>
+#include <osgEarth/TileSource>
+#include <limits.h>
+
+#define LC "[TileCoverageIndex] "
+
+using namespace osgEarth;
+
+namespace
+{
+    // a node is split only if more extents than this intersect it.
+    const unsigned MAX_LEAF_EXTENTS = 4;
+
+    // limits on the size of the tree; below them, queries test the extents of the deepest node.
+    const unsigned MAX_DEPTH = 16;
+    const unsigned MAX_NODES = 1u << 20;
+}
+
+TileCoverageIndex::TileCoverageIndex( const TileSource* source, const Profile* profile ) :
+_profile         ( profile ),
+_rootsWide       ( 1u ),
+_everywhere      ( true ),
+_maxLevel        ( UINT_MAX ),
+_minCompleteLevel( UINT_MAX )
+{
+    if ( source )
+    {
+        init( source->getDataExtents(), source->getProfile(), source->getOptions().maxDataLevel() );
+    }
+}
+
+TileCoverageIndex::TileCoverageIndex(const DataExtentList&     extents,
+                                     const Profile*            extentsProfile,
+                                     const Profile*            profile,
+                                     const optional<unsigned>& maxDataLevel) :
+_profile         ( profile ),
+_rootsWide       ( 1u ),
+_everywhere      ( true ),
+_maxLevel        ( UINT_MAX ),
+_minCompleteLevel( UINT_MAX )
+{
+    init( extents, extentsProfile, maxDataLevel );
+}
+
+void
+TileCoverageIndex::init(const DataExtentList&     extents,
+                        const Profile*            extentsProfile,
+                        const optional<unsigned>& maxDataLevel)
+{
+    if ( !_profile.valid() )
+        return;
+
+    // the extent levels are in the source profile; convert them once to the indexed profile.
+    bool convertLevels = extentsProfile && !extentsProfile->isHorizEquivalentTo( _profile.get() );
+
+    if ( maxDataLevel.isSet() )
+    {
+        _maxLevel = convertLevels ? _profile->getEquivalentLOD( extentsProfile, maxDataLevel.get() ) : maxDataLevel.get();
+    }
+
+    // no extents: there might be data anywhere, just like TileSource::hasData.
+    _everywhere = extents.empty();
+
+    for( DataExtentList::const_iterator i = extents.begin(); i != extents.end(); ++i )
+    {
+        unsigned minLevel = 0u, maxLevel = UINT_MAX;
+        if ( i->minLevel().isSet() )
+            minLevel = convertLevels ? _profile->getEquivalentLOD( extentsProfile, i->minLevel().get() ) : i->minLevel().get();
+        if ( i->maxLevel().isSet() )
+            maxLevel = convertLevels ? _profile->getEquivalentLOD( extentsProfile, i->maxLevel().get() ) : i->maxLevel().get();
+
+        GeoExtent extent = _profile->clampAndTransformExtent( *i );
+        if ( !extent.isValid() )
+            continue;
+
+        if ( extent.crossesAntimeridian() )
+        {
+            GeoExtent west, east;
+            if ( extent.splitAcrossAntimeridian(west, east) )
+            {
+                addExtent( west, minLevel, maxLevel );
+                addExtent( east, minLevel, maxLevel );
+            }
+        }
+        else
+        {
+            addExtent( extent, minLevel, maxLevel );
+        }
+    }
+
+    // one node per root tile, subdivided where many extents meet.
+    unsigned wide, high;
+    _profile->getNumTiles( 0, wide, high );
+    _rootsWide = wide;
+    _nodes.resize( wide*high );
+
+    for( unsigned y=0; y<high; ++y )
+    {
+        for( unsigned x=0; x<wide; ++x )
+        {
+            TileKey key( 0, x, y, _profile.get() );
+            const GeoExtent& ke = key.getExtent();
+
+            Node& node = _nodes[x + y*wide];
+            node._children = -1;
+            for( unsigned e=0; e<_extents.size(); ++e )
+            {
+                const Extent& ext = _extents[e];
+                if ( ext._xmin < ke.xMax() && ext._xmax > ke.xMin() && ext._ymin < ke.yMax() && ext._ymax > ke.yMin() )
+                    node._extents.push_back( e );
+            }
+
+            subdivide( x + y*wide, key );
+        }
+    }
+
+    OE_DEBUG << LC << _extents.size() << " extents, " << _nodes.size() << " nodes" << std::endl;
+}
+
+void
+TileCoverageIndex::addExtent( const GeoExtent& extent, unsigned minLevel, unsigned maxLevel )
+{
+    Extent e;
+    e._xmin     = extent.xMin();
+    e._ymin     = extent.yMin();
+    e._xmax     = extent.xMax();
+    e._ymax     = extent.yMax();
+    e._minLevel = minLevel;
+    e._maxLevel = maxLevel;
+    _extents.push_back( e );
+}
+
+void
+TileCoverageIndex::subdivide( unsigned n, const TileKey& key )
+{
+    if ( _nodes[n]._extents.size() <= MAX_LEAF_EXTENTS ||
+         key.getLevelOfDetail() >= MAX_DEPTH ||
+         _nodes.size() + 4 > MAX_NODES )
+    {
+        return;
+    }
+
+    // if every extent covers the whole node, the children would test the same extents.
+    const GeoExtent& ke = key.getExtent();
+    bool allCover = true;
+    for( unsigned i=0; i<_nodes[n]._extents.size() && allCover; ++i )
+    {
+        const Extent& ext = _extents[_nodes[n]._extents[i]];
+        allCover = ext._xmin <= ke.xMin() && ext._xmax >= ke.xMax() && ext._ymin <= ke.yMin() && ext._ymax >= ke.yMax();
+    }
+    if ( allCover )
+        return;
+
+    // note: resizing invalidates references into _nodes, so use indices throughout.
+    unsigned first = _nodes.size();
+    _nodes.resize( first + 4 );
+    _nodes[n]._children = (int)first;
+
+    for( unsigned q=0; q<4; ++q )
+    {
+        TileKey child = key.createChildKey( q );
+        const GeoExtent& ce = child.getExtent();
+
+        _nodes[first+q]._children = -1;
+        for( unsigned i=0; i<_nodes[n]._extents.size(); ++i )
+        {
+            unsigned e = _nodes[n]._extents[i];
+            const Extent& ext = _extents[e];
+            if ( ext._xmin < ce.xMax() && ext._xmax > ce.xMin() && ext._ymin < ce.yMax() && ext._ymax > ce.yMin() )
+                _nodes[first+q]._extents.push_back( e );
+        }
+    }
+
+    for( unsigned q=0; q<4; ++q )
+    {
+        subdivide( first+q, key.createChildKey(q) );
+    }
+}
+
+const TileCoverageIndex::Node*
+TileCoverageIndex::findNode( const TileKey& key ) const
+{
+    unsigned lod = key.getLevelOfDetail();
+    unsigned x = key.getTileX(), y = key.getTileY();
+
+    unsigned root = (x >> lod) + (y >> lod) * _rootsWide;
+    if ( root >= _nodes.size() )
+        return 0L;
+
+    // walk down the quadrants of the key's ancestors (see TileKey::createChildKey)
+    const Node* node = &_nodes[root];
+    for( unsigned d=1; d<=lod && node->_children >= 0; ++d )
+    {
+        unsigned shift = lod - d;
+        unsigned q = ((x >> shift) & 1u) + 2u*((y >> shift) & 1u);
+        node = &_nodes[node->_children + q];
+    }
+    return node;
+}
+
+bool
+TileCoverageIndex::test( const TileKey& key, bool subtree ) const
+{
+    unsigned lod = key.getLevelOfDetail();
+    if ( lod > _maxLevel )
+        return false;
+
+    if ( _everywhere )
+        return true;
+
+    const Node* node = findNode( key );
+    if ( !node )
+        return false;
+
+    const GeoExtent& ke = key.getExtent();
+    for( unsigned i=0; i<node->_extents.size(); ++i )
+    {
+        const Extent& ext = _extents[node->_extents[i]];
+
+        // a subtree has data at some level if the extent goes at least as deep as the key.
+        if ( lod > ext._maxLevel || (!subtree && lod < ext._minLevel) )
+            continue;
+
+        if ( ext._xmin < ke.xMax() && ext._xmax > ke.xMin() && ext._ymin < ke.yMax() && ext._ymax > ke.yMin() )
+            return true;
+    }
+    return false;
+}
+
+bool
+TileCoverageIndex::mayHaveData( const TileKey& key ) const
+{
+    return test( key, true );
+}
+
+bool
+TileCoverageIndex::hasData( const TileKey& key ) const
+{
+    return test( key, false );
+}
+
+void
+TileCoverageIndex::setComplete( const TileKey& key )
+{
+    _complete.insert( key );
+    _minCompleteLevel = osg::minimum( _minCompleteLevel, key.getLevelOfDetail() );
+}
+
+bool
+TileCoverageIndex::isComplete( const TileKey& key ) const
+{
+    if ( _complete.empty() || key.getLevelOfDetail() < _minCompleteLevel )
+        return false;
+
+    for( TileKey k = key; k.valid(); k = k.createParentKey() )
+    {
+        if ( _complete.find(k) != _complete.end() )
+            return true;
+        if ( k.getLevelOfDetail() <= _minCompleteLevel )
+            break;
+    }
+    return false;
+}
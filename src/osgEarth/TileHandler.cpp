@@ -36,3 +36,23 @@ std::string TileHandler::getProcessString() const
 {
     return "";
 }
+
+bool TileHandler::supportsStages() const
+{
+    return false;
+}
+
+osg::Referenced* TileHandler::fetchTile( const TileKey& key )
+{
+    return 0L;
+}
+
+osg::Referenced* TileHandler::processTile( const TileKey& key, osg::Referenced* data )
+{
+    return data;
+}
+
+bool TileHandler::storeTile( const TileKey& key, osg::Referenced* data )
+{
+    return false;
+}
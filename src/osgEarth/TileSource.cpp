@@ -25,6 +25,7 @@
 #include <osgEarth/Registry>
 #include <osgEarth/ThreadingUtils>
 #include <osgEarth/MemCache>
+#include <osgEarth/Profiler>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
@@ -361,7 +362,11 @@ TileSource::createImage(const TileKey&        key,
             return r.releaseImage();
     }
 
-    osg::ref_ptr<osg::Image> newImage = createImage(key, progress);
+    osg::ref_ptr<osg::Image> newImage;
+    {
+        OE_PROFILING_ZONE("TileSource::createImage");
+        newImage = createImage(key, progress);
+    }
 
     if ( prepOp )
         (*prepOp)( newImage );
@@ -391,7 +396,11 @@ TileSource::createHeightField(const TileKey&        key,
             return r.release<osg::HeightField>();
     }
 
-    osg::ref_ptr<osg::HeightField> newHF = createHeightField( key, progress );
+    osg::ref_ptr<osg::HeightField> newHF;
+    {
+        OE_PROFILING_ZONE("TileSource::createHeightField");
+        newHF = createHeightField( key, progress );
+    }
 
     if ( prepOp )
         (*prepOp)( newHF );
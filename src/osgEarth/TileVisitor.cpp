@@ -19,6 +19,14 @@
 #include <osgEarth/TileVisitor>
 #include <osgEarth/CacheEstimator>
 #include <osgEarth/FileUtils>
+#include <osgEarth/ThreadingUtils>
+#include <osgDB/FileUtils>
+#include <osg/Timer>
+#include <OpenThreads/Condition>
+#include <deque>
+#include <algorithm>
+#include <set>
+#include <fstream>
 
 using namespace osgEarth;
 
@@ -73,6 +81,11 @@ void TileVisitor::setTileHandler( TileHandler* handler )
     _tileHandler = handler;
 }
 
+void TileVisitor::setCoverageIndex( TileCoverageIndex* index )
+{
+    _coverage = index;
+}
+
 void TileVisitor::setProgressCallback( ProgressCallback* progress )
 {
     _progress = progress;
@@ -123,6 +136,12 @@ void TileVisitor::processKey( const TileKey& key )
     key.getTileXY(x, y);
     lod = key.getLevelOfDetail();    
 
+    // Skip the whole subtree if there's no data under it, or it's already done.
+    if (_coverage.valid() && (!_coverage->mayHaveData(key) || _coverage->isComplete(key)))
+    {
+        return;
+    }
+
     // Only process this key if it has a chance of succeeding.
     if (_tileHandler && !_tileHandler->hasData(key))
     {                
@@ -276,6 +295,439 @@ bool MultithreadedTileVisitor::handleTile( const TileKey& key )
 
 /*****************************************************************************************/
 
+namespace
+{
+    struct PipelineItem
+    {
+        TileKey                        _key;
+        osg::ref_ptr<osg::Referenced>  _data;
+    };
+
+    /**
+     * Blocking queue of bounded size between two stages of the pipeline. It
+     * closes once all of its producers are done, and pop then returns false
+     * as soon as it is empty.
+     */
+    class TileQueue
+    {
+    public:
+        TileQueue(unsigned maxSize, unsigned producers) :
+            _maxSize( osg::maximum(maxSize, 1u) ), _producers( producers ), _closed( false ), _aborted( false ) { }
+
+        bool push( const PipelineItem& item )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            while( _items.size() >= _maxSize && !_aborted )
+                _notFull.wait( &_mutex );
+            if ( _aborted )
+                return false;
+            _items.push_back( item );
+            _notEmpty.signal();
+            return true;
+        }
+
+        bool pop( PipelineItem& out )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            while( _items.empty() && !_closed && !_aborted )
+                _notEmpty.wait( &_mutex );
+            if ( _aborted || _items.empty() )
+                return false;
+            out = _items.front();
+            _items.pop_front();
+            _notFull.signal();
+            return true;
+        }
+
+        void producerDone()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            if ( _producers > 0 && --_producers == 0 )
+            {
+                _closed = true;
+                _notEmpty.broadcast();
+            }
+        }
+
+        void abort()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            _aborted = true;
+            _items.clear();
+            _notEmpty.broadcast();
+            _notFull.broadcast();
+        }
+
+    private:
+        OpenThreads::Mutex       _mutex;
+        OpenThreads::Condition   _notEmpty, _notFull;
+        std::deque<PipelineItem> _items;
+        unsigned                 _maxSize;
+        unsigned                 _producers;
+        bool                     _closed, _aborted;
+    };
+}
+
+/**
+ * State of one run of the PipelinedTileVisitor: the queue in front of each
+ * stage, the stage threads and the journal.
+ */
+struct PipelinedTileVisitor::Pipeline
+{
+    enum Stage { FETCH, PROCESS, STORE, HANDLE };
+
+    struct StageThread : public OpenThreads::Thread
+    {
+        StageThread(Pipeline* pipeline, unsigned index, Stage stage) :
+            _pipeline(pipeline), _index(index), _stage(stage), _tiles(0u), _busy(0.0), _finished(0) { }
+
+        void run()
+        {
+            TileQueue* in  = _pipeline->_queues[_index];
+            TileQueue* out = _index+1 < _pipeline->_queues.size() ? _pipeline->_queues[_index+1] : 0L;
+            TileHandler* handler = _pipeline->_visitor->_tileHandler.get();
+
+            PipelineItem item;
+            while( in->pop(item) )
+            {
+                if ( _pipeline->isCanceled() )
+                {
+                    _pipeline->abort();
+                    break;
+                }
+
+                osg::Timer_t start = osg::Timer::instance()->tick();
+                bool done = true, ok = false;
+
+                switch( _stage )
+                {
+                case FETCH:
+                    item._data = handler->fetchTile( item._key );
+                    done = !item._data.valid();
+                    break;
+                case PROCESS:
+                    item._data = handler->processTile( item._key, item._data.get() );
+                    done = !item._data.valid();
+                    break;
+                case STORE:
+                    ok = handler->storeTile( item._key, item._data.get() );
+                    break;
+                case HANDLE:
+                    ok = handler->handleTile( item._key, *_pipeline->_visitor );
+                    break;
+                }
+
+                _busy += osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+                ++_tiles;
+
+                if ( done )
+                {
+                    _pipeline->finish( item._key, ok );
+                }
+                else if ( !out->push(item) )
+                {
+                    break;
+                }
+                item._data = 0L;
+            }
+
+            if ( out )
+                out->producerDone();
+
+            _finished = osg::Timer::instance()->tick();
+        }
+
+        Pipeline*    _pipeline;
+        unsigned     _index;
+        Stage        _stage;
+        unsigned     _tiles;
+        double       _busy;
+        osg::Timer_t _finished;
+    };
+
+    Pipeline(PipelinedTileVisitor* visitor) : _visitor(visitor), _journalEntries(0u) { }
+
+    ~Pipeline()
+    {
+        for(unsigned i=0; i<_threads.size(); ++i)
+            delete _threads[i];
+        for(unsigned i=0; i<_queues.size(); ++i)
+            delete _queues[i];
+    }
+
+    void addStage(const std::string& name, Stage stage, unsigned numThreads)
+    {
+        // the queue in front of the stage; the visitor itself feeds the first one.
+        unsigned index = _queues.size();
+        unsigned producers = index == 0 ? 1u : _stageThreads.back();
+        _queues.push_back( new TileQueue(_visitor->_queueSize, producers) );
+        _stageNames.push_back( name );
+        _stageThreads.push_back( osg::maximum(numThreads, 1u) );
+
+        for(unsigned i=0; i<_stageThreads.back(); ++i)
+            _threads.push_back( new StageThread(this, index, stage) );
+    }
+
+    bool isCanceled() const
+    {
+        return _visitor->_progress.valid() && _visitor->_progress->isCanceled();
+    }
+
+    void abort()
+    {
+        for(unsigned i=0; i<_queues.size(); ++i)
+            _queues[i]->abort();
+    }
+
+    bool isDone(const TileKey& key) const
+    {
+        return _done.find(key) != _done.end();
+    }
+
+    // A tile made it through the pipeline (or dropped out of it); record it if it succeeded.
+    void finish(const TileKey& key, bool ok)
+    {
+        if ( ok && _journal.is_open() )
+        {
+            Threading::ScopedMutexLock lock( _journalMutex );
+            _journal << key.getLevelOfDetail() << ", " << key.getTileX() << ", " << key.getTileY() << "\n";
+
+            // flush regularly, so a crash loses only the last few tiles.
+            if ( ++_journalEntries % 64 == 0 )
+                _journal.flush();
+        }
+
+        _visitor->incrementProgress(1);
+    }
+
+    PipelinedTileVisitor*      _visitor;
+    std::vector<TileQueue*>    _queues;
+    std::vector<std::string>   _stageNames;
+    std::vector<unsigned>      _stageThreads;
+    std::vector<StageThread*>  _threads;
+    std::set<TileKey>          _done;
+    std::ofstream              _journal;
+    Threading::Mutex           _journalMutex;
+    unsigned                   _journalEntries;
+};
+
+PipelinedTileVisitor::PipelinedTileVisitor():
+_numFetchThreads( OpenThreads::GetNumberOfProcessors() ),
+_numProcessThreads( OpenThreads::GetNumberOfProcessors() ),
+_numStoreThreads( 1 ),
+_queueSize( 256 ),
+_pipeline( 0L )
+{
+    // see MultithreadedTileVisitor
+    osgDB::ObjectWrapper* wrapper = osgDB::Registry::instance()->getObjectWrapperManager()->findWrapper( "osg::Image" );
+}
+
+PipelinedTileVisitor::PipelinedTileVisitor( TileHandler* handler ):
+TileVisitor( handler ),
+_numFetchThreads( OpenThreads::GetNumberOfProcessors() ),
+_numProcessThreads( OpenThreads::GetNumberOfProcessors() ),
+_numStoreThreads( 1 ),
+_queueSize( 256 ),
+_pipeline( 0L )
+{
+}
+
+void PipelinedTileVisitor::setNumFetchThreads( unsigned int numThreads )
+{
+    _numFetchThreads = osg::maximum(numThreads, 1u);
+}
+
+void PipelinedTileVisitor::setNumProcessThreads( unsigned int numThreads )
+{
+    _numProcessThreads = osg::maximum(numThreads, 1u);
+}
+
+void PipelinedTileVisitor::setNumStoreThreads( unsigned int numThreads )
+{
+    _numStoreThreads = osg::maximum(numThreads, 1u);
+}
+
+void PipelinedTileVisitor::setQueueSize( unsigned int queueSize )
+{
+    _queueSize = osg::maximum(queueSize, 1u);
+}
+
+void PipelinedTileVisitor::setJournal( const std::string& filename )
+{
+    _journal = filename;
+}
+
+void PipelinedTileVisitor::run(const Profile* mapProfile)
+{
+    _stageStats.clear();
+    if ( !_tileHandler.valid() )
+        return;
+
+    Pipeline pipeline( this );
+
+    if ( !_journal.empty() )
+    {
+        // tiles completed by an earlier run:
+        if ( osgDB::fileExists(_journal) )
+        {
+            TaskList done( mapProfile );
+            done.load( _journal );
+            pipeline._done.insert( done.getKeys().begin(), done.getKeys().end() );
+            OE_NOTICE << "Resuming from journal " << _journal << ": " << pipeline._done.size() << " tiles already done" << std::endl;
+
+            if ( _coverage.valid() )
+            {
+                markComplete( pipeline._done );
+            }
+        }
+
+        // terminate a line the earlier run left half written, so the
+        // records appended after it parse on their own.
+        bool terminate = false;
+        {
+            std::ifstream last( _journal.c_str(), std::ios::in | std::ios::binary );
+            if ( last.is_open() && last.seekg(-1, std::ios::end) )
+            {
+                char c = '\n';
+                last.get( c );
+                terminate = ( c != '\n' );
+            }
+        }
+
+        pipeline._journal.open( _journal.c_str(), std::ios::out | std::ios::app );
+        if ( terminate && pipeline._journal.is_open() )
+        {
+            pipeline._journal << std::endl;
+        }
+        if ( !pipeline._journal.is_open() )
+        {
+            OE_WARN << "Failed to open journal " << _journal << std::endl;
+        }
+    }
+
+    if ( _tileHandler->supportsStages() )
+    {
+        pipeline.addStage( "fetch",   Pipeline::FETCH,   _numFetchThreads );
+        pipeline.addStage( "process", Pipeline::PROCESS, _numProcessThreads );
+        pipeline.addStage( "store",   Pipeline::STORE,   _numStoreThreads );
+    }
+    else
+    {
+        pipeline.addStage( "handle",  Pipeline::HANDLE,  _numFetchThreads );
+    }
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    for(unsigned i=0; i<pipeline._threads.size(); ++i)
+        pipeline._threads[i]->start();
+
+    // Produce the tiles
+    _pipeline = &pipeline;
+    TileVisitor::run( mapProfile );
+    _pipeline = 0L;
+
+    pipeline._queues[0]->producerDone();
+
+    for(unsigned i=0; i<pipeline._threads.size(); ++i)
+        pipeline._threads[i]->join();
+
+    pipeline._journal.close();
+
+    // Collect the throughput of each stage.
+    unsigned t = 0;
+    for(unsigned s=0; s<pipeline._stageNames.size(); ++s)
+    {
+        StageStats stats;
+        stats._name        = pipeline._stageNames[s];
+        stats._threads     = pipeline._stageThreads[s];
+        stats._tiles       = 0u;
+        stats._busySeconds = 0.0;
+        stats._wallSeconds = 0.0;
+
+        for(unsigned i=0; i<stats._threads; ++i, ++t)
+        {
+            Pipeline::StageThread* thread = pipeline._threads[t];
+            stats._tiles       += thread->_tiles;
+            stats._busySeconds += thread->_busy;
+            stats._wallSeconds  = osg::maximum( stats._wallSeconds, osg::Timer::instance()->delta_s(start, thread->_finished) );
+        }
+
+        OE_INFO << "Stage " << stats._name << " (" << stats._threads << " threads): " << stats._tiles << " tiles, "
+            << stats.tilesPerSecond() << " tiles/sec" << std::endl;
+
+        _stageStats.push_back( stats );
+    }
+}
+
+namespace
+{
+    bool deeperFirst(const TileKey& lhs, const TileKey& rhs)
+    {
+        return lhs.getLevelOfDetail() > rhs.getLevelOfDetail();
+    }
+}
+
+void PipelinedTileVisitor::markComplete( const std::set<TileKey>& done )
+{
+    // Working up from the deepest tiles, a tile's subtree is complete if the
+    // tile is done and each of its children is complete or has nothing to do.
+    std::vector<TileKey> keys( done.begin(), done.end() );
+    std::stable_sort( keys.begin(), keys.end(), deeperFirst );
+
+    std::set<TileKey> complete;
+    for (std::vector<TileKey>::const_iterator i = keys.begin(); i != keys.end(); ++i)
+    {
+        if ( i->getLevelOfDetail() > _maxLevel )
+            continue;
+
+        bool full = true;
+        if ( i->getLevelOfDetail() < _maxLevel )
+        {
+            for (unsigned int q = 0; q < 4 && full; ++q)
+            {
+                TileKey child = i->createChildKey( q );
+                full =
+                    complete.find(child) != complete.end() ||
+                    !_coverage->mayHaveData(child) ||
+                    !intersects(child.getExtent());
+            }
+        }
+
+        if ( full )
+            complete.insert( *i );
+    }
+
+    // Only the top of each complete subtree needs to go in the index.
+    unsigned int marked = 0;
+    for (std::set<TileKey>::const_iterator i = complete.begin(); i != complete.end(); ++i)
+    {
+        if ( i->getLevelOfDetail() == 0 || complete.find(i->createParentKey()) == complete.end() )
+        {
+            _coverage->setComplete( *i );
+            ++marked;
+        }
+    }
+
+    OE_INFO << "Skipping " << marked << " complete subtrees (" << complete.size() << " tiles)" << std::endl;
+}
+
+bool PipelinedTileVisitor::handleTile( const TileKey& key )
+{
+    if ( _pipeline->isDone(key) )
+    {
+        incrementProgress(1);
+        return true;
+    }
+
+    PipelineItem item;
+    item._key = key;
+
+    // Blocks while the first stage is behind. Fails once the run is cancelled.
+    return _pipeline->_queues[0]->push( item );
+}
+
+/*****************************************************************************************/
+
 TaskList::TaskList(const Profile* profile):
 _profile( profile )
 {
@@ -288,9 +740,25 @@ bool TaskList::load( const std::string &filename)
     std::string line;
     while( getline(in, line) )
     {            
+        // a last line without a newline may have been cut off mid-write
+        // (e.g. "12, 345, 6" of "12, 345, 678"), so don't trust it.
+        if ( in.eof() )
+            break;
+
         std::vector< std::string > parts;
-        StringTokenizer(line, parts, "," );
+        StringTokenizer(line, parts, ",", "", true, true );
+
+        // skip blank or malformed lines.
+        if ( parts.size() != 3 )
+            continue;
 
+        bool valid = true;
+        for(unsigned i=0; i<3 && valid; ++i)
+        {
+            valid = !parts[i].empty() && parts[i].find_first_not_of("0123456789") == std::string::npos;
+        }
+        if ( !valid )
+            continue;
 
         _keys.push_back( TileKey(as<unsigned int>(parts[0], 0), 
             as<unsigned int>(parts[1], 0), 
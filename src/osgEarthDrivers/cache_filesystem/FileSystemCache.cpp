@@ -25,9 +25,18 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/StringUtils>
 #include <osgEarth/Registry>
+#include <osgEarth/TileCodec>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
 #include <fstream>
+#include <sstream>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <time.h>
 #include <sys/stat.h>
 
 using namespace osgEarth;
@@ -38,16 +47,263 @@ using namespace osgEarth::Threading;
 #   include <unistd.h>
 #endif
 
+// number of key-hashed mutexes that serialize writers within a bin
+#define NUM_WRITE_STRIPES 64
+
+// access-time index file, stored in each bin next to the bin metadata
+#define INDEX_FILE_NAME "osgearth_cacheindex.txt"
+
+// once over its limit, the evictor shrinks a cache/bin to this fraction of it
+#define EVICTION_LOW_WATER_MARK 0.9
+
+// seconds between saves of a changed access index
+#define INDEX_SAVE_PERIOD 60.0
+
 namespace
 {
+    off_t fileSize( const std::string& path )
+    {
+        struct stat buf;
+        return ::stat( path.c_str(), &buf ) == 0 ? buf.st_size : (off_t)0;
+    }
+
+    /**
+     * Access-time index of the records in one cache bin. Records are kept in
+     * least-recently-used order so the evictor can find the oldest ones
+     * without scanning the disk. Keys are record paths relative to the bin
+     * folder, without extension.
+     */
+    class AccessIndex
+    {
+    public:
+        AccessIndex() : _totalSize(0), _dirty(false) { }
+
+        /** Adds or replaces a record after a write, marking it most-recently-used. */
+        void insert( const std::string& key, off_t size )
+        {
+            ScopedMutexLock lock( _mutex );
+            EntryMap::iterator i = _entries.find( key );
+            if ( i != _entries.end() )
+            {
+                _totalSize -= i->second._size;
+                _lru.erase( i->second._lru );
+            }
+            else
+            {
+                i = _entries.insert( std::make_pair(key, Entry()) ).first;
+            }
+            i->second._time = ::time(0L);
+            i->second._size = size;
+            i->second._lru  = _lru.insert( _lru.end(), &i->first );
+            _totalSize += size;
+            _dirty = true;
+        }
+
+        /** Marks an existing record most-recently-used after a read. */
+        void touch( const std::string& key )
+        {
+            ScopedMutexLock lock( _mutex );
+            EntryMap::iterator i = _entries.find( key );
+            if ( i != _entries.end() )
+            {
+                i->second._time = ::time(0L);
+                _lru.splice( _lru.end(), _lru, i->second._lru );
+                _dirty = true;
+            }
+        }
+
+        bool has( const std::string& key ) const
+        {
+            ScopedMutexLock lock( _mutex );
+            return _entries.find( key ) != _entries.end();
+        }
+
+        void remove( const std::string& key )
+        {
+            ScopedMutexLock lock( _mutex );
+            EntryMap::iterator i = _entries.find( key );
+            if ( i != _entries.end() )
+            {
+                _totalSize -= i->second._size;
+                _lru.erase( i->second._lru );
+                _entries.erase( i );
+                _dirty = true;
+            }
+        }
+
+        void clear()
+        {
+            ScopedMutexLock lock( _mutex );
+            _lru.clear();
+            _entries.clear();
+            _totalSize = 0;
+            _dirty = true;
+        }
+
+        off_t getTotalSize() const
+        {
+            ScopedMutexLock lock( _mutex );
+            return _totalSize;
+        }
+
+        /** Access time of the least-recently-used record; false if empty. */
+        bool getOldestTime( TimeStamp& out ) const
+        {
+            ScopedMutexLock lock( _mutex );
+            if ( _lru.empty() )
+                return false;
+            out = _entries.find( *_lru.front() )->second._time;
+            return true;
+        }
+
+        /** Removes up to "maxnum" least-recently-used records and returns their keys. */
+        void popOldest( unsigned maxnum, std::vector<std::string>& out_keys )
+        {
+            ScopedMutexLock lock( _mutex );
+            for(unsigned n=0; n<maxnum && !_lru.empty(); ++n)
+            {
+                EntryMap::iterator i = _entries.find( *_lru.front() );
+                out_keys.push_back( i->first );
+                _totalSize -= i->second._size;
+                _lru.pop_front();
+                _entries.erase( i );
+                _dirty = true;
+            }
+        }
+
+        /** Reads a persisted index; returns false if there is none. */
+        bool load( const std::string& path )
+        {
+            std::ifstream in( path.c_str() );
+            if ( !in.is_open() )
+                return false;
+
+            std::vector<Record> records;
+            Record r;
+            while( in >> r._time >> r._size )
+            {
+                in.get(); // separator
+                if ( std::getline(in, r._key) && !r._key.empty() )
+                    records.push_back( r );
+            }
+
+            merge( records );
+            return true;
+        }
+
+        /** Builds the index from the files on disk, using modification times. */
+        void rebuild( const std::string& binPath )
+        {
+            CollectRecords visitor( binPath );
+            visitor.traverse( binPath );
+            merge( visitor._records );
+        }
+
+        /** Persists the index if it changed since the last save. */
+        bool save( const std::string& path )
+        {
+            std::stringstream buf;
+            {
+                ScopedMutexLock lock( _mutex );
+                if ( !_dirty )
+                    return true;
+                for(LRUList::const_iterator i = _lru.begin(); i != _lru.end(); ++i)
+                {
+                    const Entry& e = _entries.find( **i )->second;
+                    buf << e._time << " " << e._size << " " << **i << "\n";
+                }
+                _dirty = false;
+            }
+
+            std::string temp = path + ".tmp";
+            {
+                std::ofstream out( temp.c_str() );
+                if ( !out.is_open() )
+                    return false;
+                out << buf.rdbuf();
+            }
+            return osgEarth::replaceFile( temp, path );
+        }
+
+    private:
+        struct Record
+        {
+            TimeStamp   _time;
+            off_t       _size;
+            std::string _key;
+            bool operator < (const Record& rhs) const { return _time < rhs._time; }
+        };
+
+        struct CollectRecords : public DirectoryVisitor
+        {
+            CollectRecords( const std::string& binPath )
+                : _prefix( osgDB::convertFileNameToUnixStyle(binPath) + "/" ) { }
+
+            void handleFile( const std::string& filename )
+            {
+                std::string path = osgDB::convertFileNameToUnixStyle( filename );
+                if ( !endsWith(path, ".osgb") || endsWith(path, ".tmp.osgb") || !startsWith(path, _prefix) )
+                    return;
+
+                std::string base = path.substr( 0, path.length()-5 );
+                Record r;
+                r._key  = base.substr( _prefix.length() );
+                r._time = osgEarth::getLastModifiedTime( path );
+                r._size = fileSize( path ) + fileSize( base + ".meta" );
+                _records.push_back( r );
+            }
+
+            std::string         _prefix;
+            std::vector<Record> _records;
+        };
+
+        // Records read from disk are older than anything touched since the
+        // bin opened, so they go in front of the existing entries.
+        void merge( std::vector<Record>& records )
+        {
+            std::sort( records.begin(), records.end() );
+
+            ScopedMutexLock lock( _mutex );
+            for(std::vector<Record>::reverse_iterator r = records.rbegin(); r != records.rend(); ++r)
+            {
+                if ( _entries.find(r->_key) == _entries.end() )
+                {
+                    EntryMap::iterator i = _entries.insert( std::make_pair(r->_key, Entry()) ).first;
+                    i->second._time = r->_time;
+                    i->second._size = r->_size;
+                    i->second._lru  = _lru.insert( _lru.begin(), &i->first );
+                    _totalSize += r->_size;
+                }
+            }
+        }
+
+        typedef std::list<const std::string*> LRUList; // points at the map keys
+
+        struct Entry
+        {
+            TimeStamp         _time;
+            off_t             _size;
+            LRUList::iterator _lru;
+        };
+        typedef std::map<std::string, Entry> EntryMap;
+
+        EntryMap                 _entries;
+        LRUList                  _lru;
+        off_t                    _totalSize;
+        bool                     _dirty;
+        mutable Threading::Mutex _mutex;
+    };
+
+    class Evictor;
+
     /** 
      * Cache that stores data in the local file system.
      */
     class FileSystemCache : public Cache
     {
     public:
-        FileSystemCache() { } // unused
-        FileSystemCache( const FileSystemCache& rhs, const osg::CopyOp& op ) { } // unused
+        FileSystemCache() : _evictor(0L) { } // unused
+        FileSystemCache( const FileSystemCache& rhs, const osg::CopyOp& op ) : _evictor(0L) { } // unused
         META_Object( osgEarth, FileSystemCache );
 
         /**
@@ -63,11 +319,19 @@ namespace
 
         CacheBin* getOrCreateDefaultBin();
 
+        off_t getApproximateSize() const;
+
+        bool compact();
+
     protected:
 
+        virtual ~FileSystemCache();
+
         void init();
 
-        std::string _rootPath;
+        std::string            _rootPath;
+        FileSystemCacheOptions _fsOptions;
+        Evictor*               _evictor;
     };
 
     /** 
@@ -103,6 +367,24 @@ namespace
 
         bool writeMetadata( const Config& meta );
 
+        unsigned getStorageSize();
+
+    public: // size management, called by the Evictor
+
+        /** Turns on access tracking, with an optional per-bin limit (0 = none). */
+        void setSizeLimit( off_t maxBytes ) { _maxBytes = maxBytes; _trackAccess = true; }
+        off_t getSizeLimit() const { return _maxBytes; }
+
+        /** Loads (or rebuilds from disk) the access index; only the first call does anything. */
+        void loadIndex();
+        void saveIndex();
+
+        off_t getTrackedSize() const { return _index.getTotalSize(); }
+        bool getOldestAccessTime( TimeStamp& out ) const { return _index.getOldestTime(out); }
+
+        /** Removes up to "maxnum" least-recently-used records; returns the number removed. */
+        unsigned evict( unsigned maxnum );
+
     protected:
         bool purgeDirectory( const std::string& dir );
 
@@ -112,13 +394,63 @@ namespace
 
         std::string getValidKey(const std::string&);
 
+        Threading::Mutex& getWriteStripe(const std::string& validKey) {
+            return _writeStripes[ osgEarth::hashString(validKey) % NUM_WRITE_STRIPES ];
+        }
+
         bool                              _ok;
         bool                              _binPathExists;
         std::string                       _metaPath;       // full path to the bin's metadata file
         std::string                       _binPath;        // full path to the bin's root folder
         osg::ref_ptr<osgDB::ReaderWriter> _rw;
         osg::ref_ptr<osgDB::Options>      _rwOptions;
-        Threading::ReadWriteMutex         _rwmutex;
+        Threading::ReadWriteMutex         _rwmutex;        // exclusive only for whole-bin operations
+        Threading::Mutex                  _writeStripes[NUM_WRITE_STRIPES];
+        std::string                       _indexPath;      // full path to the bin's access index
+        AccessIndex                       _index;
+        volatile bool                     _trackAccess;
+        bool                              _indexLoaded;
+        off_t                             _maxBytes;
+    };
+
+    /**
+     * Background thread that keeps a FileSystemCache within its size limits
+     * by removing least-recently-used records in small batches. Each batch
+     * only holds the index lock long enough to pop its keys, so readers are
+     * never blocked for the duration of an eviction pass.
+     */
+    class Evictor : public OpenThreads::Thread
+    {
+    public:
+        Evictor( const FileSystemCacheOptions& options );
+
+        /** Puts a bin under size management. */
+        void add( FileSystemCacheBin* bin );
+
+        /** Runs one eviction pass over all bins. */
+        void evict();
+
+        /** Sum of the tracked sizes of all bins. */
+        off_t getTotalSize() const;
+
+        void run();
+        int cancel();
+
+    private:
+        typedef std::vector< osg::ref_ptr<FileSystemCacheBin> > Bins;
+
+        void getBins( Bins& out ) const;
+        void saveIndices();
+
+        Bins                     _bins;
+        mutable Threading::Mutex _binsMutex;
+        Threading::Mutex         _evictMutex;
+        off_t                    _maxBytes;
+        off_t                    _binMaxBytes;
+        double                   _period;
+        unsigned                 _batchSize;
+        osg::Timer_t             _lastSave;
+        volatile bool            _done;
     };
 
     void writeMeta( const std::string& fullPath, const Config& meta )
@@ -145,6 +477,28 @@ namespace
             meta.fromJSON( bufStr );
         }
     }
+
+    /** Reads a cache file, which holds either a TileCodec record or osgb. */
+    template<typename READER>
+    osgDB::ReaderWriter::ReadResult readFile( const std::string& fullPath, const READER& reader )
+    {
+        std::ifstream in( fullPath.c_str(), std::ios_base::in | std::ios_base::binary );
+        if ( !in.is_open() )
+            return osgDB::ReaderWriter::ReadResult( osgDB::ReaderWriter::ReadResult::FILE_NOT_FOUND );
+        return TileCodec::readObject( in, reader );
+    }
+
+    struct ImageReader {
+        ImageReader(osgDB::ReaderWriter* rw, const osgDB::Options* op) : _rw(rw), _op(op) { }
+        osgDB::ReaderWriter::ReadResult read(std::istream& in) const { return _rw->readImage(in, _op); }
+        osgDB::ReaderWriter* _rw; const osgDB::Options* _op;
+    };
+
+    struct ObjectReader {
+        ObjectReader(osgDB::ReaderWriter* rw, const osgDB::Options* op) : _rw(rw), _op(op) { }
+        osgDB::ReaderWriter::ReadResult read(std::istream& in) const { return _rw->readObject(in, _op); }
+        osgDB::ReaderWriter* _rw; const osgDB::Options* _op;
+    };
 }
 
 
@@ -171,20 +525,73 @@ namespace
                 fsco.rootPath() = cachePath;
         }
 
+        const char* maxsize = ::getenv(OSGEARTH_ENV_CACHE_MAX_SIZE_MB);
+        if ( maxsize )
+        {
+            unsigned mb = as<unsigned>(std::string(maxsize), 0u);
+            if ( mb > 0 )
+            {
+                fsco.maxSizeMB() = mb;
+                OE_INFO << LC << "Set max cache size from environment: " << mb << " MB" << std::endl;
+            }
+            else
+            {
+                OE_WARN << LC 
+                    << "Env var \"" OSGEARTH_ENV_CACHE_MAX_SIZE_MB "\" set to an invalid value"
+                    << std::endl;
+            }
+        }
+
+        _fsOptions = fsco;
+        _evictor   = 0L;
+
         _rootPath = URI( *fsco.rootPath(), options.referrer() ).full();
         init();
     }
 
+    FileSystemCache::~FileSystemCache()
+    {
+        if ( _evictor )
+        {
+            _evictor->cancel();
+            delete _evictor;
+            _evictor = 0L;
+        }
+    }
+
     void
     FileSystemCache::init()
     {
-        //nop
+        if ( _fsOptions.maxSizeMB().isSet() || _fsOptions.binMaxSizeMB().isSet() )
+        {
+            _evictor = new Evictor( _fsOptions );
+            _evictor->start();
+        }
     }
 
     CacheBin*
     FileSystemCache::addBin( const std::string& name )
     {
-        return _bins.getOrCreate( name, new FileSystemCacheBin( name, _rootPath ) );
+        CacheBin* bin = _bins.getOrCreate( name, new FileSystemCacheBin( name, _rootPath ) );
+        if ( bin && _evictor )
+            _evictor->add( static_cast<FileSystemCacheBin*>(bin) );
+        return bin;
+    }
+
+    off_t
+    FileSystemCache::getApproximateSize() const
+    {
+        return _evictor ? _evictor->getTotalSize() : 0;
+    }
+
+    bool
+    FileSystemCache::compact()
+    {
+        if ( !_evictor )
+            return false;
+
+        _evictor->evict();
+        return true;
     }
 
     CacheBin*
@@ -197,6 +604,8 @@ namespace
             if ( !_defaultBin.valid() ) // double-check
             {
                 _defaultBin = new FileSystemCacheBin( "__default", _rootPath );
+                if ( _evictor )
+                    _evictor->add( static_cast<FileSystemCacheBin*>(_defaultBin.get()) );
             }
         }
         return _defaultBin.get();
@@ -276,10 +685,14 @@ namespace
     FileSystemCacheBin::FileSystemCacheBin(const std::string&   binID,
                                            const std::string&   rootPath) :
     CacheBin            ( binID ),
-    _binPathExists      ( false )
+    _binPathExists      ( false ),
+    _trackAccess        ( false ),
+    _indexLoaded        ( false ),
+    _maxBytes           ( 0 )
     {
         _binPath = osgDB::concatPaths( rootPath, binID );
         _metaPath = osgDB::concatPaths( _binPath, "osgearth_cacheinfo.json" );
+        _indexPath = osgDB::concatPaths( _binPath, INDEX_FILE_NAME );
 
         _rw = osgDB::Registry::instance()->getReaderWriterForExtension( "osgb" );
 #ifdef OSGEARTH_HAVE_ZLIB
@@ -306,7 +719,7 @@ namespace
         osgDB::ReaderWriter::ReadResult r;
         {
             ScopedReadLock sharedLock( _rwmutex );
-            r = _rw->readImage( path, _rwOptions.get() );
+            r = readFile( path, ImageReader(_rw.get(), _rwOptions.get()) );
             if ( !r.success() )
                 return ReadResult();
 
@@ -316,6 +729,9 @@ namespace
             if ( osgDB::fileExists(metafile) )
                 readMeta( metafile, meta );
 
+            if ( _trackAccess )
+                _index.touch( getValidKey(key) );
+
             ReadResult rr( r.getImage(), meta );
             rr.setLastModifiedTime(timeStamp);
             return rr;            
@@ -340,7 +756,7 @@ namespace
         osgDB::ReaderWriter::ReadResult r;
         {
             ScopedReadLock sharedLock( _rwmutex );
-            r = _rw->readObject( path, _rwOptions.get() );
+            r = readFile( path, ObjectReader(_rw.get(), _rwOptions.get()) );
             if ( !r.success() )
                 return ReadResult();
 
@@ -350,6 +766,9 @@ namespace
             if ( osgDB::fileExists(metafile) )
                 readMeta( metafile, meta );
 
+            if ( _trackAccess )
+                _index.touch( getValidKey(key) );
+
             ReadResult rr( r.getObject(), meta );
             rr.setLastModifiedTime(timeStamp);
             return rr;            
@@ -384,6 +803,9 @@ namespace
             if ( osgDB::fileExists(metafile) )
                 readMeta( metafile, meta );
 
+            if ( _trackAccess )
+                _index.touch( getValidKey(key) );
+
             ReadResult rr( r.getNode(), meta );
             rr.setLastModifiedTime(timeStamp);
             return rr;            
@@ -414,44 +836,93 @@ namespace
             return false;
 
         // convert the key into a legal filename:
-        URI fileURI( getValidKey(key), _metaPath );
+        std::string validKey = getValidKey(key);
+        URI fileURI( validKey, _metaPath );
+        std::string filename = fileURI.full() + ".osgb";
+
+        // Serialize into a per-thread temporary file and then swap it into place.
+        // Readers therefore never see a partial record and don't need to lock.
+        // (The temp name must keep the .osgb extension for the ReaderWriter.)
+        std::string tempname = Stringify() << fileURI.full() << "." << getCurrentThreadId() << ".tmp.osgb";
         
         osgDB::ReaderWriter::WriteResult r;
 
         bool objWriteOK = false;
         {
-            // prevent cache contention:
-            ScopedWriteLock exclusiveLock( _rwmutex );
+            // only clear() takes this exclusively:
+            ScopedReadLock sharedLock( _rwmutex );
+
+            // serialize writers of the same key; writers of other keys
+            // only collide if they hash to the same stripe.
+            ScopedMutexLock stripeLock( getWriteStripe(validKey) );
 
             // make a home for it..
             if ( !osgDB::fileExists( osgDB::getFilePath(fileURI.full()) ) )
                 osgEarth::makeDirectoryForFile( fileURI.full() );
 
 
-            if ( dynamic_cast<const osg::Image*>(object) )
+            if ( useTileCodec(object) )
+            {
+                std::ofstream out( tempname.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+                objWriteOK = out.is_open() && TileCodec::encode( object, out, *_tileCodec );
+                out.close();
+                if ( !objWriteOK )
+                    r = osgDB::ReaderWriter::WriteResult( "TileCodec encoding failed" );
+            }
+            else if ( dynamic_cast<const osg::Image*>(object) )
             {
-                std::string filename = fileURI.full() + ".osgb";
-                r = _rw->writeImage( *static_cast<const osg::Image*>(object), filename, _rwOptions.get() );
+                r = _rw->writeImage( *static_cast<const osg::Image*>(object), tempname, _rwOptions.get() );
                 objWriteOK = r.success();
             }
             else if ( dynamic_cast<const osg::Node*>(object) )
             {
-                std::string filename = fileURI.full() + ".osgb";
-                r = _rw->writeNode( *static_cast<const osg::Node*>(object), filename, _rwOptions.get() );
+                r = _rw->writeNode( *static_cast<const osg::Node*>(object), tempname, _rwOptions.get() );
                 objWriteOK = r.success();
             }
             else
             {
-                std::string filename = fileURI.full() + ".osgb";
-                r = _rw->writeObject( *object, filename );
+                r = _rw->writeObject( *object, tempname );
                 objWriteOK = r.success();
             }
 
-            // write metadata
-            if ( !meta.empty() && objWriteOK )
+            if ( objWriteOK )
             {
+                // stage the metadata next to the data, then swap the data in
+                // first and the metadata last: a failed data swap leaves the
+                // old record and its metadata untouched.
                 std::string metaname = fileURI.full() + ".meta";
-                writeMeta( metaname, meta );
+                std::string metatemp = Stringify() << fileURI.full() << "." << getCurrentThreadId() << ".tmp.meta";
+                if ( !meta.empty() )
+                    writeMeta( metatemp, meta );
+
+                objWriteOK = osgEarth::replaceFile( tempname, filename );
+
+                if ( !meta.empty() )
+                {
+                    if ( !objWriteOK )
+                    {
+                        ::unlink( metatemp.c_str() );
+                    }
+                    else if ( !osgEarth::replaceFile(metatemp, metaname) )
+                    {
+                        // better no metadata than the old record's.
+                        ::unlink( metatemp.c_str() );
+                        ::unlink( metaname.c_str() );
+                    }
+                }
+
+                if ( objWriteOK && _trackAccess )
+                {
+                    off_t size = fileSize( filename );
+                    if ( !meta.empty() )
+                        size += fileSize( metaname );
+                    _index.insert( validKey, size );
+                }
+            }
+
+            if ( !objWriteOK )
+            {
+                ::unlink( tempname.c_str() );
             }
         }
 
@@ -486,8 +957,11 @@ namespace
     FileSystemCacheBin::remove(const std::string& key)
     {
         if ( !binValidForReading() ) return false;
-        URI fileURI( getValidKey(key), _metaPath );
+        std::string validKey = getValidKey(key);
+        URI fileURI( validKey, _metaPath );
         std::string path( fileURI.full() + ".osgb" );
+        if ( _trackAccess )
+            _index.remove( validKey );
         return ::unlink( path.c_str() ) == 0;
     }
 
@@ -548,6 +1022,7 @@ namespace
             return false;
 
         ScopedWriteLock exclusiveLock( _rwmutex );
+        _index.clear();
         std::string binDir = osgDB::getFilePath( _metaPath );
         return purgeDirectory( binDir );
     }
@@ -582,6 +1057,207 @@ namespace
         }
         return false;
     }
+
+    unsigned
+    FileSystemCacheBin::getStorageSize()
+    {
+        if ( !_trackAccess )
+            return 0u;
+
+        off_t size = _index.getTotalSize();
+        return size > (off_t)UINT_MAX ? UINT_MAX : (unsigned)size;
+    }
+
+    void
+    FileSystemCacheBin::loadIndex()
+    {
+        if ( _indexLoaded )
+            return;
+
+        _indexLoaded = true;
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        if ( _index.load(_indexPath) )
+        {
+            OE_INFO << LC << "Loaded access index for bin " << getID() << " in "
+                << osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) << " s" << std::endl;
+        }
+        else if ( osgDB::fileExists(_binPath) )
+        {
+            _index.rebuild( _binPath );
+            OE_INFO << LC << "Rebuilt access index for bin " << getID() << " in "
+                << osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) << " s" << std::endl;
+        }
+    }
+
+    void
+    FileSystemCacheBin::saveIndex()
+    {
+        if ( _indexLoaded && _binPathExists )
+        {
+            if ( !_index.save(_indexPath) )
+            {
+                OE_WARN << LC << "Failed to save access index for bin " << getID() << std::endl;
+            }
+        }
+    }
+
+    unsigned
+    FileSystemCacheBin::evict( unsigned maxnum )
+    {
+        std::vector<std::string> keys;
+        _index.popOldest( maxnum, keys );
+
+        ScopedReadLock sharedLock( _rwmutex );
+
+        for(unsigned i=0; i<keys.size(); ++i)
+        {
+            // lock out writers of this key, and skip it if one re-wrote
+            // the record after we popped it from the index.
+            ScopedMutexLock stripeLock( getWriteStripe(keys[i]) );
+            if ( _index.has(keys[i]) )
+                continue;
+
+            URI fileURI( keys[i], _metaPath );
+            ::unlink( (fileURI.full() + ".osgb").c_str() );
+            ::unlink( (fileURI.full() + ".meta").c_str() );
+        }
+
+        OE_DEBUG << LC << "Evicted " << keys.size() << " record(s) from bin " << getID() << std::endl;
+        return keys.size();
+    }
+
+    //------------------------------------------------------------------------
+
+    Evictor::Evictor( const FileSystemCacheOptions& options ) :
+    _maxBytes   ( (off_t)options.maxSizeMB().getOrUse(0u) * 1048576 ),
+    _binMaxBytes( (off_t)options.binMaxSizeMB().getOrUse(0u) * 1048576 ),
+    _period     ( osg::maximum(options.evictionPeriod().get(), 0.1) ),
+    _batchSize  ( osg::maximum(options.evictionBatchSize().get(), 1u) ),
+    _done       ( false )
+    {
+        _lastSave = osg::Timer::instance()->tick();
+    }
+
+    void
+    Evictor::add( FileSystemCacheBin* bin )
+    {
+        ScopedMutexLock lock( _binsMutex );
+        for(Bins::const_iterator i = _bins.begin(); i != _bins.end(); ++i)
+            if ( i->get() == bin )
+                return;
+
+        bin->setSizeLimit( _binMaxBytes );
+        _bins.push_back( bin );
+    }
+
+    void
+    Evictor::getBins( Bins& out ) const
+    {
+        ScopedMutexLock lock( _binsMutex );
+        out = _bins;
+    }
+
+    off_t
+    Evictor::getTotalSize() const
+    {
+        Bins bins;
+        getBins( bins );
+
+        off_t total = 0;
+        for(Bins::const_iterator i = bins.begin(); i != bins.end(); ++i)
+            total += i->get()->getTrackedSize();
+        return total;
+    }
+
+    void
+    Evictor::evict()
+    {
+        ScopedMutexLock lock( _evictMutex );
+
+        Bins bins;
+        getBins( bins );
+
+        for(Bins::iterator i = bins.begin(); i != bins.end(); ++i)
+            i->get()->loadIndex();
+
+        // per-bin limits:
+        for(Bins::iterator i = bins.begin(); i != bins.end() && !_done; ++i)
+        {
+            FileSystemCacheBin* bin = i->get();
+            off_t limit = bin->getSizeLimit();
+            if ( limit > 0 && bin->getTrackedSize() > limit )
+            {
+                off_t target = (off_t)(EVICTION_LOW_WATER_MARK * (double)limit);
+                while( !_done && bin->getTrackedSize() > target && bin->evict(_batchSize) > 0 );
+            }
+        }
+
+        // cache-wide limit: take from whichever bin holds the oldest record.
+        if ( _maxBytes > 0 && getTotalSize() > _maxBytes )
+        {
+            off_t target = (off_t)(EVICTION_LOW_WATER_MARK * (double)_maxBytes);
+            while( !_done && getTotalSize() > target )
+            {
+                FileSystemCacheBin* oldestBin = 0L;
+                TimeStamp oldest = 0;
+                for(Bins::iterator i = bins.begin(); i != bins.end(); ++i)
+                {
+                    TimeStamp t;
+                    if ( i->get()->getOldestAccessTime(t) && (!oldestBin || t < oldest) )
+                    {
+                        oldest = t;
+                        oldestBin = i->get();
+                    }
+                }
+
+                if ( !oldestBin || oldestBin->evict(_batchSize) == 0 )
+                    break;
+            }
+        }
+
+        if ( osg::Timer::instance()->delta_s(_lastSave, osg::Timer::instance()->tick()) > INDEX_SAVE_PERIOD )
+        {
+            saveIndices();
+        }
+    }
+
+    void
+    Evictor::saveIndices()
+    {
+        Bins bins;
+        getBins( bins );
+        for(Bins::iterator i = bins.begin(); i != bins.end(); ++i)
+            i->get()->saveIndex();
+
+        _lastSave = osg::Timer::instance()->tick();
+    }
+
+    void
+    Evictor::run()
+    {
+        while( !_done )
+        {
+            evict();
+
+            // sleep in short slices so shutdown isn't held up.
+            for(double t = 0.0; t < _period && !_done; t += 0.1)
+                OpenThreads::Thread::microSleep( 100000 );
+        }
+
+        ScopedMutexLock lock( _evictMutex );
+        saveIndices();
+    }
+
+    int
+    Evictor::cancel()
+    {
+        _done = true;
+        if ( isRunning() )
+            join();
+        return 0;
+    }
 }
 
 //------------------------------------------------------------------------
@@ -32,8 +32,6 @@
 
 #define LC "[LevelDBCache] "
 
-#define OSGEARTH_ENV_CACHE_MAX_SIZE_MB "OSGEARTH_CACHE_MAX_SIZE_MB"
-
 #define LEVELDB_CACHE_VERSION 1
 
 using namespace osgEarth;
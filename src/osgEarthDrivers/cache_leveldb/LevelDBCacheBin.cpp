@@ -20,6 +20,7 @@
 #include <osgEarth/Cache>
 #include <osgEarth/Registry>
 #include <osgEarth/Random>
+#include <osgEarth/TileCodec>
 #include <osgDB/Registry>
 #include <leveldb/write_batch.h>
 #include <string>
@@ -276,9 +277,9 @@ LevelDBCacheBin::read(const std::string& key, const Reader& reader)
     if ( _tracker->seed().isSet() )
         unblend(datavalue, _tracker->seed().value());
 
-    // finally, decode the OSGB stream into an object.
+    // finally, decode the TileCodec or OSGB stream into an object.
     std::istringstream datastream(datavalue);
-    osgDB::ReaderWriter::ReadResult r = reader.read(datastream);
+    osgDB::ReaderWriter::ReadResult r = TileCodec::readObject(datastream, reader);
     if ( !r.success() )
     {
         OE_WARN << LC << "Cache read failure!"
@@ -338,7 +339,13 @@ LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const
     std::string       data;
     std::stringstream datastream;
 
-    if ( dynamic_cast<const osg::Image*>(object) )
+    if ( useTileCodec(object) )
+    {
+        objWriteOK = TileCodec::encode( object, datastream, *_tileCodec );
+        if ( !objWriteOK )
+            r = osgDB::ReaderWriter::WriteResult( "TileCodec encoding failed" );
+    }
+    else if ( dynamic_cast<const osg::Image*>(object) )
     {
         if ( (_rw->supportedFeatures() & _rw->FEATURE_WRITE_IMAGE) == 0 )
         {
@@ -0,0 +1,195 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "MappedFile"
+#include <osgEarth/Notify>
+#include <osg/Math>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   include <sys/mman.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#define LC "[MappedFile] "
+
+using namespace osgEarth::Drivers::PackedCache;
+
+
+MappedFile::MappedFile() :
+_data   ( 0L ),
+_size   ( 0 ),
+#ifdef _WIN32
+_file   ( INVALID_HANDLE_VALUE ),
+_mapping( 0L )
+#else
+_fd     ( -1 )
+#endif
+{
+    //nop
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool
+MappedFile::open(const std::string& path, std::size_t minSize)
+{
+    close();
+    _path = path;
+
+    _file = ::CreateFileA(
+        path.c_str(), GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ, 0L,
+        OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0L );
+
+    if ( _file == INVALID_HANDLE_VALUE )
+    {
+        OE_WARN << LC << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    ::GetFileSizeEx( (HANDLE)_file, &size );
+    _size = osg::maximum( (std::size_t)size.QuadPart, minSize );
+
+    // mapping with a larger size extends the file.
+    LARGE_INTEGER mapSize;
+    mapSize.QuadPart = _size;
+    _mapping = ::CreateFileMappingA( (HANDLE)_file, 0L, PAGE_READWRITE, mapSize.HighPart, mapSize.LowPart, 0L );
+    if ( _mapping )
+    {
+        _data = (char*)::MapViewOfFile( (HANDLE)_mapping, FILE_MAP_ALL_ACCESS, 0, 0, _size );
+    }
+
+    if ( !_data )
+    {
+        OE_WARN << LC << "Failed to map " << path << std::endl;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void
+MappedFile::close()
+{
+    if ( _data )
+    {
+        ::FlushViewOfFile( _data, 0 );
+        ::UnmapViewOfFile( _data );
+        _data = 0L;
+    }
+    if ( _mapping )
+    {
+        ::CloseHandle( (HANDLE)_mapping );
+        _mapping = 0L;
+    }
+    if ( _file != INVALID_HANDLE_VALUE )
+    {
+        ::CloseHandle( (HANDLE)_file );
+        _file = INVALID_HANDLE_VALUE;
+    }
+    _size = 0;
+}
+
+bool
+MappedFile::flush()
+{
+    return _data && ::FlushViewOfFile( _data, 0 ) != 0;
+}
+
+#else // POSIX
+
+bool
+MappedFile::open(const std::string& path, std::size_t minSize)
+{
+    close();
+    _path = path;
+
+    _fd = ::open( path.c_str(), O_RDWR | O_CREAT, 0644 );
+    if ( _fd < 0 )
+    {
+        OE_WARN << LC << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    struct stat buf;
+    if ( ::fstat(_fd, &buf) != 0 )
+    {
+        close();
+        return false;
+    }
+
+    _size = (std::size_t)buf.st_size;
+    if ( _size < minSize )
+    {
+        // extends the file (sparsely, on most file systems)
+        if ( ::ftruncate(_fd, (off_t)minSize) != 0 )
+        {
+            OE_WARN << LC << "Failed to resize " << path << std::endl;
+            close();
+            return false;
+        }
+        _size = minSize;
+    }
+
+    void* ptr = ::mmap( 0L, _size, PROT_READ|PROT_WRITE, MAP_SHARED, _fd, 0 );
+    if ( ptr == MAP_FAILED )
+    {
+        OE_WARN << LC << "Failed to map " << path << std::endl;
+        close();
+        return false;
+    }
+
+    _data = (char*)ptr;
+    return true;
+}
+
+void
+MappedFile::close()
+{
+    if ( _data )
+    {
+        ::msync( _data, _size, MS_ASYNC );
+        ::munmap( _data, _size );
+        _data = 0L;
+    }
+    if ( _fd >= 0 )
+    {
+        ::close( _fd );
+        _fd = -1;
+    }
+    _size = 0;
+}
+
+bool
+MappedFile::flush()
+{
+    return _data && ::msync( _data, _size, MS_ASYNC ) == 0;
+}
+
+#endif
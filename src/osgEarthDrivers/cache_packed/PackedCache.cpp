@@ -0,0 +1,87 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "PackedCache"
+#include "PackedCacheBin"
+#include <osgEarth/URI>
+#include <osgEarth/ThreadingUtils>
+
+#define LC "[PackedCache] "
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers::PackedCache;
+
+
+PackedCacheImpl::PackedCacheImpl( const CacheOptions& options ) :
+osgEarth::Cache( options ),
+_options       ( options )
+{
+    if ( _options.rootPath().isSet() )
+    {
+        _rootPath = URI( *_options.rootPath(), options.referrer() ).full();
+    }
+    else
+    {
+        // read the root path from ENV is necessary:
+        const char* cachePath = ::getenv(OSGEARTH_ENV_CACHE_PATH);
+        if ( cachePath )
+        {
+            _rootPath = cachePath;           
+            OE_INFO << LC << "Cache location set from environment: \"" 
+                << cachePath << "\"" << std::endl;
+        }
+    }
+
+    if ( _rootPath.empty() )
+    {
+        _ok = false;
+        OE_WARN << LC << "Illegal: no root path set for cache!" << std::endl;
+    }
+}
+
+PackedCacheImpl::~PackedCacheImpl()
+{
+    //nop
+}
+
+CacheBin*
+PackedCacheImpl::addBin( const std::string& name )
+{
+    // Note: bins open their files on first use, so the throw-away
+    // instance created here when the bin already exists is cheap.
+    return _rootPath.empty() ? 0L :
+        _bins.getOrCreate(name, new PackedCacheBin(name, _rootPath, _options));
+}
+
+CacheBin*
+PackedCacheImpl::getOrCreateDefaultBin()
+{    
+    if ( _rootPath.empty() )
+        return 0L;
+
+    static Threading::Mutex s_defaultBinMutex;
+    if ( !_defaultBin.valid() )
+    {
+        Threading::ScopedMutexLock lock( s_defaultBinMutex );
+        if ( !_defaultBin.valid() ) // double-check
+        {
+            _defaultBin = new PackedCacheBin("_default", _rootPath, _options);
+        }
+    }
+    return _defaultBin.get();
+}
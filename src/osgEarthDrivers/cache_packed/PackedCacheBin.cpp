@@ -0,0 +1,735 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "PackedCacheBin"
+#include <osgEarth/Cache>
+#include <osgEarth/Registry>
+#include <osgEarth/FileUtils>
+#include <osgEarth/StringUtils>
+#include <osgEarth/URI>
+#include <osgEarth/TileCodec>
+#include <osgDB/Registry>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <climits>
+#include <time.h>
+
+#ifndef _WIN32
+#   include <unistd.h>
+#endif
+
+using namespace osgEarth;
+using namespace osgEarth::Threading;
+using namespace osgEarth::Drivers::PackedCache;
+
+#undef  LC
+#define LC "[PackedCacheBin] "
+
+#define INDEX_MAGIC     "OEPACKIX"
+#define SLOT_EMPTY      0xFFFFFFFFu
+#define SLOT_REMOVED    0xFFFFFFFEu
+#define MAX_LOAD_FACTOR 0.7
+
+namespace
+{
+    /** Read-only stream buffer over a block of memory, so osgDB can decode in place. */
+    struct MemoryStreamBuf : public std::streambuf
+    {
+        MemoryStreamBuf(const char* data, std::size_t length)
+        {
+            char* p = const_cast<char*>(data);
+            setg(p, p, p + length);
+        }
+
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+        {
+            char* target =
+                dir == std::ios_base::beg ? eback() + off :
+                dir == std::ios_base::cur ? gptr() + off :
+                egptr() + off;
+
+            if ( target < eback() || target > egptr() )
+                return pos_type(off_type(-1));
+
+            setg(eback(), target, egptr());
+            return pos_type(target - eback());
+        }
+
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which)
+        {
+            return seekoff(off_type(pos), std::ios_base::beg, which);
+        }
+    };
+
+    inline unsigned padded(unsigned length)
+    {
+        return (length + 7u) & ~7u;
+    }
+
+    inline unsigned now()
+    {
+        return (unsigned)::time(0L);
+    }
+}
+
+//------------------------------------------------------------------------
+
+PackedCacheBin::PackedCacheBin(const std::string&        binID,
+                               const std::string&        rootPath,
+                               const PackedCacheOptions& options) :
+osgEarth::CacheBin( binID ),
+_ok               ( true ),
+_opened           ( false ),
+_options          ( options )
+{
+    _binPath   = osgDB::concatPaths( rootPath, binID );
+    _metaPath  = osgDB::concatPaths( _binPath, "osgearth_cacheinfo.json" );
+    _indexPath = osgDB::concatPaths( _binPath, "index.dat" );
+
+    _rw = osgDB::Registry::instance()->getReaderWriterForExtension( "osgb" );
+    _rwOptions = osgEarth::Registry::instance()->cloneOrCreateOptions();
+#ifdef OSGEARTH_HAVE_ZLIB
+    _rwOptions->setOptionString( "Compressor=zlib" );
+#endif        
+}
+
+PackedCacheBin::~PackedCacheBin()
+{
+    closeAll();
+}
+
+bool
+PackedCacheBin::binValidForReading(bool silent)
+{
+    if ( !_opened )
+    {
+        ScopedMutexLock lock( _openMutex );
+        if ( !_opened )
+        {
+            _ok = open();
+            _opened = true;
+            if ( !_ok && !silent )
+            {
+                OE_WARN << LC << "Failed to open cache bin at [" << _binPath << "]" << std::endl;
+            }
+        }
+    }
+    return _ok && _rw.valid();
+}
+
+bool
+PackedCacheBin::binValidForWriting(bool silent)
+{
+    return binValidForReading(silent);
+}
+
+std::string
+PackedCacheBin::segmentPath(unsigned number) const
+{
+    return osgDB::concatPaths( _binPath, Stringify() << "segment_" << std::setw(6) << std::setfill('0') << number << ".dat" );
+}
+
+bool
+PackedCacheBin::open()
+{
+    if ( !osgDB::fileExists(_binPath) && !osgEarth::makeDirectory(_binPath) )
+        return false;
+
+    if ( osgDB::fileExists(_indexPath) )
+    {
+        if ( _index.open(_indexPath, sizeof(IndexHeader)) &&
+             ::memcmp(header()->magic, INDEX_MAGIC, 8) == 0 &&
+             header()->version == PACKED_CACHE_VERSION &&
+             _index.size() >= sizeof(IndexHeader) + header()->capacity*sizeof(IndexSlot) &&
+             openSegments() )
+        {
+            OE_INFO << LC << "Opened bin " << getID() << " with " << header()->count << " records" << std::endl;
+            return true;
+        }
+
+        OE_WARN << LC << "Index for bin " << getID() << " is invalid or from another version; resetting" << std::endl;
+        closeAll();
+        deleteFiles();
+    }
+
+    // round the initial capacity up to a power of two.
+    unsigned capacity = 64u;
+    while( capacity < _options.indexCapacity().get() )
+        capacity <<= 1;
+
+    return createIndex( capacity );
+}
+
+bool
+PackedCacheBin::createIndex(unsigned capacity)
+{
+    if ( !_index.open(_indexPath, sizeof(IndexHeader) + capacity*sizeof(IndexSlot)) )
+        return false;
+
+    IndexHeader* h = header();
+    ::memset( h, 0, sizeof(IndexHeader) );
+    ::memcpy( h->magic, INDEX_MAGIC, 8 );
+    h->version     = PACKED_CACHE_VERSION;
+    h->capacity    = capacity;
+    h->segmentSize = osg::maximum(_options.segmentSizeMB().get(), 1u) * 1048576u;
+
+    ::memset( slots(), 0xFF, capacity*sizeof(IndexSlot) ); // all SLOT_EMPTY
+    return true;
+}
+
+bool
+PackedCacheBin::openSegments()
+{
+    const IndexHeader* h = header();
+    for(unsigned i = 0; i < h->numSegments; ++i)
+    {
+        MappedFile* seg = new MappedFile();
+        _segments.push_back( seg );
+        if ( !seg->open(segmentPath(h->firstSegment + i), h->segmentSize) )
+            return false;
+    }
+    return true;
+}
+
+void
+PackedCacheBin::closeAll()
+{
+    for(unsigned i=0; i<_segments.size(); ++i)
+        delete _segments[i];
+    _segments.clear();
+    _index.close();
+}
+
+void
+PackedCacheBin::deleteFiles()
+{
+    osgDB::DirectoryContents files = osgDB::getDirectoryContents( _binPath );
+    for(osgDB::DirectoryContents::const_iterator f = files.begin(); f != files.end(); ++f)
+    {
+        if ( startsWith(*f, "segment_") || startsWith(*f, "index.") )
+            ::unlink( osgDB::concatPaths(_binPath, *f).c_str() );
+    }
+}
+
+const char*
+PackedCacheBin::record(const IndexSlot& slot) const
+{
+    unsigned i = slot.segment - header()->firstSegment;
+    if ( i >= _segments.size() || slot.offset + slot.length > _segments[i]->size() )
+        return 0L;
+    return _segments[i]->data() + slot.offset;
+}
+
+PackedCacheBin::IndexSlot*
+PackedCacheBin::find(const std::string& key, unsigned hash) const
+{
+    IndexSlot* s  = slots();
+    unsigned mask = header()->capacity - 1;
+
+    for(unsigned probe = 0, i = hash & mask; probe <= mask; ++probe, i = (i+1) & mask)
+    {
+        if ( s[i].segment == SLOT_EMPTY )
+            return 0L;
+
+        if ( s[i].segment != SLOT_REMOVED && s[i].hash == hash )
+        {
+            // confirm against the key stored with the record.
+            const char* rec = record( s[i] );
+            if ( rec )
+            {
+                const RecordHeader* rh = (const RecordHeader*)rec;
+                if ( rh->keyLength == key.length() &&
+                     ::memcmp(rec + sizeof(RecordHeader), key.data(), key.length()) == 0 )
+                {
+                    return &s[i];
+                }
+            }
+        }
+    }
+    return 0L;
+}
+
+bool
+PackedCacheBin::append(const char* rec, unsigned length, IndexSlot& slot)
+{
+    IndexHeader* h = header();
+
+    unsigned writeOffset = h->writeOffset;
+    if ( !appendTo(_segments, h->firstSegment, writeOffset, rec, length, slot) )
+        return false;
+
+    h->numSegments = _segments.size();
+    h->writeOffset = writeOffset;
+    return true;
+}
+
+bool
+PackedCacheBin::appendTo(std::vector<MappedFile*>& segments,
+                         unsigned                  firstSegment,
+                         unsigned&                 writeOffset,
+                         const char*               rec,
+                         unsigned                  length,
+                         IndexSlot&                slot)
+{
+    MappedFile* seg = segments.empty() ? 0L : segments.back();
+
+    if ( !seg || writeOffset + length > seg->size() )
+    {
+        // start a new segment, oversized if this record needs it.
+        std::string path = segmentPath( firstSegment + segments.size() );
+        seg = new MappedFile();
+        if ( !seg->open(path, osg::maximum(header()->segmentSize, length)) )
+        {
+            delete seg;
+            ::unlink( path.c_str() );
+            return false;
+        }
+        segments.push_back( seg );
+        writeOffset = 0;
+    }
+
+    ::memcpy( seg->data() + writeOffset, rec, length );
+
+    slot.segment = firstSegment + segments.size() - 1;
+    slot.offset  = writeOffset;
+    slot.length  = length;
+
+    writeOffset += length;
+    return true;
+}
+
+bool
+PackedCacheBin::rehash(unsigned capacity)
+{
+    // build the new table in memory, then write it out as a fresh index file.
+    IndexHeader newHeader = *header();
+    newHeader.capacity = capacity;
+    newHeader.used     = newHeader.count;
+
+    std::vector<IndexSlot> newSlots( capacity );
+    ::memset( &newSlots[0], 0xFF, capacity*sizeof(IndexSlot) );
+
+    const IndexSlot* s = slots();
+    unsigned mask = capacity - 1;
+    for(unsigned i=0; i<header()->capacity; ++i)
+    {
+        if ( s[i].segment != SLOT_EMPTY && s[i].segment != SLOT_REMOVED )
+        {
+            unsigned j = s[i].hash & mask;
+            while( newSlots[j].segment != SLOT_EMPTY )
+                j = (j+1) & mask;
+            newSlots[j] = s[i];
+        }
+    }
+
+    std::string tempPath = _indexPath + ".tmp";
+    {
+        MappedFile temp;
+        if ( !temp.open(tempPath, sizeof(IndexHeader) + capacity*sizeof(IndexSlot)) )
+            return false;
+        ::memcpy( temp.data(), &newHeader, sizeof(IndexHeader) );
+        ::memcpy( temp.data() + sizeof(IndexHeader), &newSlots[0], capacity*sizeof(IndexSlot) );
+    }
+
+    std::size_t oldSize = _index.size();
+    _index.close();
+
+    bool replaced = osgEarth::replaceFile(tempPath, _indexPath);
+    if ( !replaced )
+    {
+        OE_WARN << LC << "Failed to replace index for bin " << getID() << std::endl;
+        ::unlink( tempPath.c_str() );
+    }
+
+    if ( !_index.open(_indexPath, replaced ? sizeof(IndexHeader) + capacity*sizeof(IndexSlot) : oldSize) )
+    {
+        // without an index the bin is unusable.
+        OE_WARN << LC << "Failed to reopen index for bin " << getID() << std::endl;
+        _ok = false;
+        return false;
+    }
+
+    return replaced;
+}
+
+ReadResult
+PackedCacheBin::readImage(const std::string& key)
+{
+    return read(key, ImageReader(_rw.get(), _rwOptions.get()));    
+}
+
+ReadResult
+PackedCacheBin::readObject(const std::string& key)
+{
+    return read(key, ObjectReader(_rw.get(), _rwOptions.get()));
+}
+
+ReadResult
+PackedCacheBin::readNode(const std::string& key)
+{
+    return read(key, NodeReader(_rw.get(), _rwOptions.get()));
+}
+
+ReadResult
+PackedCacheBin::read(const std::string& key, const Reader& reader)
+{
+    if ( !binValidForReading() ) 
+        return ReadResult(ReadResult::RESULT_NOT_FOUND);
+
+    unsigned hash = osgEarth::hashString(key);
+
+    // Copy the record out under the shared lock; the decode happens
+    // outside it so writers aren't held up by slow readers.
+    std::string data;
+    Config      metadata;
+    TimeStamp   lastModified;
+    {
+        ScopedReadLock shared( _rwMutex );
+
+        const IndexSlot* slot = find(key, hash);
+        if ( !slot )
+            return ReadResult(ReadResult::RESULT_NOT_FOUND);
+
+        const char* rec = record(*slot);
+        const RecordHeader* rh = (const RecordHeader*)rec;
+        const char* ptr = rec + sizeof(RecordHeader) + rh->keyLength;
+
+        if ( rh->metaLength > 0 )
+            metadata.fromJSON( std::string(ptr, rh->metaLength) );
+
+        data.assign( ptr + rh->metaLength, rh->dataLength );
+        lastModified = slot->time;
+    }
+
+    MemoryStreamBuf buf( data.data(), data.length() );
+    std::istream datastream( &buf );
+
+    osgDB::ReaderWriter::ReadResult r = TileCodec::readObject(datastream, reader);
+    if ( !r.success() )
+    {
+        OE_WARN << LC << "Cache read failure for (" << key << ") in bin " << getID()
+            << ": " << r.message() << std::endl;
+        return ReadResult(ReadResult::RESULT_READER_ERROR);
+    }
+
+    ReadResult rr(r.getObject(), metadata);
+    rr.setLastModifiedTime(lastModified);    
+    return rr;
+}
+
+ReadResult
+PackedCacheBin::readString(const std::string& key)
+{
+    ReadResult r = readObject(key);
+    if ( r.succeeded() )
+    {
+        if ( r.get<StringObject>() )
+            return r;
+        else
+            return ReadResult();
+    }
+    else
+    {
+        return r;
+    }
+}
+
+bool
+PackedCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta)
+{
+    if ( !binValidForWriting() || !object ) 
+        return false;
+
+    // serialize outside the lock.
+    osgDB::ReaderWriter::WriteResult r;
+    std::stringstream datastream;
+
+    if ( useTileCodec(object) )
+    {
+        r = TileCodec::encode(object, datastream, *_tileCodec) ?
+            osgDB::ReaderWriter::WriteResult( osgDB::ReaderWriter::WriteResult::FILE_SAVED ) :
+            osgDB::ReaderWriter::WriteResult( "TileCodec encoding failed" );
+    }
+    else if ( dynamic_cast<const osg::Image*>(object) )
+    {
+        r = _rw->writeImage( *static_cast<const osg::Image*>(object), datastream, _rwOptions.get() );
+    }
+    else if ( dynamic_cast<const osg::Node*>(object) )
+    {
+        r = _rw->writeNode( *static_cast<const osg::Node*>(object), datastream, _rwOptions.get() );
+    }
+    else
+    {
+        r = _rw->writeObject( *object, datastream );
+    }
+
+    if ( !r.success() )
+    {
+        OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << key << "); msg = \"" 
+            << r.message() << "\"" << std::endl;
+        return false;
+    }
+
+    std::string data     = datastream.str();
+    std::string metadata = meta.empty() ? std::string() : meta.toJSON(false);
+
+    // assemble the record: header, key, metadata, data.
+    RecordHeader rh;
+    rh.keyLength  = key.length();
+    rh.metaLength = metadata.length();
+    rh.dataLength = data.length();
+    rh.reserved   = 0;
+
+    unsigned length = padded( sizeof(RecordHeader) + rh.keyLength + rh.metaLength + rh.dataLength );
+    std::vector<char> rec( length, 0 );
+    char* ptr = &rec[0];
+    ::memcpy( ptr, &rh, sizeof(RecordHeader) );             ptr += sizeof(RecordHeader);
+    ::memcpy( ptr, key.data(), rh.keyLength );              ptr += rh.keyLength;
+    ::memcpy( ptr, metadata.data(), rh.metaLength );        ptr += rh.metaLength;
+    ::memcpy( ptr, data.data(), rh.dataLength );
+
+    unsigned hash = osgEarth::hashString(key);
+
+    ScopedWriteLock exclusive( _rwMutex );
+
+    IndexSlot* slot = find(key, hash);
+    if ( !slot )
+    {
+        if ( (double)(header()->used + 1) > MAX_LOAD_FACTOR * (double)header()->capacity )
+        {
+            if ( !rehash(header()->capacity * 2) )
+            {
+                OE_WARN << LC << "Bin " << getID() << ": failed to grow index" << std::endl;
+                return false;
+            }
+        }
+
+        // take the first free or removed slot in the probe sequence.
+        IndexSlot* s = slots();
+        unsigned mask = header()->capacity - 1;
+        unsigned i = hash & mask;
+        while( s[i].segment != SLOT_EMPTY && s[i].segment != SLOT_REMOVED )
+            i = (i+1) & mask;
+
+        slot = &s[i];
+    }
+
+    // write the record first, then publish it in the slot.
+    IndexSlot newSlot;
+    newSlot.hash     = hash;
+    newSlot.time     = now();
+    newSlot.reserved = 0;
+    if ( !append(&rec[0], length, newSlot) )
+    {
+        OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << key << "); out of space?" << std::endl;
+        return false;
+    }
+
+    if ( slot->segment == SLOT_EMPTY )
+    {
+        header()->used++;
+        header()->count++;
+    }
+    else if ( slot->segment == SLOT_REMOVED )
+    {
+        header()->count++;
+    }
+
+    *slot = newSlot;
+    return true;
+}
+
+CacheBin::RecordStatus
+PackedCacheBin::getRecordStatus(const std::string& key)
+{
+    if ( !binValidForReading() ) 
+        return STATUS_NOT_FOUND;
+
+    ScopedReadLock shared( _rwMutex );
+    return find(key, osgEarth::hashString(key)) ? STATUS_OK : STATUS_NOT_FOUND;
+}
+
+bool
+PackedCacheBin::remove(const std::string& key)
+{
+    if ( !binValidForWriting() )
+        return false;
+
+    ScopedWriteLock exclusive( _rwMutex );
+    IndexSlot* slot = find(key, osgEarth::hashString(key));
+    if ( !slot )
+        return false;
+
+    slot->segment = SLOT_REMOVED;
+    header()->count--;
+    return true;
+}
+
+bool
+PackedCacheBin::touch(const std::string& key)
+{
+    if ( !binValidForWriting() )
+        return false;
+
+    ScopedWriteLock exclusive( _rwMutex );
+    IndexSlot* slot = find(key, osgEarth::hashString(key));
+    if ( !slot )
+        return false;
+
+    slot->time = now();
+    return true;
+}
+
+bool
+PackedCacheBin::clear()
+{
+    if ( !binValidForWriting() )
+        return false;
+
+    ScopedWriteLock exclusive( _rwMutex );
+
+    unsigned capacity = header()->capacity;
+    closeAll();
+    deleteFiles();
+    _ok = createIndex( capacity );
+
+    OE_INFO << LC << "Cleared bin " << getID() << std::endl;
+    return _ok;
+}
+
+bool
+PackedCacheBin::compact()
+{
+    if ( !binValidForWriting() )
+        return false;
+
+    // This could take a while.
+    ScopedWriteLock exclusive( _rwMutex );
+
+    // copy the live records into a new run of segments that starts after the
+    // current ones, leaving the index alone until all of them are copied.
+    IndexHeader* h = header();
+    unsigned oldNum   = h->numSegments;
+    unsigned newFirst = h->firstSegment + h->numSegments;
+    unsigned newWriteOffset = 0;
+
+    std::vector<MappedFile*> newSegments;
+    std::vector<IndexSlot>   newSlots( slots(), slots() + h->capacity );
+
+    bool ok = true;
+    for(unsigned i=0; i<newSlots.size() && ok; ++i)
+    {
+        if ( newSlots[i].segment == SLOT_EMPTY || newSlots[i].segment == SLOT_REMOVED )
+            continue;
+
+        const char* rec = record( newSlots[i] );
+        ok = rec && appendTo( newSegments, newFirst, newWriteOffset, rec, newSlots[i].length, newSlots[i] );
+    }
+
+    for(unsigned i=0; i<newSegments.size() && ok; ++i)
+        ok = newSegments[i]->flush();
+
+    if ( !ok )
+    {
+        for(unsigned i=0; i<newSegments.size(); ++i)
+        {
+            std::string path = newSegments[i]->path();
+            delete newSegments[i];
+            ::unlink( path.c_str() );
+        }
+        OE_WARN << LC << "Bin " << getID() << ": compaction failed" << std::endl;
+        return false;
+    }
+
+    // publish the new layout, then drop the old segments.
+    ::memcpy( slots(), &newSlots[0], newSlots.size()*sizeof(IndexSlot) );
+    h->firstSegment = newFirst;
+    h->numSegments  = newSegments.size();
+    h->writeOffset  = newWriteOffset;
+    _index.flush();
+
+    _segments.swap( newSegments );
+    for(unsigned i=0; i<newSegments.size(); ++i)
+    {
+        std::string path = newSegments[i]->path();
+        delete newSegments[i];
+        ::unlink( path.c_str() );
+    }
+
+    // drop the removed-slot markers while we're at it.
+    if ( !rehash(h->capacity) )
+    {
+        OE_WARN << LC << "Bin " << getID() << ": failed to rebuild index after compaction" << std::endl;
+        return false;
+    }
+    _index.flush();
+
+    OE_INFO << LC << "Compacted bin " << getID() << " from " << oldNum << " to "
+        << header()->numSegments << " segment(s)" << std::endl;
+
+    return true;
+}
+
+unsigned
+PackedCacheBin::getStorageSize()
+{
+    if ( !binValidForReading() )
+        return 0u;
+
+    ScopedReadLock shared( _rwMutex );
+    double size = (double)_index.size();
+    for(unsigned i=0; i<_segments.size(); ++i)
+        size += (double)_segments[i]->size();
+    return size > (double)UINT_MAX ? UINT_MAX : (unsigned)size;
+}
+
+Config
+PackedCacheBin::readMetadata()
+{
+    if ( !binValidForReading() )
+        return Config();
+
+    ScopedMutexLock lock( _metaMutex );
+
+    Config conf;
+    conf.fromJSON( URI(_metaPath).getString(_rwOptions.get()) );
+    return conf;
+}
+
+bool
+PackedCacheBin::writeMetadata(const Config& conf)
+{
+    if ( !binValidForWriting() )
+        return false;
+
+    ScopedMutexLock lock( _metaMutex );
+
+    std::fstream output( _metaPath.c_str(), std::ios_base::out );
+    if ( output.is_open() )
+    {
+        output << conf.toJSON(true);
+        output.flush();
+        output.close();
+        return true;
+    }
+    return false;
+}
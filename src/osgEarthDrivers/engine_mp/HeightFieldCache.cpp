@@ -43,8 +43,7 @@ HeightFieldCache::getOrCreateHeightField(const MapFrame&                 frame,
     cachekey._revision     = frame.getRevision();
     cachekey._samplePolicy = samplePolicy;
 
-    if (progress)
-        progress->stats()["hfcache_try_count"] += 1;
+    Metrics::add( _tries );
 
     bool hit = false;
     LRUCache<HFKey,HFValue>::Record rec;
@@ -53,11 +52,7 @@ HeightFieldCache::getOrCreateHeightField(const MapFrame&                 frame,
         out_hf = rec.value()._hf.get();
         out_isFallback = rec.value()._isFallback;
 
-        if (progress)
-        {
-            progress->stats()["hfcache_hit_count"] += 1;
-            progress->stats()["hfcache_hit_rate"] = progress->stats()["hfcache_hit_count"]/progress->stats()["hfcache_try_count"];
-        }
+        Metrics::add( _hits );
 
         return true;
     }
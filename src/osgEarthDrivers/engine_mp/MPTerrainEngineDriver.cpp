@@ -21,6 +21,7 @@
 #include "TileNode"
 #include <osgEarth/Registry>
 #include <osgEarth/Progress>
+#include <osgEarth/Metrics>
 #include <osgEarth/Utils>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -38,10 +39,13 @@ namespace osgEarth { namespace Drivers { namespace MPTerrainEngine
     class MPTerrainEngineDriver : public osgDB::ReaderWriter
     {
     public:
-        int _profiling;
+        int                _profiling;
+        Metrics::Histogram _tileLoadTime;
 
         MPTerrainEngineDriver()
         {
+            _tileLoadTime = Metrics::getHistogram( "mp.tile.load_time", "us" );
+
             _profiling = 0;
             const char* p = ::getenv("OSGEARTH_MP_PROFILE");
             if ( p )
@@ -136,6 +140,7 @@ namespace osgEarth { namespace Drivers { namespace MPTerrainEngine
                     }
 
                     double tileLoadTime = OE_STOP_TIMER(tileLoadTime);
+                    Metrics::record( _tileLoadTime, (unsigned long long)(tileLoadTime * 1.0e6) );
                     if ( progress )
                         progress->stats()["tile_load_time"] = tileLoadTime;
 
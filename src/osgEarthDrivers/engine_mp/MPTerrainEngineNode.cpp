@@ -288,6 +288,19 @@ MPTerrainEngineNode::postInitialize( const Map* map, const TerrainOptions& optio
     // initialize the model factory:
     _tileModelFactory = new TileModelFactory(_liveTiles.get(), _terrainOptions, this);
 
+    // triangle indices shared by all the tiles with complete sampling grids:
+    if ( _terrainOptions.sharedTopology() == true )
+    {
+        _topologyCache = new TopologyCache();
+    }
+
+    // threads shared by all the paging threads for building quadrants in parallel:
+    if ( _terrainOptions.parallelQuadrants() == true )
+    {
+        _quadrantService = new TaskService(
+            "MP Quadrants", OpenThreads::GetNumberOfProcessors(), 0u, TaskService::SCHEDULER_WORK_STEALING );
+    }
+
     // handle an already-established map profile:
     if ( _update_mapf->getProfile() )
     {
@@ -581,24 +594,32 @@ MPTerrainEngineNode::getKeyNodeFactory()
         bool optimizeTriangleOrientation = 
             getMap()->getMapOptions().elevationInterpolation() != INTERP_TRIANGULATE;
 
-        // A compiler specific to this thread:
-        TileModelCompiler* compiler = new TileModelCompiler(
-            _update_mapf->terrainMaskLayers(),
-            _update_mapf->modelLayers(),
-            _primaryUnit,
-            optimizeTriangleOrientation,
-            _terrainOptions );
+        // A compiler specific to this thread, or one per quadrant if they
+        // are built in parallel:
+        TileModelCompilerVector compilers;
+        unsigned numCompilers = _quadrantService.valid() ? 4u : 1u;
+        for(unsigned i=0; i<numCompilers; ++i)
+        {
+            compilers.push_back( new TileModelCompiler(
+                _update_mapf->terrainMaskLayers(),
+                _update_mapf->modelLayers(),
+                _primaryUnit,
+                optimizeTriangleOrientation,
+                _terrainOptions,
+                _topologyCache.get() ) );
+        }
 
         // initialize a key node factory.
         knf = new SingleKeyNodeFactory(
             getMap(),
             _tileModelFactory.get(),
-            compiler,
+            compilers,
             _liveTiles.get(),
             _deadTiles.get(),
             _terrainOptions,
             _uid,
-            this );
+            this,
+            _quadrantService.get() );
     }
 
     return knf.get();
@@ -693,7 +714,8 @@ MPTerrainEngineNode::createTile( const TileKey& key )
             _update_mapf->modelLayers(),
             _primaryUnit,
             optimizeTriangleOrientation,
-            _terrainOptions );
+            _terrainOptions,
+            _topologyCache.get() );
 
     return compiler->compile(model.get(), *_update_mapf, 0L);
 }
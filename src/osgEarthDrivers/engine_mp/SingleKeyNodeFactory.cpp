@@ -95,20 +95,96 @@ namespace
             }
         }
     };
+
+
+    /**
+     * Progress of one quadrant built on the quadrant service. Each quadrant
+     * keeps its own stats, and checks the progress of the whole request
+     * (shared by all four) for cancelation.
+     */
+    struct QuadrantProgress : public ProgressCallback
+    {
+        QuadrantProgress() : _parent(0L), _parentMutex(0L) { }
+
+        bool isCanceled()
+        {
+            if ( !ProgressCallback::isCanceled() && _parent )
+            {
+                // the request's progress is not thread-safe.
+                Threading::ScopedMutexLock lock( *_parentMutex );
+                if ( _parent->isCanceled() )
+                    cancel();
+            }
+            return ProgressCallback::isCanceled();
+        }
+
+        ProgressCallback* _parent;
+        Threading::Mutex* _parentMutex;
+    };
+
+
+    /** Adds the stats of the quadrants to the progress of the request. */
+    void mergeStats(osg::ref_ptr<QuadrantProgress>* quadrants, ProgressCallback* progress)
+    {
+        if ( !progress || !quadrants[0].valid() )
+            return;
+
+        for(unsigned q=0; q<4; ++q)
+        {
+            for(fast_map<std::string,double>::iterator i = quadrants[q]->stats().begin(); i != quadrants[q]->stats().end(); ++i)
+            {
+                progress->stats()[i->first] += i->second;
+            }
+        }
+    }
 }
 
 
-SingleKeyNodeFactory::SingleKeyNodeFactory(const Map*                    map,
-                                           TileModelFactory*             modelFactory,
-                                           TileModelCompiler*            modelCompiler,
-                                           TileNodeRegistry*             liveTiles,
-                                           TileNodeRegistry*             deadTiles,
-                                           const MPTerrainEngineOptions& options,
-                                           UID                           engineUID,
-                                           TerrainTileNodeBroker*        tileNodeBroker ) :
+/**
+ * Creates the tile model of a quadrant, or compiles it into a tile node.
+ */
+struct SingleKeyNodeFactory::QuadrantTask
+{
+    void execute()
+    {
+        if ( _progress->isCanceled() )
+            return;
+
+        if ( _compile )
+        {
+            *_tile = _factory->createTile( _model->get(), _compiler, _setupChildren, _progress );
+        }
+        else
+        {
+            _factory->_modelFactory->createTileModel( _key, _factory->_frame, _accumulate, *_model, _progress );
+        }
+    }
+
+    SingleKeyNodeFactory*    _factory;
+    TileKey                  _key;
+    bool                     _compile;
+    bool                     _accumulate;
+    bool                     _setupChildren;
+    TileModelCompiler*       _compiler;
+    osg::ref_ptr<TileModel>* _model;
+    osg::ref_ptr<osg::Node>* _tile;
+    ProgressCallback*        _progress;
+};
+
+
+SingleKeyNodeFactory::SingleKeyNodeFactory(const Map*                     map,
+                                           TileModelFactory*              modelFactory,
+                                           const TileModelCompilerVector& modelCompilers,
+                                           TileNodeRegistry*              liveTiles,
+                                           TileNodeRegistry*              deadTiles,
+                                           const MPTerrainEngineOptions&  options,
+                                           UID                            engineUID,
+                                           TerrainTileNodeBroker*         tileNodeBroker,
+                                           TaskService*                   quadrantService ) :
 _frame           ( map ),
 _modelFactory    ( modelFactory ),
-_modelCompiler   ( modelCompiler ),
+_modelCompilers  ( modelCompilers ),
+_quadrantService ( quadrantService ),
 _liveTiles       ( liveTiles ),
 _deadTiles       ( deadTiles ),
 _options         ( options ),
@@ -116,6 +192,16 @@ _engineUID       ( engineUID ),
 _tileNodeBroker  ( tileNodeBroker )
 {
     _debug = _options.debug() == true;
+
+    _createTime  = Metrics::getHistogram( "mp.tile.create_time", "us" );
+    _compileTime = Metrics::getHistogram( "mp.tile.compile_time", "us" );
+
+    // each concurrent quadrant needs a compiler of its own.
+    if ( _quadrantService.valid() && _modelCompilers.size() < 4 )
+    {
+        OE_WARN << LC << "Not enough compilers to build quadrants in parallel" << std::endl;
+        _quadrantService = 0L;
+    }
 }
 
 unsigned
@@ -141,9 +227,10 @@ namespace
 #endif
 
 osg::Node*
-SingleKeyNodeFactory::createTile(TileModel*        model,
-                                 bool              setupChildrenIfNecessary,
-                                 ProgressCallback* progress)
+SingleKeyNodeFactory::createTile(TileModel*         model,
+                                 TileModelCompiler* compiler,
+                                 bool               setupChildrenIfNecessary,
+                                 ProgressCallback*  progress)
 {
 #ifdef EXPERIMENTAL_TILE_NODE_CACHE
     osg::ref_ptr<TileNode> tileNode;
@@ -155,12 +242,12 @@ SingleKeyNodeFactory::createTile(TileModel*        model,
     }
     else
     {
-        tileNode = _modelCompiler->compile( model, _frame );
+        tileNode = compiler->compile( model, _frame );
         cache.insert(model->_tileKey, tileNode);
     }
 #else
     // compile the model into a node:
-    TileNode* tileNode = _modelCompiler->compile(model, _frame, progress);
+    TileNode* tileNode = compiler->compile(model, _frame, progress);
     tileNode->setEngineUID( _engineUID );
 #endif
 
@@ -275,6 +362,22 @@ SingleKeyNodeFactory::createTile(TileModel*        model,
 }
 
 
+void
+SingleKeyNodeFactory::runQuadrants(QuadrantTask* tasks)
+{
+    // the calling thread takes the first quadrant itself.
+    Threading::MultiEvent done( 3 );
+    for(unsigned q=1; q<4; ++q)
+    {
+        ParallelTask<QuadrantTask>* task = new ParallelTask<QuadrantTask>( &done );
+        static_cast<QuadrantTask&>(*task) = tasks[q];
+        _quadrantService->add( task );
+    }
+    tasks[0].execute();
+    done.wait();
+}
+
+
 osg::Node*
 SingleKeyNodeFactory::createNode(const TileKey&    key, 
                                  bool              accumulate,
@@ -289,25 +392,63 @@ SingleKeyNodeFactory::createNode(const TileKey&    key,
     OE_START_TIMER(create_model);
 
     osg::ref_ptr<TileModel> model[4];
+    osg::ref_ptr<osg::Node> tiles[4];
+
+    // when building quadrants in parallel, each runs with its own progress:
+    Threading::Mutex               progressMutex;
+    osg::ref_ptr<QuadrantProgress> quadrantProgress[4];
+    QuadrantTask                   tasks[4];
+
+    if ( _quadrantService.valid() )
+    {
+        for(unsigned q=0; q<4; ++q)
+        {
+            quadrantProgress[q] = new QuadrantProgress();
+            quadrantProgress[q]->_parent      = progress;
+            quadrantProgress[q]->_parentMutex = &progressMutex;
+
+            tasks[q]._factory       = this;
+            tasks[q]._key           = key.createChildKey(q);
+            tasks[q]._compile       = false;
+            tasks[q]._accumulate    = accumulate;
+            tasks[q]._setupChildren = setupChildren;
+            tasks[q]._compiler      = _modelCompilers[q].get();
+            tasks[q]._model         = &model[q];
+            tasks[q]._tile          = &tiles[q];
+            tasks[q]._progress      = quadrantProgress[q].get();
+        }
+
+        runQuadrants( tasks );
+    }
+
     for(unsigned q=0; q<4; ++q)
     {
         if ( progress && progress->isCanceled() )
+        {
+            mergeStats( quadrantProgress, progress );
             return 0L;
-        
-        TileKey child = key.createChildKey(q);
-        _modelFactory->createTileModel( child, _frame, accumulate, model[q], progress );
+        }
+
+        if ( !_quadrantService.valid() )
+        {
+            TileKey child = key.createChildKey(q);
+            _modelFactory->createTileModel( child, _frame, accumulate, model[q], progress );
+        }
 
         // if any one of the TileModel creations fail, we will be unable to build
         // this quadtile. So goodbye.
         if ( !model[q].valid() )
         {
             OE_DEBUG << LC << "Bailed on key " << key.str() << " due to a NULL model." << std::endl;
+            mergeStats( quadrantProgress, progress );
             return 0L;
         }
     }
 
+    double createTime = OE_STOP_TIMER(create_model);
+    Metrics::record( _createTime, (unsigned long long)(createTime * 1.0e6) );
     if (progress)
-        progress->stats()["create_tilemodel_time"] += OE_STOP_TIMER(create_model);
+        progress->stats()["create_tilemodel_time"] += createTime;
 
     bool makeTile;
 
@@ -339,7 +480,10 @@ SingleKeyNodeFactory::createNode(const TileKey&    key,
     }
     
     if ( progress && progress->isCanceled() )
+    {
+        mergeStats( quadrantProgress, progress );
         return 0L;
+    }
 
     OE_START_TIMER(compile_tile);
 
@@ -356,16 +500,38 @@ SingleKeyNodeFactory::createNode(const TileKey&    key,
             quad = new osg::Group();
         }
 
+        if ( _quadrantService.valid() )
+        {
+            for( unsigned q=0; q<4; ++q )
+                tasks[q]._compile = true;
+
+            runQuadrants( tasks );
+        }
+
         for( unsigned q=0; q<4; ++q )
         {
-            osg::ref_ptr<osg::Node> tile = createTile(model[q].get(), setupChildren, progress);
-            _tileNodeBroker->notifyOfTerrainTileNodeCreation( model[q]->_tileKey, tile.get() );
-            quad->addChild( tile.get() );
+            if ( !_quadrantService.valid() )
+            {
+                tiles[q] = createTile(model[q].get(), _modelCompilers[0].get(), setupChildren, progress);
+            }
+            else if ( !tiles[q].valid() )
+            {
+                // canceled while compiling.
+                mergeStats( quadrantProgress, progress );
+                return 0L;
+            }
+
+            _tileNodeBroker->notifyOfTerrainTileNodeCreation( model[q]->_tileKey, tiles[q].get() );
+            quad->addChild( tiles[q].get() );
         }
     }
 
+    double compileTime = OE_STOP_TIMER(compile_tile);
+    Metrics::record( _compileTime, (unsigned long long)(compileTime * 1.0e6) );
     if (progress)
-        progress->stats()["compile_tilemodel_time"] += OE_STOP_TIMER(compile_tile);
+        progress->stats()["compile_tilemodel_time"] += compileTime;
+
+    mergeStats( quadrantProgress, progress );
 
     return quad.release();
 }
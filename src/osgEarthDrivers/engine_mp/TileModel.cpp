@@ -82,14 +82,28 @@ TileModel::ElevationData::getNormal(const osg::Vec3d&      ndc,
         return false;
     }
 
+    osg::Vec3d hf_ndc;
+    GeoLocator::convertLocalCoordBetween( *ndcLocator, ndc, *_locator.get(), hf_ndc );
+
+    return getNormalAtLocalCoord( hf_ndc, output, interp );
+}
+
+bool
+TileModel::ElevationData::getNormalAtLocalCoord(const osg::Vec3d&      hf_ndc,
+                                                osg::Vec3&             output,
+                                                ElevationInterpolation interp ) const
+{
+    if ( !_locator.valid() )
+    {
+        output.set(0,0,1);
+        return false;
+    }
+
     double xcells = (double)(_hf->getNumColumns()-1);
     double ycells = (double)(_hf->getNumRows()-1);
     double xres = 1.0/xcells;
     double yres = 1.0/ycells;
 
-    osg::Vec3d hf_ndc;
-    GeoLocator::convertLocalCoordBetween( *ndcLocator, ndc, *_locator.get(), hf_ndc );
-
     float centerHeight = HeightFieldUtils::getHeightAtNormalizedLocation(_hf.get(), hf_ndc.x(), hf_ndc.y(), interp);
 
     osg::Vec3d west ( hf_ndc.x()-xres, hf_ndc.y(), 0.0 );
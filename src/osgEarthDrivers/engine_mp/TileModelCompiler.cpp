@@ -18,6 +18,7 @@
 */
 #include "TileModelCompiler"
 #include "MPGeometry"
+#include "TopologyCache"
 
 #include <osgEarth/Locators>
 #include <osgEarth/Registry>
@@ -28,6 +29,7 @@
 #include <osgEarth/Utils>
 #include <osgEarth/ECEF>
 #include <osgEarth/ObjectIndex>
+#include <osgEarth/Profiler>
 #include <osgEarthSymbology/Geometry>
 #include <osgEarthSymbology/MeshConsolidator>
 
@@ -112,18 +114,98 @@ namespace
     typedef std::vector<MaskRecord> MaskRecordVector;
     typedef std::vector<int> Indices;
 
+    /**
+     * Maps the unit (NDC) space of one locator into that of another, for
+     * locators that differ only by a scale and an offset on each axis.
+     */
+    struct NDCTransform
+    {
+        double _sx, _sy, _tx, _ty;
+
+        void apply( const osg::Vec3d& in, osg::Vec3d& out ) const
+        {
+            out.set( in.x()*_sx + _tx, in.y()*_sy + _ty, in.z() );
+        }
+    };
+
+}
+
+namespace osgEarth { namespace Drivers { namespace MPTerrainEngine
+{
+    /**
+     * Temporary buffers for tile compilation. Each compiler (and so each thread)
+     * has its own, and they keep their capacity from one tile to the next; once
+     * they have grown to fit the largest tile, compiling a tile only allocates
+     * the arrays that go into the scene graph.
+     */
+    struct CompilerScratch
+    {
+        CompilerScratch() : _numAllocations( 0u ) { }
+
+        RenderLayerVector         _renderLayers;
+        MaskRecordVector          _maskRecords;
+        Indices                   _indices;
+        std::vector<float>        _elevations;
+        std::vector<double>       _sinLon, _cosLon, _sinLat, _cosLat, _primeVertical;
+        std::vector<NDCTransform> _texTransforms;
+        std::vector<int>          _texModes;
+        std::vector<osg::Vec3>    _boundaryVerts;
+        std::vector<float>        _boundaryElevations;
+
+        // number of times a buffer had to grow during the current tile
+        unsigned                  _numAllocations;
+
+        // empties a buffer, making room for "size" elements.
+        template<typename T>
+        void reset( std::vector<T>& buffer, unsigned size )
+        {
+            buffer.clear();
+            if ( buffer.capacity() < size )
+            {
+                buffer.reserve( size );
+                ++_numAllocations;
+            }
+        }
+
+        // fills a buffer with "size" copies of "value".
+        template<typename T>
+        void assign( std::vector<T>& buffer, unsigned size, const T& value )
+        {
+            if ( buffer.capacity() < size )
+                ++_numAllocations;
+            buffer.assign( size, value );
+        }
+
+        // starts a new tile, dropping the references held for the last one.
+        void clear()
+        {
+            _renderLayers.clear();
+            _maskRecords.clear();
+            _numAllocations = 0u;
+        }
+    };
+} } }
+
+namespace
+{
 
     struct Data
     {
         Data(const TileModel* in_model, 
              const MapFrame&  in_frame,
              const MaskLayerVector& in_maskLayers,
-             const ModelLayerVector& in_modelLayers)
+             const ModelLayerVector& in_modelLayers,
+             CompilerScratch& in_scratch)
 
             : model     ( in_model ), 
               frame     ( in_frame ),
               maskLayers( in_maskLayers ),
-              modelLayers( in_modelLayers )
+              modelLayers( in_modelLayers ),
+              scratch   ( in_scratch ),
+              renderLayers( in_scratch._renderLayers ),
+              elevations( &in_scratch._elevations ),
+              indices   ( in_scratch._indices ),
+              maskRecords( in_scratch._maskRecords )
         {
             surfaceGeode     = 0L;
             surface          = 0L;
@@ -138,6 +220,8 @@ namespace
             ownsTileCoords   = false;
             stitchTileCoords = 0L;
             installParentData = false;
+            topologies       = 0L;
+            sharedTopology   = false;
         }
 
         osg::Matrixd local2world, world2local;
@@ -155,8 +239,9 @@ namespace
         const ModelLayerVector&  modelLayers;                   // model layers with masks set
         osg::ref_ptr<GeoLocator> geoLocator;                    // tile locator adjusted to geographic
         osg::Vec3d               centerModel;                   // tile center in model (world) coords
+        CompilerScratch&         scratch;                       // the compiler's temporary buffers
 
-        RenderLayerVector            renderLayers;
+        RenderLayerVector&           renderLayers;
         osg::ref_ptr<osg::Vec2Array> renderTileCoords;
         bool                         ownsTileCoords;
 
@@ -171,10 +256,14 @@ namespace
         osg::Vec4Array*               surfaceAttribs;
         osg::Vec4Array*               surfaceAttribs2;
         unsigned                      numVerticesInSurface;
-        osg::ref_ptr<osg::FloatArray> elevations;
-        Indices                       indices;
+        std::vector<float>*           elevations;
+        Indices&                      indices;
         osg::BoundingSphere           surfaceBound;
 
+        // shared triangle indices for complete grids:
+        TopologyCache*                topologies;
+        bool                          sharedTopology;
+
         // skirt data:
         unsigned                 numVerticesInSkirt;
         bool                     createSkirt;
@@ -190,7 +279,7 @@ namespace
         unsigned                 originalNumCols;
         
         // for masking/stitching:
-        MaskRecordVector         maskRecords;
+        MaskRecordVector&        maskRecords;
         //MPGeometry*              stitchGeom;
 
         bool useUInt;
@@ -260,6 +349,8 @@ namespace
      */
     void setupMaskRecords(Data& d)
     {
+        d.scratch.reset( d.maskRecords, d.maskLayers.size() + d.modelLayers.size() );
+
         // When displaying Plate Carre, Heights have to be converted from meters to degrees.
         // This is also true for mask feature
         // TODO: adjust this calculation based on the actual EllipsoidModel.
@@ -365,9 +456,8 @@ namespace
         d.surface->setVertexAttribNormalize( osg::Drawable::ATTRIBUTE_7, false );
         
         // temporary data structures for triangulation support
-        d.elevations = new osg::FloatArray();
-        d.elevations->reserve( d.numVerticesInSurface );
-        d.indices.resize( d.numVerticesInSurface, -1 );
+        d.scratch.reset( *d.elevations, d.numVerticesInSurface );
+        d.scratch.assign( d.indices, d.numVerticesInSurface, -1 );
 
         // Uint required?
         d.useUInt = d.numVerticesInSurface > 0xFFFF;
@@ -381,7 +471,7 @@ namespace
     {
         // Any color entries that have the same Locator will share a texcoord
         // array, saving on memory.
-        d.renderLayers.reserve( d.model->_colorData.size() );
+        d.scratch.reset( d.renderLayers, d.model->_colorData.size() );
 
         if ( d.maskRecords.size() > 0 )
         {
@@ -516,11 +606,304 @@ namespace
     }
 
 
+    /**
+     * Solves the NDC transform between two linear locators from the corners of
+     * the unit square, and checks it against the exact conversion at interior
+     * points. Fails if the locators are not linearly related.
+     */
+    bool solveNDCTransform( const GeoLocator* from, const GeoLocator* to, NDCTransform& out )
+    {
+        if ( !from || !to || !from->isLinear() || !to->isLinear() )
+            return false;
+
+        osg::Vec3d a, b;
+        if ( !osgTerrain::Locator::convertLocalCoordBetween( *from, osg::Vec3d(0,0,0), *to, a ) ||
+             !osgTerrain::Locator::convertLocalCoordBetween( *from, osg::Vec3d(1,1,0), *to, b ) )
+        {
+            return false;
+        }
+
+        out._tx = a.x();
+        out._ty = a.y();
+        out._sx = b.x() - a.x();
+        out._sy = b.y() - a.y();
+
+        const double probes[3][2] = { {0.25, 0.75}, {0.75, 0.25}, {0.5, 0.5} };
+        for( unsigned p=0; p<3; ++p )
+        {
+            osg::Vec3d ndc( probes[p][0], probes[p][1], 0.0 ), exact, fast;
+            if ( !osgTerrain::Locator::convertLocalCoordBetween( *from, ndc, *to, exact ) )
+                return false;
+
+            out.apply( ndc, fast );
+            if ( !osg::equivalent(exact.x(), fast.x(), MATCH_TOLERANCE) ||
+                 !osg::equivalent(exact.y(), fast.y(), MATCH_TOLERANCE) )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Samples an elevation data set at NDC coordinates of the tile locator.
+     * When the locators are linearly related, the sample location comes from
+     * a precomputed transform; otherwise every sample goes through the locators.
+     */
+    struct ElevationSampler
+    {
+        ElevationSampler( const TileModel::ElevationData& data, const GeoLocator* ndcLocator )
+            : _data( data ), _ndcLocator( ndcLocator )
+        {
+            _linear =
+                data.getHeightField() != 0L &&
+                solveNDCTransform( ndcLocator, data.getLocator(), _xform );
+        }
+
+        bool getHeight( const osg::Vec3d& ndc, float& output ) const
+        {
+            if ( !_linear )
+                return _data.getHeight( ndc, _ndcLocator, output, INTERP_TRIANGULATE );
+
+            osg::Vec3d hf_ndc;
+            _xform.apply( ndc, hf_ndc );
+            output = HeightFieldUtils::getHeightAtNormalizedLocation( _data.getHeightField(), hf_ndc.x(), hf_ndc.y(), INTERP_TRIANGULATE );
+            return true;
+        }
+
+        bool getNormal( const osg::Vec3d& ndc, osg::Vec3& output ) const
+        {
+            if ( !_linear )
+                return _data.getNormal( ndc, _ndcLocator, output, INTERP_TRIANGULATE );
+
+            osg::Vec3d hf_ndc;
+            _xform.apply( ndc, hf_ndc );
+            return _data.getNormalAtLocalCoord( hf_ndc, output, INTERP_TRIANGULATE );
+        }
+
+        const TileModel::ElevationData& _data;
+        const GeoLocator*               _ndcLocator;
+        NDCTransform                    _xform;
+        bool                            _linear;
+    };
+
+
+    /**
+     * Builds the surface vertices and normals of a geocentric tile without
+     * going through the locators for each vertex. The longitude of a vertex
+     * depends only on its column and the latitude only on its row, so the
+     * trigonometry (and the ellipsoid's prime vertical radius) is computed
+     * once per row and once per column. Layer texture coordinates and the
+     * heightfield sample locations come from NDC transforms when the locators
+     * are linearly related.
+     *
+     * Returns false without touching the tile if it doesn't qualify (e.g. it
+     * has masks or a non-linear or rotated locator); the caller then builds
+     * the surface the general way.
+     */
+    bool createGeocentricSurfaceGeometry( Data& d )
+    {
+        const GeoLocator* locator = d.model->_tileLocator.get();
+        if ( !d.maskRecords.empty() ||
+             locator->getCoordinateSystemType() != GeoLocator::GEOCENTRIC ||
+             !locator->isLinear() ||
+             !locator->getEllipsoidModel() )
+        {
+            return false;
+        }
+
+        // the locator maps NDC to (lon, lat, height) in radians and meters.
+        const osg::Matrixd& t = locator->getTransform();
+        if ( t(0,1) != 0.0 || t(0,2) != 0.0 || t(1,0) != 0.0 || t(1,2) != 0.0 || t(2,0) != 0.0 || t(2,1) != 0.0 )
+        {
+            return false;
+        }
+
+        const osg::EllipsoidModel* ellipsoid = locator->getEllipsoidModel();
+        double a  = ellipsoid->getRadiusEquator();
+        double b  = ellipsoid->getRadiusPolar();
+        double e2 = 1.0 - (b*b)/(a*a);
+
+        // per-column longitude and per-row latitude tables:
+        std::vector<double>& sinLon = d.scratch._sinLon;
+        std::vector<double>& cosLon = d.scratch._cosLon;
+        d.scratch.assign( sinLon, d.numCols, 0.0 );
+        d.scratch.assign( cosLon, d.numCols, 0.0 );
+        for(unsigned i=0; i < d.numCols; ++i)
+        {
+            double lon = ((double)i/(double)(d.numCols-1)) * t(0,0) + t(3,0);
+            sinLon[i] = sin(lon);
+            cosLon[i] = cos(lon);
+        }
+
+        std::vector<double>& sinLat = d.scratch._sinLat;
+        std::vector<double>& cosLat = d.scratch._cosLat;
+        std::vector<double>& primeVertical = d.scratch._primeVertical;
+        d.scratch.assign( sinLat, d.numRows, 0.0 );
+        d.scratch.assign( cosLat, d.numRows, 0.0 );
+        d.scratch.assign( primeVertical, d.numRows, 0.0 );
+        for(unsigned j=0; j < d.numRows; ++j)
+        {
+            double lat = ((double)j/(double)(d.numRows-1)) * t(1,1) + t(3,1);
+            sinLat[j] = sin(lat);
+            cosLat[j] = cos(lat);
+            primeVertical[j] = a / sqrt(1.0 - e2*sinLat[j]*sinLat[j]);
+        }
+
+        // make sure the tables agree with the locator before building anything.
+        for(unsigned c=0; c<5; ++c)
+        {
+            unsigned i = c == 4 ? d.numCols/2 : (c&1) * (d.numCols-1);
+            unsigned j = c == 4 ? d.numRows/2 : (c>>1) * (d.numRows-1);
+            osg::Vec3d ndc( (double)i/(double)(d.numCols-1), (double)j/(double)(d.numRows-1), 1000.0 );
+
+            osg::Vec3d exact;
+            locator->unitToModel( ndc, exact );
+
+            double h = ndc.z() * t(2,2) + t(3,2);
+            double n = primeVertical[j];
+            osg::Vec3d fast(
+                (n + h) * cosLat[j] * cosLon[i],
+                (n + h) * cosLat[j] * sinLon[i],
+                (n*(1.0-e2) + h) * sinLat[j] );
+
+            if ( (exact - fast).length() > 0.001 )
+                return false;
+        }
+
+        // NDC transforms for the layers that need their own texture coordinates:
+        std::vector<NDCTransform>& texXforms = d.scratch._texTransforms;
+        std::vector<int>&          texMode   = d.scratch._texModes; // 0=tile ndc, 1=transform, 2=locators
+        d.scratch.assign( texXforms, d.renderLayers.size(), NDCTransform() );
+        d.scratch.assign( texMode, d.renderLayers.size(), 0 );
+        for(unsigned r=0; r < d.renderLayers.size(); ++r)
+        {
+            const RenderLayer& layer = d.renderLayers[r];
+            if ( layer._ownsTexCoords && !layer._locator->isEquivalentTo( *d.geoLocator.get() ) )
+            {
+                texMode[r] = solveNDCTransform( d.geoLocator.get(), layer._locator.get(), texXforms[r] ) ? 1 : 2;
+            }
+        }
+
+        osg::HeightField* hf = d.model->_elevationData.getHeightField();
+        ElevationSampler elevation( d.model->_elevationData, locator );
+
+        // This only works if the tile size is an odd number in both directions.
+        bool useParent = d.model->_tileKey.getLOD() > 0 && (d.numCols&1) && (d.numRows&1) && d.parentModel.valid();
+        ElevationSampler parentElevation( useParent ? d.parentModel->_elevationData : d.model->_elevationData, locator );
+
+        for(unsigned j=0; j < d.numRows; ++j)
+        {
+            double n  = primeVertical[j];
+            double cl = cosLat[j];
+            double sl = sinLat[j];
+
+            for(unsigned i=0; i < d.numCols; ++i)
+            {
+                unsigned int iv = j*d.numCols + i;
+                osg::Vec3d ndc( ((double)i)/(double)(d.numCols-1), ((double)j)/(double)(d.numRows-1), 0.0);
+
+                // raw height:
+                float heightValue = 0.0f;
+                bool  validValue  = true;
+
+                if ( hf )
+                {
+                    validValue = elevation.getHeight( ndc, heightValue );
+                }
+
+                ndc.z() = heightValue * d.heightScale + d.heightOffset;
+
+                if ( !validValue )
+                {
+                    d.indices[iv] = -1;
+                    continue;
+                }
+
+                d.indices[iv] = d.surfaceVerts->size();
+
+                // geodetic to geocentric, using the row and column tables:
+                double h = ndc.z() * t(2,2) + t(3,2);
+                osg::Vec3d up( cl * cosLon[i], cl * sinLon[i], sl );
+                osg::Vec3d model( (n + h) * up.x(), (n + h) * up.y(), (n*(1.0-e2) + h) * sl );
+
+                osg::Vec3d modelLTP = model * d.world2local;
+                (*d.surfaceVerts).push_back(modelLTP);
+
+                // grow the bounding sphere:
+                d.surfaceBound.expandBy( (*d.surfaceVerts).back() );
+
+                // the separate texture space requires separate transformed texcoords for each layer.
+                for(unsigned r=0; r < d.renderLayers.size(); ++r)
+                {
+                    const RenderLayer& layer = d.renderLayers[r];
+                    if ( layer._ownsTexCoords )
+                    {
+                        osg::Vec3d color_ndc = ndc;
+                        if ( texMode[r] == 1 )
+                            texXforms[r].apply( ndc, color_ndc );
+                        else if ( texMode[r] == 2 )
+                            osgTerrain::Locator::convertLocalCoordBetween( *d.geoLocator.get(), ndc, *layer._locator.get(), color_ndc );
+
+                        layer._texCoords->push_back( osg::Vec2( color_ndc.x(), color_ndc.y() ) );
+                    }
+                }
+
+                if ( d.ownsTileCoords )
+                {
+                    d.renderTileCoords->push_back( osg::Vec2(ndc.x(), ndc.y()) );
+                }
+
+                // record the raw elevation value in our float array for later
+                (*d.elevations).push_back(ndc.z());
+
+                // the local normal (up vector) is the ellipsoid normal, which
+                // doesn't depend on the height.
+                osg::Vec3d model_up = osg::Matrixd::transform3x3( up, d.world2local );
+                model_up.normalize();
+                (*d.normals).push_back(model_up);
+
+                // Calculate and store the "old height", i.e the height value from
+                // the parent LOD.
+                float     oldHeightValue = heightValue;
+                osg::Vec3 oldNormal;
+
+                if ( useParent )
+                {
+                    parentElevation.getHeight( ndc, oldHeightValue );
+                    parentElevation.getNormal( ndc, oldNormal );
+                }
+                else
+                {
+                    elevation.getNormal( ndc, oldNormal );
+                }
+
+                // first attribute set has the unit extrusion vector and the
+                // raw height value.
+                (*d.surfaceAttribs).push_back( osg::Vec4f(
+                    model_up.x(),
+                    model_up.y(),
+                    model_up.z(),
+                    heightValue) );
+
+                // second attribute set has the old height value in "w"
+                (*d.surfaceAttribs2).push_back( osg::Vec4f(
+                    oldNormal.x(),
+                    oldNormal.y(),
+                    oldNormal.z(),
+                    oldHeightValue ) );
+            }
+        }
+
+        return true;
+    }
+
+
     /**
      * Iterate over the sampling grid and calculate the vertex positions and normals
      * for each sampling point.
      */
-    void createSurfaceGeometry( Data& d, bool debug )
+    void createSurfaceGeometry( Data& d, bool debug, bool fastSurface )
     {
         d.surfaceBound.init();
 
@@ -553,6 +936,12 @@ namespace
             }
         }
 
+        // geocentric tiles without masks have a much faster way:
+        if ( fastSurface && createGeocentricSurfaceGeometry(d) )
+        {
+            return;
+        }
+
 
         // populate vertex and tex coord arrays    
         for(unsigned j=0; j < d.numRows; ++j)
@@ -1142,11 +1531,16 @@ namespace
         }
 
         // Use the existing DrawElements on the surface so we merge the skirts and the surface together.
-        osg::ref_ptr<osg::DrawElements> elements = dynamic_cast< osg::DrawElements* >(d.surface->getPrimitiveSet(0));
-        if (!elements)
+        // Shared elements already include the skirts.
+        osg::ref_ptr<osg::DrawElements> elements;
+        if ( !d.sharedTopology )
         {
-            OE_WARN << LC << "Couldn't find existing DrawElements" << std::endl;
-            return;
+            elements = dynamic_cast< osg::DrawElements* >(d.surface->getPrimitiveSet(0));
+            if (!elements)
+            {
+                OE_WARN << LC << "Couldn't find existing DrawElements" << std::endl;
+                return;
+            }
         }
        
         int skirtIndex = 0;
@@ -1189,7 +1583,7 @@ namespace
                 d.renderTileCoords->push_back( tilec );
 
                 skirtIndex++;
-                if (skirtIndex > 1)
+                if (skirtIndex > 1 && elements.valid())
                 {
                     int prev_i = d.indices[c-1];
                     elements->addElement(prev_i);
@@ -1243,7 +1637,7 @@ namespace
                 d.renderTileCoords->push_back( tilec );
 
                 skirtIndex++;
-                if (skirtIndex > 1)
+                if (skirtIndex > 1 && elements.valid())
                 {
                     int prev_i = d.indices[(r-1)*d.numCols+(d.numCols-1)];
                     elements->addElement(prev_i);
@@ -1296,7 +1690,7 @@ namespace
                 d.renderTileCoords->push_back( tilec );
 
                 skirtIndex++;
-                if (skirtIndex > 1)
+                if (skirtIndex > 1 && elements.valid())
                 {
                     int prev_i = d.indices[(d.numRows - 1)*d.numCols + c + 1];
                     elements->addElement(prev_i);
@@ -1349,7 +1743,7 @@ namespace
                 d.renderTileCoords->push_back( tilec );
 
                 skirtIndex++;
-                if (skirtIndex > 1)
+                if (skirtIndex > 1 && elements.valid())
                 {
                     int prev_i = d.indices[(r + 1)*d.numCols];
                     elements->addElement(prev_i);
@@ -1366,6 +1760,48 @@ namespace
 
 
 
+    /**
+     * Whether all the cells of a complete grid pick the same diagonal when the
+     * triangles follow the slope of the terrain, and if so, which one.
+     */
+    bool getUniformDiagonal( const Data& d, bool swapOrientation, bool& out_flip )
+    {
+        for(unsigned j=0; j<d.numRows-1; ++j)
+        {
+            for(unsigned i=0; i<d.numCols-1; ++i)
+            {
+                // in a complete grid, vertex indices are grid indices.
+                int i00, i01;
+                if (swapOrientation)
+                {
+                    i01 = j*d.numCols + i;
+                    i00 = i01+d.numCols;
+                }
+                else
+                {
+                    i00 = j*d.numCols + i;
+                    i01 = i00+d.numCols;
+                }
+
+                int i10 = i00+1;
+                int i11 = i01+1;
+
+                float e00 = (*d.elevations)[i00];
+                float e10 = (*d.elevations)[i10];
+                float e01 = (*d.elevations)[i01];
+                float e11 = (*d.elevations)[i11];
+
+                bool flip = !(fabsf(e00-e11)<fabsf(e01-e10));
+                if ( i == 0 && j == 0 )
+                    out_flip = flip;
+                else if ( flip != out_flip )
+                    return false;
+            }
+        }
+        return true;
+    }
+
+
     /**
      * Builds triangles for the surface geometry, and recalculates the surface normals
      * to be optimized for slope.
@@ -1380,8 +1816,34 @@ namespace
 
         unsigned numSurfaceNormals = d.numRows * d.numCols;
 
-        osg::DrawElements* elements = d.newDrawElements(GL_TRIANGLES);
-        elements->reserveElements((d.numRows-1) * (d.numCols-1) * 6);
+        // a complete grid (no masks, no missing samples) can use shared triangles,
+        // as long as all its cells are split along the same diagonal.
+        osg::ref_ptr<osg::DrawElements> sharedElements;
+        if ( d.topologies && d.maskRecords.empty() && d.surfaceVerts->size() == numSurfaceNormals )
+        {
+            TopologyCache::Key key;
+            key._numCols         = d.numCols;
+            key._numRows         = d.numRows;
+            key._skirt           = d.createSkirt;
+            key._swapOrientation = swapOrientation;
+            key._flipDiagonal    = false;
+
+            if ( !optimizeTriangleOrientation || getUniformDiagonal(d, swapOrientation, key._flipDiagonal) )
+            {
+                sharedElements = d.topologies->get( key );
+            }
+        }
+        d.sharedTopology = sharedElements.valid();
+
+        // make room for the skirts too, since they go into the same primitive set.
+        unsigned numSkirtElements = d.createSkirt ? 2 * ((d.numRows-1) + (d.numCols-1)) * 6 : 0;
+
+        osg::DrawElements* elements = 0L;
+        if ( !d.sharedTopology )
+        {
+            elements = d.newDrawElements(GL_TRIANGLES);
+            elements->reserveElements((d.numRows-1) * (d.numCols-1) * 6 + numSkirtElements);
+        }
 
         if ( recalcNormals )
         {
@@ -1457,13 +1919,16 @@ namespace
 
                         if (!optimizeTriangleOrientation || fabsf(e00-e11)<fabsf(e01-e10))
                         {
-                            elements->addElement(i01);
-                            elements->addElement(i00);
-                            elements->addElement(i11);
+                            if (elements)
+                            {
+                                elements->addElement(i01);
+                                elements->addElement(i00);
+                                elements->addElement(i11);
 
-                            elements->addElement(i00);
-                            elements->addElement(i10);
-                            elements->addElement(i11);
+                                elements->addElement(i00);
+                                elements->addElement(i10);
+                                elements->addElement(i11);
+                            }
 
                             if (recalcNormals)
                             {                        
@@ -1480,13 +1945,16 @@ namespace
                         }
                         else
                         {
-                            elements->addElement(i01);
-                            elements->addElement(i00);
-                            elements->addElement(i10);
+                            if (elements)
+                            {
+                                elements->addElement(i01);
+                                elements->addElement(i00);
+                                elements->addElement(i10);
 
-                            elements->addElement(i01);
-                            elements->addElement(i10);
-                            elements->addElement(i11);
+                                elements->addElement(i01);
+                                elements->addElement(i10);
+                                elements->addElement(i11);
+                            }
 
                             if (recalcNormals)
                             {                       
@@ -1518,11 +1986,11 @@ namespace
             osg::HeightField* n_neighbor  = d.model->_elevationData.getNeighbor( 0, -1 );
 
             // Utility arrays:
-            std::vector<osg::Vec3> boundaryVerts;
-            boundaryVerts.reserve( 2 * std::max(d.numRows, d.numCols) );
+            std::vector<osg::Vec3>& boundaryVerts = d.scratch._boundaryVerts;
+            d.scratch.reset( boundaryVerts, 2 * std::max(d.numRows, d.numCols) );
 
-            std::vector< float > boundaryElevations;
-            boundaryElevations.reserve( 2 * std::max(d.numRows, d.numCols) );
+            std::vector< float >& boundaryElevations = d.scratch._boundaryElevations;
+            d.scratch.reset( boundaryElevations, 2 * std::max(d.numRows, d.numCols) );
 
             //Recalculate the west side
             if (w_neighbor && w_neighbor->getNumColumns() == d.originalNumCols && w_neighbor->getNumRows() == d.originalNumRows)
@@ -1882,7 +2350,11 @@ namespace
         }
 
         // in the case of full-masking, this will be empty
-        if ( elements->getNumIndices() > 0 )
+        if ( d.sharedTopology )
+        {
+            d.surface->insertPrimitiveSet(0, sharedElements.get());
+        }
+        else if ( elements->getNumIndices() > 0 )
         {
             d.surface->insertPrimitiveSet(0, elements); // because we always want this first.
         }
@@ -2056,16 +2528,25 @@ TileModelCompiler::TileModelCompiler(const MaskLayerVector&              maskLay
                                      const ModelLayerVector&             modelLayers,
                                      int                                 texImageUnit,
                                      bool                                optimizeTriOrientation,
-                                     const MPTerrainEngineOptions& options) :
+                                     const MPTerrainEngineOptions& options,
+                                     TopologyCache*                      topologies) :
 _maskLayers            ( maskLayers ),
 _modelLayers           ( modelLayers ),
 _optimizeTriOrientation( optimizeTriOrientation ),
 _options               ( options ),
-_textureImageUnit      ( texImageUnit )
+_textureImageUnit      ( texImageUnit ),
+_topologies            ( topologies )
 {
     _debug =
         _options.debug() == true || 
         ::getenv("OSGEARTH_MP_DEBUG") != 0L;
+
+    _scratch = new CompilerScratch();
+}
+
+TileModelCompiler::~TileModelCompiler()
+{
+    delete _scratch;
 }
 
 
@@ -2074,10 +2555,13 @@ TileModelCompiler::compile(TileModel*        model,
                            const MapFrame&   frame,
                            ProgressCallback* progress)
 {
+    OE_PROFILING_ZONE("TileModelCompiler::compile");
 
     // Working data for the build.
-    Data d(model, frame, _maskLayers, _modelLayers);
+    _scratch->clear();
+    Data d(model, frame, _maskLayers, _modelLayers, *_scratch);
     d.textureImageUnit = _textureImageUnit;
+    d.topologies = _topologies.get();
 
     GeoPoint centroid;
     model->_tileKey.getExtent().getCentroid(centroid);
@@ -2118,7 +2602,7 @@ TileModelCompiler::compile(TileModel*        model,
     setupTextureAttributes( d, _cache );
 
     // calculate the vertex and normals for the surface geometry.
-    createSurfaceGeometry( d, _debug );
+    createSurfaceGeometry( d, _debug, *_options.fastSurface() );
 
     // build geometry for the masked areas, if applicable
     if ( d.maskRecords.size() > 0 )
@@ -2175,5 +2659,26 @@ TileModelCompiler::compile(TileModel*        model,
         tile->addChild( makeBBox(d) );
     }
 
+    // allocation stats: scratch buffers that had to grow for this tile, and
+    // the arrays built for the scene graph.
+    if ( progress )
+    {
+        unsigned numArrays = 4 + (d.ownsTileCoords ? 1 : 0) + (d.sharedTopology ? 0 : d.surface->getNumPrimitiveSets());
+        for( RenderLayerVector::const_iterator r = d.renderLayers.begin(); r != d.renderLayers.end(); ++r )
+        {
+            if ( r->_ownsTexCoords )
+                ++numArrays;
+        }
+
+        progress->stats()["compile_scratch_allocs"] += _scratch->_numAllocations;
+        progress->stats()["compile_array_allocs"]   += numArrays;
+
+        if ( d.sharedTopology )
+            progress->stats()["compile_shared_topology"] += 1.0;
+    }
+
+    // release the layer data referenced by the scratch buffers.
+    _scratch->clear();
+
     return tile;
 }
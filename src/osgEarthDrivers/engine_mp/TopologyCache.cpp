@@ -0,0 +1,165 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2014 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "TopologyCache"
+#include <osgEarth/Notify>
+#include <osg/BufferObject>
+#include <vector>
+
+using namespace osgEarth::Drivers::MPTerrainEngine;
+using namespace osgEarth;
+
+#define LC "[MP.TopologyCache] "
+
+
+bool
+TopologyCache::Key::operator < (const TopologyCache::Key& rhs) const
+{
+    if ( _numCols < rhs._numCols ) return true;
+    if ( _numCols > rhs._numCols ) return false;
+    if ( _numRows < rhs._numRows ) return true;
+    if ( _numRows > rhs._numRows ) return false;
+    if ( _skirt != rhs._skirt ) return !_skirt;
+    if ( _swapOrientation != rhs._swapOrientation ) return !_swapOrientation;
+    return !_flipDiagonal && rhs._flipDiagonal;
+}
+
+TopologyCache::TopologyCache()
+{
+    //nop
+}
+
+osg::DrawElements*
+TopologyCache::get(const TopologyCache::Key& key)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    osg::ref_ptr<osg::DrawElements>& elements = _elements[key];
+    if ( !elements.valid() )
+    {
+        elements = build( key );
+        OE_DEBUG << LC << "Built topology for " << key._numCols << "x" << key._numRows << " grid" << std::endl;
+    }
+    return elements.get();
+}
+
+unsigned
+TopologyCache::size() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return _elements.size();
+}
+
+osg::DrawElements*
+TopologyCache::build(const TopologyCache::Key& key) const
+{
+    unsigned cols = key._numCols, rows = key._numRows;
+
+    // same vertex layout as the TileModelCompiler: the grid, row by row, then
+    // the skirt vertices in bottom, right, top, left order.
+    unsigned numSurfaceVerts = cols * rows;
+    unsigned numSkirtVerts   = key._skirt ? 2 * (cols + rows) : 0;
+
+    // same index type as the compiler would choose for the tile.
+    osg::DrawElements* elements;
+    if ( numSurfaceVerts + (key._skirt ? 2 * (cols*2 + rows*2 - 4) : 0) > 0xFFFF )
+        elements = new osg::DrawElementsUInt( GL_TRIANGLES );
+    else
+        elements = new osg::DrawElementsUShort( GL_TRIANGLES );
+
+    elements->setName( "TMC" );
+    elements->reserveElements( (rows-1) * (cols-1) * 6 + (key._skirt ? 2 * ((rows-1) + (cols-1)) * 6 : 0) );
+
+    for(unsigned j=0; j<rows-1; ++j)
+    {
+        for(unsigned i=0; i<cols-1; ++i)
+        {
+            unsigned i00, i01;
+            if ( key._swapOrientation )
+            {
+                i01 = j*cols + i;
+                i00 = i01 + cols;
+            }
+            else
+            {
+                i00 = j*cols + i;
+                i01 = i00 + cols;
+            }
+
+            unsigned i10 = i00+1;
+            unsigned i11 = i01+1;
+
+            if ( !key._flipDiagonal )
+            {
+                elements->addElement(i01);
+                elements->addElement(i00);
+                elements->addElement(i11);
+
+                elements->addElement(i00);
+                elements->addElement(i10);
+                elements->addElement(i11);
+            }
+            else
+            {
+                elements->addElement(i01);
+                elements->addElement(i00);
+                elements->addElement(i10);
+
+                elements->addElement(i01);
+                elements->addElement(i10);
+                elements->addElement(i11);
+            }
+        }
+    }
+
+    if ( key._skirt )
+    {
+        // surface vertices along each edge, in the order the skirt walks them:
+        std::vector<unsigned> edge;
+        edge.reserve( numSkirtVerts );
+        for(unsigned c=0; c<cols; ++c)       edge.push_back( c );                      // bottom
+        for(unsigned r=0; r<rows; ++r)       edge.push_back( r*cols + (cols-1) );      // right
+        for(int c=(int)cols-1; c>=0; --c)    edge.push_back( (rows-1)*cols + c );      // top
+        for(int r=(int)rows-1; r>=0; --r)    edge.push_back( r*cols );                 // left
+
+        // each edge starts a new strip; the skirt vertex k hangs below edge[k].
+        unsigned starts[4] = { 0, cols, cols+rows, 2*cols+rows };
+        for(unsigned k=1; k<edge.size(); ++k)
+        {
+            if ( k == starts[1] || k == starts[2] || k == starts[3] )
+                continue;
+
+            unsigned skirtPrev = numSurfaceVerts + k - 1;
+            unsigned skirtThis = numSurfaceVerts + k;
+
+            elements->addElement(edge[k-1]);
+            elements->addElement(skirtPrev);
+            elements->addElement(edge[k]);
+
+            elements->addElement(skirtThis);
+            elements->addElement(edge[k]);
+            elements->addElement(skirtPrev);
+        }
+    }
+
+    // the elements are shared by many geometries; give them their own
+    // buffer object so no geometry ever assigns one of its own.
+    elements->setElementBufferObject( new osg::ElementBufferObject() );
+
+    return elements;
+}
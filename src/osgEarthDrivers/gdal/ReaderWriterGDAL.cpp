@@ -23,6 +23,7 @@
 #include <osgEarth/ImageUtils>
 #include <osgEarth/URI>
 #include <osgEarth/HeightFieldUtils>
+#include <osgEarth/ThreadingUtils>
 
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -31,6 +32,8 @@
 #include <osgDB/WriteFile>
 #include <osgDB/ImageOptions>
 
+#include <OpenThreads/Condition>
+
 #include <sstream>
 #include <stdlib.h>
 #include <memory.h>
@@ -620,6 +623,174 @@ GDALDatasetH GDALAutoCreateWarpedVRTforPolarStereographic(
 }
 
 
+/**
+ * Bounded pool of dataset handles for one GDAL tile source. Each handle is an
+ * independently opened copy of the source dataset (with its own warping VRT if
+ * the source needs one) and serves one thread at a time, so threads can read
+ * tiles in parallel without holding the global GDAL lock. Handles are opened
+ * on demand and closed under the global lock.
+ */
+class GDALDatasetPool : public osg::Referenced
+{
+public:
+    struct Handle
+    {
+        GDALDataset* _srcDS;
+        GDALDataset* _warpedDS;
+        unsigned     _lastThread;
+    };
+
+    /** What it takes to open another handle on the source. */
+    struct OpenParams
+    {
+        OpenParams() : _warp(false), _polar(false) { }
+        std::string _name;    // file name, subdataset name or VRT XML, as passed to GDALOpen
+        bool        _warp;    // whether to create a warping VRT
+        bool        _polar;   // whether that warp is polar stereographic to geographic
+        std::string _srcWKT;
+        std::string _destWKT;
+    };
+
+    GDALDatasetPool(const OpenParams& params, unsigned maxHandles) :
+        _params    ( params ),
+        _maxHandles( maxHandles ),
+        _numOpen   ( 0u )
+    {
+    }
+
+    /**
+     * Checks out a handle for the calling thread, preferring the one it used
+     * last (its blocks are likely still in GDAL's cache). Waits if all the
+     * handles are in use. Returns NULL if no handle could be opened at all.
+     */
+    Handle* acquire()
+    {
+        unsigned threadId = osgEarth::Threading::getCurrentThreadId();
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            for( ; ; )
+            {
+                if ( !_free.empty() )
+                {
+                    for(unsigned i=0; i<_free.size()-1; ++i)
+                    {
+                        if ( _free[i]->_lastThread == threadId )
+                        {
+                            std::swap( _free[i], _free.back() );
+                            break;
+                        }
+                    }
+                    Handle* handle = _free.back();
+                    _free.pop_back();
+                    handle->_lastThread = threadId;
+                    return handle;
+                }
+
+                if ( _numOpen < _maxHandles )
+                {
+                    // reserve a slot, and open the handle outside the pool lock.
+                    ++_numOpen;
+                    break;
+                }
+
+                if ( _numOpen == 0u )
+                {
+                    // opening failed before, and there is nothing to wait for.
+                    return 0L;
+                }
+
+                _handleReleased.wait( &_mutex );
+            }
+        }
+
+        Handle* handle = open();
+
+        if ( !handle )
+        {
+            // Stop trying to grow the pool; any waiters go back to the open handles.
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            --_numOpen;
+            _maxHandles = _numOpen;
+            _handleReleased.broadcast();
+            return 0L;
+        }
+
+        handle->_lastThread = threadId;
+        return handle;
+    }
+
+    /** Returns a handle to the pool. */
+    void release(Handle* handle)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        _free.push_back( handle );
+        _handleReleased.signal();
+    }
+
+protected:
+    virtual ~GDALDatasetPool()
+    {
+        GDAL_SCOPED_LOCK;
+
+        for(unsigned i=0; i<_free.size(); ++i)
+        {
+            if ( _free[i]->_warpedDS != _free[i]->_srcDS )
+                GDALClose( _free[i]->_warpedDS );
+            GDALClose( _free[i]->_srcDS );
+            delete _free[i];
+        }
+    }
+
+    Handle* open()
+    {
+        GDAL_SCOPED_LOCK;
+
+        GDALDataset* srcDS = (GDALDataset*)GDALOpen( _params._name.c_str(), GA_ReadOnly );
+        if ( !srcDS )
+        {
+            OE_WARN << LC << "Failed to open another dataset handle" << std::endl;
+            return 0L;
+        }
+
+        GDALDataset* warpedDS = srcDS;
+        if ( _params._warp )
+        {
+            if ( _params._polar )
+            {
+                warpedDS = (GDALDataset*)GDALAutoCreateWarpedVRTforPolarStereographic(
+                    srcDS, _params._srcWKT.c_str(), _params._destWKT.c_str(), GRA_NearestNeighbour, 5.0, NULL);
+            }
+            else
+            {
+                warpedDS = (GDALDataset*)GDALAutoCreateWarpedVRT(
+                    srcDS, _params._srcWKT.c_str(), _params._destWKT.c_str(), GRA_NearestNeighbour, 5.0, 0);
+            }
+
+            if ( !warpedDS )
+            {
+                OE_WARN << LC << "Failed to create a warping VRT for another dataset handle" << std::endl;
+                GDALClose( srcDS );
+                return 0L;
+            }
+        }
+
+        Handle* handle = new Handle();
+        handle->_srcDS      = srcDS;
+        handle->_warpedDS   = warpedDS;
+        handle->_lastThread = 0u;
+        return handle;
+    }
+
+private:
+    OpenParams            _params;
+    unsigned              _maxHandles;
+    unsigned              _numOpen;
+    std::vector<Handle*>  _free;
+    OpenThreads::Mutex    _mutex;
+    OpenThreads::Condition _handleReleased;
+};
+
+
 class GDALTileSource : public TileSource
 {
 public:
@@ -675,6 +846,9 @@ public:
 
         Cache* cache = 0;
 
+        // how to open more handles on the dataset, for the handle pool:
+        GDALDatasetPool::OpenParams poolParams;
+
         _dbOptions = Registry::instance()->cloneOrCreateOptions( dbOptions );
 
         if ( _dbOptions.valid() )
@@ -833,12 +1007,18 @@ public:
                         return Status::Error( "Failed to build VRT from input datasets" );
                     }
                 }
+
+                // More handles on the combined dataset open straight from its XML.
+                char** vrtXML = _srcDS->GetMetadata( "xml:VRT" );
+                if ( vrtXML && vrtXML[0] )
+                    poolParams._name = vrtXML[0];
             }
             else
             {
                 //If we couldn't build a VRT, just try opening the file directly
                 //Open the dataset
                 _srcDS = (GDALDataset*)GDALOpen( files[0].c_str(), GA_ReadOnly );
+                poolParams._name = files[0];
 
                 if (_srcDS)
                 {
@@ -856,6 +1036,7 @@ public:
                         char *pszSubdatasetName = CPLStrdup( CSLFetchNameValue( subDatasets, buf.str().c_str() ) );
                         GDALClose( _srcDS );
                         _srcDS = (GDALDataset*)GDALOpen( pszSubdatasetName, GA_ReadOnly ) ;
+                        poolParams._name = pszSubdatasetName;
                         CPLFree( pszSubdatasetName );
                     }
                 }
@@ -993,6 +1174,9 @@ public:
                     GRA_NearestNeighbour,
                     5.0,
                     NULL);
+
+                poolParams._polar   = true;
+                poolParams._destWKT = profile->getSRS()->getWKT();
             }
             else
             {
@@ -1004,8 +1188,13 @@ public:
                     GRA_NearestNeighbour,
                     5.0,
                     0);
+
+                poolParams._destWKT = destWKT;
             }
 
+            poolParams._warp   = true;
+            poolParams._srcWKT = src_srs->getWKT();
+
             if ( _warpedDS )
             {
                 warpedSRSWKT = _warpedDS->GetProjectionRef();
@@ -1140,6 +1329,21 @@ public:
         setProfile( profile );
         OE_DEBUG << LC << INDENT << "Set Profile to " << (profile ? profile->toString() : "NULL") <<  std::endl;
 
+        // Set up the dataset handle pool, if requested:
+        if ( _options.maxDatasetHandles().isSet() && _options.maxDatasetHandles().value() > 0u )
+        {
+            if ( !poolParams._name.empty() )
+            {
+                _pool = new GDALDatasetPool( poolParams, _options.maxDatasetHandles().value() );
+                OE_INFO << LC << INDENT << "Reading through up to " << _options.maxDatasetHandles().value()
+                    << " dataset handles" << std::endl;
+            }
+            else
+            {
+                OE_INFO << LC << INDENT << "Dataset cannot be reopened; max_dataset_handles ignored" << std::endl;
+            }
+        }
+
         return STATUS_OK;
     }
 
@@ -1149,8 +1353,6 @@ public:
     */
     static GDALRasterBand* findBandByColorInterp(GDALDataset *ds, GDALColorInterp colorInterp)
     {
-        GDAL_SCOPED_LOCK;
-
         for (int i = 1; i <= ds->GetRasterCount(); ++i)
         {
             if (ds->GetRasterBand(i)->GetColorInterpretation() == colorInterp) return ds->GetRasterBand(i);
@@ -1160,8 +1362,6 @@ public:
 
     static GDALRasterBand* findBandByDataType(GDALDataset *ds, GDALDataType dataType)
     {
-        GDAL_SCOPED_LOCK;
-
         for (int i = 1; i <= ds->GetRasterCount(); ++i)
         {
             if (ds->GetRasterBand(i)->GetRasterDataType() == dataType) return ds->GetRasterBand(i);
@@ -1253,7 +1453,11 @@ public:
         geoY = _geotransform[3] + _geotransform[4] * x + _geotransform[5] * y;
     }
 
-    void geoToPixel(double geoX, double geoY, double &x, double &y)
+    /**
+     * Converts to pixel coordinates in a raster of the given size; with the
+     * handle pool, the raster read may not be _warpedDS.
+     */
+    void geoToPixel(double geoX, double geoY, double &x, double &y, int rasterWidth, int rasterHeight)
     {
         x = _invtransform[0] + _invtransform[1] * geoX + _invtransform[2] * geoY;
         y = _invtransform[3] + _invtransform[4] * geoX + _invtransform[5] * geoY;
@@ -1262,8 +1466,8 @@ public:
         double eps = 0.0001;
         if (osg::equivalent(x, 0, eps)) x = 0;
         if (osg::equivalent(y, 0, eps)) y = 0;
-        if (osg::equivalent(x, (double)_warpedDS->GetRasterXSize(), eps)) x = _warpedDS->GetRasterXSize();
-        if (osg::equivalent(y, (double)_warpedDS->GetRasterYSize(), eps)) y = _warpedDS->GetRasterYSize();
+        if (osg::equivalent(x, (double)rasterWidth, eps)) x = rasterWidth;
+        if (osg::equivalent(y, (double)rasterHeight, eps)) y = rasterHeight;
 
     }
 
@@ -1277,7 +1481,8 @@ public:
             return NULL;
         }
 
-        GDAL_SCOPED_LOCK;
+        ScopedDataset dataset( this );
+        GDALDataset* warpedDS = dataset.get();
 
         int tileSize = _options.tileSize().value();
 
@@ -1293,9 +1498,12 @@ public:
 
             // Determine the read window
             double src_min_x, src_min_y, src_max_x, src_max_y;
+            int rasterWidth = warpedDS->GetRasterXSize();
+            int rasterHeight = warpedDS->GetRasterYSize();
+
             // Get the pixel coordiantes of the intersection
-            geoToPixel( intersection.xMin(), intersection.yMax(), src_min_x, src_min_y);
-            geoToPixel( intersection.xMax(), intersection.yMin(), src_max_x, src_max_y);
+            geoToPixel( intersection.xMin(), intersection.yMax(), src_min_x, src_min_y, rasterWidth, rasterHeight);
+            geoToPixel( intersection.xMax(), intersection.yMin(), src_max_x, src_max_y, rasterWidth, rasterHeight);
 
             // Convert the doubles to integers.  We floor the mins and ceil the maximums to give the widest window possible.
             src_min_x = floor(src_min_x);
@@ -1308,9 +1516,6 @@ public:
             int width  = (int)(src_max_x - src_min_x);
             int height = (int)(src_max_y - src_min_y);
 
-
-            int rasterWidth = _warpedDS->GetRasterXSize();
-            int rasterHeight = _warpedDS->GetRasterYSize();
             if (off_x + width > rasterWidth || off_y + height > rasterHeight)
             {
                 OE_WARN << LC << "Read window outside of bounds of dataset.  Source Dimensions=" << rasterWidth << "x" << rasterHeight << " Read Window=" << off_x << ", " << off_y << " " << width << "x" << height << std::endl;
@@ -1344,44 +1549,44 @@ public:
 
 
 
-            GDALRasterBand* bandRed = findBandByColorInterp(_warpedDS, GCI_RedBand);
-            GDALRasterBand* bandGreen = findBandByColorInterp(_warpedDS, GCI_GreenBand);
-            GDALRasterBand* bandBlue = findBandByColorInterp(_warpedDS, GCI_BlueBand);
-            GDALRasterBand* bandAlpha = findBandByColorInterp(_warpedDS, GCI_AlphaBand);
+            GDALRasterBand* bandRed = findBandByColorInterp(warpedDS, GCI_RedBand);
+            GDALRasterBand* bandGreen = findBandByColorInterp(warpedDS, GCI_GreenBand);
+            GDALRasterBand* bandBlue = findBandByColorInterp(warpedDS, GCI_BlueBand);
+            GDALRasterBand* bandAlpha = findBandByColorInterp(warpedDS, GCI_AlphaBand);
 
-            GDALRasterBand* bandGray = findBandByColorInterp(_warpedDS, GCI_GrayIndex);
+            GDALRasterBand* bandGray = findBandByColorInterp(warpedDS, GCI_GrayIndex);
 
-            GDALRasterBand* bandPalette = findBandByColorInterp(_warpedDS, GCI_PaletteIndex);
+            GDALRasterBand* bandPalette = findBandByColorInterp(warpedDS, GCI_PaletteIndex);
 
             if (!bandRed && !bandGreen && !bandBlue && !bandAlpha && !bandGray && !bandPalette)
             {
                 OE_DEBUG << LC << "Could not determine bands based on color interpretation, using band count" << std::endl;
                 //We couldn't find any valid bands based on the color interp, so just make an educated guess based on the number of bands in the file
                 //RGB = 3 bands
-                if (_warpedDS->GetRasterCount() == 3)
+                if (warpedDS->GetRasterCount() == 3)
                 {
-                    bandRed   = _warpedDS->GetRasterBand( 1 );
-                    bandGreen = _warpedDS->GetRasterBand( 2 );
-                    bandBlue  = _warpedDS->GetRasterBand( 3 );
+                    bandRed   = warpedDS->GetRasterBand( 1 );
+                    bandGreen = warpedDS->GetRasterBand( 2 );
+                    bandBlue  = warpedDS->GetRasterBand( 3 );
                 }
                 //RGBA = 4 bands
-                else if (_warpedDS->GetRasterCount() == 4)
+                else if (warpedDS->GetRasterCount() == 4)
                 {
-                    bandRed   = _warpedDS->GetRasterBand( 1 );
-                    bandGreen = _warpedDS->GetRasterBand( 2 );
-                    bandBlue  = _warpedDS->GetRasterBand( 3 );
-                    bandAlpha = _warpedDS->GetRasterBand( 4 );
+                    bandRed   = warpedDS->GetRasterBand( 1 );
+                    bandGreen = warpedDS->GetRasterBand( 2 );
+                    bandBlue  = warpedDS->GetRasterBand( 3 );
+                    bandAlpha = warpedDS->GetRasterBand( 4 );
                 }
                 //Gray = 1 band
-                else if (_warpedDS->GetRasterCount() == 1)
+                else if (warpedDS->GetRasterCount() == 1)
                 {
-                    bandGray = _warpedDS->GetRasterBand( 1 );
+                    bandGray = warpedDS->GetRasterBand( 1 );
                 }
                 //Gray + alpha = 2 bands
-                else if (_warpedDS->GetRasterCount() == 2)
+                else if (warpedDS->GetRasterCount() == 2)
                 {
-                    bandGray  = _warpedDS->GetRasterBand( 1 );
-                    bandAlpha = _warpedDS->GetRasterBand( 2 );
+                    bandGray  = warpedDS->GetRasterBand( 1 );
+                    bandAlpha = warpedDS->GetRasterBand( 2 );
                 }
             }
 
@@ -1447,18 +1652,27 @@ public:
                 }
                 else
                 {
-                    //Sample each point exactly
+                    // Read the source window of each band once, then sample each point exactly
+                    WindowPixels redPixels(this, bandRed), greenPixels(this, bandGreen), bluePixels(this, bandBlue);
+                    readSampleWindow(redPixels,   key.getExtent(), tileSize, false);
+                    readSampleWindow(greenPixels, key.getExtent(), tileSize, false);
+                    readSampleWindow(bluePixels,  key.getExtent(), tileSize, false);
+
+                    WindowPixels alphaPixels(this, bandAlpha);
+                    if (bandAlpha != NULL)
+                        readSampleWindow(alphaPixels, key.getExtent(), tileSize, false);
+
                     for (unsigned int c = 0; c < (unsigned int)tileSize; ++c)
                     {
                         double geoX = xmin + (dx * (double)c);
                         for (unsigned int r = 0; r < (unsigned int)tileSize; ++r)
                         {
                             double geoY = ymin + (dy * (double)r);
-                            *(image->data(c,r) + 0) = (unsigned char)getInterpolatedValue(bandRed,  geoX,geoY,false);
-                            *(image->data(c,r) + 1) = (unsigned char)getInterpolatedValue(bandGreen,geoX,geoY,false);
-                            *(image->data(c,r) + 2) = (unsigned char)getInterpolatedValue(bandBlue, geoX,geoY,false);
+                            *(image->data(c,r) + 0) = (unsigned char)getInterpolatedValue(redPixels,  geoX,geoY,false);
+                            *(image->data(c,r) + 1) = (unsigned char)getInterpolatedValue(greenPixels,geoX,geoY,false);
+                            *(image->data(c,r) + 2) = (unsigned char)getInterpolatedValue(bluePixels, geoX,geoY,false);
                             if (bandAlpha != NULL)
-                                *(image->data(c,r) + 3) = (unsigned char)getInterpolatedValue(bandAlpha,geoX, geoY, false);
+                                *(image->data(c,r) + 3) = (unsigned char)getInterpolatedValue(alphaPixels,geoX, geoY, false);
                             else
                                 *(image->data(c,r) + 3) = 255;
                         }
@@ -1518,6 +1732,14 @@ public:
                 }
                 else
                 {
+                    // Read the source window of each band once, then sample each point exactly
+                    WindowPixels grayPixels(this, bandGray);
+                    readSampleWindow(grayPixels, key.getExtent(), tileSize, false);
+
+                    WindowPixels alphaPixels(this, bandAlpha);
+                    if (bandAlpha != NULL)
+                        readSampleWindow(alphaPixels, key.getExtent(), tileSize, false);
+
                         for (int r = 0; r < tileSize; ++r)
                         {
                             double geoY   = ymin + (dy * (double)r);
@@ -1525,13 +1747,13 @@ public:
                         for (int c = 0; c < tileSize; ++c)
                         {
                             double geoX = xmin + (dx * (double)c);
-                            float  color = getInterpolatedValue(bandGray,geoX,geoY,false);
+                            float  color = getInterpolatedValue(grayPixels,geoX,geoY,false);
 
                             *(image->data(c,r) + 0) = (unsigned char)color;
                             *(image->data(c,r) + 1) = (unsigned char)color;
                             *(image->data(c,r) + 2) = (unsigned char)color;
                             if (bandAlpha != NULL)
-                                *(image->data(c,r) + 3) = (unsigned char)getInterpolatedValue(bandAlpha,geoX,geoY,false);
+                                *(image->data(c,r) + 3) = (unsigned char)getInterpolatedValue(alphaPixels,geoX,geoY,false);
                             else
                                 *(image->data(c,r) + 3) = 255;
                         }
@@ -1608,10 +1830,8 @@ public:
         return image.release();
     }
 
-    bool isValidValue(float v, GDALRasterBand* band)
+    static float getBandNoDataValue(GDALRasterBand* band)
     {
-        GDAL_SCOPED_LOCK;
-
         float bandNoData = -32767.0f;
         int success;
         float value = band->GetNoDataValue(&success);
@@ -1619,7 +1839,16 @@ public:
         {
             bandNoData = value;
         }
+        return bandNoData;
+    }
 
+    bool isValidValue(float v, GDALRasterBand* band)
+    {
+        return isValidValue(v, getBandNoDataValue(band));
+    }
+
+    bool isValidValue(float v, float bandNoData)
+    {
         //Check to see if the value is equal to the bands specified no data
         if (bandNoData == v) return false;
         //Check to see if the value is equal to the user specified nodata value
@@ -1636,11 +1865,122 @@ public:
         return true;
     }
 
+    /**
+     * Pixels of a band, read one at a time.
+     */
+    struct BandPixels
+    {
+        BandPixels(GDALTileSource* source, GDALRasterBand* band)
+            : _source(source), _band(band), _noData(band ? getBandNoDataValue(band) : 0.0f) { }
+
+        float get(int col, int row) const
+        {
+            float value;
+            _band->RasterIO(GF_Read, col, row, 1, 1, &value, 1, 1, GDT_Float32, 0, 0);
+            return value;
+        }
+
+        bool isValid(float v) const { return _source->isValidValue(v, _noData); }
+
+        GDALTileSource* _source;
+        GDALRasterBand* _band;
+        float           _noData;
+    };
+
+    /**
+     * Pixels of a band, read a whole window at a time so that sampling a tile
+     * takes one RasterIO call instead of four per sample. Pixels outside the
+     * window (or all of them, if no window was read) are read one at a time.
+     */
+    struct WindowPixels : public BandPixels
+    {
+        WindowPixels(GDALTileSource* source, GDALRasterBand* band)
+            : BandPixels(source, band), _col0(0), _row0(0), _width(0), _height(0) { }
+
+        bool read(int colMin, int rowMin, int colMax, int rowMax)
+        {
+            int width  = colMax - colMin + 1;
+            int height = rowMax - rowMin + 1;
+            if ( width <= 0 || height <= 0 )
+                return false;
+
+            _data.resize( width * height );
+            if ( _band->RasterIO(GF_Read, colMin, rowMin, width, height, &_data[0], width, height, GDT_Float32, 0, 0) != CE_None )
+            {
+                _data.clear();
+                return false;
+            }
+
+            _col0   = colMin;
+            _row0   = rowMin;
+            _width  = width;
+            _height = height;
+            return true;
+        }
+
+        float get(int col, int row) const
+        {
+            int c = col - _col0, r = row - _row0;
+            if ( c >= 0 && r >= 0 && c < _width && r < _height )
+                return _data[r * _width + c];
+            return BandPixels::get(col, row);
+        }
+
+        int                _col0, _row0, _width, _height;
+        std::vector<float> _data;
+    };
+
+    /**
+     * Reads the window of source pixels that interpolating the samples of a tile
+     * will touch, plus a one pixel apron. Skips the read if the window is much
+     * larger than the tile (i.e. the tile is heavily downsampled), in which case
+     * the samples read their pixels individually.
+     */
+    void readSampleWindow(WindowPixels& pixels, const GeoExtent& extent, int tileSize, bool applyOffset)
+    {
+        if ( !*_options.windowedSampling() || !pixels._band )
+            return;
+
+        // the band belongs to the dataset checked out for this tile, which
+        // may not be _warpedDS when reading through the handle pool.
+        int rasterWidth  = pixels._band->GetXSize();
+        int rasterHeight = pixels._band->GetYSize();
+
+        double c0, r0, c1, r1;
+        geoToPixel( extent.xMin(), extent.yMax(), c0, r0, rasterWidth, rasterHeight );
+        geoToPixel( extent.xMax(), extent.yMin(), c1, r1, rasterWidth, rasterHeight );
+
+        if ( applyOffset )
+        {
+            c0 -= 0.5; r0 -= 0.5; c1 -= 0.5; r1 -= 0.5;
+        }
+
+        int colMin = osg::maximum( (int)floor(osg::minimum(c0, c1)) - 1, 0 );
+        int colMax = osg::minimum( (int)ceil (osg::maximum(c0, c1)) + 1, rasterWidth - 1 );
+        int rowMin = osg::maximum( (int)floor(osg::minimum(r0, r1)) - 1, 0 );
+        int rowMax = osg::minimum( (int)ceil (osg::maximum(r0, r1)) + 1, rasterHeight - 1 );
+
+        double windowSize = (double)(colMax - colMin + 1) * (double)(rowMax - rowMin + 1);
+        if ( windowSize > 16.0 * (double)tileSize * (double)tileSize )
+            return;
+
+        pixels.read( colMin, rowMin, colMax, rowMax );
+    }
 
     float getInterpolatedValue(GDALRasterBand *band, double x, double y, bool applyOffset=true)
     {
+        return getInterpolatedValue( BandPixels(this, band), x, y, applyOffset );
+    }
+
+    template<typename PIXELS>
+    float getInterpolatedValue(const PIXELS& pixels, double x, double y, bool applyOffset=true)
+    {
+        // size by the band read, like readSampleWindow.
+        int rasterWidth  = pixels._band->GetXSize();
+        int rasterHeight = pixels._band->GetYSize();
+
         double r, c;
-        geoToPixel( x, y, c, r );
+        geoToPixel( x, y, c, r, rasterWidth, rasterHeight );
 
 
         if (applyOffset)
@@ -1656,31 +1996,31 @@ public:
             {
                 c = 0;
             }
-            else if (c > _warpedDS->GetRasterXSize()-1 && c <= _warpedDS->GetRasterXSize()-0.5)
+            else if (c > rasterWidth-1 && c <= rasterWidth-0.5)
             {
-                c = _warpedDS->GetRasterXSize()-1;
+                c = rasterWidth-1;
             }
 
             if (r < 0 && r >= -0.5)
             {
                 r = 0;
             }
-            else if (r > _warpedDS->GetRasterYSize()-1 && r <= _warpedDS->GetRasterYSize()-0.5)
+            else if (r > rasterHeight-1 && r <= rasterHeight-0.5)
             {
-                r = _warpedDS->GetRasterYSize()-1;
+                r = rasterHeight-1;
             }
         }
 
         float result = 0.0f;
 
         //If the location is outside of the pixel values of the dataset, just return 0
-        if (c < 0 || r < 0 || c > _warpedDS->GetRasterXSize()-1 || r > _warpedDS->GetRasterYSize()-1)
+        if (c < 0 || r < 0 || c > rasterWidth-1 || r > rasterHeight-1)
             return NO_DATA_VALUE;
 
         if ( _options.interpolation() == INTERP_NEAREST )
         {
-            band->RasterIO(GF_Read, (int)osg::round(c), (int)osg::round(r), 1, 1, &result, 1, 1, GDT_Float32, 0, 0);
-            if (!isValidValue( result, band))
+            result = pixels.get((int)osg::round(c), (int)osg::round(r));
+            if (!pixels.isValid(result))
             {
                 return NO_DATA_VALUE;
             }
@@ -1688,19 +2028,19 @@ public:
         else
         {
             int rowMin = osg::maximum((int)floor(r), 0);
-            int rowMax = osg::maximum(osg::minimum((int)ceil(r), (int)(_warpedDS->GetRasterYSize()-1)), 0);
+            int rowMax = osg::maximum(osg::minimum((int)ceil(r), rasterHeight-1), 0);
             int colMin = osg::maximum((int)floor(c), 0);
-            int colMax = osg::maximum(osg::minimum((int)ceil(c), (int)(_warpedDS->GetRasterXSize()-1)), 0);
+            int colMax = osg::maximum(osg::minimum((int)ceil(c), rasterWidth-1), 0);
 
             if (rowMin > rowMax) rowMin = rowMax;
             if (colMin > colMax) colMin = colMax;
 
             float urHeight, llHeight, ulHeight, lrHeight;
 
-            band->RasterIO(GF_Read, colMin, rowMin, 1, 1, &llHeight, 1, 1, GDT_Float32, 0, 0);
-            band->RasterIO(GF_Read, colMin, rowMax, 1, 1, &ulHeight, 1, 1, GDT_Float32, 0, 0);
-            band->RasterIO(GF_Read, colMax, rowMin, 1, 1, &lrHeight, 1, 1, GDT_Float32, 0, 0);
-            band->RasterIO(GF_Read, colMax, rowMax, 1, 1, &urHeight, 1, 1, GDT_Float32, 0, 0);
+            llHeight = pixels.get(colMin, rowMin);
+            ulHeight = pixels.get(colMin, rowMax);
+            lrHeight = pixels.get(colMax, rowMin);
+            urHeight = pixels.get(colMax, rowMax);
 
             /*
             if (!isValidValue(urHeight, band)) urHeight = 0.0f;
@@ -1708,7 +2048,7 @@ public:
             if (!isValidValue(ulHeight, band)) ulHeight = 0.0f;
             if (!isValidValue(lrHeight, band)) lrHeight = 0.0f;
             */
-            if ((!isValidValue(urHeight, band)) || (!isValidValue(llHeight, band)) ||(!isValidValue(ulHeight, band)) || (!isValidValue(lrHeight, band)))
+            if ((!pixels.isValid(urHeight)) || (!pixels.isValid(llHeight)) ||(!pixels.isValid(ulHeight)) || (!pixels.isValid(lrHeight)))
             {
                 return NO_DATA_VALUE;
             }
@@ -1853,7 +2193,8 @@ public:
             return NULL;
         }
 
-        GDAL_SCOPED_LOCK;
+        ScopedDataset dataset( this );
+        GDALDataset* warpedDS = dataset.get();
 
         int tileSize = _options.tileSize().value();
 
@@ -1873,12 +2214,12 @@ public:
 
             // Determine the read window
             double src_min_x, src_min_y, src_max_x, src_max_y;
-            // Get the pixel coordinates of the intersection
-            geoToPixel( intersection.xMin(), intersection.yMax(), src_min_x, src_min_y);
-            geoToPixel( intersection.xMax(), intersection.yMin(), src_max_x, src_max_y);
+            int rasterWidth = warpedDS->GetRasterXSize();
+            int rasterHeight = warpedDS->GetRasterYSize();
 
-            int rasterWidth = _warpedDS->GetRasterXSize();
-            int rasterHeight = _warpedDS->GetRasterYSize();
+            // Get the pixel coordinates of the intersection
+            geoToPixel( intersection.xMin(), intersection.yMax(), src_min_x, src_min_y, rasterWidth, rasterHeight);
+            geoToPixel( intersection.xMax(), intersection.yMin(), src_max_x, src_max_y, rasterWidth, rasterHeight);
 
             // Convert the doubles to integers.  We floor the mins and ceil the maximums to give the widest window possible.
             src_min_x = osg::round(src_min_x);
@@ -2041,11 +2382,11 @@ public:
             OE_DEBUG << LC << "Read extents " << read_min_x << ", " << read_min_y << " to " << read_max_x << ", " << read_max_y << std::endl;
 
             // Try to find a FLOAT band
-            GDALRasterBand* band = findBandByDataType(_warpedDS, GDT_Float32);
+            GDALRasterBand* band = findBandByDataType(warpedDS, GDT_Float32);
             if (band == NULL)
             {
                 // Just get first band
-                band = _warpedDS->GetRasterBand(1);
+                band = warpedDS->GetRasterBand(1);
             }
 
             float *heights = new float[target_width * target_height];
@@ -2058,6 +2399,7 @@ public:
             // Now create a GeoHeightField that we can sample from.  This heightfield only contains the portion that was actually read from the dataset
             osg::ref_ptr< osg::HeightField > readHF = new osg::HeightField();
             readHF->allocate( target_width, target_height );
+            float bandNoData = getBandNoDataValue( band );
             for (unsigned int c = 0; c < target_width; c++)
             {
                 for (unsigned int r = 0; r < target_height; r++)
@@ -2065,7 +2407,7 @@ public:
                     unsigned inv_r = target_height - r -1;
                     float h = heights[r * target_width + c];
                     // Mark the value as nodata using the universal NO_DATA_VALUE marker.
-                    if (!isValidValue( h, band ) )
+                    if (!isValidValue( h, bandNoData ) )
                     {
                         h = NO_DATA_VALUE;
                     }
@@ -2116,8 +2458,42 @@ public:
 
 private:
 
+    /**
+     * The dataset to read a tile from. With a handle pool, that is a handle
+     * checked out for this thread; otherwise, or if the pool cannot open a
+     * handle, it is the shared dataset, under the global GDAL lock.
+     */
+    class ScopedDataset
+    {
+    public:
+        ScopedDataset(GDALTileSource* source) : _source(source), _handle(0L), _lock(0L)
+        {
+            if ( _source->_pool.valid() )
+                _handle = _source->_pool->acquire();
+
+            if ( !_handle )
+                _lock = new OpenThreads::ScopedLock<OpenThreads::ReentrantMutex>( Registry::instance()->getGDALMutex() );
+        }
+
+        ~ScopedDataset()
+        {
+            if ( _handle )
+                _source->_pool->release( _handle );
+            delete _lock;
+        }
+
+        GDALDataset* get() const { return _handle ? _handle->_warpedDS : _source->_warpedDS; }
+
+    private:
+        GDALTileSource*                                       _source;
+        GDALDatasetPool::Handle*                              _handle;
+        OpenThreads::ScopedLock<OpenThreads::ReentrantMutex>* _lock;
+    };
+    friend class ScopedDataset;
+
     GDALDataset* _srcDS;
     GDALDataset* _warpedDS;
+    osg::ref_ptr<GDALDatasetPool> _pool;
     double       _geotransform[6];
     double       _invtransform[6];
 
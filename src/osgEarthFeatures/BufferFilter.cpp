@@ -89,7 +89,7 @@ BufferFilter::push( FeatureList& input, FilterContext& context )
     for( FeatureList::iterator i = input.begin(); i != input.end(); )
     {
         Feature* feature = i->get();
-        if ( !feature || !feature->getGeometry() )
+        if ( !feature || !feature->readGeometry() )
             continue;
 
         osg::ref_ptr<Symbology::Geometry> output;
@@ -104,7 +104,7 @@ BufferFilter::push( FeatureList& input, FilterContext& context )
 
         params._cornerSegs = _numQuadSegs;
 
-        if ( feature->getGeometry()->buffer( _distance.value(), output, params ) )
+        if ( feature->readGeometry()->buffer( _distance.value(), output, params ) )
         {
             feature->setGeometry( output.get() );
             ++i;
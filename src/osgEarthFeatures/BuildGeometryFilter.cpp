@@ -363,10 +363,10 @@ BuildGeometryFilter::processLines(FeatureList& features, FilterContext& context)
             input->eval( temp, &context );
         }
 
-        GeometryIterator parts( input->getGeometry(), true );
+        ConstGeometryIterator parts( input->readGeometry(), true );
         while( parts.hasMore() )
         {
-            Geometry* part = parts.next();
+            const Geometry* part = parts.next();
 
             // skip invalid geometry for lines.
             if ( part->size() < 2 )
@@ -374,7 +374,7 @@ BuildGeometryFilter::processLines(FeatureList& features, FilterContext& context)
 
             // if the underlying geometry is a ring (or a polygon), use a line loop; otherwise
             // use a line strip.
-            GLenum primMode = dynamic_cast<Ring*>(part) ? GL_LINE_LOOP : GL_LINE_STRIP;
+            GLenum primMode = dynamic_cast<const Ring*>(part) ? GL_LINE_LOOP : GL_LINE_STRIP;
 
             // resolve the color:
             osg::Vec4f primaryColor = line->stroke()->color();
@@ -464,10 +464,10 @@ BuildGeometryFilter::processPoints(FeatureList& features, FilterContext& context
     {
         Feature* input = f->get();
 
-        GeometryIterator parts( input->getGeometry(), true );
+        ConstGeometryIterator parts( input->readGeometry(), true );
         while( parts.hasMore() )
         {
-            Geometry* part = parts.next();
+            const Geometry* part = parts.next();
 
             // extract the required point symbol; bail out if not found.
             const PointSymbol* point =
@@ -889,9 +889,9 @@ BuildGeometryFilter::push( FeatureList& input, FilterContext& context )
         }
 
         // if no style is set, use the geometry type:
-        if ( !has_polysymbol && !has_linesymbol && !has_polylinesymbol && !has_pointsymbol && f->getGeometry() )
+        if ( !has_polysymbol && !has_linesymbol && !has_polylinesymbol && !has_pointsymbol && f->readGeometry() )
         {
-            switch( f->getGeometry()->getComponentType() )
+            switch( f->readGeometry()->getComponentType() )
             {
             case Geometry::TYPE_LINESTRING:
             case Geometry::TYPE_RING:
@@ -95,7 +95,7 @@ osg::Node* BuildTextOperator::operator()(const FeatureList&   features,
     for (FeatureList::const_iterator itr = features.begin(); itr != features.end(); ++itr)
     {
         Feature* feature = itr->get();
-        if (!feature->getGeometry()) continue;
+        if (!feature->readGeometry()) continue;
 
         std::string text;
         if (symbol->content().isSet())
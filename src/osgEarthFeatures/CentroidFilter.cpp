@@ -37,7 +37,7 @@ CentroidFilter::push(FeatureList& features, FilterContext& context )
     {
         Feature* f = i->get();
         
-        Geometry* geom = f->getGeometry();
+        const Geometry* geom = f->readGeometry();
         if ( !geom )
             continue;
 
@@ -0,0 +1,193 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2014 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/CompiledExpression>
+#include <osgEarthFeatures/Session>
+#include <osgEarthFeatures/ScriptEngine>
+#include <osgEarth/StringUtils>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+#define LC "[CompiledExpression] "
+
+namespace
+{
+    // most expressions have a handful of variables; evaluate those without
+    // allocating anything.
+    const unsigned FIXED_VARS = 16;
+
+    bool inSchema(const std::string& name, const FeatureSchema& schema)
+    {
+        // feature attribute names are case-insensitive.
+        for(FeatureSchema::const_iterator i = schema.begin(); i != schema.end(); ++i)
+        {
+            if ( ciEquals(i->first, name) )
+                return true;
+        }
+        return false;
+    }
+
+    ScriptResult runScript(const std::string& script, const Feature* feature, FilterContext const* context)
+    {
+        ScriptEngine* engine = context->getSession() ? context->getSession()->getScriptEngine() : 0L;
+        if ( !engine )
+            return ScriptResult(EMPTY_STRING, false);
+
+        return engine->run(script, feature, context);
+    }
+}
+
+//------------------------------------------------------------------------
+
+CompiledNumericExpression::CompiledNumericExpression(const NumericExpression& expr,
+                                                     const FeatureSchema&     schema) :
+_expr( expr )
+{
+    const NumericExpression::Variables& vars = _expr.variables();
+    for( NumericExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i )
+    {
+        Slot slot;
+        slot._name     = i->first;
+        slot._inSchema = inSchema(i->first, schema);
+        _slots.push_back( slot );
+    }
+}
+
+double
+CompiledNumericExpression::eval(const Feature* feature, FilterContext const* context) const
+{
+    double fixedValues[FIXED_VARS];
+    std::vector<double> moreValues;
+    double* values = fixedValues;
+    if ( _slots.size() > FIXED_VARS )
+    {
+        moreValues.resize( _slots.size() );
+        values = &moreValues[0];
+    }
+
+    const AttributeTable& attrs = feature->getAttrs();
+
+    for( unsigned i=0; i<_slots.size(); ++i )
+    {
+        const Slot& slot = _slots[i];
+        values[i] = 0.0;
+
+        AttributeTable::const_iterator a = attrs.find( slot._name );
+        if ( a != attrs.end() )
+        {
+            values[i] = a->second.getDouble( 0.0 );
+        }
+        else if ( !slot._inSchema && context )
+        {
+            ScriptResult result = runScript( slot._name, feature, context );
+            if ( result.success() )
+                values[i] = result.asDouble();
+            else if ( !result.message().empty() )
+                OE_WARN << LC << "Feature Script error on '" << _expr.expr() << "': " << result.message() << std::endl;
+        }
+    }
+
+    return _expr.eval( values );
+}
+
+//------------------------------------------------------------------------
+
+CompiledStringExpression::CompiledStringExpression(const StringExpression& expr,
+                                                   const FeatureSchema&    schema) :
+_expr( expr )
+{
+    const StringExpression::Variables& vars = _expr.variables();
+    for( StringExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i )
+    {
+        Slot slot;
+        slot._name     = i->first;
+        slot._inSchema = inSchema(i->first, schema);
+        _slots.push_back( slot );
+    }
+
+    // settle a constant (or literal) expression once, so eval never touches it.
+    if ( _slots.empty() )
+    {
+        _constant = _expr.eval();
+    }
+}
+
+void
+CompiledStringExpression::eval(const Feature* feature, FilterContext const* context, std::string& out) const
+{
+    if ( _slots.empty() )
+    {
+        out = _constant;
+        return;
+    }
+
+    // string attributes are used in place; other values are converted into
+    // the temporaries.
+    const std::string* fixedValues[FIXED_VARS];
+    std::string fixedTemps[FIXED_VARS];
+    std::vector<const std::string*> moreValues;
+    std::vector<std::string> moreTemps;
+    const std::string** values = fixedValues;
+    std::string* temps = fixedTemps;
+    if ( _slots.size() > FIXED_VARS )
+    {
+        moreValues.resize( _slots.size() );
+        moreTemps.resize( _slots.size() );
+        values = &moreValues[0];
+        temps = &moreTemps[0];
+    }
+
+    const AttributeTable& attrs = feature->getAttrs();
+
+    for( unsigned i=0; i<_slots.size(); ++i )
+    {
+        const Slot& slot = _slots[i];
+        values[i] = 0L;
+
+        AttributeTable::const_iterator a = attrs.find( slot._name );
+        if ( a != attrs.end() )
+        {
+            if ( a->second.first == ATTRTYPE_STRING )
+            {
+                values[i] = &a->second.second.stringValue;
+            }
+            else
+            {
+                temps[i] = a->second.getString();
+                values[i] = &temps[i];
+            }
+        }
+        else if ( !slot._inSchema && context )
+        {
+            ScriptResult result = runScript( slot._name, feature, context );
+            if ( result.success() )
+            {
+                temps[i] = result.asString();
+                values[i] = &temps[i];
+            }
+            else if ( !result.message().empty() )
+            {
+                OE_WARN << LC << "Feature Script error on '" << _expr.expr() << "': " << result.message() << std::endl;
+            }
+        }
+    }
+
+    _expr.eval( values, out );
+}
@@ -82,9 +82,9 @@ ConvertTypeFilter::push( FeatureList& input, FilterContext& context )
     for( FeatureList::iterator i = input.begin(); i != input.end(); ++i )
     {
         Feature* input = i->get();
-        if ( input && input->getGeometry() && input->getGeometry()->getComponentType() != _toType )
+        if ( input && input->readGeometry() && input->readGeometry()->getComponentType() != _toType )
         {
-            input->setGeometry( input->getGeometry()->cloneAs(_toType) );
+            input->setGeometry( input->readGeometry()->cloneAs(_toType) );
         }
     }
 
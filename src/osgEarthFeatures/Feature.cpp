@@ -144,17 +144,21 @@ AttributeValue::getBool( bool defaultValue ) const
 //----------------------------------------------------------------------------
 
 Feature::Feature( FeatureID fid ) :
-_fid( fid ),
-_srs( 0L )
+_fid       ( fid ),
+_geomShared( 0u ),
+_srs       ( 0L ),
+_attrs     ( new SharedAttributeTable() )
 //_cachedBoundingPolytopeValid( false )
 {
     //NOP
 }
 
 Feature::Feature( Geometry* geom, const SpatialReference* srs, const Style& style, FeatureID fid ) :
-_geom ( geom ),
-_srs  ( srs ),
-_fid  ( fid )
+_geom      ( geom ),
+_geomShared( 0u ),
+_srs       ( srs ),
+_attrs     ( new SharedAttributeTable() ),
+_fid       ( fid )
 {
     if ( !style.empty() )
         _style = style;
@@ -163,14 +167,32 @@ _fid  ( fid )
 }
 
 Feature::Feature( const Feature& rhs, const osg::CopyOp& copyOp ) :
-_fid      ( rhs._fid ),
-_attrs    ( rhs._attrs ),
-_style    ( rhs._style ),
-_geoInterp( rhs._geoInterp ),
-_srs      ( rhs._srs.get() )
+_fid       ( rhs._fid ),
+_geomShared( 0u ),
+_style     ( rhs._style ),
+_geoInterp ( rhs._geoInterp ),
+_srs       ( rhs._srs.get() )
 {
-    if ( rhs._geom.valid() )
-        _geom = rhs._geom->clone();
+    if ( copyOp.getCopyFlags() == osg::CopyOp::SHALLOW_COPY )
+    {
+        // copy-on-write: both features share the data until one of them changes it.
+        // Several threads may copy the same feature at once (e.g. under a source's
+        // shared read lock), so the original is marked with an atomic write.
+        _geom  = rhs._geom.get();
+        _attrs = rhs._attrs.get();
+        if ( _geom.valid() )
+        {
+            _geomShared.exchange( 1u );
+            rhs._geomShared.exchange( 1u );
+        }
+    }
+    else
+    {
+        if ( rhs._geom.valid() )
+            _geom = rhs._geom->clone();
+
+        _attrs = new SharedAttributeTable( *rhs._attrs.get() );
+    }
 
     dirty();
 }
@@ -192,7 +214,36 @@ void
 Feature::setGeometry( Geometry* geom )
 {
     _geom = geom;
+    _geomShared.exchange( 0u );
+    dirty();
+}
+
+Geometry*
+Feature::getGeometry()
+{
+    // the caller may change the geometry, so stop sharing it. Once the
+    // features it was shared with have copied or released it, this one holds
+    // the only reference and can keep it.
+    if ( _geomShared != 0u )
+    {
+        if ( _geom.valid() && _geom->referenceCount() > 1 )
+            _geom = _geom->clone();
+        _geomShared.exchange( 0u );
+    }
+
     dirty();
+    return _geom.get();
+}
+
+AttributeTable&
+Feature::writeAttrs()
+{
+    // only features share attribute tables, so the reference count tells
+    // whether anyone else can see this one.
+    if ( _attrs->referenceCount() > 1 )
+        _attrs = new SharedAttributeTable( *_attrs.get() );
+
+    return _attrs->_table;
 }
 
 void
@@ -206,7 +257,7 @@ Feature::dirty()
 void
 Feature::set( const std::string& name, const std::string& value )
 {
-    AttributeValue& a = _attrs[name];
+    AttributeValue& a = writeAttrs()[name];
     a.first = ATTRTYPE_STRING;
     a.second.stringValue = value;
     a.second.set = true;
@@ -215,7 +266,7 @@ Feature::set( const std::string& name, const std::string& value )
 void
 Feature::set( const std::string& name, double value )
 {
-    AttributeValue& a = _attrs[name];
+    AttributeValue& a = writeAttrs()[name];
     a.first = ATTRTYPE_DOUBLE;
     a.second.doubleValue = value;
     a.second.set = true;
@@ -224,7 +275,7 @@ Feature::set( const std::string& name, double value )
 void
 Feature::set( const std::string& name, int value )
 {
-    AttributeValue& a = _attrs[name];
+    AttributeValue& a = writeAttrs()[name];
     a.first = ATTRTYPE_INT;
     a.second.intValue = value;
     a.second.set = true;
@@ -233,7 +284,7 @@ Feature::set( const std::string& name, int value )
 void
 Feature::set( const std::string& name, bool value )
 {
-    AttributeValue& a = _attrs[name];
+    AttributeValue& a = writeAttrs()[name];
     a.first = ATTRTYPE_BOOL;
     a.second.boolValue = value;
     a.second.set = true;
@@ -242,14 +293,14 @@ Feature::set( const std::string& name, bool value )
 void
 Feature::setNull( const std::string& name)
 {
-    AttributeValue& a = _attrs[name];    
+    AttributeValue& a = writeAttrs()[name];    
     a.second.set = false;
 }
 
 void
 Feature::setNull( const std::string& name, AttributeType type)
 {
-    AttributeValue& a = _attrs[name];
+    AttributeValue& a = writeAttrs()[name];
     a.first = type;    
     a.second.set = false;
 }
@@ -260,42 +311,42 @@ Feature::setNull( const std::string& name, AttributeType type)
 bool
 Feature::hasAttr( const std::string& name ) const
 {
-    return _attrs.find(toLower(name)) != _attrs.end();
+    return getAttrs().find(toLower(name)) != getAttrs().end();
 }
 
 std::string
 Feature::getString( const std::string& name ) const
 {
-    AttributeTable::const_iterator i = _attrs.find(toLower(name));
-    return i != _attrs.end()? i->second.getString() : EMPTY_STRING;
+    AttributeTable::const_iterator i = getAttrs().find(toLower(name));
+    return i != getAttrs().end()? i->second.getString() : EMPTY_STRING;
 }
 
 double
 Feature::getDouble( const std::string& name, double defaultValue ) const 
 {
-    AttributeTable::const_iterator i = _attrs.find(toLower(name));
-    return i != _attrs.end()? i->second.getDouble(defaultValue) : defaultValue;
+    AttributeTable::const_iterator i = getAttrs().find(toLower(name));
+    return i != getAttrs().end()? i->second.getDouble(defaultValue) : defaultValue;
 }
 
 int
 Feature::getInt( const std::string& name, int defaultValue ) const 
 {
-    AttributeTable::const_iterator i = _attrs.find(toLower(name));
-    return i != _attrs.end()? i->second.getInt(defaultValue) : defaultValue;
+    AttributeTable::const_iterator i = getAttrs().find(toLower(name));
+    return i != getAttrs().end()? i->second.getInt(defaultValue) : defaultValue;
 }
 
 bool
 Feature::getBool( const std::string& name, bool defaultValue ) const 
 {
-    AttributeTable::const_iterator i = _attrs.find(toLower(name));
-    return i != _attrs.end()? i->second.getBool(defaultValue) : defaultValue;
+    AttributeTable::const_iterator i = getAttrs().find(toLower(name));
+    return i != getAttrs().end()? i->second.getBool(defaultValue) : defaultValue;
 }
 
 bool
 Feature::isSet( const std::string& name) const
 {
-    AttributeTable::const_iterator i = _attrs.find(toLower(name));
-    return i != _attrs.end()? i->second.second.set : false;
+    AttributeTable::const_iterator i = getAttrs().find(toLower(name));
+    return i != getAttrs().end()? i->second.second.set : false;
 }
 
 double
@@ -305,8 +356,8 @@ Feature::eval( NumericExpression& expr, FilterContext const* context ) const
     for( NumericExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i )
     {
       double val = 0.0;
-      AttributeTable::const_iterator ai = _attrs.find(toLower(i->first));
-      if (ai != _attrs.end())
+      AttributeTable::const_iterator ai = getAttrs().find(toLower(i->first));
+      if (ai != getAttrs().end())
       {
         val = ai->second.getDouble(0.0);
       }
@@ -338,8 +389,8 @@ Feature::eval( StringExpression& expr, FilterContext const* context ) const
     for( StringExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i )
     {
       std::string val = "";
-      AttributeTable::const_iterator ai = _attrs.find(toLower(i->first));
-      if (ai != _attrs.end())
+      AttributeTable::const_iterator ai = getAttrs().find(toLower(i->first));
+      if (ai != getAttrs().end())
       {
         val = ai->second.getString();
       }
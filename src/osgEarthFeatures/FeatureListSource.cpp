@@ -17,9 +17,74 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/FeatureListSource>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#define LC "[FeatureListSource] "
 
 using namespace osgEarth::Features;
 
+namespace
+{
+    // entries per leaf, and children per node, of the R-tree.
+    const unsigned NODE_CAPACITY = 16;
+
+    template<typename T>
+    struct LessCenterX {
+        bool operator()(const T& lhs, const T& rhs) const {
+            return lhs._xmin+lhs._xmax < rhs._xmin+rhs._xmax;
+        }
+    };
+
+    template<typename T>
+    struct LessCenterY {
+        bool operator()(const T& lhs, const T& rhs) const {
+            return lhs._ymin+lhs._ymax < rhs._ymin+rhs._ymax;
+        }
+    };
+
+    template<typename T>
+    struct LessOrder {
+        bool operator()(const T* lhs, const T* rhs) const {
+            return lhs->_order < rhs->_order;
+        }
+    };
+
+    /**
+     * Sort-tile-recursive ordering: sorts the boxes into vertical slices by
+     * their centers, then each slice from bottom to top, so that consecutive
+     * runs of NODE_CAPACITY boxes are spatially compact.
+     */
+    template<typename T>
+    void sortTileRecursive( typename std::vector<T>::iterator begin, typename std::vector<T>::iterator end )
+    {
+        unsigned size      = end - begin;
+        unsigned numNodes  = (size + NODE_CAPACITY - 1) / NODE_CAPACITY;
+        unsigned numSlices = (unsigned)ceil( sqrt((double)numNodes) );
+        unsigned sliceSize = numSlices * NODE_CAPACITY;
+
+        std::sort( begin, end, LessCenterX<T>() );
+        for( unsigned first = 0; first < size; first += sliceSize )
+        {
+            unsigned last = std::min( first + sliceSize, size );
+            std::sort( begin + first, begin + last, LessCenterY<T>() );
+        }
+    }
+
+    template<typename A, typename B>
+    bool intersects( const A& a, const B& b )
+    {
+        return a._xmin <= b._xmax && a._xmax >= b._xmin && a._ymin <= b._ymax && a._ymax >= b._ymin;
+    }
+
+    /** Bounds in the same layout as the index, for the intersection tests */
+    struct Box
+    {
+        double _xmin, _ymin, _xmax, _ymax;
+    };
+}
+
 FeatureListSource::FeatureListSource():
 FeatureSource()
 {
@@ -36,17 +101,168 @@ _defaultExtent( defaultExtent )
 FeatureCursor*
 FeatureListSource::createFeatureCursor( const Symbology::Query& query )
 {
-    //Create a copy of all of the features before returning the cursor.
-    //The processing filters in osgEarth can modify the features as they are operating and we don't want our original data destroyed.
+    //The processing filters in osgEarth can modify the features as they are operating and we don't want our original data destroyed,
+    //so the cursor returns copy-on-write clones; a clone only copies its geometry or attributes when a filter changes them.
     FeatureList cursorFeatures;
-    for (FeatureList::iterator itr = _features.begin(); itr != _features.end(); ++itr)
+
+    if ( !query.bounds().isSet() )
+    {
+        for (FeatureList::iterator itr = _features.begin(); itr != _features.end(); ++itr)
+        {
+            cursorFeatures.push_back( new Feature(*(itr->get()), osg::CopyOp::SHALLOW_COPY) );
+        }
+        return new FeatureListCursor( cursorFeatures );
+    }
+
+    // bring the index up to date with the list:
+    bool inSync;
+    {
+        Threading::ScopedReadLock shared( _indexMutex );
+        inSync = inSyncWith( _indexRevision );
+    }
+    if ( !inSync )
+    {
+        Threading::ScopedWriteLock exclusive( _indexMutex );
+        if ( !inSyncWith(_indexRevision) )
+        {
+            buildIndex();
+            sync( _indexRevision );
+        }
+    }
+
+    Threading::ScopedReadLock shared( _indexMutex );
+
+    std::vector<const IndexEntry*> hits;
+    queryIndex( query.bounds().get(), hits );
+
+    for (unsigned i = 0; i < hits.size(); ++i)
     {
-        Feature* feature = new osgEarth::Features::Feature(*(itr->get()), osg::CopyOp::DEEP_COPY_ALL);        
-        cursorFeatures.push_back( feature );
-    }    
+        cursorFeatures.push_back( new Feature(*hits[i]->_feature.get(), osg::CopyOp::SHALLOW_COPY) );
+    }
     return new FeatureListCursor( cursorFeatures );
 }
 
+void
+FeatureListSource::buildIndex()
+{
+    _entries.clear();
+    _unbounded.clear();
+    _nodes.clear();
+
+    unsigned order = 0;
+    for (FeatureList::const_iterator itr = _features.begin(); itr != _features.end(); ++itr, ++order)
+    {
+        const Feature* feature = itr->get();
+
+        IndexEntry entry;
+        entry._order   = order;
+        entry._feature = itr->get();
+
+        Bounds b;
+        if ( feature->getGeometry() )
+            b = feature->getGeometry()->getBounds();
+
+        if ( b.isValid() )
+        {
+            entry._xmin = b.xMin(); entry._ymin = b.yMin();
+            entry._xmax = b.xMax(); entry._ymax = b.yMax();
+            _entries.push_back( entry );
+        }
+        else
+        {
+            _unbounded.push_back( entry );
+        }
+    }
+
+    if ( _entries.empty() )
+        return;
+
+    // leaves over runs of entries:
+    sortTileRecursive<IndexEntry>( _entries.begin(), _entries.end() );
+
+    for (unsigned first = 0; first < _entries.size(); first += NODE_CAPACITY)
+    {
+        IndexNode node;
+        node._first = first;
+        node._count = std::min( NODE_CAPACITY, (unsigned)_entries.size() - first );
+        node._leaf  = true;
+        node._xmin  = node._ymin =  DBL_MAX;
+        node._xmax  = node._ymax = -DBL_MAX;
+        for (unsigned i = first; i < first + node._count; ++i)
+        {
+            const IndexEntry& e = _entries[i];
+            node._xmin = osg::minimum(node._xmin, e._xmin); node._ymin = osg::minimum(node._ymin, e._ymin);
+            node._xmax = osg::maximum(node._xmax, e._xmax); node._ymax = osg::maximum(node._ymax, e._ymax);
+        }
+        _nodes.push_back( node );
+    }
+
+    // then each level over runs of the level below, up to a single root:
+    unsigned levelStart = 0;
+    while ( _nodes.size() - levelStart > 1 )
+    {
+        unsigned levelEnd = _nodes.size();
+        sortTileRecursive<IndexNode>( _nodes.begin() + levelStart, _nodes.end() );
+
+        for (unsigned first = levelStart; first < levelEnd; first += NODE_CAPACITY)
+        {
+            IndexNode node;
+            node._first = first;
+            node._count = std::min( NODE_CAPACITY, levelEnd - first );
+            node._leaf  = false;
+            node._xmin  = node._ymin =  DBL_MAX;
+            node._xmax  = node._ymax = -DBL_MAX;
+            for (unsigned i = first; i < first + node._count; ++i)
+            {
+                const IndexNode& c = _nodes[i];
+                node._xmin = osg::minimum(node._xmin, c._xmin); node._ymin = osg::minimum(node._ymin, c._ymin);
+                node._xmax = osg::maximum(node._xmax, c._xmax); node._ymax = osg::maximum(node._ymax, c._ymax);
+            }
+            _nodes.push_back( node );
+        }
+
+        levelStart = levelEnd;
+    }
+
+    OE_DEBUG << LC << "Indexed " << _entries.size() << " features in " << _nodes.size() << " nodes" << std::endl;
+}
+
+void
+FeatureListSource::queryIndex( const Bounds& bounds, std::vector<const IndexEntry*>& output ) const
+{
+    Box box;
+    box._xmin = bounds.xMin(); box._ymin = bounds.yMin();
+    box._xmax = bounds.xMax(); box._ymax = bounds.yMax();
+
+    for (unsigned i = 0; i < _unbounded.size(); ++i)
+        output.push_back( &_unbounded[i] );
+
+    if ( !_nodes.empty() )
+    {
+        std::vector<unsigned> stack;
+        stack.push_back( _nodes.size()-1 );
+        while ( !stack.empty() )
+        {
+            const IndexNode& node = _nodes[stack.back()];
+            stack.pop_back();
+
+            if ( !intersects(node, box) )
+                continue;
+
+            for (unsigned i = node._first; i < node._first + node._count; ++i)
+            {
+                if ( !node._leaf )
+                    stack.push_back( i );
+                else if ( intersects(_entries[i], box) )
+                    output.push_back( &_entries[i] );
+            }
+        }
+    }
+
+    // return the features in the order of the list, as before.
+    std::sort( output.begin(), output.end(), LessOrder<IndexEntry>() );
+}
+
 const FeatureProfile*
 FeatureListSource::createFeatureProfile()
 {    
@@ -59,9 +275,9 @@ FeatureListSource::createFeatureProfile()
         srs = _features.front()->getSRS();
 
         // Compute the extent of the features
-        for (FeatureList::iterator itr = _features.begin(); itr != _features.end(); ++itr)
+        for (FeatureList::const_iterator itr = _features.begin(); itr != _features.end(); ++itr)
         {
-            Feature* feature = itr->get();
+            const Feature* feature = itr->get();
             if (feature->getGeometry())
             {
                 bounds.expandBy( feature->getGeometry()->getBounds() );
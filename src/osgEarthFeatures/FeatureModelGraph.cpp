@@ -18,6 +18,7 @@
  */
 
 #include <osgEarthFeatures/FeatureModelGraph>
+#include <osgEarthFeatures/CompiledExpression>
 #include <osgEarthFeatures/CropFilter>
 #include <osgEarthFeatures/FeatureSourceIndexNode>
 #include <osgEarthFeatures/Session>
@@ -1111,16 +1112,17 @@ FeatureModelGraph::queryAndSortIntoStyleGroups(const Query&            query,
     // establish the working bounds and a context:
     Bounds bounds = query.bounds().isSet() ? *query.bounds() : extent.bounds();
     FilterContext context( _session.get(), featureProfile, GeoExtent(featureProfile->getSRS(), bounds), index );
-    StringExpression styleExprCopy( styleExpr );
+    CompiledStringExpression compiledStyleExpr( styleExpr, _session->getFeatureSource()->getSchema() );
 
     // visit each feature and run the expression to sort it into a bin.
     std::map<std::string, FeatureList> styleBins;
+    std::string styleString;
     while( cursor->hasMore() )
     {
         osg::ref_ptr<Feature> feature = cursor->nextFeature();
         if ( feature.valid() )
         {
-            const std::string& styleString = feature->eval( styleExprCopy, &context );
+            compiledStyleExpr.eval( feature.get(), &context, styleString );
             styleBins[styleString].push_back( feature.get() );
         }
     }
@@ -102,7 +102,11 @@ FeatureSourceIndexNode::tagDrawable(osg::Drawable* drawable, Feature* feature)
 {
     if ( !feature || !_index.valid() ) return OSGEARTH_OBJECTID_EMPTY;
     RefIDPair* r = _index->tagDrawable( drawable, feature );
-    if ( r ) _fids[ feature->getFID() ] = r;
+    if ( r )
+    {
+        Threading::ScopedMutexLock lock( _fidsMutex );
+        _fids[ feature->getFID() ] = r;
+    }
     return r ? r->_oid : OSGEARTH_OBJECTID_EMPTY;
 }
 
@@ -111,7 +115,11 @@ FeatureSourceIndexNode::tagAllDrawables(osg::Node* node, Feature* feature)
 {
     if ( !feature || !_index.valid() ) return OSGEARTH_OBJECTID_EMPTY;
     RefIDPair* r = _index->tagAllDrawables( node, feature );
-    if ( r ) _fids[ feature->getFID() ] = r;
+    if ( r )
+    {
+        Threading::ScopedMutexLock lock( _fidsMutex );
+        _fids[ feature->getFID() ] = r;
+    }
     return r ? r->_oid : OSGEARTH_OBJECTID_EMPTY;
 }
 
@@ -120,13 +128,19 @@ FeatureSourceIndexNode::tagNode(osg::Node* node, Feature* feature)
 {
     if ( !feature || !_index.valid() ) return OSGEARTH_OBJECTID_EMPTY;
     RefIDPair* r = _index->tagNode( node, feature );
-    if ( r ) _fids[ feature->getFID() ] = r;
+    if ( r )
+    {
+        Threading::ScopedMutexLock lock( _fidsMutex );
+        _fids[ feature->getFID() ] = r;
+    }
     return r ? r->_oid : OSGEARTH_OBJECTID_EMPTY;
 }
 
 bool
 FeatureSourceIndexNode::getAllFIDs(std::vector<FeatureID>& output) const
 {
+    Threading::ScopedMutexLock lock( _fidsMutex );
+
     ConstKeyIter<FIDMap> start( _fids.begin() );
     ConstKeyIter<FIDMap> end  ( _fids.end() );
     for(ConstKeyIter<FIDMap> i = start; i != end; ++i )
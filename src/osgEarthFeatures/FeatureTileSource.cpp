@@ -256,16 +256,17 @@ FeatureTileSource::queryAndRenderFeaturesForStyle(const Style&     style,
         while( cursor.valid() && cursor->hasMore() )
         {
             Feature* feature = cursor->nextFeature();
-            Geometry* geom = feature->getGeometry();
+            const Geometry* geom = feature->readGeometry();
             if ( geom )
             {
                 // apply a type override if requested:
                 if (_options.geometryTypeOverride().isSet() &&
                     _options.geometryTypeOverride() != geom->getComponentType() )
                 {
-                    geom = geom->cloneAs( _options.geometryTypeOverride().value() );
-                    if ( geom )
-                        feature->setGeometry( geom );
+                    Geometry* converted = geom->cloneAs( _options.geometryTypeOverride().value() );
+                    if ( converted )
+                        feature->setGeometry( converted );
+                    geom = converted;
                 }
             }
             if ( geom )
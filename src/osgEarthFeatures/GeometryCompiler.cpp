@@ -33,11 +33,16 @@
 #include <osgEarth/Capabilities>
 #include <osgEarth/ShaderGenerator>
 #include <osgEarth/ShaderUtils>
-#include <osgEarth/Utils>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/Profiler>
+#include <osgEarthSymbology/MeshConsolidator>
+#include <osg/Geode>
 #include <osg/MatrixTransform>
 #include <osg/Timer>
 #include <osgDB/WriteFile>
 #include <osgUtil/Optimizer>
+#include <set>
 
 
 #define LC "[GeometryCompiler] "
@@ -71,7 +76,8 @@ _shaderPolicy          ( SHADERPOLICY_GENERATE ),
 _geoInterp             ( GEOINTERP_GREAT_CIRCLE ),
 _optimizeStateSharing  ( true ),
 _optimize              ( false ),
-_validate              ( false )
+_validate              ( false ),
+_compileThreads        ( 0u )
 {
    //nop
 }
@@ -91,7 +97,8 @@ _shaderPolicy          ( s_defaults.shaderPolicy().value() ),
 _geoInterp             ( s_defaults.geoInterp().value() ),
 _optimizeStateSharing  ( s_defaults.optimizeStateSharing().value() ),
 _optimize              ( s_defaults.optimize().value() ),
-_validate              ( s_defaults.validate().value() )
+_validate              ( s_defaults.validate().value() ),
+_compileThreads        ( s_defaults.compileThreads().value() )
 {
     fromConfig(_conf);
 }
@@ -112,6 +119,7 @@ GeometryCompilerOptions::fromConfig( const Config& conf )
     conf.getIfSet   ( "optimize_state_sharing", _optimizeStateSharing );
     conf.getIfSet   ( "optimize", _optimize );
     conf.getIfSet   ( "validate", _validate );
+    conf.getIfSet   ( "compile_threads", _compileThreads );
 
     conf.getIfSet( "shader_policy", "disable",  _shaderPolicy, SHADERPOLICY_DISABLE );
     conf.getIfSet( "shader_policy", "inherit",  _shaderPolicy, SHADERPOLICY_INHERIT );
@@ -135,6 +143,7 @@ GeometryCompilerOptions::getConfig() const
     conf.addIfSet   ( "optimize_state_sharing", _optimizeStateSharing );
     conf.addIfSet   ( "optimize", _optimize );
     conf.addIfSet   ( "validate", _validate );
+    conf.addIfSet   ( "compile_threads", _compileThreads );
 
     conf.addIfSet( "shader_policy", "disable",  _shaderPolicy, SHADERPOLICY_DISABLE );
     conf.addIfSet( "shader_policy", "inherit",  _shaderPolicy, SHADERPOLICY_INHERIT );
@@ -151,6 +160,242 @@ GeometryCompilerOptions::mergeConfig( const Config& conf )
 
 //-----------------------------------------------------------------------
 
+namespace
+{
+    // below this many features per chunk, threading costs more than it saves.
+    const unsigned MIN_FEATURES_PER_CHUNK = 256;
+
+    TaskService* getCompileService()
+    {
+        return Registry::instance()->getTaskServiceManager()->getOrAdd( TaskServiceManager::COMPILE_SERVICE_UID );
+    }
+
+    osg::Node* extrudeFeatures(FeatureList&                   features,
+                               FilterContext&                 cx,
+                               const Style&                   style,
+                               const GeometryCompilerOptions& options)
+    {
+        ExtrudeGeometryFilter extrude;
+        extrude.setStyle( style );
+
+        // Activate texture arrays if the GPU supports them and if the user
+        // hasn't disabled them.        
+        extrude.useTextureArrays() =
+            Registry::capabilities().supportsTextureArrays() &&
+            options.useTextureArrays() == true;
+
+        // apply per-feature naming if requested.
+        if ( options.featureName().isSet() )
+            extrude.setFeatureNameExpr( *options.featureName() );
+        if ( options.useVertexBufferObjects().isSet())
+            extrude.useVertexBufferObjects() = *options.useVertexBufferObjects();
+
+        return extrude.push( features, cx );
+    }
+
+    osg::Node* buildGeometry(FeatureList&                   features,
+                             FilterContext&                 cx,
+                             const Style&                   style,
+                             const GeometryCompilerOptions& options)
+    {
+        BuildGeometryFilter filter( style );
+        filter.maxGranularity() = *options.maxGranularity();
+        filter.geoInterp()      = *options.geoInterp();
+
+        if ( options.featureName().isSet() )
+            filter.featureName() = *options.featureName();
+
+        return filter.push( features, cx );
+    }
+
+    /**
+     * Clamps and extrudes (or builds geometry for) one chunk of the working
+     * set, with its own filters and filter context.
+     */
+    struct CompileChunk
+    {
+        void execute()
+        {
+            if ( _clamp )
+            {
+                AltitudeFilter clamp;
+                clamp.setPropertiesFromStyle( *_style );
+                _context = clamp.push( _features, _context );
+            }
+
+            *_result = _extrude ?
+                extrudeFeatures( _features, _context, *_style, *_options ) :
+                buildGeometry  ( _features, _context, *_style, *_options );
+        }
+
+        FeatureList                    _features;
+        FilterContext                  _context;
+        const Style*                   _style;
+        const GeometryCompilerOptions* _options;
+        bool                           _clamp;
+        bool                           _extrude;
+        osg::ref_ptr<osg::Node>*       _result;
+    };
+
+    /** The group holding a chunk's geodes, below any delocalizing transform. */
+    osg::Group* findGeodeParent(osg::Node* node)
+    {
+        osg::Group* group = node ? node->asGroup() : 0L;
+        while( group && group->getNumChildren() == 1 && group->getChild(0)->asGroup() )
+            group = group->getChild(0)->asGroup();
+
+        if ( !group )
+            return 0L;
+
+        for( unsigned i=0; i<group->getNumChildren(); ++i )
+        {
+            if ( !dynamic_cast<osg::Geode*>(group->getChild(i)) )
+                return 0L;
+        }
+        return group;
+    }
+
+    /** Whether two chunks share the same local frame. */
+    bool sameFrame(osg::Node* a, osg::Node* b)
+    {
+        osg::MatrixTransform* ax = dynamic_cast<osg::MatrixTransform*>(a);
+        osg::MatrixTransform* bx = dynamic_cast<osg::MatrixTransform*>(b);
+        return (ax == 0L) == (bx == 0L) && (!ax || ax->getMatrix() == bx->getMatrix());
+    }
+
+    /**
+     * Merges the chunks' graphs into the first one: geodes that share a state
+     * set are combined and their geometry consolidated, and the rest are
+     * added alongside. Chunks that don't fit are added as siblings.
+     */
+    osg::Node* mergeChunks(std::vector< osg::ref_ptr<osg::Node> >& results, const GeometryCompilerOptions& options)
+    {
+        osg::ref_ptr<osg::Node> base;
+        osg::ref_ptr<osg::Group> siblings;
+        osg::Group* target = 0L;
+        std::set<osg::Geode*> combined;
+
+        for( unsigned c=0; c<results.size(); ++c )
+        {
+            // take the chunk's reference, so the merged graph has a single owner.
+            osg::ref_ptr<osg::Node> node = results[c].get();
+            results[c] = 0L;
+            if ( !node.valid() )
+                continue;
+
+            if ( !base.valid() )
+            {
+                base   = node.get();
+                target = findGeodeParent( node.get() );
+                continue;
+            }
+
+            osg::Group* source = target && sameFrame(base.get(), node.get()) ? findGeodeParent(node.get()) : 0L;
+            if ( !source )
+            {
+                if ( !siblings.valid() )
+                    siblings = new osg::Group();
+                siblings->addChild( node.get() );
+                continue;
+            }
+
+            for( unsigned i=0; i<source->getNumChildren(); ++i )
+            {
+                osg::Geode* geode = static_cast<osg::Geode*>( source->getChild(i) );
+
+                osg::Geode* match = 0L;
+                for( unsigned j=0; j<target->getNumChildren() && !match; ++j )
+                {
+                    osg::Geode* candidate = static_cast<osg::Geode*>( target->getChild(j) );
+                    if ( candidate->getStateSet() == geode->getStateSet() )
+                        match = candidate;
+                }
+
+                if ( match )
+                {
+                    for( unsigned d=0; d<geode->getNumDrawables(); ++d )
+                        match->addDrawable( geode->getDrawable(d) );
+                    combined.insert( match );
+                }
+                else
+                {
+                    target->addChild( geode );
+                }
+            }
+        }
+
+        // named features keep their own drawables, as in the filters.
+        if ( !options.featureName().isSet() )
+        {
+            for( std::set<osg::Geode*>::iterator i = combined.begin(); i != combined.end(); ++i )
+                MeshConsolidator::run( **i );
+        }
+
+        if ( siblings.valid() )
+        {
+            if ( base.valid() )
+                siblings->insertChild( 0, base.get() );
+            return siblings.release();
+        }
+
+        return base.release();
+    }
+
+    /**
+     * Splits the working set into chunks and runs them on the compile
+     * service, the calling thread taking the first chunk itself.
+     *
+     * Each chunk works on its own copy of the filter context. The clamping,
+     * extruding and geometry filters only read the context (AltitudeFilter
+     * returns the one it was given), so there is nothing to merge back into
+     * the caller's. They do share the context's feature index, which is why
+     * index builders must be thread-safe.
+     */
+    osg::Node* compileInChunks(FeatureList&                   workingSet,
+                               const FilterContext&           cx,
+                               const Style&                   style,
+                               const GeometryCompilerOptions& options,
+                               bool                           clamp,
+                               bool                           extrude,
+                               unsigned                       numChunks)
+    {
+        std::vector< osg::ref_ptr<osg::Node> > results( numChunks );
+        std::vector<CompileChunk> chunks( numChunks );
+
+        unsigned size = workingSet.size();
+        FeatureList::iterator f = workingSet.begin();
+        for( unsigned c=0; c<numChunks; ++c )
+        {
+            CompileChunk& chunk = chunks[c];
+            unsigned count = size/numChunks + (c < size%numChunks ? 1u : 0u);
+            for( unsigned i=0; i<count; ++i, ++f )
+                chunk._features.push_back( *f );
+
+            chunk._context = cx;
+            chunk._style   = &style;
+            chunk._options = &options;
+            chunk._clamp   = clamp;
+            chunk._extrude = extrude;
+            chunk._result  = &results[c];
+        }
+
+        TaskService* service = getCompileService();
+        Threading::MultiEvent done( numChunks-1 );
+        for( unsigned c=1; c<numChunks; ++c )
+        {
+            ParallelTask<CompileChunk>* task = new ParallelTask<CompileChunk>( &done );
+            static_cast<CompileChunk&>(*task) = chunks[c];
+            service->add( task );
+        }
+        chunks[0].execute();
+        done.wait();
+
+        return mergeChunks( results, options );
+    }
+}
+
+//-----------------------------------------------------------------------
+
 GeometryCompiler::GeometryCompiler()
 {
     //nop
@@ -213,6 +458,8 @@ GeometryCompiler::compile(FeatureList&          workingSet,
                           const Style&          style,
                           const FilterContext&  context)
 {
+    OE_PROFILING_ZONE("GeometryCompiler::compile");
+
 #ifdef PROFILING
     osg::Timer_t p_start = osg::Timer::instance()->tick();
     unsigned p_features = workingSet.size();
@@ -274,7 +521,7 @@ GeometryCompiler::compile(FeatureList&          workingSet,
     if ( !point && !line && !polygon && !marker && !extrusion && !text && !model && !icon && workingSet.size() > 0 )
     {
         Feature* first = workingSet.begin()->get();
-        Geometry* geom = first->getGeometry();
+        const Geometry* geom = first->readGeometry();
         if ( geom )
         {
             switch( geom->getComponentType() )
@@ -437,34 +684,37 @@ GeometryCompiler::compile(FeatureList&          workingSet,
         }
     }
 
+    // split a large working set into chunks that clamp and extrude (or build
+    // geometry) in parallel.
+    unsigned numChunks = osg::minimum(
+        _options.compileThreads().value(),
+        (unsigned)workingSet.size() / MIN_FEATURES_PER_CHUNK );
+
     // extruded geometry
     if ( extrusion )
     {
-        if ( altRequired )
+        osg::Node* node = 0L;
+
+        if ( numChunks > 1 )
         {
-            AltitudeFilter clamp;
-            clamp.setPropertiesFromStyle( style );
-            sharedCX = clamp.push( workingSet, sharedCX );
-            if ( trackHistory ) history.push_back( "altitude" );
+            node = compileInChunks( workingSet, sharedCX, style, _options, altRequired, true, numChunks );
+            if ( trackHistory && altRequired ) history.push_back( "altitude" );
             altRequired = false;
         }
+        else
+        {
+            if ( altRequired )
+            {
+                AltitudeFilter clamp;
+                clamp.setPropertiesFromStyle( style );
+                sharedCX = clamp.push( workingSet, sharedCX );
+                if ( trackHistory ) history.push_back( "altitude" );
+                altRequired = false;
+            }
 
-        ExtrudeGeometryFilter extrude;
-        extrude.setStyle( style );
-
-        // Activate texture arrays if the GPU supports them and if the user
-        // hasn't disabled them.        
-        extrude.useTextureArrays() =
-            Registry::capabilities().supportsTextureArrays() &&
-            _options.useTextureArrays() == true;
-
-        // apply per-feature naming if requested.
-        if ( _options.featureName().isSet() )
-            extrude.setFeatureNameExpr( *_options.featureName() );
-        if ( _options.useVertexBufferObjects().isSet())
-            extrude.useVertexBufferObjects() = *_options.useVertexBufferObjects();
+            node = extrudeFeatures( workingSet, sharedCX, style, _options );
+        }
 
-        osg::Node* node = extrude.push( workingSet, sharedCX );
         if ( node )
         {
             if ( trackHistory ) history.push_back( "extrude" );
@@ -476,23 +726,28 @@ GeometryCompiler::compile(FeatureList&          workingSet,
     // simple geometry
     else if ( point || line || polygon )
     {
-        if ( altRequired )
+        osg::Node* node = 0L;
+
+        if ( numChunks > 1 )
         {
-            AltitudeFilter clamp;
-            clamp.setPropertiesFromStyle( style );
-            sharedCX = clamp.push( workingSet, sharedCX );
-            if ( trackHistory ) history.push_back( "altitude" );
+            node = compileInChunks( workingSet, sharedCX, style, _options, altRequired, false, numChunks );
+            if ( trackHistory && altRequired ) history.push_back( "altitude" );
             altRequired = false;
         }
+        else
+        {
+            if ( altRequired )
+            {
+                AltitudeFilter clamp;
+                clamp.setPropertiesFromStyle( style );
+                sharedCX = clamp.push( workingSet, sharedCX );
+                if ( trackHistory ) history.push_back( "altitude" );
+                altRequired = false;
+            }
 
-        BuildGeometryFilter filter( style );
-        filter.maxGranularity() = *_options.maxGranularity();
-        filter.geoInterp()      = *_options.geoInterp();
-
-        if ( _options.featureName().isSet() )
-            filter.featureName() = *_options.featureName();
+            node = buildGeometry( workingSet, sharedCX, style, _options );
+        }
 
-        osg::Node* node = filter.push( workingSet, sharedCX );
         if ( node )
         {
             if ( trackHistory ) history.push_back( "geometry" );
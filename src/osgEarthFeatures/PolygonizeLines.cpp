@@ -630,10 +630,10 @@ PolygonizeLinesFilter::push(FeatureList& input, FilterContext& cx)
 
         // iterate over all the feature's geometry parts. We will treat
         // them as lines strings.
-        GeometryIterator parts( f->getGeometry(), false );
+        ConstGeometryIterator parts( f->readGeometry(), false );
         while( parts.hasMore() )
         {
-            Geometry* part = parts.next();
+            const Geometry* part = parts.next();
 
             // skip empty geometry
             if ( part->size() == 0 )
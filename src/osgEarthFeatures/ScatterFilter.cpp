@@ -196,7 +196,7 @@ ScatterFilter::push(FeatureList& features, FilterContext& context )
     {
         Feature* f = i->get();
         
-        Geometry* geom = f->getGeometry();
+        const Geometry* geom = f->readGeometry();
         if ( !geom )
             continue;
 
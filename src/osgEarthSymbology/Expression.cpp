@@ -270,86 +270,72 @@ NumericExpression::eval() const
 {
     if ( _dirty )
     {
-        std::stack<double> s;
+        const_cast<NumericExpression*>(this)->_value = evalRPN( 0L );
+        const_cast<NumericExpression*>(this)->_dirty = false;
+    }
 
-        for( unsigned i=0; i<_rpn.size(); ++i )
-        {
-            const Atom& a = _rpn[i];
+    return !osg::isNaN( _value ) ? _value : 0.0;
+}
 
-            if ( a.first == ADD )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 + op2 );
-                }
-            }
-            else if ( a.first == SUB )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 - op2 );
-                }
-            }
-            else if ( a.first == MULT )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 * op2 );
-                }
-            }
-            else if ( a.first == DIV )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 / op2 );
-                }
-            }
-            else if ( a.first == MOD )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( fmod(op1, op2) );
-                }
-            }
-            else if ( a.first == MIN )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( std::min(op1, op2) );
-                }
-            }
-            else if ( a.first == MAX )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( std::max(op1, op2) );
-                }
-            }
-            else // OPERAND or VARIABLE
+double
+NumericExpression::eval( const double* values ) const
+{
+    double value = evalRPN( values );
+    return !osg::isNaN( value ) ? value : 0.0;
+}
+
+double
+NumericExpression::evalRPN( const double* values ) const
+{
+    // the stack can never be deeper than the RPN, so use a fixed array
+    // for the usual short expressions and only allocate for long ones.
+    const unsigned FIXED_STACK = 32;
+    double fixedStack[FIXED_STACK];
+    std::vector<double> bigStack;
+    double* s = fixedStack;
+    if ( _rpn.size() > FIXED_STACK )
+    {
+        bigStack.resize( _rpn.size() );
+        s = &bigStack[0];
+    }
+
+    unsigned size = 0;  // stack size
+    unsigned var  = 0;  // index of the next variable
+
+    for( unsigned i=0; i<_rpn.size(); ++i )
+    {
+        const Atom& a = _rpn[i];
+
+        if ( a.first == VARIABLE )
+        {
+            s[size++] = values ? values[var] : a.second;
+            ++var;
+        }
+        else if ( a.first == ADD || a.first == SUB || a.first == MULT || a.first == DIV ||
+                  a.first == MOD || a.first == MIN || a.first == MAX )
+        {
+            if ( size >= 2 )
             {
-                s.push( a.second );
+                double op2 = s[--size];
+                double op1 = s[size-1];
+                double& r  = s[size-1];
+
+                if      ( a.first == ADD )  r = op1 + op2;
+                else if ( a.first == SUB )  r = op1 - op2;
+                else if ( a.first == MULT ) r = op1 * op2;
+                else if ( a.first == DIV )  r = op1 / op2;
+                else if ( a.first == MOD )  r = fmod(op1, op2);
+                else if ( a.first == MIN )  r = std::min(op1, op2);
+                else                        r = std::max(op1, op2);
             }
         }
-
-        const_cast<NumericExpression*>(this)->_value = s.size() > 0 ? s.top() : 0.0;
-        const_cast<NumericExpression*>(this)->_dirty = false;
+        else // OPERAND
+        {
+            s[size++] = a.second;
+        }
     }
 
-    return !osg::isNaN( _value ) ? _value : 0.0;
+    return size > 0 ? s[size-1] : 0.0;
 }
 
 //------------------------------------------------------------------------
@@ -542,3 +528,24 @@ StringExpression::eval() const
 
     return _value;
 }
+
+void
+StringExpression::eval( const std::string* const* values, std::string& out ) const
+{
+    out.clear();
+
+    unsigned var = 0; // index of the next variable
+    for( AtomVector::const_iterator i = _infix.begin(); i != _infix.end(); ++i )
+    {
+        if ( i->first == VARIABLE )
+        {
+            if ( values[var] )
+                out.append( *values[var] );
+            ++var;
+        }
+        else
+        {
+            out.append( i->second );
+        }
+    }
+}